@@ -130,6 +130,8 @@ static struct corosync_api_v1 apidef_corosync_api_v1 = {
 	.schedwrk_create = schedwrk_create,
 	.schedwrk_create_nolock = schedwrk_create_nolock,
 	.schedwrk_destroy = schedwrk_destroy,
+	.schedwrk_create_named = schedwrk_create_named,
+	.schedwrk_budget_exhausted = schedwrk_budget_exhausted,
 	.sync_request = NULL, //sync_request,
 	.quorum_is_quorate = corosync_quorum_is_quorate,
 	.quorum_register_callback = corosync_quorum_register_callback,
@@ -598,9 +598,14 @@ static void remove_ro_entries(icmap_map_t temp_map)
 	delete_and_notify_if_changed(temp_map, "totem.interface.ttl");
 	delete_and_notify_if_changed(temp_map, "totem.vsftype");
 	delete_and_notify_if_changed(temp_map, "totem.transport");
+	delete_and_notify_if_changed(temp_map, "totem.io_uring");
+	delete_and_notify_if_changed(temp_map, "totem.shm_path");
 	delete_and_notify_if_changed(temp_map, "totem.cluster_name");
 	delete_and_notify_if_changed(temp_map, "quorum.provider");
 	delete_and_notify_if_changed(temp_map, "qb.ipc_type");
+	delete_and_notify_if_changed(temp_map, "qb.ipc_batch_size");
+	delete_and_notify_if_changed(temp_map, "system.cpu_affinity");
+	delete_and_notify_if_changed(temp_map, "system.helper_cpu_affinity");
 }
 
 /*
@@ -609,15 +614,18 @@ static void remove_ro_entries(icmap_map_t temp_map)
  *
  * NOTE: This routine depends entirely on the keys returned by the iterators
  * being in alpha-sorted order.
+ *
+ * Old keys are iterated from snapshot of the global map, so deleting keys (and
+ * changes done by notified listeners) don't modify map being iterated.
  */
-static void remove_deleted_entries(icmap_map_t temp_map, const char *prefix)
+static void remove_deleted_entries(icmap_map_t old_map, icmap_map_t temp_map, const char *prefix)
 {
 	icmap_iter_t old_iter;
 	icmap_iter_t new_iter;
 	const char *old_key, *new_key;
 	int ret;
 
-	old_iter = icmap_iter_init(prefix);
+	old_iter = icmap_iter_init_r(old_map, prefix);
 	new_iter = icmap_iter_init_r(temp_map, prefix);
 
 	old_key = icmap_iter_next(old_iter, NULL, NULL);
@@ -670,6 +678,7 @@ static void message_handler_req_exec_cfg_reload_config (
 	const struct req_exec_cfg_reload_config *req_exec_cfg_reload_config = message;
 	struct res_lib_cfg_reload_config res_lib_cfg_reload_config;
 	icmap_map_t temp_map;
+	icmap_map_t old_map;
 	const char *error_string;
 	int res = CS_OK;
 
@@ -699,10 +708,19 @@ static void message_handler_req_exec_cfg_reload_config (
 	icmap_set_uint8("config.reload_in_progress", 1);
 
 	/* Detect deleted entries and remove them from the main icmap hashtable */
-	remove_deleted_entries(temp_map, "logging.");
-	remove_deleted_entries(temp_map, "totem.");
-	remove_deleted_entries(temp_map, "nodelist.");
-	remove_deleted_entries(temp_map, "quorum.");
+	if (icmap_snapshot_create(&old_map) != CS_OK) {
+		log_printf(LOGSYS_LEVEL_WARNING, "Unable to create icmap snapshot, iterating live map\n");
+		old_map = icmap_get_global_map();
+	}
+
+	remove_deleted_entries(old_map, temp_map, "logging.");
+	remove_deleted_entries(old_map, temp_map, "totem.");
+	remove_deleted_entries(old_map, temp_map, "nodelist.");
+	remove_deleted_entries(old_map, temp_map, "quorum.");
+
+	if (old_map != icmap_get_global_map()) {
+		icmap_fini_r(old_map);
+	}
 
 	/* Remove entries that cannot be changed */
 	remove_ro_entries(temp_map);
@@ -601,6 +601,10 @@ static int main_config_parser_cb(const char *path,
 			    (strcmp(path, "totem.window_size") == 0) ||
 			    (strcmp(path, "totem.max_messages") == 0) ||
 			    (strcmp(path, "totem.miss_count_const") == 0) ||
+			    (strcmp(path, "totem.schedwrk_budget") == 0) ||
+			    (strcmp(path, "totem.shm_delay") == 0) ||
+			    (strcmp(path, "totem.shm_loss") == 0) ||
+			    (strcmp(path, "totem.shm_reorder") == 0) ||
 			    (strcmp(path, "totem.netmtu") == 0)) {
 				val_type = ICMAP_VALUETYPE_UINT32;
 				if (safe_atoq(value, &val, val_type) != 0) {
@@ -670,6 +674,14 @@ static int main_config_parser_cb(const char *path,
 					return (0);
 				}
 			}
+			if (strcmp(path, "qb.ipc_batch_size") == 0) {
+				val_type = ICMAP_VALUETYPE_UINT32;
+				if (safe_atoq(value, &val, val_type) != 0) {
+					goto atoi_error;
+				}
+				icmap_set_uint32_r(config_map, path, val);
+				add_as_string = 0;
+			}
 			break;
 
 		case MAIN_CP_CB_DATA_STATE_INTERFACE:
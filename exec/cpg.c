@@ -49,6 +49,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <errno.h>
+#include <stddef.h>
 #include <time.h>
 #include <assert.h>
 #include <unistd.h>
@@ -56,6 +57,8 @@
 #include <arpa/inet.h>
 #include <sys/mman.h>
 #include <qb/qbmap.h>
+#include <qb/qbatomic.h>
+#include <qb/qbutil.h>
 
 #include <corosync/corotypes.h>
 #include <qb/qbipc_common.h>
@@ -63,6 +66,7 @@
 #include <corosync/list.h>
 #include <corosync/logsys.h>
 #include <corosync/coroapi.h>
+#include <corosync/icmap.h>
 
 #include <corosync/cpg.h>
 #include <corosync/ipc_cpg.h>
@@ -85,6 +89,8 @@ enum cpg_message_req_types {
 	MESSAGE_REQ_EXEC_CPG_DOWNLIST_OLD = 4,
 	MESSAGE_REQ_EXEC_CPG_DOWNLIST = 5,
 	MESSAGE_REQ_EXEC_CPG_PARTIAL_MCAST = 6,
+	MESSAGE_REQ_EXEC_CPG_MCAST_BATCH = 7,
+	MESSAGE_REQ_EXEC_CPG_JOINLIST_HASH = 8,
 };
 
 struct zcb_mapped {
@@ -92,6 +98,33 @@ struct zcb_mapped {
 	void *addr;
 	size_t size;
 };
+
+/*
+ * Fragmented message of one sender being reassembled in a slot
+ */
+struct cpg_zc_deliver_assembly {
+	struct list_head list;
+	struct cpg_zc_deliver_slot *slot;
+	uint32_t nodeid;
+	uint32_t pid;
+	uint32_t msglen;
+	uint32_t written;
+};
+
+/*
+ * Ring of struct cpg_zc_deliver_slot mapped from the library. Fragmented
+ * messages are reassembled directly into it (CPG_MODEL_V1_ZC_DELIVER).
+ * Fragments of different senders may interleave, so there is one
+ * assembly per (nodeid, pid).
+ */
+struct cpg_zc_deliver {
+	char *addr;
+	size_t size;
+	size_t head; /* Offset of next slot to allocate */
+	size_t tail; /* Offset of oldest slot not yet reclaimed */
+	size_t used;
+	struct list_head assembly_list_head; /* List of cpg_zc_deliver_assembly */
+};
 /*
  * state`		exec deliver
  * match group name, pid -> if matched deliver for YES:
@@ -138,7 +171,10 @@ enum cpd_state {
 
 enum cpg_sync_state {
 	CPGSYNC_DOWNLIST,
-	CPGSYNC_JOINLIST
+	CPGSYNC_JOINLIST_HASH,
+	CPGSYNC_JOINLIST_WAIT,
+	CPGSYNC_JOINLIST,
+	CPGSYNC_DONE
 };
 
 enum cpg_downlist_state_e {
@@ -159,9 +195,12 @@ struct cpg_pd {
 	int initial_totem_conf_sent;
 	uint64_t transition_counter; /* These two are used when sending fragmented messages */
 	uint64_t initial_transition_counter;
+	uint32_t partial_sent; /* Bytes of current fragmented message sent so far */
+	cs_error_t partial_error; /* First error hit by an unacknowledged fragment */
 	struct list_head list;
 	struct list_head iteration_instance_list_head;
 	struct list_head zcb_mapped_list_head;
+	struct cpg_zc_deliver zc_deliver;
 };
 
 struct cpg_iteration_instance {
@@ -189,6 +228,79 @@ static enum cpg_sync_state my_sync_state = CPGSYNC_DOWNLIST;
 
 static mar_cpg_ring_id_t last_sync_ring_id;
 
+/*
+ * Delta joinlist exchange. Every node sends hash of its own joins together
+ * with hashes of how it sees joins of the other members. Full joinlist is
+ * sent only by nodes which somebody sees differently.
+ */
+struct joinlist_hash_state {
+	int view_known;
+	int downlisted;
+	mar_uint64_t view_hash;
+	int received;
+	int confirmed;
+};
+
+static struct joinlist_hash_state joinlist_hash_list[PROCESSOR_COUNT_MAX];
+
+static mar_uint64_t my_joinlist_hash;
+
+static int joinlist_full_needed;
+
+static int joinlist_delta;
+
+/*
+ * Set when all members of current membership understand
+ * MESSAGE_REQ_EXEC_CPG_MCAST_BATCH. It is cleared on configuration change
+ * and set on sync activation, both of which every node sees at the same
+ * place of the message stream, so all nodes agree on it when a batch is
+ * delivered.
+ */
+static int mcast_batch_supported;
+
+/*
+ * Opt-in (cpg.latency_tracing) delivery latency of mcast messages. Sender
+ * stamps message with its wall clock, receiver accounts time until message
+ * is delivered in agreed order and time spent passing it to local members.
+ */
+#define CPG_LATENCY_BUCKETS		22
+#define CPG_LATENCY_UPDATE_INTERVAL	1000 /* ms */
+
+enum cpg_latency_phase {
+	CPG_LATENCY_DELIVERY,
+	CPG_LATENCY_DISPATCH,
+	CPG_LATENCY_MAX
+};
+
+static const char *cpg_latency_phase_names[CPG_LATENCY_MAX] = {
+	"delivery",
+	"dispatch"
+};
+
+struct cpg_latency_stats {
+	uint64_t count;
+	uint64_t time_total;
+	uint64_t time_max;
+	uint64_t hist[CPG_LATENCY_BUCKETS]; /* <= 2^i us, last one is overflow */
+};
+
+struct cpg_group_latency {
+	char name[CPG_MAX_NAME_LENGTH + 1]; /* Group name usable in icmap key */
+	int changed;
+	struct cpg_latency_stats phase[CPG_LATENCY_MAX];
+	struct list_head list;
+};
+
+DECLARE_LIST_INIT(cpg_group_latency_list_head);
+
+static int latency_tracing;
+
+static int latency_update_timer_running;
+
+static corosync_timer_handle_t latency_update_timer;
+
+static icmap_track_t latency_tracing_track;
+
 struct process_info {
 	unsigned int nodeid;
 	uint32_t pid;
@@ -223,6 +335,10 @@ static void message_handler_req_exec_cpg_joinlist (
 	const void *message,
 	unsigned int nodeid);
 
+static void message_handler_req_exec_cpg_joinlist_hash (
+	const void *message,
+	unsigned int nodeid);
+
 static void message_handler_req_exec_cpg_mcast (
 	const void *message,
 	unsigned int nodeid);
@@ -231,6 +347,10 @@ static void message_handler_req_exec_cpg_partial_mcast (
 	const void *message,
 	unsigned int nodeid);
 
+static void message_handler_req_exec_cpg_mcast_batch (
+	const void *message,
+	unsigned int nodeid);
+
 static void message_handler_req_exec_cpg_downlist_old (
 	const void *message,
 	unsigned int nodeid);
@@ -243,10 +363,14 @@ static void exec_cpg_procjoin_endian_convert (void *msg);
 
 static void exec_cpg_joinlist_endian_convert (void *msg);
 
+static void exec_cpg_joinlist_hash_endian_convert (void *msg);
+
 static void exec_cpg_mcast_endian_convert (void *msg);
 
 static void exec_cpg_partial_mcast_endian_convert (void *msg);
 
+static void exec_cpg_mcast_batch_endian_convert (void *msg);
+
 static void exec_cpg_downlist_endian_convert_old (void *msg);
 
 static void exec_cpg_downlist_endian_convert (void *msg);
@@ -261,6 +385,10 @@ static void message_handler_req_lib_cpg_mcast (void *conn, const void *message);
 
 static void message_handler_req_lib_cpg_partial_mcast (void *conn, const void *message);
 
+static void message_handler_req_lib_cpg_partial_mcast_async (void *conn, const void *message);
+
+static void message_handler_req_lib_cpg_mcast_batch (void *conn, const void *message);
+
 static void message_handler_req_lib_cpg_membership (void *conn,
 						    const void *message);
 
@@ -291,12 +419,21 @@ static void message_handler_req_lib_cpg_zc_execute (
 	void *conn,
 	const void *message);
 
+static void message_handler_req_lib_cpg_zc_deliver_area_set (
+	void *conn,
+	const void *message);
+
 static int cpg_node_joinleave_send (unsigned int pid, const mar_cpg_name_t *group_name, int fn, int reason);
 
 static int cpg_exec_send_downlist(void);
 
+static int cpg_mcast_send (void *conn, const struct cpg_pd *cpd,
+	const void *message, int msglen);
+
 static int cpg_exec_send_joinlist(void);
 
+static int cpg_exec_send_joinlist_hash(void);
+
 static void downlist_messages_delete (void);
 
 static void downlist_master_choose_and_send (void);
@@ -318,6 +455,13 @@ static void cpg_sync_activate (void);
 
 static void cpg_sync_abort (void);
 
+static void cpg_confchg_fn (
+	enum totem_configuration_type configuration_type,
+	const unsigned int *member_list, size_t member_list_entries,
+	const unsigned int *left_list, size_t left_list_entries,
+	const unsigned int *joined_list, size_t joined_list_entries,
+	const struct memb_ring_id *ring_id);
+
 static void do_proc_join(
 	const mar_cpg_name_t *name,
 	uint32_t pid,
@@ -338,6 +482,14 @@ static int notify_lib_totem_membership (
 static inline int zcb_all_free (
 	struct cpg_pd *cpd);
 
+static void zc_deliver_area_free (
+	struct cpg_pd *cpd);
+
+static void zc_deliver_sender_abandon (
+	struct cpg_pd *cpd,
+	uint32_t nodeid,
+	uint32_t pid);
+
 static char *cpg_print_group_name (
 	const mar_cpg_name_t *group);
 
@@ -398,6 +550,18 @@ static struct corosync_lib_handler cpg_lib_engine[] =
 		.lib_handler_fn				= message_handler_req_lib_cpg_partial_mcast,
 		.flow_control				= CS_LIB_FLOW_CONTROL_REQUIRED
 	},
+	{ /* 13 */
+		.lib_handler_fn				= message_handler_req_lib_cpg_partial_mcast_async,
+		.flow_control				= CS_LIB_FLOW_CONTROL_REQUIRED
+	},
+	{ /* 14 */
+		.lib_handler_fn				= message_handler_req_lib_cpg_mcast_batch,
+		.flow_control				= CS_LIB_FLOW_CONTROL_REQUIRED
+	},
+	{ /* 15 */
+		.lib_handler_fn				= message_handler_req_lib_cpg_zc_deliver_area_set,
+		.flow_control				= CS_LIB_FLOW_CONTROL_REQUIRED
+	},
 
 };
 
@@ -431,6 +595,14 @@ static struct corosync_exec_handler cpg_exec_engine[] =
 		.exec_handler_fn	= message_handler_req_exec_cpg_partial_mcast,
 		.exec_endian_convert_fn	= exec_cpg_partial_mcast_endian_convert
 	},
+	{ /* 7 - MESSAGE_REQ_EXEC_CPG_MCAST_BATCH */
+		.exec_handler_fn	= message_handler_req_exec_cpg_mcast_batch,
+		.exec_endian_convert_fn	= exec_cpg_mcast_batch_endian_convert
+	},
+	{ /* 8 - MESSAGE_REQ_EXEC_CPG_JOINLIST_HASH */
+		.exec_handler_fn	= message_handler_req_exec_cpg_joinlist_hash,
+		.exec_endian_convert_fn	= exec_cpg_joinlist_hash_endian_convert
+	},
 };
 
 struct corosync_service_engine cpg_service_engine = {
@@ -448,6 +620,7 @@ struct corosync_service_engine cpg_service_engine = {
 	.exec_dump_fn				= NULL,
 	.exec_engine				= cpg_exec_engine,
 	.exec_engine_count		        = sizeof (cpg_exec_engine) / sizeof (struct corosync_exec_handler),
+	.confchg_fn                             = cpg_confchg_fn,
 	.sync_init                              = cpg_sync_init,
 	.sync_process                           = cpg_sync_process,
 	.sync_activate                          = cpg_sync_activate,
@@ -475,6 +648,15 @@ struct req_exec_cpg_mcast {
 	mar_uint8_t message[] __attribute__((aligned(8)));
 };
 
+/*
+ * Appended after the message of req_exec_cpg_mcast (and counted in
+ * header.size only) when latency tracing is enabled. Older nodes deliver
+ * just msglen bytes, so they ignore it.
+ */
+struct req_exec_cpg_mcast_trace {
+	mar_uint64_t send_time __attribute__((aligned(8))); /* ns from epoch */
+};
+
 struct req_exec_cpg_partial_mcast {
 	struct qb_ipc_request_header header __attribute__((aligned(8)));
 	mar_cpg_name_t group_name __attribute__((aligned(8)));
@@ -486,6 +668,15 @@ struct req_exec_cpg_partial_mcast {
 	mar_uint8_t message[] __attribute__((aligned(8)));
 };
 
+struct req_exec_cpg_mcast_batch {
+	struct qb_ipc_request_header header __attribute__((aligned(8)));
+	mar_cpg_name_t group_name __attribute__((aligned(8)));
+	mar_uint32_t msg_count __attribute__((aligned(8)));
+	mar_uint32_t pid __attribute__((aligned(8)));
+	mar_message_source_t source __attribute__((aligned(8)));
+	mar_uint8_t message[] __attribute__((aligned(8)));
+};
+
 struct req_exec_cpg_downlist_old {
 	struct qb_ipc_request_header header __attribute__((aligned(8)));
 	mar_uint32_t left_nodes __attribute__((aligned(8)));
@@ -499,16 +690,35 @@ struct req_exec_cpg_downlist {
 	/* downlist below */
 	mar_uint32_t left_nodes __attribute__((aligned(8)));
 	mar_uint32_t nodeids[PROCESSOR_COUNT_MAX]  __attribute__((aligned(8)));
+	/* appended, older nodes don't send it */
+	mar_uint32_t flags __attribute__((aligned(8)));
 };
 
+#define CPG_DOWNLIST_FLAG_JOINLIST_HASH		(1 << 0)
+#define CPG_DOWNLIST_FLAG_MCAST_BATCH		(1 << 1)
+
 struct downlist_msg {
 	mar_uint32_t sender_nodeid;
 	mar_uint32_t old_members __attribute__((aligned(8)));
 	mar_uint32_t left_nodes __attribute__((aligned(8)));
 	mar_uint32_t nodeids[PROCESSOR_COUNT_MAX]  __attribute__((aligned(8)));
+	mar_uint32_t flags;
 	struct list_head list;
 };
 
+struct joinlist_view_entry {
+	mar_uint32_t nodeid __attribute__((aligned(8)));
+	mar_uint32_t known __attribute__((aligned(8)));
+	mar_uint64_t hash __attribute__((aligned(8)));
+};
+
+struct req_exec_cpg_joinlist_hash {
+	struct qb_ipc_request_header header __attribute__((aligned(8)));
+	mar_uint64_t hash __attribute__((aligned(8)));
+	mar_uint32_t view_entries __attribute__((aligned(8)));
+	struct joinlist_view_entry view[PROCESSOR_COUNT_MAX] __attribute__((aligned(8)));
+};
+
 struct joinlist_msg {
 	mar_uint32_t sender_nodeid;
 	uint32_t pid;
@@ -518,6 +728,13 @@ struct joinlist_msg {
 
 static struct req_exec_cpg_downlist g_req_exec_cpg_downlist;
 
+static struct req_exec_cpg_joinlist_hash g_req_exec_cpg_joinlist_hash;
+
+static int zc_deliver_fragment (
+	struct cpg_pd *cpd,
+	const struct req_exec_cpg_partial_mcast *req_exec_cpg_mcast,
+	unsigned int nodeid);
+
 /*
  * Function print group name. It's not reentrant
  */
@@ -548,6 +765,147 @@ static char *cpg_print_group_name(const mar_cpg_name_t *group)
 	return (res);
 }
 
+/*
+ * Order independent hash of joins of one node. Bytes are fed in fixed
+ * order so all nodes compute same value regardless of endianness.
+ */
+static mar_uint64_t joinlist_hash_get (unsigned int nodeid)
+{
+	struct list_head *iter;
+	struct process_info *pi;
+	mar_uint64_t res = 0;
+	mar_uint64_t h;
+	uint32_t count = 0;
+	uint32_t i;
+
+	for (iter = process_info_list_head.next; iter != &process_info_list_head; iter = iter->next) {
+		pi = list_entry (iter, struct process_info, list);
+
+		if (pi->nodeid != nodeid) {
+			continue;
+		}
+
+		h = 14695981039346656037ULL;
+		for (i = 0; i < 4; i++) {
+			h = (h ^ ((pi->pid >> (i * 8)) & 0xff)) * 1099511628211ULL;
+		}
+		for (i = 0; i < pi->group.length && i < CPG_MAX_NAME_LENGTH; i++) {
+			h = (h ^ (unsigned char)pi->group.value[i]) * 1099511628211ULL;
+		}
+		res += h;
+		count++;
+	}
+
+	return (res ^ ((mar_uint64_t)count << 32));
+}
+
+/*
+ * Hashes are taken at sync_init, which every member runs at the same point
+ * of the message stream. Joins of nodes which were not in our transitional
+ * membership are unknown (they may be removed by downlist).
+ */
+static void joinlist_hash_build (const unsigned int *trans_list,
+	size_t trans_list_entries)
+{
+	unsigned int my_nodeid = api->totem_nodeid_get ();
+	int i, j;
+
+	memset (joinlist_hash_list, 0, sizeof (joinlist_hash_list));
+	joinlist_full_needed = 0;
+	joinlist_delta = 0;
+
+	my_joinlist_hash = joinlist_hash_get (my_nodeid);
+
+	for (i = 0; i < my_member_list_entries; i++) {
+		for (j = 0; j < trans_list_entries; j++) {
+			if (my_member_list[i] == trans_list[j]) {
+				joinlist_hash_list[i].view_known = 1;
+				break;
+			}
+		}
+		if (my_member_list[i] == my_nodeid) {
+			joinlist_hash_list[i].view_known = 1;
+		}
+		if (joinlist_hash_list[i].view_known) {
+			joinlist_hash_list[i].view_hash = joinlist_hash_get (my_member_list[i]);
+		}
+
+		g_req_exec_cpg_joinlist_hash.view[i].nodeid = my_member_list[i];
+		g_req_exec_cpg_joinlist_hash.view[i].known = joinlist_hash_list[i].view_known;
+		g_req_exec_cpg_joinlist_hash.view[i].hash = joinlist_hash_list[i].view_hash;
+	}
+	g_req_exec_cpg_joinlist_hash.view_entries = my_member_list_entries;
+	g_req_exec_cpg_joinlist_hash.hash = my_joinlist_hash;
+}
+
+/*
+ * Joins of nodes in chosen downlist are removed, so they must be resent
+ * even if hashes matched
+ */
+static void joinlist_hash_downlist_apply (const struct downlist_msg *downlist)
+{
+	int i, j;
+
+	for (i = 0; i < downlist->left_nodes; i++) {
+		if (downlist->nodeids[i] == api->totem_nodeid_get ()) {
+			joinlist_full_needed = 1;
+		}
+		for (j = 0; j < my_member_list_entries; j++) {
+			if (my_member_list[j] == downlist->nodeids[i]) {
+				joinlist_hash_list[j].downlisted = 1;
+				joinlist_hash_list[j].confirmed = 0;
+			}
+		}
+	}
+}
+
+/*
+ * Whether all members of new membership sent flag in their downlist
+ */
+static int downlist_flag_supported (mar_uint32_t flag)
+{
+	struct downlist_msg *stored_msg;
+	struct list_head *iter;
+
+	for (iter = downlist_messages_head.next;
+		iter != &downlist_messages_head;
+		iter = iter->next) {
+
+		stored_msg = list_entry(iter, struct downlist_msg, list);
+		if ((stored_msg->flags & flag) == 0) {
+			return (0);
+		}
+	}
+
+	return (1);
+}
+
+static int joinlist_hash_all_received (void)
+{
+	int i;
+
+	for (i = 0; i < my_member_list_entries; i++) {
+		if (!joinlist_hash_list[i].received) {
+			return (0);
+		}
+	}
+
+	return (1);
+}
+
+static int joinlist_hash_confirmed (unsigned int nodeid)
+{
+	int i;
+
+	for (i = 0; i < my_member_list_entries; i++) {
+		if (my_member_list[i] == nodeid) {
+			return (joinlist_hash_list[i].confirmed);
+		}
+	}
+
+	return (0);
+}
+
 static void cpg_sync_init (
 	const unsigned int *trans_list,
 	size_t trans_list_entries,
@@ -588,6 +946,8 @@ static void cpg_sync_init (
 		}
 	}
 	g_req_exec_cpg_downlist.left_nodes = entries;
+
+	joinlist_hash_build (trans_list, trans_list_entries);
 }
 
 static int cpg_sync_process (void)
@@ -599,10 +959,45 @@ static int cpg_sync_process (void)
 		if (res == -1) {
 			return (-1);
 		}
+		my_sync_state = CPGSYNC_JOINLIST_HASH;
+	}
+	if (my_sync_state == CPGSYNC_JOINLIST_HASH) {
+		/*
+		 * Hash is sent only if every member understands it, which is
+		 * known once downlists of all members are received
+		 */
+		if (downlist_state == CPG_DOWNLIST_WAITING_FOR_MESSAGES) {
+			return (-1);
+		}
+		if (downlist_flag_supported (CPG_DOWNLIST_FLAG_JOINLIST_HASH)) {
+			res = cpg_exec_send_joinlist_hash();
+			if (res == -1) {
+				return (-1);
+			}
+			my_sync_state = CPGSYNC_JOINLIST_WAIT;
+		} else {
+			my_sync_state = CPGSYNC_JOINLIST;
+		}
+	}
+	if (my_sync_state == CPGSYNC_JOINLIST_WAIT) {
+		if (!joinlist_hash_all_received ()) {
+			return (-1);
+		}
+		joinlist_delta = 1;
+		if (!joinlist_full_needed) {
+			my_sync_state = CPGSYNC_DONE;
+			return (0);
+		}
 		my_sync_state = CPGSYNC_JOINLIST;
 	}
 	if (my_sync_state == CPGSYNC_JOINLIST) {
 		res = cpg_exec_send_joinlist();
+		if (res == 0) {
+			my_sync_state = CPGSYNC_DONE;
+		}
+	}
+	if (my_sync_state == CPGSYNC_DONE) {
+		res = 0;
 	}
 	return (res);
 }
@@ -619,9 +1014,12 @@ static void cpg_sync_activate (void)
 
 	joinlist_inform_clients ();
 
+	mcast_batch_supported = downlist_flag_supported (CPG_DOWNLIST_FLAG_MCAST_BATCH);
+
 	downlist_messages_delete ();
 	downlist_state = CPG_DOWNLIST_NONE;
 	joinlist_messages_delete ();
+	joinlist_delta = 0;
 
 	notify_lib_totem_membership (NULL, my_member_list_entries, my_member_list);
 }
@@ -631,6 +1029,20 @@ static void cpg_sync_abort (void)
 	downlist_state = CPG_DOWNLIST_NONE;
 	downlist_messages_delete ();
 	joinlist_messages_delete ();
+	joinlist_delta = 0;
+}
+
+static void cpg_confchg_fn (
+	enum totem_configuration_type configuration_type,
+	const unsigned int *member_list, size_t member_list_entries,
+	const unsigned int *left_list, size_t left_list_entries,
+	const unsigned int *joined_list, size_t joined_list_entries,
+	const struct memb_ring_id *ring_id)
+{
+	/*
+	 * New members may not understand batches until sync tells
+	 */
+	mcast_batch_supported = 0;
 }
 
 static int notify_lib_totem_membership (
@@ -685,6 +1097,7 @@ static int notify_lib_joinlist(
 	int count;
 	struct res_lib_cpg_confchg_callback *res;
 	mar_cpg_address_t *retgi;
+	int i;
 
 	count = 0;
 
@@ -771,6 +1184,10 @@ static int notify_lib_joinlist(
 					api->ipc_dispatch_send (cpd->conn, buf, size);
 					cpd->transition_counter++;
 				}
+				for (i = 0; i < left_list_entries; i++) {
+					zc_deliver_sender_abandon (cpd, left_list[i].nodeid,
+						left_list[i].pid);
+				}
 				if (left_list_entries) {
 					if (left_list[0].pid == cpd->pid &&
 						left_list[0].nodeid == api->totem_nodeid_get() &&
@@ -895,6 +1312,8 @@ static void downlist_master_choose_and_send (void)
 	}
 	downlist_log("chosen downlist", stored_msg);
 
+	joinlist_hash_downlist_apply (stored_msg);
+
 	group_map = qb_skiplist_create();
 
 	/*
@@ -983,6 +1402,14 @@ static void joinlist_remove_zombie_pi_entries (void)
 			continue ;
 		}
 
+		/*
+		 * Joins of node are same as sender sees them, no joinlist
+		 * was sent for it
+		 */
+		if (joinlist_delta && joinlist_hash_confirmed (pi->nodeid)) {
+			continue ;
+		}
+
 		/*
 		 * Try to find message in joinlist messages
 		 */
@@ -1076,55 +1503,283 @@ static void joinlist_messages_delete (void)
 	list_init (&joinlist_messages_head);
 }
 
-static char *cpg_exec_init_fn (struct corosync_api_v1 *corosync_api)
+/*
+ * Group name converted to form usable as part of icmap key. Dot is
+ * key separator so it's replaced too.
+ */
+static void cpg_latency_group_name_get (const mar_cpg_name_t *group_name, char *name)
 {
-	list_init (&downlist_messages_head);
-	list_init (&joinlist_messages_head);
-	api = corosync_api;
-	return (NULL);
+	uint32_t i;
+
+	for (i = 0; i < group_name->length && i < CPG_MAX_NAME_LENGTH; i++) {
+		name[i] = (group_name->value[i] == '.') ? '_' : group_name->value[i];
+	}
+	name[i] = '\0';
+
+	if (i == 0) {
+		strcpy (name, "_");
+	}
+
+	icmap_convert_name_to_valid_name (name);
 }
 
-static void cpg_iteration_instance_finalize (struct cpg_iteration_instance *cpg_iteration_instance)
+static struct cpg_group_latency *cpg_group_latency_get (const mar_cpg_name_t *group_name)
 {
-	struct list_head *iter, *iter_next;
-	struct process_info *pi;
+	char name[CPG_MAX_NAME_LENGTH + 1];
+	struct cpg_group_latency *gl;
+	struct list_head *iter;
 
-	for (iter = cpg_iteration_instance->items_list_head.next;
-		iter != &cpg_iteration_instance->items_list_head;
-		iter = iter_next) {
+	cpg_latency_group_name_get (group_name, name);
 
-		iter_next = iter->next;
+	for (iter = cpg_group_latency_list_head.next;
+		iter != &cpg_group_latency_list_head; iter = iter->next) {
 
-		pi = list_entry (iter, struct process_info, list);
-		list_del (&pi->list);
-		free (pi);
+		gl = list_entry (iter, struct cpg_group_latency, list);
+		if (strcmp (gl->name, name) == 0) {
+			return (gl);
+		}
 	}
 
-	list_del (&cpg_iteration_instance->list);
-	hdb_handle_destroy (&cpg_iteration_handle_t_db, cpg_iteration_instance->handle);
+	gl = calloc (1, sizeof (*gl));
+	if (gl == NULL) {
+		return (NULL);
+	}
+	strcpy (gl->name, name);
+	list_init (&gl->list);
+	list_add (&gl->list, &cpg_group_latency_list_head);
+
+	return (gl);
 }
 
-static void cpg_pd_finalize (struct cpg_pd *cpd)
+static void cpg_latency_account (struct cpg_latency_stats *stats, uint64_t us)
 {
-	struct list_head *iter, *iter_next;
-	struct cpg_iteration_instance *cpii;
+	int i;
 
-	zcb_all_free(cpd);
-	for (iter = cpd->iteration_instance_list_head.next;
-		iter != &cpd->iteration_instance_list_head;
-		iter = iter_next) {
+	stats->count++;
+	stats->time_total += us;
+	if (us > stats->time_max) {
+		stats->time_max = us;
+	}
+	for (i = 0; i < CPG_LATENCY_BUCKETS - 1; i++) {
+		if (us <= (1ULL << i)) {
+			break;
+		}
+	}
+	stats->hist[i]++;
+}
 
-		iter_next = iter->next;
+static void cpg_group_latency_publish (const struct cpg_group_latency *gl)
+{
+	char key_name[ICMAP_KEYNAME_MAXLEN];
+	const struct cpg_latency_stats *stats;
+	int phase, i;
+
+	for (phase = 0; phase < CPG_LATENCY_MAX; phase++) {
+		stats = &gl->phase[phase];
+
+		snprintf(key_name, ICMAP_KEYNAME_MAXLEN,
+			"runtime.services.cpg.groups.%s.latency.%s.count",
+			gl->name, cpg_latency_phase_names[phase]);
+		icmap_set_uint64(key_name, stats->count);
+		snprintf(key_name, ICMAP_KEYNAME_MAXLEN,
+			"runtime.services.cpg.groups.%s.latency.%s.avg",
+			gl->name, cpg_latency_phase_names[phase]);
+		icmap_set_uint64(key_name, stats->count ? stats->time_total / stats->count : 0);
+		snprintf(key_name, ICMAP_KEYNAME_MAXLEN,
+			"runtime.services.cpg.groups.%s.latency.%s.max",
+			gl->name, cpg_latency_phase_names[phase]);
+		icmap_set_uint64(key_name, stats->time_max);
+
+		for (i = 0; i < CPG_LATENCY_BUCKETS; i++) {
+			if (i == CPG_LATENCY_BUCKETS - 1) {
+				snprintf(key_name, ICMAP_KEYNAME_MAXLEN,
+					"runtime.services.cpg.groups.%s.latency.%s.le_inf",
+					gl->name, cpg_latency_phase_names[phase]);
+			} else {
+				snprintf(key_name, ICMAP_KEYNAME_MAXLEN,
+					"runtime.services.cpg.groups.%s.latency.%s.le_%uus",
+					gl->name, cpg_latency_phase_names[phase], 1U << i);
+			}
+			icmap_set_uint64(key_name, stats->hist[i]);
+		}
+	}
+}
 
-		cpii = list_entry (iter, struct cpg_iteration_instance, list);
+static void cpg_group_latency_free (struct cpg_group_latency *gl)
+{
+	char prefix[ICMAP_KEYNAME_MAXLEN];
+	icmap_iter_t iter;
+	const char *key_name;
 
-		cpg_iteration_instance_finalize (cpii);
+	snprintf(prefix, ICMAP_KEYNAME_MAXLEN, "runtime.services.cpg.groups.%s.", gl->name);
+	iter = icmap_iter_init(prefix);
+	while ((key_name = icmap_iter_next(iter, NULL, NULL)) != NULL) {
+		icmap_delete(key_name);
 	}
+	icmap_iter_finalize(iter);
 
-	list_del (&cpd->list);
+	list_del (&gl->list);
+	free (gl);
 }
 
-static int cpg_lib_exit_fn (void *conn)
+static int cpg_group_latency_has_local_member (const struct cpg_group_latency *gl)
+{
+	char name[CPG_MAX_NAME_LENGTH + 1];
+	struct cpg_pd *cpd;
+	struct list_head *iter;
+
+	for (iter = cpg_pd_list_head.next; iter != &cpg_pd_list_head; iter = iter->next) {
+		cpd = list_entry (iter, struct cpg_pd, list);
+
+		if (cpd->cpd_state == CPD_STATE_UNJOINED) {
+			continue;
+		}
+		cpg_latency_group_name_get (&cpd->group_name, name);
+		if (strcmp (gl->name, name) == 0) {
+			return (1);
+		}
+	}
+
+	return (0);
+}
+
+/*
+ * Stats are published periodically rather than per message. Groups
+ * without local member are forgotten.
+ */
+static void cpg_latency_update_timer_fn (void *data)
+{
+	struct cpg_group_latency *gl;
+	struct list_head *iter, *iter_next;
+
+	for (iter = cpg_group_latency_list_head.next;
+		iter != &cpg_group_latency_list_head; iter = iter_next) {
+
+		iter_next = iter->next;
+		gl = list_entry (iter, struct cpg_group_latency, list);
+
+		if (!cpg_group_latency_has_local_member (gl)) {
+			cpg_group_latency_free (gl);
+			continue;
+		}
+		if (gl->changed) {
+			cpg_group_latency_publish (gl);
+			gl->changed = 0;
+		}
+	}
+
+	api->timer_add_duration ((unsigned long long)CPG_LATENCY_UPDATE_INTERVAL * 1000000,
+		NULL, cpg_latency_update_timer_fn, &latency_update_timer);
+}
+
+static void cpg_latency_tracing_config_read (void)
+{
+	struct list_head *iter, *iter_next;
+	char *str;
+	int enabled = 0;
+
+	if (icmap_get_string ("cpg.latency_tracing", &str) == CS_OK) {
+		if (strcmp (str, "yes") == 0) {
+			enabled = 1;
+		}
+		free (str);
+	}
+
+	if (enabled == latency_tracing) {
+		return;
+	}
+	latency_tracing = enabled;
+
+	if (latency_tracing) {
+		log_printf (LOGSYS_LEVEL_NOTICE, "CPG mcast latency tracing enabled");
+		api->timer_add_duration ((unsigned long long)CPG_LATENCY_UPDATE_INTERVAL * 1000000,
+			NULL, cpg_latency_update_timer_fn, &latency_update_timer);
+		latency_update_timer_running = 1;
+	} else {
+		log_printf (LOGSYS_LEVEL_NOTICE, "CPG mcast latency tracing disabled");
+		if (latency_update_timer_running) {
+			api->timer_delete (latency_update_timer);
+			latency_update_timer_running = 0;
+		}
+		for (iter = cpg_group_latency_list_head.next;
+			iter != &cpg_group_latency_list_head; iter = iter_next) {
+
+			iter_next = iter->next;
+			cpg_group_latency_free (list_entry (iter, struct cpg_group_latency, list));
+		}
+	}
+}
+
+static void cpg_latency_tracing_changed (
+	int32_t event,
+	const char *key_name,
+	struct icmap_notify_value new_val,
+	struct icmap_notify_value old_val,
+	void *user_data)
+{
+	cpg_latency_tracing_config_read ();
+}
+
+static char *cpg_exec_init_fn (struct corosync_api_v1 *corosync_api)
+{
+	list_init (&downlist_messages_head);
+	list_init (&joinlist_messages_head);
+	api = corosync_api;
+
+	cpg_latency_tracing_config_read ();
+	if (icmap_track_add("cpg.latency_tracing",
+		ICMAP_TRACK_ADD | ICMAP_TRACK_DELETE | ICMAP_TRACK_MODIFY,
+		cpg_latency_tracing_changed,
+		NULL,
+		&latency_tracing_track) != CS_OK) {
+		return (char *)"Unable to setup cpg latency tracing config tracking!\n";
+	}
+
+	return (NULL);
+}
+
+static void cpg_iteration_instance_finalize (struct cpg_iteration_instance *cpg_iteration_instance)
+{
+	struct list_head *iter, *iter_next;
+	struct process_info *pi;
+
+	for (iter = cpg_iteration_instance->items_list_head.next;
+		iter != &cpg_iteration_instance->items_list_head;
+		iter = iter_next) {
+
+		iter_next = iter->next;
+
+		pi = list_entry (iter, struct process_info, list);
+		list_del (&pi->list);
+		free (pi);
+	}
+
+	list_del (&cpg_iteration_instance->list);
+	hdb_handle_destroy (&cpg_iteration_handle_t_db, cpg_iteration_instance->handle);
+}
+
+static void cpg_pd_finalize (struct cpg_pd *cpd)
+{
+	struct list_head *iter, *iter_next;
+	struct cpg_iteration_instance *cpii;
+
+	zcb_all_free(cpd);
+	zc_deliver_area_free(cpd);
+	for (iter = cpd->iteration_instance_list_head.next;
+		iter != &cpd->iteration_instance_list_head;
+		iter = iter_next) {
+
+		iter_next = iter->next;
+
+		cpii = list_entry (iter, struct cpg_iteration_instance, list);
+
+		cpg_iteration_instance_finalize (cpii);
+	}
+
+	list_del (&cpd->list);
+}
+
+static int cpg_lib_exit_fn (void *conn)
 {
 	struct cpg_pd *cpd = (struct cpg_pd *)api->ipc_private_data_get (conn);
 
@@ -1136,6 +1791,10 @@ static int cpg_lib_exit_fn (void *conn)
 	}
 
 	cpg_pd_finalize (cpd);
+	/*
+	 * cpd stays around while some message batch holds the connection
+	 */
+	cpd->cpd_state = CPD_STATE_UNJOINED;
 
 	api->ipc_refcnt_dec (conn);
 	return (0);
@@ -1202,6 +1861,30 @@ static void exec_cpg_downlist_endian_convert (void *msg)
 	for (i = 0; i < req_exec_cpg_downlist->left_nodes; i++) {
 		req_exec_cpg_downlist->nodeids[i] = swab32(req_exec_cpg_downlist->nodeids[i]);
 	}
+
+	swab_coroipc_request_header_t (&req_exec_cpg_downlist->header);
+	if (req_exec_cpg_downlist->header.size >= sizeof (struct req_exec_cpg_downlist)) {
+		req_exec_cpg_downlist->flags = swab32(req_exec_cpg_downlist->flags);
+	}
+}
+
+static void exec_cpg_joinlist_hash_endian_convert (void *msg)
+{
+	struct req_exec_cpg_joinlist_hash *req_exec_cpg_joinlist_hash = msg;
+	unsigned int i;
+
+	swab_coroipc_request_header_t (&req_exec_cpg_joinlist_hash->header);
+	req_exec_cpg_joinlist_hash->hash = swab64(req_exec_cpg_joinlist_hash->hash);
+	req_exec_cpg_joinlist_hash->view_entries = swab32(req_exec_cpg_joinlist_hash->view_entries);
+
+	for (i = 0; i < req_exec_cpg_joinlist_hash->view_entries; i++) {
+		req_exec_cpg_joinlist_hash->view[i].nodeid =
+			swab32(req_exec_cpg_joinlist_hash->view[i].nodeid);
+		req_exec_cpg_joinlist_hash->view[i].known =
+			swab32(req_exec_cpg_joinlist_hash->view[i].known);
+		req_exec_cpg_joinlist_hash->view[i].hash =
+			swab64(req_exec_cpg_joinlist_hash->view[i].hash);
+	}
 }
 
 
@@ -1214,6 +1897,17 @@ static void exec_cpg_mcast_endian_convert (void *msg)
 	req_exec_cpg_mcast->pid = swab32(req_exec_cpg_mcast->pid);
 	req_exec_cpg_mcast->msglen = swab32(req_exec_cpg_mcast->msglen);
 	swab_mar_message_source_t (&req_exec_cpg_mcast->source);
+
+	if (req_exec_cpg_mcast->header.size >= sizeof (*req_exec_cpg_mcast) +
+	    req_exec_cpg_mcast->msglen + sizeof (struct req_exec_cpg_mcast_trace)) {
+		struct req_exec_cpg_mcast_trace trace;
+		char *trace_pos = (char *)msg + sizeof (*req_exec_cpg_mcast) +
+			req_exec_cpg_mcast->msglen;
+
+		memcpy (&trace, trace_pos, sizeof (trace));
+		trace.send_time = swab64(trace.send_time);
+		memcpy (trace_pos, &trace, sizeof (trace));
+	}
 }
 
 static void exec_cpg_partial_mcast_endian_convert (void *msg)
@@ -1229,6 +1923,64 @@ static void exec_cpg_partial_mcast_endian_convert (void *msg)
 	swab_mar_message_source_t (&req_exec_cpg_mcast->source);
 }
 
+static void exec_cpg_mcast_batch_endian_convert (void *msg)
+{
+	struct req_exec_cpg_mcast_batch *req_exec_cpg_mcast_batch = msg;
+	struct cpg_mcast_batch_entry *entry;
+	char *pos;
+	char *end;
+	unsigned int i;
+
+	swab_coroipc_request_header_t (&req_exec_cpg_mcast_batch->header);
+	swab_mar_cpg_name_t (&req_exec_cpg_mcast_batch->group_name);
+	req_exec_cpg_mcast_batch->msg_count = swab32(req_exec_cpg_mcast_batch->msg_count);
+	req_exec_cpg_mcast_batch->pid = swab32(req_exec_cpg_mcast_batch->pid);
+	swab_mar_message_source_t (&req_exec_cpg_mcast_batch->source);
+
+	pos = (char *)req_exec_cpg_mcast_batch->message;
+	end = (char *)msg + req_exec_cpg_mcast_batch->header.size;
+	for (i = 0; i < req_exec_cpg_mcast_batch->msg_count &&
+	    pos + sizeof (*entry) <= end; i++) {
+		entry = (struct cpg_mcast_batch_entry *)pos;
+		entry->msglen = swab32(entry->msglen);
+		pos += sizeof (*entry) + CPG_MCAST_BATCH_ALIGN(entry->msglen);
+	}
+}
+
+/*
+ * Check that msg_count entries of a message batch fit into batch_len bytes
+ */
+static int cpg_mcast_batch_valid (const void *batch, size_t batch_len, unsigned int msg_count)
+{
+	const struct cpg_mcast_batch_entry *entry;
+	size_t pos = 0;
+	unsigned int i;
+
+	if (msg_count == 0 || msg_count > CPG_MCAST_BATCH_MAX) {
+		return (0);
+	}
+
+	for (i = 0; i < msg_count; i++) {
+		if (batch_len - pos < sizeof (*entry)) {
+			return (0);
+		}
+		entry = (const struct cpg_mcast_batch_entry *)((const char *)batch + pos);
+		pos += sizeof (*entry);
+		if (batch_len - pos < entry->msglen) {
+			return (0);
+		}
+		/*
+		 * Padding of the last entry may be left out
+		 */
+		pos += CPG_MCAST_BATCH_ALIGN(entry->msglen);
+		if (pos > batch_len) {
+			pos = batch_len;
+		}
+	}
+
+	return (1);
+}
+
 static struct process_info *process_info_find(const mar_cpg_name_t *group_name, uint32_t pid, unsigned int nodeid) {
 	struct list_head *iter;
 
@@ -1357,6 +2109,10 @@ static void message_handler_req_exec_cpg_downlist(
 	stored_msg->left_nodes = req_exec_cpg_downlist->left_nodes;
 	memcpy (stored_msg->nodeids, req_exec_cpg_downlist->nodeids,
 		req_exec_cpg_downlist->left_nodes * sizeof (mar_uint32_t));
+	stored_msg->flags = 0;
+	if (req_exec_cpg_downlist->header.size >= sizeof (struct req_exec_cpg_downlist)) {
+		stored_msg->flags = req_exec_cpg_downlist->flags;
+	}
 	list_init (&stored_msg->list);
 	list_add (&stored_msg->list, &downlist_messages_head);
 
@@ -1438,30 +2194,80 @@ static void message_handler_req_exec_cpg_joinlist (
 	}
 }
 
-static void message_handler_req_exec_cpg_mcast (
+static void message_handler_req_exec_cpg_joinlist_hash (
 	const void *message,
 	unsigned int nodeid)
 {
-	const struct req_exec_cpg_mcast *req_exec_cpg_mcast = message;
+	const struct req_exec_cpg_joinlist_hash *req_exec_cpg_joinlist_hash = message;
+	struct joinlist_hash_state *state;
+	int i;
+
+	if (downlist_state == CPG_DOWNLIST_NONE) {
+		log_printf (LOGSYS_LEVEL_DEBUG, "joinlist hash from node 0x%x received outside of sync",
+			nodeid);
+		return;
+	}
+
+	for (i = 0; i < my_member_list_entries; i++) {
+		if (my_member_list[i] == nodeid) {
+			break;
+		}
+	}
+	if (i == my_member_list_entries) {
+		return;
+	}
+	state = &joinlist_hash_list[i];
+	state->received = 1;
+	state->confirmed = (state->view_known && !state->downlisted &&
+		state->view_hash == req_exec_cpg_joinlist_hash->hash);
+
+	/*
+	 * Sender sees our joins differently, all nodes have to get our joinlist
+	 */
+	for (i = 0; i < req_exec_cpg_joinlist_hash->view_entries; i++) {
+		if (req_exec_cpg_joinlist_hash->view[i].nodeid != api->totem_nodeid_get ()) {
+			continue;
+		}
+		if (!req_exec_cpg_joinlist_hash->view[i].known ||
+		    req_exec_cpg_joinlist_hash->view[i].hash != my_joinlist_hash) {
+			joinlist_full_needed = 1;
+		}
+	}
+
+	log_printf (LOGSYS_LEVEL_DEBUG, "got joinlist hash from node 0x%x (%s)",
+		nodeid, state->confirmed ? "same" : "differs");
+}
+
+/*
+ * Deliver mcast message to local members of group. Returns number of
+ * connections message was passed to.
+ */
+static int cpg_mcast_deliver (
+	const mar_cpg_name_t *group_name,
+	uint32_t pid,
+	unsigned int nodeid,
+	const void *message,
+	int msglen)
+{
 	struct res_lib_cpg_deliver_callback res_lib_cpg_mcast;
-	int msglen = req_exec_cpg_mcast->msglen;
 	struct list_head *iter, *pi_iter;
 	struct cpg_pd *cpd;
 	struct iovec iovec[2];
 	int known_node = 0;
+	int delivered = 0;
 
 	res_lib_cpg_mcast.header.id = MESSAGE_RES_CPG_DELIVER_CALLBACK;
 	res_lib_cpg_mcast.header.size = sizeof(res_lib_cpg_mcast) + msglen;
 	res_lib_cpg_mcast.msglen = msglen;
-	res_lib_cpg_mcast.pid = req_exec_cpg_mcast->pid;
+	res_lib_cpg_mcast.pid = pid;
 	res_lib_cpg_mcast.nodeid = nodeid;
 
-	memcpy(&res_lib_cpg_mcast.group_name, &req_exec_cpg_mcast->group_name,
+	memcpy(&res_lib_cpg_mcast.group_name, group_name,
 		sizeof(mar_cpg_name_t));
 	iovec[0].iov_base = (void *)&res_lib_cpg_mcast;
 	iovec[0].iov_len = sizeof (res_lib_cpg_mcast);
 
-	iovec[1].iov_base = (char*)message+sizeof(*req_exec_cpg_mcast);
+	iovec[1].iov_base = (char *)message;
 	iovec[1].iov_len = msglen;
 
 	for (iter = cpg_pd_list_head.next; iter != &cpg_pd_list_head; ) {
@@ -1469,7 +2275,7 @@ static void message_handler_req_exec_cpg_mcast (
 		iter = iter->next;
 
 		if ((cpd->cpd_state == CPD_STATE_LEAVE_STARTED || cpd->cpd_state == CPD_STATE_JOIN_COMPLETED)
-			&& (mar_name_compare (&cpd->group_name, &req_exec_cpg_mcast->group_name) == 0)) {
+			&& (mar_name_compare (&cpd->group_name, group_name) == 0)) {
 
 			if (!known_node) {
 				/* Try to find, if we know the node */
@@ -1479,7 +2285,7 @@ static void message_handler_req_exec_cpg_mcast (
 					struct process_info *pi = list_entry (pi_iter, struct process_info, list);
 
 					if (pi->nodeid == nodeid &&
-						mar_name_compare (&pi->group, &req_exec_cpg_mcast->group_name) == 0) {
+						mar_name_compare (&pi->group, group_name) == 0) {
 						known_node = 1;
 						break;
 					}
@@ -1488,12 +2294,65 @@ static void message_handler_req_exec_cpg_mcast (
 
 			if (!known_node) {
 				log_printf(LOGSYS_LEVEL_WARNING, "Unknown node -> we will not deliver message");
-				return ;
+				return (0);
 			}
 
 			api->ipc_dispatch_iov_send (cpd->conn, iovec, 2);
+			delivered++;
 		}
 	}
+
+	return (delivered);
+}
+
+/*
+ * Message with trace appended is accounted in latency stats of the group.
+ * Delivery latency includes queueing on sender, ordering and transport and
+ * is taken from clocks of two nodes, so it's only as exact as their sync.
+ */
+static void message_handler_req_exec_cpg_mcast (
+	const void *message,
+	unsigned int nodeid)
+{
+	const struct req_exec_cpg_mcast *req_exec_cpg_mcast = message;
+	const char *msg = (const char *)message + sizeof(*req_exec_cpg_mcast);
+	struct req_exec_cpg_mcast_trace trace;
+	struct cpg_group_latency *gl;
+	uint64_t recv_time;
+	uint64_t dispatch_start;
+	uint64_t dispatch_end;
+
+	if (!latency_tracing ||
+	    req_exec_cpg_mcast->header.size < sizeof(*req_exec_cpg_mcast) +
+	    req_exec_cpg_mcast->msglen + sizeof(trace)) {
+		cpg_mcast_deliver (&req_exec_cpg_mcast->group_name, req_exec_cpg_mcast->pid,
+			nodeid, msg, req_exec_cpg_mcast->msglen);
+		return ;
+	}
+
+	memcpy (&trace, msg + req_exec_cpg_mcast->msglen, sizeof(trace));
+	recv_time = qb_util_nano_from_epoch_get ();
+	dispatch_start = qb_util_nano_current_get ();
+
+	if (cpg_mcast_deliver (&req_exec_cpg_mcast->group_name, req_exec_cpg_mcast->pid,
+		nodeid, msg, req_exec_cpg_mcast->msglen) == 0) {
+
+		return ;
+	}
+
+	dispatch_end = qb_util_nano_current_get ();
+
+	gl = cpg_group_latency_get (&req_exec_cpg_mcast->group_name);
+	if (gl == NULL) {
+		return ;
+	}
+
+	cpg_latency_account (&gl->phase[CPG_LATENCY_DELIVERY],
+		recv_time > trace.send_time ?
+		(recv_time - trace.send_time) / QB_TIME_NS_IN_USEC : 0);
+	cpg_latency_account (&gl->phase[CPG_LATENCY_DISPATCH],
+		(dispatch_end - dispatch_start) / QB_TIME_NS_IN_USEC);
+	gl->changed = 1;
 }
 
 static void message_handler_req_exec_cpg_partial_mcast (
@@ -1553,11 +2412,158 @@ static void message_handler_req_exec_cpg_partial_mcast (
 				return ;
 			}
 
+			if (zc_deliver_fragment (cpd, req_exec_cpg_mcast, nodeid)) {
+				continue;
+			}
+
 			api->ipc_dispatch_iov_send (cpd->conn, iovec, 2);
 		}
 	}
 }
 
+static void cpg_mcast_batch_deliver (
+	const struct req_exec_cpg_mcast_batch *req_exec_cpg_mcast_batch,
+	unsigned int nodeid)
+{
+	struct res_lib_cpg_deliver_callback res_lib_cpg_mcast;
+	const struct cpg_mcast_batch_entry *entry;
+	const char *pos;
+	struct list_head *iter, *pi_iter;
+	struct cpg_pd *cpd;
+	struct iovec iovec[2];
+	int known_node = 0;
+	unsigned int i;
+
+	res_lib_cpg_mcast.header.id = MESSAGE_RES_CPG_DELIVER_CALLBACK;
+	res_lib_cpg_mcast.pid = req_exec_cpg_mcast_batch->pid;
+	res_lib_cpg_mcast.nodeid = nodeid;
+
+	memcpy(&res_lib_cpg_mcast.group_name, &req_exec_cpg_mcast_batch->group_name,
+		sizeof(mar_cpg_name_t));
+	iovec[0].iov_base = (void *)&res_lib_cpg_mcast;
+	iovec[0].iov_len = sizeof (res_lib_cpg_mcast);
+
+	for (iter = cpg_pd_list_head.next; iter != &cpg_pd_list_head; ) {
+		cpd = list_entry(iter, struct cpg_pd, list);
+		iter = iter->next;
+
+		if ((cpd->cpd_state == CPD_STATE_LEAVE_STARTED || cpd->cpd_state == CPD_STATE_JOIN_COMPLETED)
+			&& (mar_name_compare (&cpd->group_name, &req_exec_cpg_mcast_batch->group_name) == 0)) {
+
+			if (!known_node) {
+				/* Try to find, if we know the node */
+				for (pi_iter = process_info_list_head.next;
+					pi_iter != &process_info_list_head; pi_iter = pi_iter->next) {
+
+					struct process_info *pi = list_entry (pi_iter, struct process_info, list);
+
+					if (pi->nodeid == nodeid &&
+						mar_name_compare (&pi->group, &req_exec_cpg_mcast_batch->group_name) == 0) {
+						known_node = 1;
+						break;
+					}
+				}
+			}
+
+			if (!known_node) {
+				log_printf(LOGSYS_LEVEL_WARNING, "Unknown node -> we will not deliver message");
+				return ;
+			}
+
+			/*
+			 * Deliver every message of the batch as a separate callback
+			 */
+			pos = (const char *)req_exec_cpg_mcast_batch->message;
+			for (i = 0; i < req_exec_cpg_mcast_batch->msg_count; i++) {
+				entry = (const struct cpg_mcast_batch_entry *)pos;
+
+				res_lib_cpg_mcast.header.size = sizeof(res_lib_cpg_mcast) + entry->msglen;
+				res_lib_cpg_mcast.msglen = entry->msglen;
+				iovec[1].iov_base = (void *)entry->message;
+				iovec[1].iov_len = entry->msglen;
+
+				api->ipc_dispatch_iov_send (cpd->conn, iovec, 2);
+
+				pos += sizeof (*entry) + CPG_MCAST_BATCH_ALIGN(entry->msglen);
+			}
+		}
+	}
+}
+
+/*
+ * Send messages of own batch again one by one. Used when the batch was
+ * delivered in a membership where some member may have discarded it.
+ */
+static void cpg_mcast_batch_resend (
+	const struct req_exec_cpg_mcast_batch *req_exec_cpg_mcast_batch)
+{
+	void *conn = req_exec_cpg_mcast_batch->source.conn;
+	struct cpg_pd *cpd = (struct cpg_pd *)api->ipc_private_data_get (conn);
+	const struct cpg_mcast_batch_entry *entry;
+	const char *pos;
+	unsigned int i;
+
+	if ((cpd->cpd_state != CPD_STATE_LEAVE_STARTED && cpd->cpd_state != CPD_STATE_JOIN_COMPLETED) ||
+	    cpd->pid != req_exec_cpg_mcast_batch->pid ||
+	    mar_name_compare (&cpd->group_name, &req_exec_cpg_mcast_batch->group_name) != 0) {
+		log_printf(LOGSYS_LEVEL_WARNING,
+			"Sender of message batch to group %s is gone, dropping %u messages",
+			cpg_print_group_name (&req_exec_cpg_mcast_batch->group_name),
+			req_exec_cpg_mcast_batch->msg_count);
+		return ;
+	}
+
+	log_printf(LOGSYS_LEVEL_DEBUG,
+		"Message batch of conn %p crossed membership change, sending its %u messages again",
+		conn, req_exec_cpg_mcast_batch->msg_count);
+
+	pos = (const char *)req_exec_cpg_mcast_batch->message;
+	for (i = 0; i < req_exec_cpg_mcast_batch->msg_count; i++) {
+		entry = (const struct cpg_mcast_batch_entry *)pos;
+
+		if (cpg_mcast_send (conn, cpd, entry->message, entry->msglen) != 0) {
+			log_printf(LOGSYS_LEVEL_ERROR, "*** %p can't mcast message %u of %u of batch to group %s",
+				conn, i + 1, req_exec_cpg_mcast_batch->msg_count,
+				cpg_print_group_name (&req_exec_cpg_mcast_batch->group_name));
+			break;
+		}
+
+		pos += sizeof (*entry) + CPG_MCAST_BATCH_ALIGN(entry->msglen);
+	}
+}
+
+/*
+ * Batch queued before a configuration change may be delivered in a
+ * membership with members which don't understand it and discard it. No
+ * node delivers such batch then and the sending node sends its messages
+ * again as ordinary mcast messages, so all members get them.
+ */
+static void message_handler_req_exec_cpg_mcast_batch (
+	const void *message,
+	unsigned int nodeid)
+{
+	const struct req_exec_cpg_mcast_batch *req_exec_cpg_mcast_batch = message;
+	int local = api->ipc_source_is_local (&req_exec_cpg_mcast_batch->source);
+
+	if (req_exec_cpg_mcast_batch->header.size < sizeof (*req_exec_cpg_mcast_batch) ||
+	    !cpg_mcast_batch_valid (req_exec_cpg_mcast_batch->message,
+			req_exec_cpg_mcast_batch->header.size - sizeof (*req_exec_cpg_mcast_batch),
+			req_exec_cpg_mcast_batch->msg_count)) {
+		log_printf(LOGSYS_LEVEL_WARNING, "Malformed message batch from node 0x%x", nodeid);
+	} else if (mcast_batch_supported) {
+		cpg_mcast_batch_deliver (req_exec_cpg_mcast_batch, nodeid);
+	} else if (local) {
+		cpg_mcast_batch_resend (req_exec_cpg_mcast_batch);
+	}
+
+	/*
+	 * Reference taken when the batch was sent
+	 */
+	if (local) {
+		api->ipc_refcnt_dec (req_exec_cpg_mcast_batch->source.conn);
+	}
+}
+
 
 static int cpg_exec_send_downlist(void)
 {
@@ -1567,6 +2573,8 @@ static int cpg_exec_send_downlist(void)
 	g_req_exec_cpg_downlist.header.size = sizeof(struct req_exec_cpg_downlist);
 
 	g_req_exec_cpg_downlist.old_members = my_old_member_list_entries;
+	g_req_exec_cpg_downlist.flags = CPG_DOWNLIST_FLAG_JOINLIST_HASH |
+		CPG_DOWNLIST_FLAG_MCAST_BATCH;
 
 	iov.iov_base = (void *)&g_req_exec_cpg_downlist;
 	iov.iov_len = g_req_exec_cpg_downlist.header.size;
@@ -1623,6 +2631,22 @@ static int cpg_exec_send_joinlist(void)
 	return (api->totem_mcast (&req_exec_cpg_iovec, 1, TOTEM_AGREED));
 }
 
+static int cpg_exec_send_joinlist_hash(void)
+{
+	struct iovec iov;
+
+	g_req_exec_cpg_joinlist_hash.header.id = SERVICE_ID_MAKE(CPG_SERVICE,
+		MESSAGE_REQ_EXEC_CPG_JOINLIST_HASH);
+	g_req_exec_cpg_joinlist_hash.header.size =
+		offsetof (struct req_exec_cpg_joinlist_hash, view) +
+		g_req_exec_cpg_joinlist_hash.view_entries * sizeof (struct joinlist_view_entry);
+
+	iov.iov_base = (void *)&g_req_exec_cpg_joinlist_hash;
+	iov.iov_len = g_req_exec_cpg_joinlist_hash.header.size;
+
+	return (api->totem_mcast (&iov, 1, TOTEM_AGREED));
+}
+
 static int cpg_lib_init_fn (void *conn)
 {
 	struct cpg_pd *cpd = (struct cpg_pd *)api->ipc_private_data_get (conn);
@@ -1632,6 +2656,7 @@ static int cpg_lib_init_fn (void *conn)
 
 	list_init (&cpd->iteration_instance_list_head);
 	list_init (&cpd->zcb_mapped_list_head);
+	list_init (&cpd->zc_deliver.assembly_list_head);
 
 	api->ipc_refcnt_inc (conn);
 	log_printf(LOGSYS_LEVEL_DEBUG, "lib_init_fn: conn=%p, cpd=%p", conn, cpd);
@@ -1899,6 +2924,261 @@ static inline int zcb_all_free (
 	return (0);
 }
 
+static void zc_deliver_assembly_abandon (
+	struct cpg_zc_deliver_assembly *assembly)
+{
+	qb_atomic_int_set (&assembly->slot->state, CPG_ZC_DELIVER_SLOT_RELEASED);
+	list_del (&assembly->list);
+	free (assembly);
+}
+
+static void zc_deliver_area_free (
+	struct cpg_pd *cpd)
+{
+	struct cpg_zc_deliver *zcd = &cpd->zc_deliver;
+	struct cpg_zc_deliver_assembly *assembly;
+
+	while (!list_empty (&zcd->assembly_list_head)) {
+		assembly = list_entry (zcd->assembly_list_head.next,
+			struct cpg_zc_deliver_assembly, list);
+		log_printf(LOGSYS_LEVEL_DEBUG,
+			"Dropping message of node 0x%x pid %u being reassembled for conn %p",
+			assembly->nodeid, assembly->pid, cpd->conn);
+		list_del (&assembly->list);
+		free (assembly);
+	}
+
+	if (zcd->addr != NULL) {
+		munmap (zcd->addr, zcd->size);
+	}
+	zcd->addr = NULL;
+	zcd->size = 0;
+	zcd->head = zcd->tail = zcd->used = 0;
+}
+
+static struct cpg_zc_deliver_assembly *zc_deliver_assembly_find (
+	struct cpg_zc_deliver *zcd,
+	uint32_t nodeid,
+	uint32_t pid)
+{
+	struct list_head *iter;
+	struct cpg_zc_deliver_assembly *assembly;
+
+	for (iter = zcd->assembly_list_head.next; iter != &zcd->assembly_list_head;
+	    iter = iter->next) {
+		assembly = list_entry (iter, struct cpg_zc_deliver_assembly, list);
+		if (assembly->nodeid == nodeid && assembly->pid == pid) {
+			return (assembly);
+		}
+	}
+
+	return (NULL);
+}
+
+/*
+ * Sender left the group, it will never send the rest of its message
+ */
+static void zc_deliver_sender_abandon (
+	struct cpg_pd *cpd,
+	uint32_t nodeid,
+	uint32_t pid)
+{
+	struct cpg_zc_deliver_assembly *assembly;
+
+	assembly = zc_deliver_assembly_find (&cpd->zc_deliver, nodeid, pid);
+	if (assembly != NULL) {
+		zc_deliver_assembly_abandon (assembly);
+	}
+}
+
+/*
+ * Reclaim slots released by the library. Slot headers are writable by the
+ * library, so they are checked before use and -1 is returned if they are broken.
+ */
+static int zc_deliver_reclaim (
+	struct cpg_zc_deliver *zcd)
+{
+	struct cpg_zc_deliver_slot *slot;
+	size_t slot_size;
+
+	while (zcd->used > 0) {
+		slot = (struct cpg_zc_deliver_slot *)(zcd->addr + zcd->tail);
+
+		if (qb_atomic_int_get (&slot->state) != CPG_ZC_DELIVER_SLOT_RELEASED) {
+			break;
+		}
+
+		slot_size = slot->size;
+		if (slot_size < sizeof (struct cpg_zc_deliver_slot) || (slot_size & 7) != 0 ||
+		    slot_size > zcd->size - zcd->tail || slot_size > zcd->used) {
+			return (-1);
+		}
+
+		zcd->used -= slot_size;
+		zcd->tail += slot_size;
+		if (zcd->tail == zcd->size) {
+			zcd->tail = 0;
+		}
+	}
+
+	if (zcd->used == 0) {
+		zcd->head = zcd->tail = 0;
+	}
+
+	return (0);
+}
+
+static struct cpg_zc_deliver_slot *zc_deliver_slot_alloc (
+	struct cpg_pd *cpd,
+	uint32_t msglen)
+{
+	struct cpg_zc_deliver *zcd = &cpd->zc_deliver;
+	struct cpg_zc_deliver_slot *slot;
+	size_t slot_size = (sizeof (struct cpg_zc_deliver_slot) + (size_t)msglen + 7) & ~(size_t)7;
+	size_t pad;
+
+	if (zc_deliver_reclaim (zcd) != 0) {
+		log_printf(LOGSYS_LEVEL_WARNING,
+			"Zero-copy delivery area of conn %p is corrupted, disabling it", cpd->conn);
+		zc_deliver_area_free (cpd);
+		return (NULL);
+	}
+
+	if (slot_size > zcd->size) {
+		return (NULL);
+	}
+
+	if (zcd->head > zcd->tail || zcd->used == 0) {
+		if (zcd->size - zcd->head < slot_size) {
+			/*
+			 * Not enough space at the end of the ring. Cover it by released
+			 * padding slot and continue from the beginning.
+			 */
+			if (zcd->tail < slot_size) {
+				return (NULL);
+			}
+
+			pad = zcd->size - zcd->head;
+			if (pad > 0) {
+				slot = (struct cpg_zc_deliver_slot *)(zcd->addr + zcd->head);
+				slot->size = pad;
+				qb_atomic_int_set (&slot->state, CPG_ZC_DELIVER_SLOT_RELEASED);
+				zcd->used += pad;
+			}
+			zcd->head = 0;
+		}
+	} else if (zcd->tail - zcd->head < slot_size) {
+		return (NULL);
+	}
+
+	slot = (struct cpg_zc_deliver_slot *)(zcd->addr + zcd->head);
+	slot->size = slot_size;
+	qb_atomic_int_set (&slot->state, CPG_ZC_DELIVER_SLOT_BUSY);
+
+	zcd->used += slot_size;
+	zcd->head += slot_size;
+	if (zcd->head == zcd->size) {
+		zcd->head = 0;
+	}
+
+	return (slot);
+}
+
+/*
+ * Reassemble fragment directly in the zero-copy delivery area of cpd and
+ * notify the library when the message is complete. Returns 0 if the fragment
+ * has to be sent as MESSAGE_RES_CPG_PARTIAL_DELIVER_CALLBACK instead, which
+ * happens if the library has no area or there was no space in it for the
+ * first fragment of the message. All fragments of one message take the
+ * same path.
+ */
+static int zc_deliver_fragment (
+	struct cpg_pd *cpd,
+	const struct req_exec_cpg_partial_mcast *req_exec_cpg_mcast,
+	unsigned int nodeid)
+{
+	struct cpg_zc_deliver *zcd = &cpd->zc_deliver;
+	struct cpg_zc_deliver_assembly *assembly;
+	struct res_lib_cpg_zc_deliver_callback res_lib_cpg_zc_deliver;
+	uint32_t fraglen = req_exec_cpg_mcast->fraglen;
+
+	if (zcd->addr == NULL) {
+		return (0);
+	}
+
+	assembly = zc_deliver_assembly_find (zcd, nodeid, req_exec_cpg_mcast->pid);
+
+	if (req_exec_cpg_mcast->type == LIBCPG_PARTIAL_FIRST) {
+		/*
+		 * Previous message was abandoned by the sender
+		 */
+		if (assembly != NULL) {
+			zc_deliver_assembly_abandon (assembly);
+		}
+
+		assembly = malloc (sizeof (struct cpg_zc_deliver_assembly));
+		if (assembly == NULL) {
+			return (0);
+		}
+		assembly->slot = zc_deliver_slot_alloc (cpd, req_exec_cpg_mcast->msglen);
+		if (assembly->slot == NULL) {
+			free (assembly);
+			return (0);
+		}
+		assembly->nodeid = nodeid;
+		assembly->pid = req_exec_cpg_mcast->pid;
+		assembly->msglen = req_exec_cpg_mcast->msglen;
+		assembly->written = 0;
+		list_add_tail (&assembly->list, &zcd->assembly_list_head);
+	} else if (assembly == NULL) {
+		return (0);
+	}
+
+	if (fraglen > assembly->msglen - assembly->written) {
+		log_printf(LOGSYS_LEVEL_WARNING,
+			"Fragment from node 0x%x overflows message, dropping message", nodeid);
+		zc_deliver_assembly_abandon (assembly);
+		return (1);
+	}
+
+	memcpy (assembly->slot->message + assembly->written, req_exec_cpg_mcast->message, fraglen);
+	assembly->written += fraglen;
+
+	if (req_exec_cpg_mcast->type != LIBCPG_PARTIAL_LAST) {
+		return (1);
+	}
+
+	if (assembly->written != assembly->msglen) {
+		log_printf(LOGSYS_LEVEL_WARNING,
+			"Incomplete message from node 0x%x, dropping message", nodeid);
+		zc_deliver_assembly_abandon (assembly);
+		return (1);
+	}
+
+	res_lib_cpg_zc_deliver.header.id = MESSAGE_RES_CPG_ZC_DELIVER_CALLBACK;
+	res_lib_cpg_zc_deliver.header.size = sizeof (res_lib_cpg_zc_deliver);
+	res_lib_cpg_zc_deliver.header.error = CS_OK;
+	memcpy (&res_lib_cpg_zc_deliver.group_name, &req_exec_cpg_mcast->group_name,
+		sizeof (mar_cpg_name_t));
+	res_lib_cpg_zc_deliver.msglen = assembly->msglen;
+	res_lib_cpg_zc_deliver.nodeid = nodeid;
+	res_lib_cpg_zc_deliver.pid = assembly->pid;
+	res_lib_cpg_zc_deliver.offset = (char *)assembly->slot->message - zcd->addr;
+
+	if (api->ipc_dispatch_send (cpd->conn, &res_lib_cpg_zc_deliver,
+	    sizeof (res_lib_cpg_zc_deliver)) != 0) {
+		/*
+		 * Library will never release slot it doesn't know about
+		 */
+		zc_deliver_assembly_abandon (assembly);
+	} else {
+		list_del (&assembly->list);
+		free (assembly);
+	}
+
+	return (1);
+}
+
 union u {
 	uint64_t server_addr;
 	void *server_ptr;
@@ -1969,22 +3249,80 @@ static void message_handler_req_lib_cpg_zc_free (
 		res_header.size);
 }
 
-/* Fragmented mcast message from the library */
-static void message_handler_req_lib_cpg_partial_mcast (void *conn, const void *message)
+static void message_handler_req_lib_cpg_zc_deliver_area_set (
+	void *conn,
+	const void *message)
+{
+	const mar_req_coroipcc_zc_deliver_area_set_t *hdr = message;
+	struct qb_ipc_response_header res_header;
+	struct cpg_pd *cpd = (struct cpg_pd *)api->ipc_private_data_get (conn);
+	const char *file_name;
+	void *addr = NULL;
+	cs_error_t error = CS_OK;
+
+	if (memchr (hdr->path_to_file, 0, CPG_ZC_PATH_LEN) == NULL ||
+	    hdr->map_size < sizeof (struct cpg_zc_deliver_slot) ||
+	    hdr->map_size > CPG_ZC_DELIVER_AREA_SIZE || (hdr->map_size & 7) != 0) {
+		error = CS_ERR_INVALID_PARAM;
+		goto response_send;
+	}
+
+	/*
+	 * Only map files created by libcpg memory_map
+	 */
+	file_name = strrchr (hdr->path_to_file, '/');
+	if (file_name == NULL || strstr (hdr->path_to_file, "/../") != NULL ||
+	    strncmp (file_name + 1, "corosync_zerocopy-", strlen ("corosync_zerocopy-")) != 0) {
+		error = CS_ERR_INVALID_PARAM;
+		goto response_send;
+	}
+
+	log_printf(LOGSYS_LEVEL_DEBUG, "zero-copy delivery area path: %s", hdr->path_to_file);
+
+	if (memory_map (hdr->path_to_file, hdr->map_size, &addr) == -1) {
+		error = CS_ERR_NO_RESOURCES;
+		goto response_send;
+	}
+
+	zc_deliver_area_free (cpd);
+	cpd->zc_deliver.addr = addr;
+	cpd->zc_deliver.size = hdr->map_size;
+
+response_send:
+	res_header.size = sizeof (struct qb_ipc_response_header);
+	res_header.id = MESSAGE_RES_CPG_ZC_DELIVER_AREA_SET;
+	res_header.error = error;
+	api->ipc_response_send (conn, &res_header, res_header.size);
+}
+
+/*
+ * Send one fragment of a fragmented message.
+ *
+ * Fragments other than the last one may be sent by the library without
+ * waiting for a reply (MESSAGE_REQ_CPG_PARTIAL_MCAST_ASYNC).  Such a
+ * fragment can be dropped by IPC flow control before it reaches this
+ * handler, so the number of bytes sent is tracked and a fragment is only
+ * multicast if its offset follows on from it.  Once a fragment is rejected,
+ * nothing more of the message is multicast.  Errors of unacknowledged
+ * fragments are remembered and reported in the reply to the last fragment.
+ */
+static cs_error_t cpg_partial_mcast_send (void *conn,
+	uint32_t type,
+	uint32_t msglen,
+	uint32_t fraglen,
+	uint32_t offset,
+	const void *message)
 {
-	const struct req_lib_cpg_partial_mcast *req_lib_cpg_mcast = message;
 	struct cpg_pd *cpd = (struct cpg_pd *)api->ipc_private_data_get (conn);
 	mar_cpg_name_t group_name = cpd->group_name;
 
 	struct iovec req_exec_cpg_iovec[2];
 	struct req_exec_cpg_partial_mcast req_exec_cpg_mcast;
-	struct res_lib_cpg_partial_send res_lib_cpg_partial_send;
-	int msglen = req_lib_cpg_mcast->fraglen;
 	int result;
 	cs_error_t error = CS_ERR_NOT_EXIST;
 
 	log_printf(LOGSYS_LEVEL_TRACE, "got fragmented mcast request on %p", conn);
-	log_printf(LOGSYS_LEVEL_DEBUG, "Sending fragmented message size = %d bytes\n", msglen);
+	log_printf(LOGSYS_LEVEL_DEBUG, "Sending fragmented message size = %u bytes\n", fraglen);
 
 	switch (cpd->cpd_state) {
 	case CPD_STATE_UNJOINED:
@@ -2001,45 +3339,148 @@ static void message_handler_req_lib_cpg_partial_mcast (void *conn, const void *m
 		break;
 	}
 
-	res_lib_cpg_partial_send.header.size = sizeof(res_lib_cpg_partial_send);
-	res_lib_cpg_partial_send.header.id = MESSAGE_RES_CPG_PARTIAL_SEND;
-
-	if (req_lib_cpg_mcast->type == LIBCPG_PARTIAL_FIRST) {
+	if (type == LIBCPG_PARTIAL_FIRST) {
 		cpd->initial_transition_counter = cpd->transition_counter;
+		cpd->partial_sent = 0;
+		cpd->partial_error = CS_OK;
 	}
 	if (cpd->transition_counter != cpd->initial_transition_counter) {
 		error = CS_ERR_INTERRUPT;
 	}
 
+	if (error == CS_OK && cpd->partial_error != CS_OK) {
+		error = cpd->partial_error;
+	}
+
+	/*
+	 * Some fragment before this one never arrived
+	 */
+	if (error == CS_OK && offset != cpd->partial_sent) {
+		error = CS_ERR_MESSAGE_ERROR;
+	}
+	if (error == CS_OK &&
+	    (fraglen > msglen - cpd->partial_sent ||
+	     (type == LIBCPG_PARTIAL_LAST &&
+	      cpd->partial_sent + fraglen != msglen))) {
+		error = CS_ERR_MESSAGE_ERROR;
+	}
+
 	if (error == CS_OK) {
-		req_exec_cpg_mcast.header.size = sizeof(req_exec_cpg_mcast) + msglen;
+		req_exec_cpg_mcast.header.size = sizeof(req_exec_cpg_mcast) + fraglen;
 		req_exec_cpg_mcast.header.id = SERVICE_ID_MAKE(CPG_SERVICE,
 							       MESSAGE_REQ_EXEC_CPG_PARTIAL_MCAST);
 		req_exec_cpg_mcast.pid = cpd->pid;
-		req_exec_cpg_mcast.msglen = req_lib_cpg_mcast->msglen;
-		req_exec_cpg_mcast.type = req_lib_cpg_mcast->type;
-		req_exec_cpg_mcast.fraglen = req_lib_cpg_mcast->fraglen;
+		req_exec_cpg_mcast.msglen = msglen;
+		req_exec_cpg_mcast.type = type;
+		req_exec_cpg_mcast.fraglen = fraglen;
 		api->ipc_source_set (&req_exec_cpg_mcast.source, conn);
 		memcpy(&req_exec_cpg_mcast.group_name, &group_name,
 		       sizeof(mar_cpg_name_t));
 
 		req_exec_cpg_iovec[0].iov_base = (char *)&req_exec_cpg_mcast;
 		req_exec_cpg_iovec[0].iov_len = sizeof(req_exec_cpg_mcast);
-		req_exec_cpg_iovec[1].iov_base = (char *)&req_lib_cpg_mcast->message;
-		req_exec_cpg_iovec[1].iov_len = msglen;
+		req_exec_cpg_iovec[1].iov_base = (char *)message;
+		req_exec_cpg_iovec[1].iov_len = fraglen;
 
 		result = api->totem_mcast (req_exec_cpg_iovec, 2, TOTEM_AGREED);
 		assert(result == 0);
+
+		cpd->partial_sent += fraglen;
 	} else {
 		log_printf(LOGSYS_LEVEL_ERROR, "*** %p can't mcast to group %s state:%d, error:%d",
 			   conn, group_name.value, cpd->cpd_state, error);
+		if (cpd->partial_error == CS_OK) {
+			cpd->partial_error = error;
+		}
+	}
+
+	if (type == LIBCPG_PARTIAL_LAST) {
+		cpd->partial_sent = 0;
+		cpd->partial_error = CS_OK;
+	}
+
+	return (error);
+}
+
+/* Fragmented mcast message from the library */
+static void message_handler_req_lib_cpg_partial_mcast (void *conn, const void *message)
+{
+	const struct req_lib_cpg_partial_mcast *req_lib_cpg_mcast = message;
+	struct res_lib_cpg_partial_send res_lib_cpg_partial_send;
+	struct cpg_pd *cpd = (struct cpg_pd *)api->ipc_private_data_get (conn);
+	uint32_t offset;
+
+	res_lib_cpg_partial_send.header.size = sizeof(res_lib_cpg_partial_send);
+	res_lib_cpg_partial_send.header.id = MESSAGE_RES_CPG_PARTIAL_SEND;
+	/*
+	 * Every fragment before an acknowledged one was acknowledged too, only
+	 * the last fragment of a pipelined message can follow a gap
+	 */
+	if (req_lib_cpg_mcast->type == LIBCPG_PARTIAL_LAST) {
+		offset = req_lib_cpg_mcast->msglen - req_lib_cpg_mcast->fraglen;
+	} else if (req_lib_cpg_mcast->type == LIBCPG_PARTIAL_FIRST) {
+		offset = 0;
+	} else {
+		offset = cpd->partial_sent;
 	}
 
-	res_lib_cpg_partial_send.header.error = error;
+	res_lib_cpg_partial_send.header.error = cpg_partial_mcast_send (conn,
+		req_lib_cpg_mcast->type, req_lib_cpg_mcast->msglen, req_lib_cpg_mcast->fraglen,
+		offset, req_lib_cpg_mcast->message);
+
 	api->ipc_response_send (conn, &res_lib_cpg_partial_send,
 				sizeof (res_lib_cpg_partial_send));
 }
 
+/* Pipelined fragment from the library, there is no reply */
+static void message_handler_req_lib_cpg_partial_mcast_async (void *conn, const void *message)
+{
+	const struct req_lib_cpg_partial_mcast_async *req_lib_cpg_mcast_async = message;
+
+	(void)cpg_partial_mcast_send (conn,
+		req_lib_cpg_mcast_async->type, req_lib_cpg_mcast_async->msglen,
+		req_lib_cpg_mcast_async->fraglen, req_lib_cpg_mcast_async->offset,
+		req_lib_cpg_mcast_async->message);
+}
+
+/*
+ * Send mcast message of joined cpd, with trace appended when latency
+ * tracing is enabled
+ */
+static int cpg_mcast_send (void *conn, const struct cpg_pd *cpd,
+	const void *message, int msglen)
+{
+	struct iovec req_exec_cpg_iovec[3];
+	struct req_exec_cpg_mcast req_exec_cpg_mcast;
+	struct req_exec_cpg_mcast_trace trace;
+	int iov_len = 2;
+
+	req_exec_cpg_mcast.header.size = sizeof(req_exec_cpg_mcast) + msglen;
+	req_exec_cpg_mcast.header.id = SERVICE_ID_MAKE(CPG_SERVICE,
+		MESSAGE_REQ_EXEC_CPG_MCAST);
+	req_exec_cpg_mcast.pid = cpd->pid;
+	req_exec_cpg_mcast.msglen = msglen;
+	api->ipc_source_set (&req_exec_cpg_mcast.source, conn);
+	memcpy(&req_exec_cpg_mcast.group_name, &cpd->group_name,
+		sizeof(mar_cpg_name_t));
+
+	req_exec_cpg_iovec[0].iov_base = (char *)&req_exec_cpg_mcast;
+	req_exec_cpg_iovec[0].iov_len = sizeof(req_exec_cpg_mcast);
+	req_exec_cpg_iovec[1].iov_base = (char *)message;
+	req_exec_cpg_iovec[1].iov_len = msglen;
+
+	if (latency_tracing) {
+		trace.send_time = qb_util_nano_from_epoch_get ();
+		req_exec_cpg_mcast.header.size += sizeof(trace);
+
+		req_exec_cpg_iovec[2].iov_base = (char *)&trace;
+		req_exec_cpg_iovec[2].iov_len = sizeof(trace);
+		iov_len = 3;
+	}
+
+	return (api->totem_mcast (req_exec_cpg_iovec, iov_len, TOTEM_AGREED));
+}
+
 /* Mcast message from the library */
 static void message_handler_req_lib_cpg_mcast (void *conn, const void *message)
 {
@@ -2047,8 +3488,6 @@ static void message_handler_req_lib_cpg_mcast (void *conn, const void *message)
 	struct cpg_pd *cpd = (struct cpg_pd *)api->ipc_private_data_get (conn);
 	mar_cpg_name_t group_name = cpd->group_name;
 
-	struct iovec req_exec_cpg_iovec[2];
-	struct req_exec_cpg_mcast req_exec_cpg_mcast;
 	int msglen = req_lib_cpg_mcast->msglen;
 	int result;
 	cs_error_t error = CS_ERR_NOT_EXIST;
@@ -2071,24 +3510,102 @@ static void message_handler_req_lib_cpg_mcast (void *conn, const void *message)
 	}
 
 	if (error == CS_OK) {
-		req_exec_cpg_mcast.header.size = sizeof(req_exec_cpg_mcast) + msglen;
-		req_exec_cpg_mcast.header.id = SERVICE_ID_MAKE(CPG_SERVICE,
-			MESSAGE_REQ_EXEC_CPG_MCAST);
-		req_exec_cpg_mcast.pid = cpd->pid;
-		req_exec_cpg_mcast.msglen = msglen;
-		api->ipc_source_set (&req_exec_cpg_mcast.source, conn);
-		memcpy(&req_exec_cpg_mcast.group_name, &group_name,
+		result = cpg_mcast_send (conn, cpd, &req_lib_cpg_mcast->message, msglen);
+		assert(result == 0);
+	} else {
+		log_printf(LOGSYS_LEVEL_ERROR, "*** %p can't mcast to group %s state:%d, error:%d",
+			conn, group_name.value, cpd->cpd_state, error);
+	}
+}
+
+/* Batch of mcast messages from the library */
+static void message_handler_req_lib_cpg_mcast_batch (void *conn, const void *message)
+{
+	const struct req_lib_cpg_mcast_batch *req_lib_cpg_mcast_batch = message;
+	struct cpg_pd *cpd = (struct cpg_pd *)api->ipc_private_data_get (conn);
+	mar_cpg_name_t group_name = cpd->group_name;
+
+	struct iovec req_exec_cpg_iovec[2];
+	struct req_exec_cpg_mcast_batch req_exec_cpg_mcast_batch;
+	const struct cpg_mcast_batch_entry *entry;
+	const char *pos;
+	size_t batch_len;
+	unsigned int i;
+	int result;
+	cs_error_t error = CS_ERR_NOT_EXIST;
+
+	log_printf(LOGSYS_LEVEL_TRACE, "got mcast batch request on %p", conn);
+
+	switch (cpd->cpd_state) {
+	case CPD_STATE_UNJOINED:
+		error = CS_ERR_NOT_EXIST;
+		break;
+	case CPD_STATE_LEAVE_STARTED:
+		error = CS_ERR_NOT_EXIST;
+		break;
+	case CPD_STATE_JOIN_STARTED:
+		error = CS_OK;
+		break;
+	case CPD_STATE_JOIN_COMPLETED:
+		error = CS_OK;
+		break;
+	}
+
+	if (req_lib_cpg_mcast_batch->header.size < sizeof (*req_lib_cpg_mcast_batch)) {
+		error = CS_ERR_INVALID_PARAM;
+		batch_len = 0;
+	} else {
+		batch_len = req_lib_cpg_mcast_batch->header.size - sizeof (*req_lib_cpg_mcast_batch);
+	}
+
+	if (error == CS_OK &&
+	    !cpg_mcast_batch_valid (req_lib_cpg_mcast_batch->message, batch_len,
+			req_lib_cpg_mcast_batch->msg_count)) {
+		error = CS_ERR_INVALID_PARAM;
+	}
+
+	if (error == CS_OK && !mcast_batch_supported) {
+		/*
+		 * Some member would discard the batch, send every message of it
+		 * separately
+		 */
+		pos = (const char *)req_lib_cpg_mcast_batch->message;
+		for (i = 0; i < req_lib_cpg_mcast_batch->msg_count; i++) {
+			entry = (const struct cpg_mcast_batch_entry *)pos;
+
+			result = cpg_mcast_send (conn, cpd, entry->message, entry->msglen);
+			if (result != 0) {
+				log_printf(LOGSYS_LEVEL_ERROR, "*** %p can't mcast message %u of %u of batch to group %s",
+					conn, i + 1, req_lib_cpg_mcast_batch->msg_count, group_name.value);
+				break;
+			}
+
+			pos += sizeof (*entry) + CPG_MCAST_BATCH_ALIGN(entry->msglen);
+		}
+	} else if (error == CS_OK) {
+		req_exec_cpg_mcast_batch.header.size = sizeof(req_exec_cpg_mcast_batch) + batch_len;
+		req_exec_cpg_mcast_batch.header.id = SERVICE_ID_MAKE(CPG_SERVICE,
+			MESSAGE_REQ_EXEC_CPG_MCAST_BATCH);
+		req_exec_cpg_mcast_batch.pid = cpd->pid;
+		req_exec_cpg_mcast_batch.msg_count = req_lib_cpg_mcast_batch->msg_count;
+		api->ipc_source_set (&req_exec_cpg_mcast_batch.source, conn);
+		memcpy(&req_exec_cpg_mcast_batch.group_name, &group_name,
 			sizeof(mar_cpg_name_t));
 
-		req_exec_cpg_iovec[0].iov_base = (char *)&req_exec_cpg_mcast;
-		req_exec_cpg_iovec[0].iov_len = sizeof(req_exec_cpg_mcast);
-		req_exec_cpg_iovec[1].iov_base = (char *)&req_lib_cpg_mcast->message;
-		req_exec_cpg_iovec[1].iov_len = msglen;
+		req_exec_cpg_iovec[0].iov_base = (char *)&req_exec_cpg_mcast_batch;
+		req_exec_cpg_iovec[0].iov_len = sizeof(req_exec_cpg_mcast_batch);
+		req_exec_cpg_iovec[1].iov_base = (char *)&req_lib_cpg_mcast_batch->message;
+		req_exec_cpg_iovec[1].iov_len = batch_len;
 
+		/*
+		 * Connection must stay around until the batch is delivered, it
+		 * may have to be sent again then
+		 */
+		api->ipc_refcnt_inc (conn);
 		result = api->totem_mcast (req_exec_cpg_iovec, 2, TOTEM_AGREED);
 		assert(result == 0);
 	} else {
-		log_printf(LOGSYS_LEVEL_ERROR, "*** %p can't mcast to group %s state:%d, error:%d",
+		log_printf(LOGSYS_LEVEL_ERROR, "*** %p can't mcast batch to group %s state:%d, error:%d",
 			conn, group_name.value, cpd->cpd_state, error);
 	}
 }
@@ -2101,8 +3618,6 @@ static void message_handler_req_lib_cpg_zc_execute (
 	struct qb_ipc_request_header *header;
 	struct res_lib_cpg_mcast res_lib_cpg_mcast;
 	struct cpg_pd *cpd = (struct cpg_pd *)api->ipc_private_data_get (conn);
-	struct iovec req_exec_cpg_iovec[2];
-	struct req_exec_cpg_mcast req_exec_cpg_mcast;
 	struct req_lib_cpg_mcast *req_lib_cpg_mcast;
 	int result;
 	cs_error_t error = CS_ERR_NOT_EXIST;
@@ -2130,21 +3645,9 @@ static void message_handler_req_lib_cpg_zc_execute (
 	res_lib_cpg_mcast.header.size = sizeof(res_lib_cpg_mcast);
 	res_lib_cpg_mcast.header.id = MESSAGE_RES_CPG_MCAST;
 	if (error == CS_OK) {
-		req_exec_cpg_mcast.header.size = sizeof(req_exec_cpg_mcast) + req_lib_cpg_mcast->msglen;
-		req_exec_cpg_mcast.header.id = SERVICE_ID_MAKE(CPG_SERVICE,
-			MESSAGE_REQ_EXEC_CPG_MCAST);
-		req_exec_cpg_mcast.pid = cpd->pid;
-		req_exec_cpg_mcast.msglen = req_lib_cpg_mcast->msglen;
-		api->ipc_source_set (&req_exec_cpg_mcast.source, conn);
-		memcpy(&req_exec_cpg_mcast.group_name, &cpd->group_name,
-			sizeof(mar_cpg_name_t));
-
-		req_exec_cpg_iovec[0].iov_base = (char *)&req_exec_cpg_mcast;
-		req_exec_cpg_iovec[0].iov_len = sizeof(req_exec_cpg_mcast);
-		req_exec_cpg_iovec[1].iov_base = (char *)header + sizeof(struct req_lib_cpg_mcast);
-		req_exec_cpg_iovec[1].iov_len = req_exec_cpg_mcast.msglen;
-
-		result = api->totem_mcast (req_exec_cpg_iovec, 2, TOTEM_AGREED);
+		result = cpg_mcast_send (conn, cpd,
+			(char *)header + sizeof(struct req_lib_cpg_mcast),
+			req_lib_cpg_mcast->msglen);
 		if (result == 0) {
 			res_lib_cpg_mcast.header.error = CS_OK;
 		} else {
@@ -40,20 +40,32 @@
 #include <corosync/corotypes.h>
 
 #include <qb/qbdefs.h>
+#include <qb/qbatomic.h>
 #include <corosync/list.h>
 #include <corosync/icmap.h>
 
 #define ICMAP_MAX_VALUE_LEN	(16*1024)
 
+/*
+ * Item is allocated as one block holding header and value, key name is
+ * allocated separately so it can outlive the item when the value is replaced.
+ * Items with fixed size value are changed in place and previous value is kept
+ * in prev_value for trackers. Item may be shared by snapshots (refcount > 1)
+ * and such item is never changed.
+ */
 struct icmap_item {
 	char *key_name;
 	icmap_value_types_t type;
 	size_t value_len;
+	int32_t refcount;
+	int prev_value_set;
+	uint64_t prev_value;
 	char value[];
 };
 
 struct icmap_map {
 	qb_map_t *qb_map;
+	int read_only;
 };
 
 static icmap_map_t icmap_global_map;
@@ -75,6 +87,22 @@ struct icmap_ro_access_item {
 DECLARE_LIST_INIT(icmap_ro_access_item_list_head);
 DECLARE_LIST_INIT(icmap_track_list_head);
 
+/*
+ * Sorted index of icmap_ro_access_item_list_head used by icmap_is_key_ro. It's
+ * rebuilt on first lookup after the list is changed. Prefixes covered by shorter
+ * prefix are left out, so only the greatest prefix lower or equal to key name
+ * can match.
+ */
+struct icmap_ro_access_index {
+	int valid;
+	const char **prefixes;
+	size_t prefixes_len;
+	const char **keys;
+	size_t keys_len;
+};
+
+static struct icmap_ro_access_index icmap_ro_access_index;
+
 /*
  * Static functions declarations
  */
@@ -110,6 +138,11 @@ static int32_t icmap_qbtt_to_tt(int32_t track_type);
  */
 static int icmap_item_eq(const struct icmap_item *item, const void *value, size_t value_len, icmap_value_types_t type);
 
+/*
+ * Free and invalidate icmap_ro_access_index
+ */
+static void icmap_ro_access_index_free(void);
+
 /*
  * Checks if given character is valid in key name. Returns 0 if not, otherwise !0.
  */
@@ -185,6 +218,15 @@ static int32_t icmap_qbtt_to_tt(int32_t track_type)
 	return (res);
 }
 
+static void icmap_item_unref(struct icmap_item *item)
+{
+
+	if (qb_atomic_int_dec_and_test(&item->refcount)) {
+		free(item->key_name);
+		free(item);
+	}
+}
+
 static void icmap_map_free_cb(uint32_t event,
 		char* key, void* old_value,
 		void* value, void* user_data)
@@ -192,11 +234,10 @@ static void icmap_map_free_cb(uint32_t event,
 	struct icmap_item *item = (struct icmap_item *)old_value;
 
 	/*
-	 * value == old_value -> fast_adjust_int was used, don't free data
+	 * value == old_value -> item was changed in place, don't free data
 	 */
 	if (item != NULL && value != old_value) {
-		free(item->key_name);
-		free(item);
+		icmap_item_unref(item);
 	}
 }
 
@@ -208,6 +249,7 @@ cs_error_t icmap_init_r(icmap_map_t *result)
 	if (*result == NULL) {
 		return (CS_ERR_NO_MEMORY);
 	}
+	memset(*result, 0, sizeof(struct icmap_map));
 
         (*result)->qb_map = qb_trie_create();
 	if ((*result)->qb_map == NULL)
@@ -235,6 +277,8 @@ static void icmap_set_ro_access_free(void)
 		free(icmap_ro_ai);
 		iter = icmap_ro_access_item_list_head.next;
 	}
+
+	icmap_ro_access_index_free();
 }
 
 static void icmap_del_all_track(void)
@@ -434,6 +478,10 @@ cs_error_t icmap_set_r(
 		return (CS_ERR_INVALID_PARAM);
 	}
 
+	if (map->read_only) {
+		return (CS_ERR_ACCESS);
+	}
+
 	if (icmap_check_value_len(value, value_len, type) != 0) {
 		return (CS_ERR_INVALID_PARAM);
 	}
@@ -446,6 +494,23 @@ cs_error_t icmap_set_r(
 		if (icmap_item_eq(item, value, value_len, type)) {
 			return (CS_OK);
 		}
+
+		/*
+		 * Fixed size value of same type is changed in place, so frequently
+		 * updated keys (runtime statistics) don't allocate new item. Item
+		 * shared with snapshot is copied.
+		 */
+		if (item->type == type && type != ICMAP_VALUETYPE_STRING && type != ICMAP_VALUETYPE_BINARY &&
+		    qb_atomic_int_get(&item->refcount) == 1) {
+			memcpy(&item->prev_value, item->value, item->value_len);
+			item->prev_value_set = 1;
+			memcpy(item->value, value, item->value_len);
+
+			qb_map_put(map->qb_map, item->key_name, item);
+			item->prev_value_set = 0;
+
+			return (CS_OK);
+		}
 	} else {
 		if (icmap_check_key_name(key_name) != 0) {
 			return (CS_ERR_NAME_TOO_LONG);
@@ -471,18 +536,24 @@ cs_error_t icmap_set_r(
 	if (new_item == NULL) {
 		return (CS_ERR_NO_MEMORY);
 	}
-	memset(new_item, 0, new_item_size);
+	memset(new_item, 0, sizeof(struct icmap_item));
 
-	if (item == NULL) {
+	/*
+	 * Replaced item is freed during qb_map_put, so it hands over its key
+	 * name, which the trie and notifications keep using. Item shared with
+	 * snapshot keeps its key name for the snapshot.
+	 */
+	if (item != NULL && qb_atomic_int_get(&item->refcount) == 1) {
+		new_item->key_name = item->key_name;
+		item->key_name = NULL;
+	} else {
 		new_item->key_name = strdup(key_name);
 		if (new_item->key_name == NULL) {
 			free(new_item);
 			return (CS_ERR_NO_MEMORY);
 		}
-	} else {
-		new_item->key_name = item->key_name;
-		item->key_name = NULL;
 	}
+	new_item->refcount = 1;
 
 	new_item->type = type;
 	new_item->value_len = new_value_len;
@@ -652,6 +723,10 @@ cs_error_t icmap_delete_r(const icmap_map_t map, const char *key_name)
 		return (CS_ERR_INVALID_PARAM);
 	}
 
+	if (map->read_only) {
+		return (CS_ERR_ACCESS);
+	}
+
 	item = qb_map_get(map->qb_map, key_name);
 	if (item == NULL) {
 		return (CS_ERR_NOT_EXIST);
@@ -760,7 +835,7 @@ static cs_error_t icmap_get_int_r(
 	key_size = sizeof(key_value);
 	memset(key_value, 0, key_size);
 
-	err = icmap_get(key_name, key_value, &key_size, &key_type);
+	err = icmap_get_r(map, key_name, key_value, &key_size, &key_type);
 	if (err != CS_OK)
 		return (err);
 
@@ -943,6 +1018,10 @@ cs_error_t icmap_adjust_int_r(
 		return (CS_ERR_INVALID_PARAM);
 	}
 
+	if (map->read_only) {
+		return (CS_ERR_ACCESS);
+	}
+
 	item = qb_map_get(map->qb_map, key_name);
 	if (item == NULL) {
 		return (CS_ERR_NOT_EXIST);
@@ -953,25 +1032,25 @@ cs_error_t icmap_adjust_int_r(
 	case ICMAP_VALUETYPE_UINT8:
 		memcpy(&u8, item->value, sizeof(u8));
 		u8 += step;
-		err = icmap_set(key_name, &u8, sizeof(u8), item->type);
+		err = icmap_set_r(map, key_name, &u8, sizeof(u8), item->type);
 		break;
 	case ICMAP_VALUETYPE_INT16:
 	case ICMAP_VALUETYPE_UINT16:
 		memcpy(&u16, item->value, sizeof(u16));
 		u16 += step;
-		err = icmap_set(key_name, &u16, sizeof(u16), item->type);
+		err = icmap_set_r(map, key_name, &u16, sizeof(u16), item->type);
 		break;
 	case ICMAP_VALUETYPE_INT32:
 	case ICMAP_VALUETYPE_UINT32:
 		memcpy(&u32, item->value, sizeof(u32));
 		u32 += step;
-		err = icmap_set(key_name, &u32, sizeof(u32), item->type);
+		err = icmap_set_r(map, key_name, &u32, sizeof(u32), item->type);
 		break;
 	case ICMAP_VALUETYPE_INT64:
 	case ICMAP_VALUETYPE_UINT64:
 		memcpy(&u64, item->value, sizeof(u64));
 		u64 += step;
-		err = icmap_set(key_name, &u64, sizeof(u64), item->type);
+		err = icmap_set_r(map, key_name, &u64, sizeof(u64), item->type);
 		break;
 	case ICMAP_VALUETYPE_FLOAT:
 	case ICMAP_VALUETYPE_DOUBLE:
@@ -1004,11 +1083,22 @@ cs_error_t icmap_fast_adjust_int_r(
 		return (CS_ERR_INVALID_PARAM);
 	}
 
+	if (map->read_only) {
+		return (CS_ERR_ACCESS);
+	}
+
 	item = qb_map_get(map->qb_map, key_name);
 	if (item == NULL) {
 		return (CS_ERR_NOT_EXIST);
 	}
 
+	if (qb_atomic_int_get(&item->refcount) != 1) {
+		/*
+		 * Item is shared with snapshot -> copy it
+		 */
+		return (icmap_adjust_int_r(map, key_name, step));
+	}
+
 	switch (item->type) {
 	case ICMAP_VALUETYPE_INT8:
 	case ICMAP_VALUETYPE_UINT8:
@@ -1147,12 +1237,17 @@ static void icmap_notify_fn(uint32_t event, char *key, void *old_value, void *va
 	}
 
 	/*
-	 * old_item == new_item if fast functions are used -> don't fill old value
+	 * old_item == new_item if item was changed in place. Old value is known
+	 * only for icmap_set, fast functions don't fill it.
 	 */
 	if (old_item != NULL && old_item != new_item) {
 		old_val.type = old_item->type;
 		old_val.len = old_item->value_len;
 		old_val.data = old_item->value;
+	} else if (old_item != NULL && old_item->prev_value_set) {
+		old_val.type = old_item->type;
+		old_val.len = old_item->value_len;
+		old_val.data = &old_item->prev_value;
 	} else {
 		memset(&old_val, 0, sizeof(old_val));
 	}
@@ -1248,6 +1343,7 @@ cs_error_t icmap_set_ro_access(const char *key_name, int prefix, int ro_access)
 				list_del(&icmap_ro_ai->list);
 				free(icmap_ro_ai->key_name);
 				free(icmap_ro_ai);
+				icmap_ro_access_index_free();
 
 				return (CS_OK);
 			}
@@ -1273,15 +1369,129 @@ cs_error_t icmap_set_ro_access(const char *key_name, int prefix, int ro_access)
 	icmap_ro_ai->prefix = prefix;
 	list_init(&icmap_ro_ai->list);
 	list_add (&icmap_ro_ai->list, &icmap_ro_access_item_list_head);
+	icmap_ro_access_index_free();
 
 	return (CS_OK);
 }
 
+static void icmap_ro_access_index_free(void)
+{
+
+	free(icmap_ro_access_index.prefixes);
+	free(icmap_ro_access_index.keys);
+	memset(&icmap_ro_access_index, 0, sizeof(icmap_ro_access_index));
+}
+
+static int icmap_ro_access_index_cmp(const void *a, const void *b)
+{
+
+	return (strcmp(*(const char * const *)a, *(const char * const *)b));
+}
+
+/*
+ * Build icmap_ro_access_index. Returns 0 on success, and -1 on fail
+ */
+static int icmap_ro_access_index_build(void)
+{
+	struct icmap_ro_access_index *index = &icmap_ro_access_index;
+	struct list_head *iter;
+	struct icmap_ro_access_item *icmap_ro_ai;
+	size_t items = 0;
+	size_t i, j;
+
+	icmap_ro_access_index_free();
+
+	for (iter = icmap_ro_access_item_list_head.next; iter != &icmap_ro_access_item_list_head; iter = iter->next) {
+		items++;
+	}
+
+	index->prefixes = malloc(sizeof(*index->prefixes) * (items + 1));
+	index->keys = malloc(sizeof(*index->keys) * (items + 1));
+	if (index->prefixes == NULL || index->keys == NULL) {
+		icmap_ro_access_index_free();
+		return (-1);
+	}
+
+	for (iter = icmap_ro_access_item_list_head.next; iter != &icmap_ro_access_item_list_head; iter = iter->next) {
+		icmap_ro_ai = list_entry(iter, struct icmap_ro_access_item, list);
+
+		if (icmap_ro_ai->prefix) {
+			index->prefixes[index->prefixes_len++] = icmap_ro_ai->key_name;
+		} else {
+			index->keys[index->keys_len++] = icmap_ro_ai->key_name;
+		}
+	}
+
+	qsort(index->prefixes, index->prefixes_len, sizeof(*index->prefixes), icmap_ro_access_index_cmp);
+	qsort(index->keys, index->keys_len, sizeof(*index->keys), icmap_ro_access_index_cmp);
+
+	/*
+	 * Prefixes starting with other prefix directly follow it after sort
+	 */
+	for (i = 0, j = 0; i < index->prefixes_len; i++) {
+		if (j > 0 && strncmp(index->prefixes[i], index->prefixes[j - 1],
+		    strlen(index->prefixes[j - 1])) == 0) {
+			continue;
+		}
+		index->prefixes[j++] = index->prefixes[i];
+	}
+	index->prefixes_len = j;
+
+	index->valid = 1;
+
+	return (0);
+}
+
+static int icmap_ro_access_index_lookup(const char *key_name)
+{
+	const struct icmap_ro_access_index *index = &icmap_ro_access_index;
+	const char *prefix;
+	size_t lo, hi, mid;
+
+	if (bsearch(&key_name, index->keys, index->keys_len, sizeof(*index->keys),
+	    icmap_ro_access_index_cmp) != NULL) {
+		return (CS_TRUE);
+	}
+
+	/*
+	 * Find greatest prefix lower or equal to key_name
+	 */
+	lo = 0;
+	hi = index->prefixes_len;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (strcmp(index->prefixes[mid], key_name) <= 0) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	if (lo == 0) {
+		return (CS_FALSE);
+	}
+
+	prefix = index->prefixes[lo - 1];
+	if (strncmp(prefix, key_name, strlen(prefix)) == 0) {
+		return (CS_TRUE);
+	}
+
+	return (CS_FALSE);
+}
+
 int icmap_is_key_ro(const char *key_name)
 {
 	struct list_head *iter;
 	struct icmap_ro_access_item *icmap_ro_ai;
 
+	if (icmap_ro_access_index.valid || icmap_ro_access_index_build() == 0) {
+		return (icmap_ro_access_index_lookup(key_name));
+	}
+
+	/*
+	 * Index can't be built -> fall back to scanning the list
+	 */
+
 	for (iter = icmap_ro_access_item_list_head.next; iter != &icmap_ro_access_item_list_head; iter = iter->next) {
 		icmap_ro_ai = list_entry(iter, struct icmap_ro_access_item, list);
 
@@ -1336,3 +1546,38 @@ exit_iter_finalize:
 
 	return (err);
 }
+
+cs_error_t icmap_snapshot_create_r(const icmap_map_t map, icmap_map_t *snapshot)
+{
+	qb_map_iter_t *iter;
+	struct icmap_item *item;
+	cs_error_t err;
+
+	err = icmap_init_r(snapshot);
+	if (err != CS_OK) {
+		return (err);
+	}
+
+	iter = qb_map_iter_create(map->qb_map);
+	if (iter == NULL) {
+		icmap_fini_r(*snapshot);
+		return (CS_ERR_NO_MEMORY);
+	}
+
+	while (qb_map_iter_next(iter, (void **)&item) != NULL) {
+		qb_atomic_int_inc(&item->refcount);
+		qb_map_put((*snapshot)->qb_map, item->key_name, item);
+	}
+
+	qb_map_iter_free(iter);
+
+	(*snapshot)->read_only = 1;
+
+	return (CS_OK);
+}
+
+cs_error_t icmap_snapshot_create(icmap_map_t *snapshot)
+{
+
+	return (icmap_snapshot_create_r(icmap_global_map, snapshot));
+}
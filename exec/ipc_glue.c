@@ -53,6 +53,8 @@
 #include <corosync/totem/totempg.h>
 #include <corosync/logsys.h>
 #include <corosync/icmap.h>
+#include <corosync/cpg.h>
+#include <corosync/ipc_cpg.h>
 
 #include "sync.h"
 #include "timer.h"
@@ -69,8 +71,11 @@ static int32_t ipc_fc_is_quorate; /* boolean */
 static int32_t ipc_fc_totem_queue_level; /* percentage used */
 static int32_t ipc_fc_sync_in_process; /* boolean */
 static int32_t ipc_allow_connections = 0; /* boolean */
+static uint32_t ipc_fc_epoch; /* bumped on every flow control change */
+static uint32_t ipc_batch_size = 1; /* requests per flow control decision */
 
 #define CS_IPCS_MAPPER_SERV_NAME		256
+#define CS_IPCS_BATCH_SIZE_MAX			64
 
 struct cs_ipcs_mapper {
 	int32_t id;
@@ -93,6 +98,7 @@ static int32_t cs_ipcs_dispatch_mod(enum qb_loop_priority p, int32_t fd, int32_t
 	void *data, qb_ipcs_dispatch_fn_t fn);
 static int32_t cs_ipcs_dispatch_del(int32_t fd);
 static void outq_flush (void *data);
+static void cs_ipcs_batch_close (void *data);
 
 
 static struct qb_ipcs_poll_handlers corosync_poll_funcs = {
@@ -255,6 +261,13 @@ struct cs_ipcs_conn_context {
 	uint64_t invalid_request;
 	uint64_t overload;
 	uint32_t sent;
+	int32_t batch_open;
+	int32_t batch_job_queued;
+	int batch_private_data;
+	uint32_t batch_left;
+	size_t batch_bytes_left;
+	uint32_t batch_epoch;
+	uint64_t batched;
 	char data[1];
 };
 
@@ -362,6 +375,9 @@ static void cs_ipcs_connection_created(qb_ipcs_connection_t *c)
 
 	snprintf(key_name, ICMAP_KEYNAME_MAXLEN, "%s.overload", context->icmap_path);
 	icmap_set_uint64(key_name, 0);
+
+	snprintf(key_name, ICMAP_KEYNAME_MAXLEN, "%s.batched", context->icmap_path);
+	icmap_set_uint64(key_name, 0);
 }
 
 void cs_ipc_refcnt_inc(void *conn)
@@ -420,9 +436,14 @@ static int32_t cs_ipcs_connection_closed (qb_ipcs_connection_t *c)
 		return res;
 	}
 
-	qb_loop_job_del(cs_poll_handle_get(), QB_LOOP_HIGH, c, outq_flush);
+	qb_loop_job_del(cs_poll_handle_get(), QB_LOOP_MED, c, outq_flush);
+	qb_loop_job_del(cs_poll_handle_get(), QB_LOOP_MED, c, cs_ipcs_batch_close);
 
 	cnx = qb_ipcs_context_get(c);
+	if (cnx->batch_open) {
+		corosync_sending_allowed_release (&cnx->batch_private_data);
+		cnx->batch_open = QB_FALSE;
+	}
 
 	snprintf(prefix, ICMAP_KEYNAME_MAXLEN, "%s.", cnx->icmap_path);
 	iter = icmap_iter_init(prefix);
@@ -495,7 +516,7 @@ static void outq_flush (void *data)
 		context->queued = 0;
 		context->sent = 0;
 	} else {
-		qb_loop_job_add(cs_poll_handle_get(), QB_LOOP_HIGH, conn, outq_flush);
+		qb_loop_job_add(cs_poll_handle_get(), QB_LOOP_MED, conn, outq_flush);
 	}
 }
 
@@ -523,7 +544,7 @@ static void msg_send_or_queue(qb_ipcs_connection_t *conn, const struct iovec *io
 			context->queued = 0;
 			context->sent = 0;
 			context->queuing = QB_TRUE;
-			qb_loop_job_add(cs_poll_handle_get(), QB_LOOP_HIGH, conn, outq_flush);
+			qb_loop_job_add(cs_poll_handle_get(), QB_LOOP_MED, conn, outq_flush);
 		} else {
 			log_printf(LOGSYS_LEVEL_ERROR, "event_send retuned %d, expected %d!", rc, bytes_msg);
 			return;
@@ -569,6 +590,62 @@ int cs_ipcs_dispatch_iov_send (void *conn,
 	return 0;
 }
 
+/*
+ * Requests pipelined by a client are processed back to back from the same
+ * poll dispatch.  With qb.ipc_batch_size > 1 the first of them takes a
+ * single totempg reservation large enough for the whole batch, and the
+ * following ones reuse that decision until the reservation is used up,
+ * flow control state changes, or the main loop gets back to its jobs.
+ */
+static void cs_ipcs_batch_close (void *data)
+{
+	qb_ipcs_connection_t *c = data;
+	struct cs_ipcs_conn_context *cnx = qb_ipcs_context_get(c);
+
+	if (cnx == NULL) {
+		return;
+	}
+	cnx->batch_job_queued = QB_FALSE;
+	if (cnx->batch_open) {
+		corosync_sending_allowed_release (&cnx->batch_private_data);
+		cnx->batch_open = QB_FALSE;
+	}
+}
+
+static int32_t cs_ipcs_batch_sending_allowed (qb_ipcs_connection_t *c,
+	struct cs_ipcs_conn_context *cnx,
+	int32_t service,
+	const struct qb_ipc_request_header *request_pt)
+{
+	if (cnx->batch_open) {
+		if (cnx->batch_epoch == ipc_fc_epoch &&
+		    cnx->batch_left > 0 &&
+		    request_pt->size <= cnx->batch_bytes_left) {
+			cnx->batch_left--;
+			cnx->batch_bytes_left -= request_pt->size;
+			cnx->batched++;
+			return (QB_TRUE);
+		}
+		corosync_sending_allowed_release (&cnx->batch_private_data);
+		cnx->batch_open = QB_FALSE;
+	}
+
+	if (!corosync_sending_allowed_batch (service, request_pt,
+			ipc_batch_size, &cnx->batch_private_data)) {
+		return (QB_FALSE);
+	}
+
+	cnx->batch_open = QB_TRUE;
+	cnx->batch_left = ipc_batch_size - 1;
+	cnx->batch_bytes_left = (size_t)request_pt->size * (ipc_batch_size - 1);
+	cnx->batch_epoch = ipc_fc_epoch;
+	if (!cnx->batch_job_queued) {
+		cnx->batch_job_queued = QB_TRUE;
+		qb_loop_job_add(cs_poll_handle_get(), QB_LOOP_MED, c, cs_ipcs_batch_close);
+	}
+	return (QB_TRUE);
+}
+
 static int32_t cs_ipcs_msg_process(qb_ipcs_connection_t *c,
 		void *data, size_t size)
 {
@@ -577,16 +654,31 @@ static int32_t cs_ipcs_msg_process(qb_ipcs_connection_t *c,
 	int32_t service = qb_ipcs_service_id_get(c);
 	int32_t send_ok = 0;
 	int32_t is_async_call = QB_FALSE;
+	int32_t in_batch = QB_FALSE;
 	ssize_t res = -1;
-	int sending_allowed_private_data;
+	int sending_allowed_private_data = -1;
 	struct cs_ipcs_conn_context *cnx;
 
-	send_ok = corosync_sending_allowed (service,
-			request_pt->id,
-			request_pt,
-			&sending_allowed_private_data);
+	if (ipc_batch_size > 1) {
+		cnx = qb_ipcs_context_get(c);
+		if (cnx) {
+			in_batch = cs_ipcs_batch_sending_allowed (c, cnx, service, request_pt);
+		}
+	}
+
+	if (in_batch) {
+		send_ok = QB_TRUE;
+	} else {
+		send_ok = corosync_sending_allowed (service,
+				request_pt->id,
+				request_pt,
+				&sending_allowed_private_data);
+	}
 
-	is_async_call = (service == CPG_SERVICE && request_pt->id == 2);
+	is_async_call = (service == CPG_SERVICE &&
+		(request_pt->id == MESSAGE_REQ_CPG_MCAST ||
+		 request_pt->id == MESSAGE_REQ_CPG_PARTIAL_MCAST_ASYNC ||
+		 request_pt->id == MESSAGE_REQ_CPG_MCAST_BATCH));
 
 	/*
 	 * This happens when the message contains some kind of invalid
@@ -639,7 +731,9 @@ static int32_t cs_ipcs_msg_process(qb_ipcs_connection_t *c,
 		corosync_service[service]->lib_engine[request_pt->id].lib_handler_fn(c, request_pt);
 		res = 0;
 	}
-	corosync_sending_allowed_release (&sending_allowed_private_data);
+	if (!in_batch) {
+		corosync_sending_allowed_release (&sending_allowed_private_data);
+	}
 	return res;
 }
 
@@ -690,6 +784,8 @@ static void cs_ipcs_check_for_flow_control(void)
 	int32_t i;
 	int32_t fc_enabled;
 
+	ipc_fc_epoch++;
+
 	for (i = 0; i < SERVICES_COUNT_MAX; i++) {
 		if (corosync_service[i] == NULL || ipcs_mapper[i].inst == NULL) {
 			continue;
@@ -720,9 +816,12 @@ static void cs_ipcs_check_for_flow_control(void)
 
 			qb_loop_timer_add(cs_poll_handle_get(), QB_LOOP_MED, 1*QB_TIME_NS_IN_MSEC,
 			       NULL, corosync_recheck_the_q_level, &ipcs_check_for_flow_control_timer);
-		} else if (ipc_fc_totem_queue_level == TOTEM_Q_LEVEL_LOW) {
-			qb_ipcs_request_rate_limit(ipcs_mapper[i].inst, QB_IPCS_RATE_FAST);
-		} else if (ipc_fc_totem_queue_level == TOTEM_Q_LEVEL_GOOD) {
+		} else if (ipc_fc_totem_queue_level == TOTEM_Q_LEVEL_LOW ||
+		    ipc_fc_totem_queue_level == TOTEM_Q_LEVEL_GOOD) {
+			/*
+			 * Never above totem sockets and timers (QB_LOOP_HIGH),
+			 * so clients can't delay the token
+			 */
 			qb_ipcs_request_rate_limit(ipcs_mapper[i].inst, QB_IPCS_RATE_NORMAL);
 		} else if (ipc_fc_totem_queue_level == TOTEM_Q_LEVEL_HIGH) {
 			qb_ipcs_request_rate_limit(ipcs_mapper[i].inst, QB_IPCS_RATE_SLOW);
@@ -804,6 +903,9 @@ void cs_ipcs_stats_update(void)
 
 			snprintf(key_name, ICMAP_KEYNAME_MAXLEN, "%s.overload", cnx->icmap_path);
 			icmap_set_uint64(key_name, cnx->overload);
+
+			snprintf(key_name, ICMAP_KEYNAME_MAXLEN, "%s.batched", cnx->icmap_path);
+			icmap_set_uint64(key_name, cnx->batched);
 		}
 	}
 }
@@ -894,6 +996,16 @@ void cs_ipcs_init(void)
 	api->quorum_register_callback (cs_ipcs_fc_quorum_changed, NULL);
 	totempg_queue_level_register_callback (cs_ipcs_totem_queue_level_changed);
 
+	if (icmap_get_uint32("qb.ipc_batch_size", &ipc_batch_size) != CS_OK ||
+	    ipc_batch_size == 0) {
+		ipc_batch_size = 1;
+	}
+	if (ipc_batch_size > CS_IPCS_BATCH_SIZE_MAX) {
+		log_printf(LOGSYS_LEVEL_WARNING, "qb.ipc_batch_size %u too large, using %u",
+			ipc_batch_size, CS_IPCS_BATCH_SIZE_MAX);
+		ipc_batch_size = CS_IPCS_BATCH_SIZE_MAX;
+	}
+
 	icmap_set_uint64("runtime.connections.active", 0);
 	icmap_set_uint64("runtime.connections.closed", 0);
 }
@@ -228,6 +228,32 @@ parse_error:
 	return (-1);
 }
 
+static int corosync_main_config_flightrec_set (
+	const char **error_string)
+{
+	char *value = NULL;
+	unsigned int mode = LOGSYS_FLIGHTREC_QB;
+
+	if (map_get_string("logging.flight_recorder", &value) == CS_OK) {
+		if (strcmp (value, "binary") == 0) {
+			mode = LOGSYS_FLIGHTREC_BINARY;
+		} else
+		if (strcmp (value, "qb") != 0) {
+			free(value);
+			*error_string = "unknown value for flight_recorder";
+			return (-1);
+		}
+		free(value);
+	}
+
+	if (logsys_flightrec_mode_set(mode) < 0) {
+		*error_string = "unable to set flight recorder mode";
+		return (-1);
+	}
+
+	return (0);
+}
+
 static int corosync_main_config_log_destination_set (
 	const char *path,
 	const char *key,
@@ -419,6 +445,27 @@ static int corosync_main_config_set (
 		}
 	}
 
+	snprintf(key_name, MAP_KEYNAME_MAXLEN, "%s.%s", path, "blackbox_priority");
+	if (map_get_string(key_name, &value) == CS_OK) {
+		int blackbox_priority;
+
+		if (strcmp (value, "trace") == 0) {
+			blackbox_priority = LOGSYS_LEVEL_TRACE;
+		} else {
+			blackbox_priority = logsys_priority_id_get(value);
+		}
+		free(value);
+		if (blackbox_priority < 0) {
+			error_reason = "unknown blackbox priority specified";
+			goto parse_error;
+		}
+		if (logsys_config_blackbox_priority_set(subsys,
+						blackbox_priority) < 0) {
+			error_reason = "unable to set blackbox priority";
+			goto parse_error;
+		}
+	}
+
 	snprintf(key_name, MAP_KEYNAME_MAXLEN, "%s.%s", path, "debug");
 	if (map_get_string(key_name, &value) == CS_OK) {
 		if (strcmp (value, "trace") == 0) {
@@ -477,6 +524,10 @@ static int corosync_main_config_read_logging (
 		goto parse_error;
 	}
 
+	if (corosync_main_config_flightrec_set(&error_reason) < 0) {
+		goto parse_error;
+	}
+
 	if (corosync_main_config_set ("logging", NULL, &error_reason) < 0) {
 		goto parse_error;
 	}
@@ -42,10 +42,16 @@
 #include <assert.h>
 #include <stdio.h>
 #include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <stddef.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include <qb/qbdefs.h>
 #include <qb/qbutil.h>
 #include <qb/qblog.h>
+#include <qb/qbatomic.h>
 
 #include <corosync/list.h>
 #include <corosync/logsys.h>
@@ -91,6 +97,9 @@ struct logsys_logger {
 	unsigned int debug;			/* debug on|off|trace */
 	int syslog_priority;			/* priority */
 	int logfile_priority;			/* priority to file */
+	int blackbox_priority;			/* priority to blackbox */
+	int blackbox_file_priority;		/* priority of per file
+						   blackbox filters, -1 if none */
 	int init_status;			/* internal field to handle init queues
 						   for subsystems */
 	int32_t target_id;
@@ -119,6 +128,79 @@ static char *format_buffer=NULL;
 
 static int logsys_thread_started = 0;
 
+/*
+ * Priority of the blackbox filter for all files
+ */
+static int blackbox_filter_priority = LOG_TRACE;
+
+static struct logsys_callsite *logsys_callsites = NULL;
+
+/*
+ * Binary flight recorder
+ *
+ * Every thread logging at trace level gets its own ring of fixed size
+ * slots, so recording needs no lock. A slot holds pointers to the format
+ * string, function and file name (all string literals) and the raw
+ * arguments. Slot seq is 0 while the owner writes the slot, which lets a
+ * dump detect torn records without stopping the writer.
+ */
+#ifdef HAVE_SMALL_MEMORY_FOOTPRINT
+#define FLIGHTREC_RING_SLOTS		256
+#else
+#define FLIGHTREC_RING_SLOTS		8192
+#endif
+#define FLIGHTREC_SLOT_SIZE		256
+#define FLIGHTREC_MSG_MAX		1024
+
+struct flightrec_record {
+	int32_t seq;
+	int32_t file_line;
+	int32_t subsys;
+	uint32_t args_len;
+	uint64_t timestamp;
+	const char *format;
+	const char *function_name;
+	const char *file_name;
+	char args[] __attribute__((aligned(8)));
+};
+
+#define FLIGHTREC_ARGS_SIZE (FLIGHTREC_SLOT_SIZE - sizeof (struct flightrec_record))
+
+struct flightrec_ring {
+	struct flightrec_ring *next;
+	int32_t head;
+	char *slots;
+};
+
+int _logsys_flightrec_active = 0;
+
+static unsigned int flightrec_mode = LOGSYS_FLIGHTREC_QB;
+
+static int flightrec_trace_wanted = 0;
+
+static struct flightrec_ring *flightrec_rings = NULL;
+
+static pthread_mutex_t flightrec_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static pthread_key_t flightrec_ring_key;
+
+static pthread_once_t flightrec_ring_key_once = PTHREAD_ONCE_INIT;
+
+/*
+ * The dump runs from the SIGSEGV and SIGABRT handlers, so it works only
+ * with the buffers below and open/write. Threads beyond
+ * FLIGHTREC_MAX_RINGS get no ring and their trace messages are not
+ * recorded.
+ */
+#define FLIGHTREC_MAX_RINGS		64
+#define FLIGHTREC_OUT_BUF_SIZE		8192
+
+static int32_t flightrec_ring_count = 0;
+
+static int flightrec_dump_busy = 0;
+
+static long flightrec_gmtoff = 0;
+
 static int _logsys_config_subsys_get_unlocked (const char *subsys)
 {
 	unsigned int i;
@@ -264,8 +346,10 @@ static void logsys_subsys_init (
 		logsys_loggers[subsysid].debug = logsys_loggers[LOGSYS_MAX_SUBSYS_COUNT].debug;
 		logsys_loggers[subsysid].syslog_priority = logsys_loggers[LOGSYS_MAX_SUBSYS_COUNT].syslog_priority;
 		logsys_loggers[subsysid].logfile_priority = logsys_loggers[LOGSYS_MAX_SUBSYS_COUNT].logfile_priority;
+		logsys_loggers[subsysid].blackbox_priority = logsys_loggers[LOGSYS_MAX_SUBSYS_COUNT].blackbox_priority;
 		logsys_loggers[subsysid].init_status = LOGSYS_LOGGER_INIT_DONE;
 	}
+	logsys_loggers[subsysid].blackbox_file_priority = -1;
 	strncpy (logsys_loggers[subsysid].subsys, subsys,
 		sizeof (logsys_loggers[subsysid].subsys));
 	logsys_loggers[subsysid].subsys[
@@ -353,6 +437,8 @@ int _logsys_system_setup(
 	logsys_loggers[i].file_idx = 0;
 	logsys_loggers[i].logfile_priority = syslog_priority;
 	logsys_loggers[i].syslog_priority = syslog_priority;
+	logsys_loggers[i].blackbox_priority = LOG_TRACE;
+	logsys_loggers[i].blackbox_file_priority = -1;
 
 	qb_log_init(mainsystem, syslog_facility, syslog_priority);
 	if (logsys_loggers[i].mode & LOGSYS_MODE_OUTPUT_STDERR) {
@@ -369,6 +455,7 @@ int _logsys_system_setup(
 
 	qb_log_filter_ctl(QB_LOG_BLACKBOX, QB_LOG_FILTER_ADD,
 			  QB_LOG_FILTER_FILE, "*", LOG_TRACE);
+	blackbox_filter_priority = LOG_TRACE;
 	qb_log_ctl(QB_LOG_BLACKBOX, QB_LOG_CONF_SIZE, IPC_LOGSYS_SIZE);
 	qb_log_ctl(QB_LOG_BLACKBOX, QB_LOG_CONF_THREADED, QB_FALSE);
 	blackbox_enable_res = qb_log_ctl(QB_LOG_BLACKBOX, QB_LOG_CONF_ENABLED, QB_TRUE);
@@ -706,11 +793,153 @@ int logsys_config_logfile_priority_set (
 	return i;
 }
 
+int logsys_config_blackbox_priority_set (
+	const char *subsys,
+	unsigned int priority)
+{
+	int i;
+
+	pthread_mutex_lock (&logsys_config_mutex);
+	if (subsys != NULL) {
+		i = _logsys_config_subsys_get_unlocked (subsys);
+		if (i >= 0) {
+			logsys_loggers[i].blackbox_priority = priority;
+			logsys_loggers[i].dirty = QB_TRUE;
+			i = 0;
+		}
+	} else {
+		for (i = 0; i <= LOGSYS_MAX_SUBSYS_COUNT; i++) {
+			logsys_loggers[i].blackbox_priority = priority;
+			logsys_loggers[i].dirty = QB_TRUE;
+		}
+		i = 0;
+	}
+	pthread_mutex_unlock (&logsys_config_mutex);
+
+	return i;
+}
+
+/*
+ * Priority up to which messages of the subsystem go to the libqb
+ * blackbox. In binary flight recorder mode trace messages are recorded
+ * by logsys itself.
+ */
+static int _logsys_blackbox_priority_get(int32_t s)
+{
+	int priority = LOG_TRACE;
+
+	if (flightrec_mode == LOGSYS_FLIGHTREC_BINARY) {
+		priority = LOG_DEBUG;
+	}
+	if (logsys_loggers[s].blackbox_priority < priority) {
+		priority = logsys_loggers[s].blackbox_priority;
+	}
+
+	return (priority);
+}
+
+/*
+ * The blackbox filter for all files uses the priority of the least
+ * verbose subsystem, more verbose subsystems get per file filters
+ * on top of it (see _logsys_config_apply_per_file).
+ */
+static void _logsys_blackbox_filter_apply(void)
+{
+	int32_t s;
+	int priority = LOG_TRACE;
+	int subsys_priority;
+
+	for (s = 0; s <= LOGSYS_MAX_SUBSYS_COUNT; s++) {
+		if (strcmp(logsys_loggers[s].subsys, "") == 0) {
+			continue;
+		}
+		subsys_priority = _logsys_blackbox_priority_get(s);
+		if (subsys_priority < priority) {
+			priority = subsys_priority;
+		}
+	}
+
+	if (priority == blackbox_filter_priority) {
+		return ;
+	}
+
+	qb_log_filter_ctl(QB_LOG_BLACKBOX, QB_LOG_FILTER_REMOVE,
+			  QB_LOG_FILTER_FILE, "*", blackbox_filter_priority);
+	qb_log_filter_ctl(QB_LOG_BLACKBOX, QB_LOG_FILTER_ADD,
+			  QB_LOG_FILTER_FILE, "*", priority);
+	blackbox_filter_priority = priority;
+}
+
+/*
+ * Is a message of given priority wanted by any target of subsystem s?
+ */
+static int _logsys_level_enabled_unlocked(int32_t s, int level)
+{
+	unsigned int system_mode = logsys_loggers[LOGSYS_MAX_SUBSYS_COUNT].mode;
+	int syslog_priority = logsys_loggers[s].syslog_priority;
+	int logfile_priority = logsys_loggers[s].logfile_priority;
+
+	switch (logsys_loggers[s].debug) {
+	case LOGSYS_DEBUG_ON:
+		syslog_priority = LOG_DEBUG;
+		logfile_priority = LOG_DEBUG;
+		break;
+	case LOGSYS_DEBUG_TRACE:
+		syslog_priority = LOG_TRACE;
+		logfile_priority = LOG_TRACE;
+		break;
+	}
+
+	if (level <= logsys_loggers[s].blackbox_priority) {
+		return (1);
+	}
+	if ((system_mode & LOGSYS_MODE_OUTPUT_SYSLOG) && level <= syslog_priority) {
+		return (1);
+	}
+	if ((system_mode & LOGSYS_MODE_OUTPUT_STDERR) && level <= logfile_priority) {
+		return (1);
+	}
+	if (logsys_loggers[s].target_id > 0 &&
+	    (logsys_loggers[s].mode & LOGSYS_MODE_OUTPUT_FILE) &&
+	    level <= logfile_priority) {
+		return (1);
+	}
+
+	return (0);
+}
+
+static void _logsys_callsite_update_unlocked(struct logsys_callsite *cs)
+{
+	if (cs->subsys < 0 || cs->subsys > LOGSYS_MAX_SUBSYS_COUNT ||
+	    strcmp(logsys_loggers[cs->subsys].subsys, "") == 0) {
+		cs->enabled = 1;
+		return ;
+	}
+
+	cs->enabled = _logsys_level_enabled_unlocked(cs->subsys, cs->level);
+}
+
+int _logsys_callsite_register(struct logsys_callsite *cs, int level, int subsys)
+{
+	pthread_mutex_lock (&logsys_config_mutex);
+	if (!cs->registered) {
+		cs->level = level;
+		cs->subsys = subsys;
+		cs->next = logsys_callsites;
+		logsys_callsites = cs;
+		_logsys_callsite_update_unlocked(cs);
+		cs->registered = 1;
+	}
+	pthread_mutex_unlock (&logsys_config_mutex);
+
+	return (cs->enabled);
+}
 
 static void _logsys_config_apply_per_file(int32_t s, const char *filename)
 {
 	uint32_t syslog_priority = logsys_loggers[s].syslog_priority;
 	uint32_t logfile_priority = logsys_loggers[s].logfile_priority;
+	int blackbox_priority = _logsys_blackbox_priority_get(s);
 
 	qb_log_filter_ctl(s, QB_LOG_TAG_SET, QB_LOG_FILTER_FILE,
 			  filename, LOG_TRACE);
@@ -724,6 +953,11 @@ static void _logsys_config_apply_per_file(int32_t s, const char *filename)
 			QB_LOG_FILTER_REMOVE,
 			QB_LOG_FILTER_FILE, filename, LOG_TRACE);
 	}
+	if (logsys_loggers[s].blackbox_file_priority >= 0) {
+		qb_log_filter_ctl(QB_LOG_BLACKBOX, QB_LOG_FILTER_REMOVE,
+			QB_LOG_FILTER_FILE, filename,
+			logsys_loggers[s].blackbox_file_priority);
+	}
 
 	if (logsys_loggers[s].debug != LOGSYS_DEBUG_OFF) {
 		switch (logsys_loggers[s].debug) {
@@ -751,14 +985,26 @@ static void _logsys_config_apply_per_file(int32_t s, const char *filename)
 			QB_LOG_FILTER_FILE, filename,
 			logfile_priority);
 	}
+	if (blackbox_priority > blackbox_filter_priority) {
+		qb_log_filter_ctl(QB_LOG_BLACKBOX, QB_LOG_FILTER_ADD,
+			QB_LOG_FILTER_FILE, filename,
+			blackbox_priority);
+	}
 }
 
 static void _logsys_config_apply_per_subsys(int32_t s)
 {
 	int32_t f;
+	int blackbox_priority = _logsys_blackbox_priority_get(s);
+
 	for (f = 0; f < logsys_loggers[s].file_idx; f++) {
 		_logsys_config_apply_per_file(s, logsys_loggers[s].files[f]);
 	}
+	if (blackbox_priority > blackbox_filter_priority) {
+		logsys_loggers[s].blackbox_file_priority = blackbox_priority;
+	} else {
+		logsys_loggers[s].blackbox_file_priority = -1;
+	}
 	if (logsys_loggers[s].target_id > 0) {
 		qb_log_ctl(logsys_loggers[s].target_id,
 			QB_LOG_CONF_ENABLED,
@@ -770,13 +1016,27 @@ static void _logsys_config_apply_per_subsys(int32_t s)
 void logsys_config_apply(void)
 {
 	int32_t s;
+	int trace_wanted = 0;
+	struct logsys_callsite *cs;
+
+	_logsys_blackbox_filter_apply();
 
 	for (s = 0; s <= LOGSYS_MAX_SUBSYS_COUNT; s++) {
 		if (strcmp(logsys_loggers[s].subsys, "") == 0) {
 			continue;
 		}
 		_logsys_config_apply_per_subsys(s);
+		if (logsys_loggers[s].debug == LOGSYS_DEBUG_TRACE) {
+			trace_wanted = 1;
+		}
+	}
+	flightrec_trace_wanted = trace_wanted;
+
+	pthread_mutex_lock (&logsys_config_mutex);
+	for (cs = logsys_callsites; cs != NULL; cs = cs->next) {
+		_logsys_callsite_update_unlocked(cs);
 	}
+	pthread_mutex_unlock (&logsys_config_mutex);
 }
 
 int logsys_config_debug_set (
@@ -838,3 +1098,795 @@ int logsys_thread_start (void)
 
 	return (0);
 }
+
+/*
+ * localtime_r is not async-signal-safe, so the dump converts timestamps
+ * with the offset taken when the binary mode was enabled.
+ */
+static void flightrec_gmtoff_update (void)
+{
+	struct tm tm;
+	time_t now;
+
+	now = time (NULL);
+	if (localtime_r (&now, &tm) != NULL) {
+		flightrec_gmtoff = tm.tm_gmtoff;
+	}
+}
+
+int logsys_flightrec_mode_set (unsigned int mode)
+{
+	int32_t s;
+
+	pthread_mutex_lock (&logsys_config_mutex);
+	if (mode == flightrec_mode) {
+		pthread_mutex_unlock (&logsys_config_mutex);
+		return (0);
+	}
+
+	if (mode != LOGSYS_FLIGHTREC_QB && mode != LOGSYS_FLIGHTREC_BINARY) {
+		pthread_mutex_unlock (&logsys_config_mutex);
+		return (-1);
+	}
+
+	if (mode == LOGSYS_FLIGHTREC_QB) {
+		_logsys_flightrec_active = 0;
+	}
+	flightrec_mode = mode;
+
+	_logsys_blackbox_filter_apply();
+	for (s = 0; s <= LOGSYS_MAX_SUBSYS_COUNT; s++) {
+		if (strcmp(logsys_loggers[s].subsys, "") == 0) {
+			continue;
+		}
+		_logsys_config_apply_per_subsys(s);
+	}
+
+	if (mode == LOGSYS_FLIGHTREC_BINARY) {
+		flightrec_gmtoff_update ();
+		_logsys_flightrec_active = 1;
+	}
+
+	pthread_mutex_unlock (&logsys_config_mutex);
+
+	return (0);
+}
+
+unsigned int logsys_flightrec_mode_get (void)
+{
+	return (flightrec_mode);
+}
+
+static void flightrec_ring_key_create (void)
+{
+	(void)pthread_key_create (&flightrec_ring_key, NULL);
+}
+
+/*
+ * Rings are never freed, a dump may walk them at any time (also from
+ * the SIGSEGV handler) without taking flightrec_mutex.
+ */
+static struct flightrec_ring *flightrec_ring_get (void)
+{
+	struct flightrec_ring *ring;
+
+	pthread_once (&flightrec_ring_key_once, flightrec_ring_key_create);
+
+	ring = pthread_getspecific (flightrec_ring_key);
+	if (ring != NULL) {
+		return (ring);
+	}
+
+	if (__atomic_load_n (&flightrec_ring_count, __ATOMIC_RELAXED) >= FLIGHTREC_MAX_RINGS) {
+		return (NULL);
+	}
+
+	ring = calloc (1, sizeof (struct flightrec_ring));
+	if (ring == NULL) {
+		return (NULL);
+	}
+	ring->slots = calloc (FLIGHTREC_RING_SLOTS, FLIGHTREC_SLOT_SIZE);
+	if (ring->slots == NULL) {
+		free (ring);
+		return (NULL);
+	}
+
+	pthread_mutex_lock (&flightrec_mutex);
+	if (flightrec_ring_count >= FLIGHTREC_MAX_RINGS) {
+		pthread_mutex_unlock (&flightrec_mutex);
+		free (ring->slots);
+		free (ring);
+		return (NULL);
+	}
+	ring->next = flightrec_rings;
+	__atomic_store_n (&flightrec_rings, ring, __ATOMIC_RELEASE);
+	__atomic_store_n (&flightrec_ring_count, flightrec_ring_count + 1, __ATOMIC_RELAXED);
+	pthread_mutex_unlock (&flightrec_mutex);
+
+	pthread_setspecific (flightrec_ring_key, ring);
+
+	return (ring);
+}
+
+enum flightrec_arg_len {
+	FLIGHTREC_LEN_NONE,
+	FLIGHTREC_LEN_HH,
+	FLIGHTREC_LEN_H,
+	FLIGHTREC_LEN_L,
+	FLIGHTREC_LEN_LL,
+	FLIGHTREC_LEN_LD,
+	FLIGHTREC_LEN_J,
+	FLIGHTREC_LEN_Z,
+	FLIGHTREC_LEN_T
+};
+
+struct flightrec_conv {
+	int width_star;
+	int precision_star;
+	enum flightrec_arg_len len;
+	char conv;
+};
+
+/*
+ * Parse one conversion specification, p points after the '%'. Returns
+ * pointer after the conversion character or NULL for specifications
+ * we don't understand (positional arguments, unknown conversions).
+ */
+static const char *flightrec_conv_parse (const char *p, struct flightrec_conv *conv)
+{
+	memset (conv, 0, sizeof (*conv));
+
+	while (*p == '#' || *p == '0' || *p == '-' || *p == ' ' ||
+	    *p == '+' || *p == '\'') {
+		p++;
+	}
+
+	if (*p == '*') {
+		conv->width_star = 1;
+		p++;
+	} else {
+		while (isdigit (*p)) {
+			p++;
+		}
+		if (*p == '$') {
+			return (NULL);
+		}
+	}
+
+	if (*p == '.') {
+		p++;
+		if (*p == '*') {
+			conv->precision_star = 1;
+			p++;
+		} else {
+			while (isdigit (*p)) {
+				p++;
+			}
+		}
+	}
+
+	switch (*p) {
+	case 'h':
+		p++;
+		if (*p == 'h') {
+			conv->len = FLIGHTREC_LEN_HH;
+			p++;
+		} else {
+			conv->len = FLIGHTREC_LEN_H;
+		}
+		break;
+	case 'l':
+		p++;
+		if (*p == 'l') {
+			conv->len = FLIGHTREC_LEN_LL;
+			p++;
+		} else {
+			conv->len = FLIGHTREC_LEN_L;
+		}
+		break;
+	case 'q':
+		conv->len = FLIGHTREC_LEN_LL;
+		p++;
+		break;
+	case 'L':
+		conv->len = FLIGHTREC_LEN_LD;
+		p++;
+		break;
+	case 'j':
+		conv->len = FLIGHTREC_LEN_J;
+		p++;
+		break;
+	case 'z':
+		conv->len = FLIGHTREC_LEN_Z;
+		p++;
+		break;
+	case 't':
+		conv->len = FLIGHTREC_LEN_T;
+		p++;
+		break;
+	}
+
+	switch (*p) {
+	case 'd': case 'i': case 'o': case 'u': case 'x': case 'X': case 'c':
+	case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A':
+	case 's': case 'p': case 'n': case 'm': case '%':
+		conv->conv = *p;
+		return (p + 1);
+	}
+
+	return (NULL);
+}
+
+static int flightrec_arg_put (char *args, size_t *pos, const void *value, size_t len)
+{
+	if (*pos + len > FLIGHTREC_ARGS_SIZE) {
+		return (-1);
+	}
+	memcpy (args + *pos, value, len);
+	*pos += len;
+
+	return (0);
+}
+
+static int flightrec_arg_get (const char *args, size_t args_len, size_t *pos,
+	void *value, size_t len)
+{
+	if (*pos + len > args_len) {
+		return (-1);
+	}
+	memcpy (value, args + *pos, len);
+	*pos += len;
+
+	return (0);
+}
+
+/*
+ * Store arguments in the record in the order they are consumed by the
+ * format. Integers are widened to 64 bits, strings are copied (and
+ * possibly truncated) because they may not outlive the call.
+ */
+static size_t flightrec_args_store (char *args, const char *format, va_list ap)
+{
+	struct flightrec_conv conv;
+	const char *p = format;
+	size_t pos = 0;
+	int64_t i64;
+	double d;
+	long double ld;
+	void *ptr;
+	const char *str;
+	uint32_t str_len;
+	int star;
+
+	while ((p = strchr (p, '%')) != NULL) {
+		p = flightrec_conv_parse (p + 1, &conv);
+		if (p == NULL) {
+			break;
+		}
+		if (conv.width_star) {
+			star = va_arg (ap, int);
+			if (flightrec_arg_put (args, &pos, &star, sizeof (star)) < 0) {
+				break;
+			}
+		}
+		if (conv.precision_star) {
+			star = va_arg (ap, int);
+			if (flightrec_arg_put (args, &pos, &star, sizeof (star)) < 0) {
+				break;
+			}
+		}
+
+		switch (conv.conv) {
+		case 'd': case 'i': case 'o': case 'u': case 'x': case 'X': case 'c':
+			switch (conv.len) {
+			case FLIGHTREC_LEN_L:
+				i64 = va_arg (ap, long);
+				break;
+			case FLIGHTREC_LEN_LL:
+				i64 = va_arg (ap, long long);
+				break;
+			case FLIGHTREC_LEN_J:
+				i64 = va_arg (ap, intmax_t);
+				break;
+			case FLIGHTREC_LEN_Z:
+				i64 = va_arg (ap, size_t);
+				break;
+			case FLIGHTREC_LEN_T:
+				i64 = va_arg (ap, ptrdiff_t);
+				break;
+			default:
+				i64 = va_arg (ap, int);
+				break;
+			}
+			if (flightrec_arg_put (args, &pos, &i64, sizeof (i64)) < 0) {
+				return (pos);
+			}
+			break;
+		case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A':
+			if (conv.len == FLIGHTREC_LEN_LD) {
+				ld = va_arg (ap, long double);
+				if (flightrec_arg_put (args, &pos, &ld, sizeof (ld)) < 0) {
+					return (pos);
+				}
+			} else {
+				d = va_arg (ap, double);
+				if (flightrec_arg_put (args, &pos, &d, sizeof (d)) < 0) {
+					return (pos);
+				}
+			}
+			break;
+		case 'p':
+			ptr = va_arg (ap, void *);
+			if (flightrec_arg_put (args, &pos, &ptr, sizeof (ptr)) < 0) {
+				return (pos);
+			}
+			break;
+		case 'n':
+			(void)va_arg (ap, void *);
+			break;
+		case 's':
+			str = va_arg (ap, const char *);
+			if (pos + sizeof (str_len) >= FLIGHTREC_ARGS_SIZE) {
+				return (pos);
+			}
+			if (str == NULL) {
+				str_len = UINT32_MAX;
+				(void)flightrec_arg_put (args, &pos, &str_len, sizeof (str_len));
+				break;
+			}
+			str_len = strnlen (str, FLIGHTREC_ARGS_SIZE - pos - sizeof (str_len) - 1);
+			(void)flightrec_arg_put (args, &pos, &str_len, sizeof (str_len));
+			memcpy (args + pos, str, str_len);
+			args[pos + str_len] = '\0';
+			pos += str_len + 1;
+			break;
+		}
+	}
+
+	return (pos);
+}
+
+int _logsys_flightrec_record_va (
+	int subsys,
+	const char *function_name,
+	const char *file_name,
+	int file_line,
+	const char *format,
+	va_list ap)
+{
+	struct flightrec_ring *ring;
+	struct flightrec_record *rec;
+	struct timespec ts;
+	uint32_t head;
+	int32_t seq;
+
+	if (subsys >= 0 && subsys <= LOGSYS_MAX_SUBSYS_COUNT &&
+	    logsys_loggers[subsys].blackbox_priority < LOG_TRACE) {
+		return (flightrec_trace_wanted);
+	}
+
+	ring = flightrec_ring_get ();
+	if (ring == NULL) {
+		return (flightrec_trace_wanted);
+	}
+
+	head = (uint32_t)ring->head;
+	rec = (struct flightrec_record *)(ring->slots +
+		(head % FLIGHTREC_RING_SLOTS) * FLIGHTREC_SLOT_SIZE);
+
+	seq = (int32_t)((head & INT32_MAX) + 1);
+	if (seq <= 0) {
+		seq = 1;
+	}
+
+	/*
+	 * Seqlock writer: seq 0 must be visible before any byte of the new
+	 * record, the final seq only after all of them.
+	 */
+	__atomic_store_n (&rec->seq, 0, __ATOMIC_RELAXED);
+	__atomic_thread_fence (__ATOMIC_RELEASE);
+
+	clock_gettime (CLOCK_REALTIME, &ts);
+	rec->timestamp = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+	rec->format = format;
+	rec->function_name = function_name;
+	rec->file_name = file_name;
+	rec->file_line = file_line;
+	rec->subsys = subsys;
+	rec->args_len = flightrec_args_store (rec->args, format, ap);
+
+	__atomic_store_n (&rec->seq, seq, __ATOMIC_RELEASE);
+
+	/*
+	 * Only the owner writes head, the dump uses it as a hint where the
+	 * oldest slot is and validates slots by seq.
+	 */
+	__atomic_store_n (&ring->head, (int32_t)(head + 1), __ATOMIC_RELEASE);
+
+	return (flightrec_trace_wanted);
+}
+
+void _logsys_flightrec_log (
+	int subsys,
+	const char *function_name,
+	const char *file_name,
+	int file_line,
+	const char *format,
+	...)
+{
+	va_list ap;
+	int wanted;
+
+	va_start (ap, format);
+	wanted = _logsys_flightrec_record_va (subsys, function_name, file_name,
+		file_line, format, ap);
+	va_end (ap);
+
+	if (!wanted) {
+		return ;
+	}
+
+	va_start (ap, format);
+	qb_log_from_external_source_va (function_name, file_name, format,
+		LOG_TRACE, file_line, 0, ap);
+	va_end (ap);
+}
+
+/*
+ * Format one conversion with the stored argument. The width and precision
+ * given by '*' are printed into the specification, so snprintf is always
+ * called with exactly one argument.
+ */
+static int flightrec_conv_format (char *out, size_t out_len,
+	const char *spec_start, const char *spec_end,
+	const struct flightrec_conv *conv,
+	const char *args, size_t args_len, size_t *pos)
+{
+	char spec[64];
+	size_t spec_pos = 0;
+	const char *p = spec_start;
+	int star;
+	int64_t i64;
+	double d;
+	long double ld;
+	void *ptr;
+	uint32_t str_len;
+
+	while (p < spec_end && spec_pos < sizeof (spec) - 16) {
+		if (*p == '*') {
+			if (flightrec_arg_get (args, args_len, pos, &star, sizeof (star)) < 0) {
+				return (-1);
+			}
+			if (p > spec_start && p[-1] == '.' && star < 0) {
+				spec_pos--;
+			} else {
+				spec_pos += snprintf (spec + spec_pos, sizeof (spec) - spec_pos,
+					"%d", star);
+			}
+		} else {
+			spec[spec_pos++] = *p;
+		}
+		p++;
+	}
+	spec[spec_pos] = '\0';
+
+	switch (conv->conv) {
+	case 'd': case 'i': case 'o': case 'u': case 'x': case 'X': case 'c':
+		if (flightrec_arg_get (args, args_len, pos, &i64, sizeof (i64)) < 0) {
+			return (-1);
+		}
+		switch (conv->len) {
+		case FLIGHTREC_LEN_L:
+			return (snprintf (out, out_len, spec, (long)i64));
+		case FLIGHTREC_LEN_LL:
+			return (snprintf (out, out_len, spec, (long long)i64));
+		case FLIGHTREC_LEN_J:
+			return (snprintf (out, out_len, spec, (intmax_t)i64));
+		case FLIGHTREC_LEN_Z:
+			return (snprintf (out, out_len, spec, (size_t)i64));
+		case FLIGHTREC_LEN_T:
+			return (snprintf (out, out_len, spec, (ptrdiff_t)i64));
+		default:
+			return (snprintf (out, out_len, spec, (int)i64));
+		}
+	case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A':
+		if (conv->len == FLIGHTREC_LEN_LD) {
+			if (flightrec_arg_get (args, args_len, pos, &ld, sizeof (ld)) < 0) {
+				return (-1);
+			}
+			return (snprintf (out, out_len, spec, ld));
+		}
+		if (flightrec_arg_get (args, args_len, pos, &d, sizeof (d)) < 0) {
+			return (-1);
+		}
+		return (snprintf (out, out_len, spec, d));
+	case 'p':
+		if (flightrec_arg_get (args, args_len, pos, &ptr, sizeof (ptr)) < 0) {
+			return (-1);
+		}
+		return (snprintf (out, out_len, spec, ptr));
+	case 's':
+		if (flightrec_arg_get (args, args_len, pos, &str_len, sizeof (str_len)) < 0) {
+			return (-1);
+		}
+		if (str_len == UINT32_MAX) {
+			return (snprintf (out, out_len, spec, "(null)"));
+		}
+		if (*pos + str_len + 1 > args_len) {
+			return (-1);
+		}
+		*pos += str_len + 1;
+		return (snprintf (out, out_len, spec, args + *pos - str_len - 1));
+	case 'n':
+		return (0);
+	}
+
+	/*
+	 * errno of the original call is lost, keep %m as is
+	 */
+	if (conv->conv == 'm') {
+		return (snprintf (out, out_len, "%%m"));
+	}
+
+	return (snprintf (out, out_len, "%%"));
+}
+
+static void flightrec_record_format (const struct flightrec_record *rec,
+	char *msg, size_t msg_len)
+{
+	struct flightrec_conv conv;
+	const char *p = rec->format;
+	const char *spec_start;
+	size_t msg_pos = 0;
+	size_t args_pos = 0;
+	int res;
+
+	while (*p != '\0' && msg_pos < msg_len - 1) {
+		if (*p != '%') {
+			msg[msg_pos++] = *p++;
+			continue;
+		}
+		spec_start = p;
+		p = flightrec_conv_parse (p + 1, &conv);
+		if (p == NULL) {
+			break;
+		}
+		res = flightrec_conv_format (msg + msg_pos, msg_len - msg_pos,
+			spec_start, p, &conv, rec->args, rec->args_len, &args_pos);
+		if (res < 0) {
+			res = snprintf (msg + msg_pos, msg_len - msg_pos, "<truncated>");
+			msg_pos += (res < msg_len - msg_pos) ? res : msg_len - msg_pos - 1;
+			break;
+		}
+		msg_pos += (res < msg_len - msg_pos) ? res : msg_len - msg_pos - 1;
+	}
+	msg[msg_pos] = '\0';
+}
+
+static const char *flightrec_subsys_name_get (const struct flightrec_record *rec)
+{
+	const char *file_name;
+	int32_t s;
+	int32_t f;
+
+	if (rec->subsys >= 0 && rec->subsys <= LOGSYS_MAX_SUBSYS_COUNT) {
+		return (logsys_loggers[rec->subsys].subsys);
+	}
+
+	file_name = strrchr (rec->file_name, '/');
+	file_name = (file_name != NULL) ? file_name + 1 : rec->file_name;
+
+	for (s = 0; s < LOGSYS_MAX_SUBSYS_COUNT; s++) {
+		for (f = 0; f < logsys_loggers[s].file_idx; f++) {
+			if (strcmp (logsys_loggers[s].files[f], file_name) == 0) {
+				return (logsys_loggers[s].subsys);
+			}
+		}
+	}
+
+	return (logsys_loggers[LOGSYS_MAX_SUBSYS_COUNT].subsys);
+}
+
+struct flightrec_cursor {
+	struct flightrec_ring *ring;
+	uint32_t pos;
+	uint32_t end;
+	int valid;
+	union {
+		struct flightrec_record rec;
+		char slot[FLIGHTREC_SLOT_SIZE];
+	} u;
+};
+
+/*
+ * Copy the next complete record the cursor can see. Records rewritten by
+ * their thread while being copied are skipped.
+ */
+static void flightrec_cursor_next (struct flightrec_cursor *cursor)
+{
+	const struct flightrec_record *rec;
+	int32_t seq;
+
+	cursor->valid = 0;
+	while (cursor->pos != cursor->end) {
+		rec = (const struct flightrec_record *)(cursor->ring->slots +
+			(cursor->pos % FLIGHTREC_RING_SLOTS) * FLIGHTREC_SLOT_SIZE);
+		cursor->pos++;
+
+		seq = __atomic_load_n (&rec->seq, __ATOMIC_ACQUIRE);
+		if (seq == 0) {
+			continue;
+		}
+		memcpy (cursor->u.slot, rec, FLIGHTREC_SLOT_SIZE);
+		__atomic_thread_fence (__ATOMIC_ACQUIRE);
+		if (__atomic_load_n (&rec->seq, __ATOMIC_RELAXED) != seq ||
+		    cursor->u.rec.args_len > FLIGHTREC_ARGS_SIZE) {
+			continue;
+		}
+		cursor->valid = 1;
+		return;
+	}
+}
+
+static const char *flightrec_month_names[] = {
+	"Jan", "Feb", "Mar", "Apr", "May", "Jun",
+	"Jul", "Aug", "Sep", "Oct", "Nov", "Dec"
+};
+
+/*
+ * Same output as strftime "%b %d %H:%M:%S" of the local time, computed
+ * without any libc time function.
+ */
+static void flightrec_time_format (uint64_t timestamp, char *buf, size_t buf_len)
+{
+	int64_t sec;
+	int64_t days;
+	uint32_t day_sec;
+	uint32_t doe, yoe, doy, mp;
+	uint32_t day, month;
+
+	sec = (int64_t)(timestamp / 1000000000ULL) + flightrec_gmtoff;
+	if (sec < 0) {
+		sec = 0;
+	}
+	days = sec / 86400;
+	day_sec = sec % 86400;
+
+	/*
+	 * Civil date from days since 1970-01-01, years starting in March
+	 */
+	days += 719468;
+	doe = days % 146097;
+	yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+	doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+	mp = (5 * doy + 2) / 153;
+	day = doy - (153 * mp + 2) / 5 + 1;
+	month = (mp < 10) ? mp + 3 : mp - 9;
+
+	snprintf (buf, buf_len, "%s %02u %02u:%02u:%02u",
+		flightrec_month_names[month - 1], day,
+		day_sec / 3600, (day_sec / 60) % 60, day_sec % 60);
+}
+
+struct flightrec_out {
+	int fd;
+	size_t len;
+	char buf[FLIGHTREC_OUT_BUF_SIZE];
+};
+
+static int flightrec_out_flush (struct flightrec_out *out)
+{
+	size_t pos = 0;
+	ssize_t res;
+
+	while (pos < out->len) {
+		res = write (out->fd, out->buf + pos, out->len - pos);
+		if (res < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return (-errno);
+		}
+		pos += res;
+	}
+	out->len = 0;
+
+	return (0);
+}
+
+static struct flightrec_cursor flightrec_dump_cursors[FLIGHTREC_MAX_RINGS];
+
+static struct flightrec_out flightrec_dump_out;
+
+static char flightrec_dump_line[FLIGHTREC_MSG_MAX + 512];
+
+static char flightrec_dump_msg[FLIGHTREC_MSG_MAX];
+
+/*
+ * Format all records of all threads into filename, oldest first.
+ * Only async-signal-safe calls (and snprintf of plain integers and
+ * strings) are used, all buffers are static. Concurrent dumps fail
+ * with -EBUSY.
+ */
+int logsys_flightrec_write_to_file (const char *filename)
+{
+	struct flightrec_ring *ring;
+	struct flightrec_cursor *cursors = flightrec_dump_cursors;
+	struct flightrec_cursor *oldest;
+	struct flightrec_out *out = &flightrec_dump_out;
+	char time_str[64];
+	size_t rings = 0;
+	size_t line_len;
+	size_t i;
+	int res = 0;
+
+	if (__atomic_exchange_n (&flightrec_dump_busy, 1, __ATOMIC_ACQUIRE)) {
+		return (-EBUSY);
+	}
+
+	out->fd = open (filename, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (out->fd < 0) {
+		res = -errno;
+		goto out_unbusy;
+	}
+	out->len = 0;
+
+	for (ring = __atomic_load_n (&flightrec_rings, __ATOMIC_ACQUIRE);
+	    ring != NULL && rings < FLIGHTREC_MAX_RINGS; ring = ring->next, rings++) {
+		memset (&cursors[rings], 0, sizeof (cursors[rings]));
+		cursors[rings].ring = ring;
+		cursors[rings].end = (uint32_t)__atomic_load_n (&ring->head, __ATOMIC_ACQUIRE);
+		cursors[rings].pos = cursors[rings].end - FLIGHTREC_RING_SLOTS;
+		flightrec_cursor_next (&cursors[rings]);
+	}
+
+	for (;;) {
+		oldest = NULL;
+		for (i = 0; i < rings; i++) {
+			if (cursors[i].valid && (oldest == NULL ||
+			    cursors[i].u.rec.timestamp < oldest->u.rec.timestamp)) {
+				oldest = &cursors[i];
+			}
+		}
+		if (oldest == NULL) {
+			break;
+		}
+
+		flightrec_record_format (&oldest->u.rec, flightrec_dump_msg,
+			sizeof (flightrec_dump_msg));
+		flightrec_time_format (oldest->u.rec.timestamp, time_str, sizeof (time_str));
+
+		line_len = snprintf (flightrec_dump_line, sizeof (flightrec_dump_line),
+		    "%s.%06u [%s] %s:%d %s: %s\n",
+		    time_str,
+		    (unsigned int)((oldest->u.rec.timestamp % 1000000000ULL) / 1000),
+		    flightrec_subsys_name_get (&oldest->u.rec),
+		    oldest->u.rec.file_name, oldest->u.rec.file_line,
+		    oldest->u.rec.function_name, flightrec_dump_msg);
+		if (line_len >= sizeof (flightrec_dump_line)) {
+			line_len = sizeof (flightrec_dump_line) - 1;
+			flightrec_dump_line[line_len - 1] = '\n';
+		}
+
+		if (out->len + line_len > sizeof (out->buf) &&
+		    (res = flightrec_out_flush (out)) < 0) {
+			break;
+		}
+		memcpy (out->buf + out->len, flightrec_dump_line, line_len);
+		out->len += line_len;
+
+		flightrec_cursor_next (oldest);
+	}
+
+	if (res == 0) {
+		res = flightrec_out_flush (out);
+	}
+	if (close (out->fd) != 0 && res == 0) {
+		res = -errno;
+	}
+
+out_unbusy:
+	__atomic_store_n (&flightrec_dump_busy, 0, __ATOMIC_RELEASE);
+
+	return (res);
+}
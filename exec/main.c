@@ -94,6 +94,7 @@
 #include <sched.h>
 #include <time.h>
 #include <semaphore.h>
+#include <dirent.h>
 
 #include <qb/qbdefs.h>
 #include <qb/qblog.h>
@@ -152,6 +153,13 @@ struct sched_param global_sched_param;
 
 static corosync_timer_handle_t corosync_stats_timer_handle;
 
+/*
+ * How late (us) the scheduler pause timer fired, published in runtime.system.
+ */
+static uint64_t scheduler_latency_last;
+
+static uint64_t scheduler_latency_max;
+
 static const char *corosync_lock_file = LOCALSTATEDIR"/run/corosync.pid";
 
 static int ip_version = AF_INET;
@@ -179,10 +187,14 @@ int cs_poll_dispatch_delete(qb_loop_t * handle, int fd)
 	return qb_loop_poll_del(handle, fd);
 }
 
+static void corosync_token_phase_dump (void);
+
 void corosync_state_dump (void)
 {
 	int i;
 
+	corosync_token_phase_dump ();
+
 	for (i = 0; i < SERVICES_COUNT_MAX; i++) {
 		if (corosync_service[i] && corosync_service[i]->exec_dump_fn) {
 			corosync_service[i]->exec_dump_fn ();
@@ -217,6 +229,24 @@ static void corosync_blackbox_write_to_file (void)
 		log_printf(LOGSYS_LEVEL_ERROR, "Can't create symlink to '%s' for corosync blackbox file '%s'",
 		    fname, fdata_fname);
 	}
+
+	/*
+	 * Trace messages of binary flight recorder are formatted only now
+	 */
+	snprintf(fdata_fname, sizeof(fdata_fname), "%s/fdata-trace", get_run_dir());
+	unlink(fdata_fname);
+	if (logsys_flightrec_mode_get() != LOGSYS_FLIGHTREC_BINARY) {
+		return ;
+	}
+
+	strncat(fname, ".trace", PATH_MAX - strlen(fname) - 1);
+	if ((res = logsys_flightrec_write_to_file(fname)) < 0) {
+		LOGSYS_PERROR(-res, LOGSYS_LEVEL_ERROR, "Can't store flight recorder trace file");
+	}
+	if (symlink(fname, fdata_fname) == -1) {
+		log_printf(LOGSYS_LEVEL_ERROR, "Can't create symlink to '%s' for corosync flight recorder trace file '%s'",
+		    fname, fdata_fname);
+	}
 }
 
 static void unlink_all_completed (void)
@@ -299,12 +329,179 @@ static void serialize_unlock (void)
 {
 }
 
+/*
+ * Monotonic timestamps (ns) of the phase boundaries of the last membership
+ * change, from the token loss (or first gather) to the quorum decision.
+ */
+struct membership_change {
+	int pending;
+	uint64_t ring_seq;
+	uint64_t token_lost;
+	uint64_t gather;
+	uint64_t commit;
+	uint64_t recovery;
+	uint64_t operational;
+	uint64_t sync_start;
+	uint64_t sync_end;
+	uint64_t quorate;
+};
+
+/*
+ * Histogram of membership change latencies, bucket i counts changes
+ * taking at most 2^i ms, the last bucket counts the rest
+ */
+#define MEMBERSHIP_CHANGE_BUCKETS	18
+
+static struct membership_change membership_change;
+
+static uint64_t membership_change_count;
+
+static uint64_t membership_change_hist[MEMBERSHIP_CHANGE_BUCKETS];
+
+static uint64_t membership_change_offset (uint64_t start, uint64_t ts)
+{
+	if (ts == 0 || ts < start) {
+		return (0);
+	}
+
+	return ((ts - start) / QB_TIME_NS_IN_USEC);
+}
+
+static void membership_change_key_set (const char *name, uint64_t start, uint64_t ts)
+{
+	char key_name[ICMAP_KEYNAME_MAXLEN];
+
+	snprintf(key_name, ICMAP_KEYNAME_MAXLEN, "runtime.membership.last_change.%s", name);
+	icmap_set_uint64(key_name, membership_change_offset (start, ts));
+}
+
+static void membership_change_hist_publish (void)
+{
+	char key_name[ICMAP_KEYNAME_MAXLEN];
+	int i;
+
+	for (i = 0; i < MEMBERSHIP_CHANGE_BUCKETS; i++) {
+		if (i == MEMBERSHIP_CHANGE_BUCKETS - 1) {
+			snprintf(key_name, ICMAP_KEYNAME_MAXLEN,
+				"runtime.membership.change_latency.le_inf");
+		} else {
+			snprintf(key_name, ICMAP_KEYNAME_MAXLEN,
+				"runtime.membership.change_latency.le_%ums", 1U << i);
+		}
+		icmap_set_uint64(key_name, membership_change_hist[i]);
+	}
+}
+
+/*
+ * Publish the last membership change. Called once synchronization is done
+ * and again if the quorum decision comes later.
+ */
+static void membership_change_publish (int account)
+{
+	struct membership_change *mc = &membership_change;
+	uint64_t start;
+	uint64_t end;
+	uint64_t total_ms;
+	int i;
+
+	start = mc->token_lost ? mc->token_lost : mc->gather;
+	if (start == 0) {
+		return;
+	}
+
+	end = mc->sync_end > mc->quorate ? mc->sync_end : mc->quorate;
+
+	icmap_set_uint64("runtime.membership.last_change.ring_id", mc->ring_seq);
+	icmap_set_uint8("runtime.membership.last_change.token_lost", mc->token_lost ? 1 : 0);
+	membership_change_key_set ("gather", start, mc->gather);
+	membership_change_key_set ("commit", start, mc->commit);
+	membership_change_key_set ("recovery", start, mc->recovery);
+	membership_change_key_set ("operational", start, mc->operational);
+	membership_change_key_set ("sync_start", start, mc->sync_start);
+	membership_change_key_set ("sync_end", start, mc->sync_end);
+	membership_change_key_set ("quorate", start, mc->quorate);
+	membership_change_key_set ("total", start, end);
+
+	if (!account) {
+		return;
+	}
+
+	total_ms = membership_change_offset (start, end) / 1000;
+	for (i = 0; i < MEMBERSHIP_CHANGE_BUCKETS - 1; i++) {
+		if (total_ms <= (1ULL << i)) {
+			break;
+		}
+	}
+	membership_change_hist[i]++;
+	membership_change_count++;
+
+	icmap_set_uint64("runtime.membership.change_count", membership_change_count);
+	membership_change_hist_publish ();
+}
+
+static void membership_change_start (const struct memb_ring_id *ring_id)
+{
+	struct membership_change *mc = &membership_change;
+	totempg_stats_t *stats;
+
+	stats = api->totem_get_stats();
+
+	/*
+	 * A change interrupting synchronization of the previous one is
+	 * accounted as part of it
+	 */
+	if (!mc->pending) {
+		memset (mc, 0, sizeof (*mc));
+		mc->token_lost = stats->mrp->srp->memb_token_lost_time;
+		mc->gather = stats->mrp->srp->memb_gather_time;
+		mc->pending = 1;
+	}
+	mc->ring_seq = ring_id->seq;
+	mc->commit = stats->mrp->srp->memb_commit_time;
+	mc->recovery = stats->mrp->srp->memb_recovery_time;
+	mc->operational = stats->mrp->srp->memb_operational_time;
+	mc->sync_start = qb_util_nano_current_get ();
+	mc->sync_end = 0;
+}
+
+static void membership_change_sync_end (void)
+{
+	struct membership_change *mc = &membership_change;
+
+	if (!mc->pending) {
+		return;
+	}
+
+	mc->sync_end = qb_util_nano_current_get ();
+	mc->pending = 0;
+	membership_change_publish (1);
+}
+
+static void membership_change_quorum_changed (int quorate, void *context)
+{
+	struct membership_change *mc = &membership_change;
+
+	if (!quorate || mc->sync_start == 0 || mc->quorate != 0) {
+		return;
+	}
+
+	mc->quorate = qb_util_nano_current_get ();
+	if (!mc->pending) {
+		/*
+		 * Quorum decided after synchronization
+		 */
+		membership_change_publish (0);
+	}
+}
+
 static void corosync_sync_completed (void)
 {
 	log_printf (LOGSYS_LEVEL_NOTICE,
 		"Completed service synchronization, ready to provide service.");
 	sync_in_process = 0;
 
+	membership_change_sync_end ();
+
 	cs_ipcs_sync_state_changed(sync_in_process);
 	cs_ipc_allow_connections(1);
 	/*
@@ -331,6 +528,7 @@ static int corosync_sync_callbacks_retrieve (
 	callbacks->sync_process = corosync_service[service_id]->sync_process;
 	callbacks->sync_activate = corosync_service[service_id]->sync_activate;
 	callbacks->sync_abort = corosync_service[service_id]->sync_abort;
+	callbacks->sync_depends = corosync_service[service_id]->sync_depends;
 	return (0);
 }
 
@@ -416,6 +614,7 @@ static void confchg_fn (
 		sync_save_transitional (member_list, member_list_entries, ring_id);
 	}
 	if (configuration_type == TOTEM_CONFIGURATION_REGULAR) {
+		membership_change_start (ring_id);
 		sync_start (member_list, member_list_entries, ring_id);
 	}
 }
@@ -488,6 +687,99 @@ static void corosync_mlockall (void)
 }
 
 
+static void corosync_token_phase_stats_update (totemsrp_stats_t *srp)
+{
+	char key_name[ICMAP_KEYNAME_MAXLEN];
+	totemsrp_token_phase_stats_t *phase_stats;
+	int phase, i;
+
+	for (phase = 0; phase < TOTEM_TOKEN_PHASE_MAX; phase++) {
+		phase_stats = &srp->token_phase[phase];
+
+		snprintf(key_name, ICMAP_KEYNAME_MAXLEN,
+			"runtime.totem.pg.mrp.srp.token_phase.%s.count", totemsrp_token_phase_name (phase));
+		icmap_set_uint64(key_name, phase_stats->count);
+		snprintf(key_name, ICMAP_KEYNAME_MAXLEN,
+			"runtime.totem.pg.mrp.srp.token_phase.%s.avg", totemsrp_token_phase_name (phase));
+		icmap_set_uint64(key_name, phase_stats->count ?
+			phase_stats->time_total / phase_stats->count : 0);
+		snprintf(key_name, ICMAP_KEYNAME_MAXLEN,
+			"runtime.totem.pg.mrp.srp.token_phase.%s.max", totemsrp_token_phase_name (phase));
+		icmap_set_uint64(key_name, phase_stats->time_max);
+
+		for (i = 0; i < TOTEM_TOKEN_PHASE_BUCKETS; i++) {
+			if (i == TOTEM_TOKEN_PHASE_BUCKETS - 1) {
+				snprintf(key_name, ICMAP_KEYNAME_MAXLEN,
+					"runtime.totem.pg.mrp.srp.token_phase.%s.le_inf",
+					totemsrp_token_phase_name (phase));
+			} else {
+				snprintf(key_name, ICMAP_KEYNAME_MAXLEN,
+					"runtime.totem.pg.mrp.srp.token_phase.%s.le_%uus",
+					totemsrp_token_phase_name (phase), 1U << i);
+			}
+			icmap_set_uint64(key_name, phase_stats->hist[i]);
+		}
+	}
+}
+
+/*
+ * Token phase summary for the blackbox, written on SIGUSR2
+ */
+static void corosync_token_phase_dump (void)
+{
+	totempg_stats_t *stats;
+	totemsrp_token_phase_stats_t *phase_stats;
+	int phase;
+
+	stats = api->totem_get_stats();
+
+	for (phase = 0; phase < TOTEM_TOKEN_PHASE_MAX; phase++) {
+		phase_stats = &stats->mrp->srp->token_phase[phase];
+		log_printf (LOGSYS_LEVEL_NOTICE,
+			"Token phase %s: count %llu avg %llu us max %llu us",
+			totemsrp_token_phase_name (phase),
+			(unsigned long long)phase_stats->count,
+			(unsigned long long)(phase_stats->count ?
+				phase_stats->time_total / phase_stats->count : 0),
+			(unsigned long long)phase_stats->time_max);
+	}
+}
+
+/*
+ * Scheduling statistics of the main loop thread
+ */
+static void corosync_system_stats_update (void)
+{
+	struct rusage usage;
+	char filename[PATH_MAX];
+	unsigned long long run_time, run_delay;
+	FILE *f;
+
+#ifdef RUSAGE_THREAD
+	if (getrusage (RUSAGE_THREAD, &usage) == 0) {
+#else
+	if (getrusage (RUSAGE_SELF, &usage) == 0) {
+#endif
+		icmap_set_uint64("runtime.system.voluntary_csw", usage.ru_nvcsw);
+		icmap_set_uint64("runtime.system.involuntary_csw", usage.ru_nivcsw);
+	}
+
+	/*
+	 * Time spent runnable but waiting for a cpu, Linux only
+	 */
+	snprintf (filename, sizeof (filename), "/proc/self/task/%d/schedstat", (int)getpid ());
+	f = fopen (filename, "r");
+	if (f != NULL) {
+		if (fscanf (f, "%llu %llu", &run_time, &run_delay) == 2) {
+			icmap_set_uint64("runtime.system.run_delay", run_delay / QB_TIME_NS_IN_USEC);
+		}
+		fclose (f);
+	}
+
+	icmap_set_uint64("runtime.system.timer_latency_last", scheduler_latency_last);
+	icmap_set_uint64("runtime.system.timer_latency_max", scheduler_latency_max);
+}
+
 static void corosync_totem_stats_updater (void *data)
 {
 	totempg_stats_t * stats;
@@ -547,6 +839,9 @@ static void corosync_totem_stats_updater (void *data)
 	for (i = 0; i < stats->mrp->srp->rrp->interface_count; i++) {
 		snprintf(key_name, ICMAP_KEYNAME_MAXLEN, "runtime.totem.pg.mrp.rrp.%u.faulty", i);
 		icmap_set_uint8(key_name, stats->mrp->srp->rrp->faulty[i]);
+		snprintf(key_name, ICMAP_KEYNAME_MAXLEN,
+			"runtime.totem.pg.mrp.rrp.%u.mcast_dup_suppressed", i);
+		icmap_set_uint64(key_name, stats->mrp->srp->rrp->mcast_dup_suppressed[i]);
 	}
 	total_mtt_rx_token = 0;
 	total_token_holdtime = 0;
@@ -576,7 +871,11 @@ static void corosync_totem_stats_updater (void *data)
 		icmap_set_uint32("runtime.totem.pg.mrp.srp.avg_backlog_calc", (total_backlog_calc / token_count));
 	}
 
+	corosync_token_phase_stats_update (stats->mrp->srp);
+
 	cs_ipcs_stats_update();
+	schedwrk_stats_update();
+	corosync_system_stats_update();
 
 	api->timer_add_duration (1500 * MILLI_2_NANO_SECONDS, NULL,
 		corosync_totem_stats_updater,
@@ -588,6 +887,9 @@ static void corosync_totem_stats_init (void)
 	icmap_set_uint32("runtime.totem.pg.mrp.srp.mtt_rx_token", 0);
 	icmap_set_uint32("runtime.totem.pg.mrp.srp.avg_token_workload", 0);
 	icmap_set_uint32("runtime.totem.pg.mrp.srp.avg_backlog_calc", 0);
+	icmap_set_uint64("runtime.membership.change_count", 0);
+	membership_change_hist_publish ();
+	api->quorum_register_callback (membership_change_quorum_changed, NULL);
 
 	/* start stats timer */
 	api->timer_add_duration (1500 * MILLI_2_NANO_SECONDS, NULL,
@@ -659,6 +961,213 @@ int main_mcast (
 	return (totempg_groups_mcast_joined (corosync_group_handle, iovec, iov_len, guarantee));
 }
 
+/*
+ * Ring id persistence. The file is kept open by a helper thread, which
+ * writes and syncs the last requested ring id. Stores requested while a
+ * write is in progress are coalesced into the next one, so a storm of
+ * reformations costs at most two syncs and never blocks the token.
+ */
+struct ring_id_store {
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	int notify_pipe[2];
+	int fd;
+	char filename[PATH_MAX];
+	char pending_filename[PATH_MAX];
+	uint64_t pending_seq;
+	uint64_t pending_time;
+	int pending;
+	int writing;
+	int exiting;
+	int error;
+	uint64_t requests;
+	uint64_t writes;
+	uint64_t latency_last;
+	uint64_t latency_max;
+};
+
+static struct ring_id_store ring_id_store = {
+	.mutex = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+	.notify_pipe = { -1, -1 },
+	.fd = -1
+};
+
+static void *ring_id_store_thread (void *data)
+{
+	struct ring_id_store *st = (struct ring_id_store *)data;
+	char filename[PATH_MAX];
+	uint64_t seq;
+	uint64_t request_time;
+	uint64_t latency;
+	int err;
+
+	pthread_mutex_lock (&st->mutex);
+	for (;;) {
+		while (!st->pending && !st->exiting) {
+			pthread_cond_wait (&st->cond, &st->mutex);
+		}
+		if (!st->pending) {
+			break;
+		}
+
+		seq = st->pending_seq;
+		request_time = st->pending_time;
+		strcpy (filename, st->pending_filename);
+		st->pending = 0;
+		st->writing = 1;
+		pthread_mutex_unlock (&st->mutex);
+
+		err = 0;
+		if (st->fd == -1 || strcmp (filename, st->filename) != 0) {
+			if (st->fd != -1) {
+				close (st->fd);
+			}
+			strcpy (st->filename, filename);
+			st->fd = open (filename, O_CREAT|O_WRONLY, 0700);
+			if (st->fd == -1) {
+				err = errno;
+			}
+		}
+		if (err == 0 &&
+		    pwrite (st->fd, &seq, sizeof (seq), 0) != sizeof (seq)) {
+			err = errno ? errno : EIO;
+		}
+		if (err == 0 && fdatasync (st->fd) == -1) {
+			err = errno;
+		}
+		latency = (qb_util_nano_current_get () - request_time) / QB_TIME_NS_IN_USEC;
+
+		pthread_mutex_lock (&st->mutex);
+		st->writing = 0;
+		if (err) {
+			st->error = err;
+		} else {
+			st->writes++;
+			st->latency_last = latency;
+			if (latency > st->latency_max) {
+				st->latency_max = latency;
+			}
+		}
+		pthread_cond_broadcast (&st->cond);
+
+		/*
+		 * Let the main loop publish the stats and handle errors
+		 */
+		if (write (st->notify_pipe[1], "", 1) == -1) {
+			/*
+			 * Pipe full, a notification is already pending
+			 */
+		}
+	}
+	pthread_mutex_unlock (&st->mutex);
+
+	return (NULL);
+}
+
+static int32_t ring_id_store_dispatch (int32_t fd, int32_t revents, void *data)
+{
+	struct ring_id_store *st = &ring_id_store;
+	char buf[64];
+	uint64_t requests, writes, latency_last, latency_max;
+	int err;
+
+	while (read (fd, buf, sizeof (buf)) > 0)
+		;
+
+	pthread_mutex_lock (&st->mutex);
+	requests = st->requests;
+	writes = st->writes;
+	latency_last = st->latency_last;
+	latency_max = st->latency_max;
+	err = st->error;
+	pthread_mutex_unlock (&st->mutex);
+
+	if (err) {
+		LOGSYS_PERROR(err, LOGSYS_LEVEL_ERROR,
+			"Couldn't store new ring id to stable storage");
+
+		corosync_exit_error (COROSYNC_DONE_STORE_RINGID);
+	}
+
+	icmap_set_uint64("runtime.ringid.store_requests", requests);
+	icmap_set_uint64("runtime.ringid.store_writes", writes);
+	icmap_set_uint64("runtime.ringid.store_latency_last", latency_last);
+	icmap_set_uint64("runtime.ringid.store_latency_max", latency_max);
+
+	return (0);
+}
+
+static void ring_id_store_init (void)
+{
+	struct ring_id_store *st = &ring_id_store;
+	sigset_t sigset, oldset;
+	int res;
+	int i;
+
+	if (pipe (st->notify_pipe) == -1) {
+		LOGSYS_PERROR (errno, LOGSYS_LEVEL_ERROR,
+			"Couldn't create ringid notification pipe");
+
+		corosync_exit_error (COROSYNC_DONE_STORE_RINGID);
+	}
+	for (i = 0; i < 2; i++) {
+		fcntl (st->notify_pipe[i], F_SETFL, O_NONBLOCK);
+		fcntl (st->notify_pipe[i], F_SETFD, FD_CLOEXEC);
+	}
+
+	/*
+	 * Signals are handled by the main loop
+	 */
+	sigfillset (&sigset);
+	pthread_sigmask (SIG_SETMASK, &sigset, &oldset);
+	res = pthread_create (&st->thread, NULL, ring_id_store_thread, st);
+	pthread_sigmask (SIG_SETMASK, &oldset, NULL);
+	if (res != 0) {
+		LOGSYS_PERROR (res, LOGSYS_LEVEL_ERROR,
+			"Couldn't create ringid store thread");
+
+		corosync_exit_error (COROSYNC_DONE_STORE_RINGID);
+	}
+
+	qb_loop_poll_add (corosync_poll_handle, QB_LOOP_MED,
+		st->notify_pipe[0], POLLIN, NULL, ring_id_store_dispatch);
+}
+
+/*
+ * Wait until all requested ring ids are on stable storage
+ */
+static void ring_id_store_sync (void)
+{
+	struct ring_id_store *st = &ring_id_store;
+
+	pthread_mutex_lock (&st->mutex);
+	while (st->pending || st->writing) {
+		pthread_cond_wait (&st->cond, &st->mutex);
+	}
+	pthread_mutex_unlock (&st->mutex);
+}
+
+static void ring_id_store_finalize (void)
+{
+	struct ring_id_store *st = &ring_id_store;
+
+	pthread_mutex_lock (&st->mutex);
+	st->exiting = 1;
+	pthread_cond_broadcast (&st->cond);
+	pthread_mutex_unlock (&st->mutex);
+
+	pthread_join (st->thread, NULL);
+
+	if (st->fd != -1) {
+		close (st->fd);
+	}
+	qb_loop_poll_del (corosync_poll_handle, st->notify_pipe[0]);
+	close (st->notify_pipe[0]);
+	close (st->notify_pipe[1]);
+}
+
 static void corosync_ring_id_create_or_load (
 	struct memb_ring_id *memb_ring_id,
 	const struct totem_ip_address *addr)
@@ -667,6 +1176,11 @@ static void corosync_ring_id_create_or_load (
 	int res = 0;
 	char filename[PATH_MAX];
 
+	/*
+	 * Don't read a ring id which is still being written
+	 */
+	ring_id_store_sync ();
+
 	snprintf (filename, sizeof(filename), "%s/ringid_%s",
 		get_run_dir(), totemip_print (addr));
 	fd = open (filename, O_RDONLY, 0700);
@@ -686,6 +1200,9 @@ static void corosync_ring_id_create_or_load (
 		fd = open (filename, O_CREAT|O_RDWR, 0700);
 		if (fd != -1) {
 			res = write (fd, &memb_ring_id->seq, sizeof (uint64_t));
+			if (res != -1 && fdatasync (fd) == -1) {
+				res = -1;
+			}
 			close (fd);
 			if (res == -1) {
 				LOGSYS_PERROR (errno, LOGSYS_LEVEL_ERROR,
@@ -709,35 +1226,22 @@ static void corosync_ring_id_store (
 	const struct memb_ring_id *memb_ring_id,
 	const struct totem_ip_address *addr)
 {
-	char filename[PATH_MAX];
-	int fd;
-	int res;
+	struct ring_id_store *st = &ring_id_store;
 
-	snprintf (filename, sizeof(filename), "%s/ringid_%s",
-		get_run_dir(), totemip_print (addr));
-
-	fd = open (filename, O_WRONLY, 0700);
-	if (fd == -1) {
-		fd = open (filename, O_CREAT|O_RDWR, 0700);
-	}
-	if (fd == -1) {
-		LOGSYS_PERROR(errno, LOGSYS_LEVEL_ERROR,
-			"Couldn't store new ring id %llx to stable storage",
-			memb_ring_id->seq);
-
-		corosync_exit_error (COROSYNC_DONE_STORE_RINGID);
-	}
 	log_printf (LOGSYS_LEVEL_DEBUG,
 		"Storing new sequence id for ring %llx", memb_ring_id->seq);
-	res = write (fd, &memb_ring_id->seq, sizeof(memb_ring_id->seq));
-	close (fd);
-	if (res != sizeof(memb_ring_id->seq)) {
-		LOGSYS_PERROR(errno, LOGSYS_LEVEL_ERROR,
-			"Couldn't store new ring id %llx to stable storage",
-			memb_ring_id->seq);
 
-		corosync_exit_error (COROSYNC_DONE_STORE_RINGID);
-	}
+	pthread_mutex_lock (&st->mutex);
+	snprintf (st->pending_filename, sizeof(st->pending_filename), "%s/ringid_%s",
+		get_run_dir(), totemip_print (addr));
+	st->pending_seq = memb_ring_id->seq;
+	if (!st->pending) {
+		st->pending_time = qb_util_nano_current_get ();
+	}
+	st->pending = 1;
+	st->requests++;
+	pthread_cond_signal (&st->cond);
+	pthread_mutex_unlock (&st->mutex);
 }
 
 static qb_loop_timer_handle recheck_the_q_level_timer;
@@ -798,6 +1302,49 @@ int corosync_sending_allowed (
 	return (sending_allowed);
 }
 
+/*
+ * Reserve totempg space for up to msg_count requests of msg's size with a
+ * single reservation.  Returns QB_TRUE only if every request of the service
+ * could be sent right now (quorate, no sync in progress, space reserved),
+ * so the caller may skip the per-request check for the rest of the batch.
+ * On QB_FALSE nothing is held and the caller falls back to
+ * corosync_sending_allowed for the request.
+ */
+int corosync_sending_allowed_batch (
+	unsigned int service,
+	const void *msg,
+	unsigned int msg_count,
+	void *sending_allowed_private_data)
+{
+	struct sending_allowed_private_data_struct *pd =
+		(struct sending_allowed_private_data_struct *)sending_allowed_private_data;
+	struct iovec reserve_iovec;
+	const struct qb_ipc_request_header *header = (const struct qb_ipc_request_header *)msg;
+
+	if (corosync_quorum_is_quorate() != 1 &&
+	    corosync_service[service]->allow_inquorate != CS_LIB_ALLOW_INQUORATE) {
+		pd->reserved_msgs = -1;
+		return (QB_FALSE);
+	}
+
+	if (sync_in_process != 0) {
+		pd->reserved_msgs = -1;
+		return (QB_FALSE);
+	}
+
+	reserve_iovec.iov_base = (char *)header;
+	reserve_iovec.iov_len = (size_t)header->size * msg_count;
+
+	pd->reserved_msgs = totempg_groups_joined_reserve (
+		corosync_group_handle,
+		&reserve_iovec, 1);
+	if (pd->reserved_msgs == 0) {
+		pd->reserved_msgs = -1;
+	}
+
+	return (pd->reserved_msgs > 0);
+}
+
 void corosync_sending_allowed_release (void *sending_allowed_private_data)
 {
 	struct sending_allowed_private_data_struct *pd =
@@ -835,6 +1382,7 @@ struct scheduler_pause_timeout_data {
 	qb_loop_timer_handle handle;
 	unsigned long long tv_prev;
 	unsigned long long max_tv_diff;
+	unsigned long long interval;
 };
 
 static void timer_function_scheduler_timeout (void *data)
@@ -856,6 +1404,14 @@ static void timer_function_scheduler_timeout (void *data)
 	tv_diff = tv_current - timeout_data->tv_prev;
 	timeout_data->tv_prev = tv_current;
 
+	if (timeout_data->interval != 0) {
+		scheduler_latency_last = tv_diff > timeout_data->interval ?
+		    (tv_diff - timeout_data->interval) / QB_TIME_NS_IN_USEC : 0;
+		if (scheduler_latency_last > scheduler_latency_max) {
+			scheduler_latency_max = scheduler_latency_last;
+		}
+	}
+
 	if (tv_diff > timeout_data->max_tv_diff) {
 		log_printf (LOGSYS_LEVEL_WARNING, "Corosync main process was not scheduled for %0.4f ms "
 		    "(threshold is %0.4f ms). Consider token timeout increase.",
@@ -866,9 +1422,10 @@ static void timer_function_scheduler_timeout (void *data)
 	 * Set next threshold, because token_timeout can change
 	 */
 	timeout_data->max_tv_diff = timeout_data->totem_config->token_timeout * QB_TIME_NS_IN_MSEC * 0.8;
+	timeout_data->interval = timeout_data->totem_config->token_timeout * QB_TIME_NS_IN_MSEC / 3;
 	qb_loop_timer_add (corosync_poll_handle,
 		QB_LOOP_MED,
-		timeout_data->totem_config->token_timeout * QB_TIME_NS_IN_MSEC / 3,
+		timeout_data->interval,
 		timeout_data,
 		timer_function_scheduler_timeout,
 		&timeout_data->handle);
@@ -921,6 +1478,124 @@ static void corosync_setscheduler (void)
 #endif
 }
 
+#ifdef HAVE_SCHED_SETAFFINITY
+/*
+ * Parse list of cpus like "0-3,6" into set
+ */
+static int cpu_list_parse (const char *str, cpu_set_t *set)
+{
+	char *end;
+	long first, last, cpu;
+
+	CPU_ZERO (set);
+
+	while (*str != '\0') {
+		first = strtol (str, &end, 10);
+		if (end == str || first < 0) {
+			return (-1);
+		}
+		last = first;
+		if (*end == '-') {
+			str = end + 1;
+			last = strtol (str, &end, 10);
+			if (end == str || last < first) {
+				return (-1);
+			}
+		}
+		if (last >= CPU_SETSIZE) {
+			return (-1);
+		}
+		for (cpu = first; cpu <= last; cpu++) {
+			CPU_SET (cpu, set);
+		}
+
+		str = end;
+		if (*str == ',') {
+			str++;
+		} else if (*str != '\0') {
+			return (-1);
+		}
+	}
+
+	return (CPU_COUNT (set) > 0 ? 0 : -1);
+}
+
+static int cpu_affinity_get (const char *key_name, cpu_set_t *set)
+{
+	char *str;
+
+	if (icmap_get_string (key_name, &str) != CS_OK) {
+		return (0);
+	}
+
+	if (cpu_list_parse (str, set) != 0) {
+		log_printf (LOGSYS_LEVEL_ERROR, "Invalid list of cpus '%s' in %s", str, key_name);
+		free (str);
+		corosync_exit_error (COROSYNC_DONE_MAINCONFIGREAD);
+	}
+	free (str);
+
+	return (1);
+}
+#endif
+
+/*
+ * Pin the main loop thread to system.cpu_affinity and the other threads
+ * (log thread, ring id store) to system.helper_cpu_affinity, which defaults
+ * to the main thread cpus. Must be called after all threads are started.
+ */
+static void corosync_set_cpu_affinity (void)
+{
+#ifdef HAVE_SCHED_SETAFFINITY
+	cpu_set_t main_set;
+	cpu_set_t helper_set;
+	int have_main, have_helper;
+	DIR *dir;
+	struct dirent *dirent;
+	pid_t tid;
+
+	have_main = cpu_affinity_get ("system.cpu_affinity", &main_set);
+	have_helper = cpu_affinity_get ("system.helper_cpu_affinity", &helper_set);
+	if (!have_helper && have_main) {
+		memcpy (&helper_set, &main_set, sizeof (helper_set));
+		have_helper = 1;
+	}
+
+	if (have_main && sched_setaffinity (0, sizeof (main_set), &main_set) == -1) {
+		LOGSYS_PERROR (errno, LOGSYS_LEVEL_WARNING,
+			"Could not set cpu affinity of main thread");
+	}
+
+	if (!have_helper) {
+		return;
+	}
+
+	dir = opendir ("/proc/self/task");
+	if (dir == NULL) {
+		LOGSYS_PERROR (errno, LOGSYS_LEVEL_WARNING,
+			"Could not list threads to set their cpu affinity");
+		return;
+	}
+	while ((dirent = readdir (dir)) != NULL) {
+		tid = atoi (dirent->d_name);
+		if (tid <= 0 || tid == getpid ()) {
+			continue;
+		}
+		if (sched_setaffinity (tid, sizeof (helper_set), &helper_set) == -1) {
+			LOGSYS_PERROR (errno, LOGSYS_LEVEL_WARNING,
+				"Could not set cpu affinity of thread %d", (int)tid);
+		}
+	}
+	closedir (dir);
+#else
+	if (icmap_get ("system.cpu_affinity", NULL, NULL, NULL) == CS_OK ||
+	    icmap_get ("system.helper_cpu_affinity", NULL, NULL, NULL) == CS_OK) {
+		log_printf (LOGSYS_LEVEL_WARNING,
+			"The Platform is missing cpu affinity setting features.  Leaving at default.");
+	}
+#endif
+}
+
 static void
 _logsys_log_printf(int level, int subsys,
 		const char *function_name,
@@ -938,6 +1613,16 @@ _logsys_log_printf(int level, int subsys,
 {
 	va_list ap;
 
+	if (level == LOGSYS_LEVEL_TRACE && _logsys_flightrec_active) {
+		va_start(ap, format);
+		if (!_logsys_flightrec_record_va(subsys, function_name,
+		    file_name, file_line, format, ap)) {
+			va_end(ap);
+			return;
+		}
+		va_end(ap);
+	}
+
 	va_start(ap, format);
 	qb_log_from_external_source_va(function_name, file_name,
 				    format, level, file_line,
@@ -996,6 +1681,10 @@ static void set_icmap_ro_keys_flag (void)
 	icmap_set_ro_access("runtime.totem.", CS_TRUE, CS_TRUE);
 	icmap_set_ro_access("runtime.services.", CS_TRUE, CS_TRUE);
 	icmap_set_ro_access("runtime.config.", CS_TRUE, CS_TRUE);
+	icmap_set_ro_access("runtime.schedwrk.", CS_TRUE, CS_TRUE);
+	icmap_set_ro_access("runtime.membership.", CS_TRUE, CS_TRUE);
+	icmap_set_ro_access("runtime.ringid.", CS_TRUE, CS_TRUE);
+	icmap_set_ro_access("runtime.system.", CS_TRUE, CS_TRUE);
 
 	/*
 	 * Set RO flag for constrete keys of configuration which can't be changed
@@ -1005,9 +1694,15 @@ static void set_icmap_ro_keys_flag (void)
 	icmap_set_ro_access("totem.crypto_hash", CS_FALSE, CS_TRUE);
 	icmap_set_ro_access("totem.secauth", CS_FALSE, CS_TRUE);
 	icmap_set_ro_access("totem.ip_version", CS_FALSE, CS_TRUE);
+	icmap_set_ro_access("totem.schedwrk_budget", CS_FALSE, CS_TRUE);
 	icmap_set_ro_access("totem.rrp_mode", CS_FALSE, CS_TRUE);
+	icmap_set_ro_access("totem.io_uring", CS_FALSE, CS_TRUE);
+	icmap_set_ro_access("totem.shm_path", CS_FALSE, CS_TRUE);
+	icmap_set_ro_access("system.cpu_affinity", CS_FALSE, CS_TRUE);
+	icmap_set_ro_access("system.helper_cpu_affinity", CS_FALSE, CS_TRUE);
 	icmap_set_ro_access("totem.netmtu", CS_FALSE, CS_TRUE);
 	icmap_set_ro_access("qb.ipc_type", CS_FALSE, CS_TRUE);
+	icmap_set_ro_access("qb.ipc_batch_size", CS_FALSE, CS_TRUE);
 	icmap_set_ro_access("config.reload_in_progress", CS_FALSE, CS_TRUE);
 	icmap_set_ro_access("config.totemconfig_reload_in_progress", CS_FALSE, CS_TRUE);
 }
@@ -1129,6 +1824,7 @@ int main (int argc, char **argv, char **envp)
 	enum e_corosync_done flock_err;
 	uint64_t totem_config_warnings;
 	struct scheduler_pause_timeout_data scheduler_pause_timeout_data;
+	uint32_t schedwrk_budget;
 
 	/* default configuration
 	 */
@@ -1290,7 +1986,7 @@ int main (int argc, char **argv, char **envp)
 	totem_config.totem_logging_configuration = totem_logging_configuration;
 	totem_config.totem_logging_configuration.log_subsys_id = _logsys_subsys_create("TOTEM", "totem,"
 			"totemmrp.c,totemrrp.c,totemip.c,totemconfig.c,totemcrypto.c,totemsrp.c,"
-			"totempg.c,totemiba.c,totemudp.c,totemudpu.c,totemnet.c");
+			"totempg.c,totemiba.c,totemudp.c,totemudpu.c,totemshm.c,totemnet.c");
 
 	totem_config.totem_logging_configuration.log_level_security = LOGSYS_LEVEL_WARNING;
 	totem_config.totem_logging_configuration.log_level_error = LOGSYS_LEVEL_ERROR;
@@ -1299,6 +1995,7 @@ int main (int argc, char **argv, char **envp)
 	totem_config.totem_logging_configuration.log_level_debug = LOGSYS_LEVEL_DEBUG;
 	totem_config.totem_logging_configuration.log_level_trace = LOGSYS_LEVEL_TRACE;
 	totem_config.totem_logging_configuration.log_printf = _logsys_log_printf;
+	totem_config.totem_logging_configuration.log_callsite_register = _logsys_callsite_register;
 	logsys_config_apply();
 
 	/*
@@ -1342,6 +2039,10 @@ int main (int argc, char **argv, char **envp)
 	 * there is more then one interface in a system, so
 	 * in this case, only a warning is printed
 	 */
+	ring_id_store_init ();
+
+	corosync_set_cpu_affinity ();
+
 	/*
 	 * Join multicast group and setup delivery
 	 *  and configuration change functions
@@ -1377,6 +2078,10 @@ int main (int argc, char **argv, char **envp)
 		serialize_lock,
 		serialize_unlock);
 
+	if (icmap_get_uint32 ("totem.schedwrk_budget", &schedwrk_budget) == CS_OK) {
+		schedwrk_budget_set (schedwrk_budget);
+	}
+
 	/*
 	 * Start main processing loop
 	 */
@@ -1387,6 +2092,8 @@ int main (int argc, char **argv, char **envp)
 	 */
 	totempg_finalize ();
 
+	ring_id_store_finalize ();
+
 	/*
 	 * free the loop resources
 	 */
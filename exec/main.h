@@ -88,6 +88,12 @@ extern int corosync_sending_allowed (
 	const void *msg,
 	void *sending_allowed_private_data);
 
+extern int corosync_sending_allowed_batch (
+	unsigned int service,
+	const void *msg,
+	unsigned int msg_count,
+	void *sending_allowed_private_data);
+
 extern void corosync_sending_allowed_release (void *sending_allowed_private_data);
 
 extern void corosync_recheck_the_q_level(void *data);
@@ -214,7 +214,7 @@ static int pload_send_message (const void *arg)
 		} else {
 			msgs_sent++;
 		}
-	} while (msgs_sent < msgs_wanted);
+	} while (msgs_sent < msgs_wanted && !api->schedwrk_budget_exhausted ());
 
 	if (msgs_sent == msgs_wanted) {
 		return (0);
@@ -316,8 +316,9 @@ static void message_handler_req_exec_pload_start (
 	msgs_wanted = req_exec_pload_start->msg_count;
 	msg_size = req_exec_pload_start->msg_size;
 
-	api->schedwrk_create (
+	api->schedwrk_create_named (
 		&start_mcasting_handle,
+		"pload",
 		pload_send_message,
 		&start_mcasting_handle);
 }
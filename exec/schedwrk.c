@@ -33,10 +33,36 @@
  */
 
 #include <config.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#include <qb/qbdefs.h>
+#include <qb/qbutil.h>
 #include <corosync/totem/totempg.h>
 #include <corosync/hdb.h>
+#include <corosync/list.h>
+#include <corosync/icmap.h>
 #include "schedwrk.h"
 
+/*
+ * All work items are kept on one run queue served by a single token
+ * callback. Each callback runs queued items round robin until the time
+ * budget is used up, the rest is deferred to the next token.
+ */
+
+#define SCHEDWRK_STATS_MAX	32
+
+#define SCHEDWRK_NAME_DEFAULT	"unnamed"
+
+struct schedwrk_stats {
+	char name[64];
+	uint64_t runs;
+	uint64_t run_time;
+	uint64_t run_time_max;
+	uint64_t deferred;
+};
+
 static void (*serialize_lock) (void);
 static void (*serialize_unlock) (void);
 
@@ -45,48 +71,161 @@ DECLARE_HDB_DATABASE (schedwrk_instance_database,NULL);
 struct schedwrk_instance {
 	int (*schedwrk_fn) (const void *);
 	const void *context;
-	void *callback_handle;
+	hdb_handle_t handle;
+	struct schedwrk_stats *stats;
 	int lock;
+	int destroyed;
+	struct list_head list;
 };
 
-union u {
-  hdb_handle_t h;
-  const void *v;
-};
-static hdb_handle_t
-void2handle (const void *v) { union u u; u.v = v; return u.h; }
-static const void *
-handle2void (hdb_handle_t h) { union u u; u.h = h; return u.v; }
+static DECLARE_LIST_INIT (schedwrk_run_queue);
 
-static int schedwrk_do (enum totem_callback_token_type type, const void *context)
+static unsigned int schedwrk_run_queue_entries = 0;
+
+static void *schedwrk_callback_handle = NULL;
+
+static int schedwrk_running = 0;
+
+static uint64_t schedwrk_budget = SCHEDWRK_BUDGET_DEFAULT * QB_TIME_NS_IN_USEC;
+
+static uint64_t schedwrk_run_start;
+
+static uint64_t schedwrk_budget_exceeded = 0;
+
+static struct schedwrk_stats schedwrk_stats_list[SCHEDWRK_STATS_MAX];
+
+static int schedwrk_stats_entries = 0;
+
+static struct schedwrk_stats *schedwrk_stats_get (const char *name)
 {
-	hdb_handle_t handle = void2handle (context);
-	struct schedwrk_instance *instance;
-	int res;
+	int i;
 
-	res = hdb_handle_get (&schedwrk_instance_database,
-		hdb_nocheck_convert (handle),
-		(void *)&instance);
-	if (res != 0) {
-		goto error_exit;
+	if (name == NULL) {
+		name = SCHEDWRK_NAME_DEFAULT;
+	}
+
+	for (i = 0; i < schedwrk_stats_entries; i++) {
+		if (strcmp (schedwrk_stats_list[i].name, name) == 0) {
+			return (&schedwrk_stats_list[i]);
+		}
 	}
 
-	if (instance->lock)
-		serialize_lock ();
+	if (schedwrk_stats_entries == SCHEDWRK_STATS_MAX) {
+		/*
+		 * Table is full, account to the last entry
+		 */
+		return (&schedwrk_stats_list[SCHEDWRK_STATS_MAX - 1]);
+	}
+
+	i = schedwrk_stats_entries++;
+	snprintf (schedwrk_stats_list[i].name, sizeof (schedwrk_stats_list[i].name),
+		"%s", name);
+
+	return (&schedwrk_stats_list[i]);
+}
+
+static void schedwrk_run (struct schedwrk_instance *instance)
+{
+	uint64_t run_start;
+	uint64_t run_time;
+	int res;
 
+	run_start = qb_util_nano_current_get ();
 	res = instance->schedwrk_fn (instance->context);
+	run_time = qb_util_nano_current_get () - run_start;
 
-	if (instance->lock)
-		serialize_unlock ();
+	instance->stats->runs++;
+	instance->stats->run_time += run_time;
+	if (run_time > instance->stats->run_time_max) {
+		instance->stats->run_time_max = run_time;
+	}
+
+	/*
+	 * Item could have been destroyed by its own function
+	 */
+	if (instance->destroyed) {
+		return;
+	}
 
 	if (res == 0) {
-		hdb_handle_destroy (&schedwrk_instance_database, hdb_nocheck_convert (handle));
+		instance->destroyed = 1;
+		hdb_handle_destroy (&schedwrk_instance_database,
+			hdb_nocheck_convert (instance->handle));
+	} else {
+		list_add_tail (&instance->list, &schedwrk_run_queue);
+		schedwrk_run_queue_entries++;
+	}
+}
+
+static int schedwrk_do (enum totem_callback_token_type type, const void *context)
+{
+	struct schedwrk_instance *instance;
+	struct list_head *iter;
+	unsigned int entries;
+	unsigned int i;
+	int locked = 0;
+
+	schedwrk_running = 1;
+	schedwrk_run_start = qb_util_nano_current_get ();
+
+	/*
+	 * Items requeued or added while running wait for the next token
+	 */
+	entries = schedwrk_run_queue_entries;
+	for (i = 0; i < entries && !list_empty (&schedwrk_run_queue); i++) {
+		if (i > 0 && schedwrk_budget_exhausted ()) {
+			schedwrk_budget_exceeded++;
+			break;
+		}
+
+		instance = list_entry (schedwrk_run_queue.next, struct schedwrk_instance, list);
+		list_del (&instance->list);
+		list_init (&instance->list);
+		schedwrk_run_queue_entries--;
+
+		if (hdb_handle_get (&schedwrk_instance_database,
+		    hdb_nocheck_convert (instance->handle), (void *)&instance) != 0) {
+			continue;
+		}
+
+		if (instance->lock && !locked) {
+			serialize_lock ();
+			locked = 1;
+		} else
+		if (!instance->lock && locked) {
+			serialize_unlock ();
+			locked = 0;
+		}
+
+		schedwrk_run (instance);
+
+		hdb_handle_put (&schedwrk_instance_database,
+			hdb_nocheck_convert (instance->handle));
+	}
+
+	if (locked) {
+		serialize_unlock ();
+	}
+
+	/*
+	 * Items at the head of the queue were not reached
+	 */
+	for (iter = schedwrk_run_queue.next; i < entries && iter != &schedwrk_run_queue;
+	    iter = iter->next, i++) {
+		instance = list_entry (iter, struct schedwrk_instance, list);
+		instance->stats->deferred++;
+	}
+
+	schedwrk_running = 0;
+
+	if (list_empty (&schedwrk_run_queue)) {
+		/*
+		 * Returning 0 removes the token callback
+		 */
+		schedwrk_callback_handle = NULL;
+		return (0);
 	}
-        hdb_handle_put (&schedwrk_instance_database,
-		hdb_nocheck_convert (handle));
-	return (res);
 
-error_exit:
 	return (-1);
 }
 
@@ -98,8 +237,23 @@ void schedwrk_init (
 	serialize_unlock = serialize_unlock_fn;
 }
 
+void schedwrk_budget_set (uint32_t budget_usec)
+{
+	schedwrk_budget = (uint64_t)budget_usec * QB_TIME_NS_IN_USEC;
+}
+
+int schedwrk_budget_exhausted (void)
+{
+	if (!schedwrk_running || schedwrk_budget == 0) {
+		return (0);
+	}
+
+	return (qb_util_nano_current_get () - schedwrk_run_start >= schedwrk_budget);
+}
+
 static int schedwrk_internal_create (
 	hdb_handle_t *handle,
+	const char *name,
 	int (schedwrk_fn) (const void *),
 	const void *context,
 	int lock)
@@ -118,21 +272,36 @@ static int schedwrk_internal_create (
 		goto error_destroy;
 	}
 
-	totempg_callback_token_create (
-		&instance->callback_handle,
-		TOTEM_CALLBACK_TOKEN_SENT,
-		1,
-		schedwrk_do,
-		handle2void (*handle));
+	if (schedwrk_callback_handle == NULL) {
+		res = totempg_callback_token_create (
+			&schedwrk_callback_handle,
+			TOTEM_CALLBACK_TOKEN_SENT,
+			1,
+			schedwrk_do,
+			NULL);
+		if (res != 0) {
+			schedwrk_callback_handle = NULL;
+			goto error_put;
+		}
+	}
 
 	instance->schedwrk_fn = schedwrk_fn;
 	instance->context = context;
+	instance->handle = *handle;
+	instance->stats = schedwrk_stats_get (name);
 	instance->lock = lock;
+	instance->destroyed = 0;
+	list_init (&instance->list);
+	list_add_tail (&instance->list, &schedwrk_run_queue);
+	schedwrk_run_queue_entries++;
 
         hdb_handle_put (&schedwrk_instance_database, *handle);
 
 	return (0);
 
+error_put:
+	hdb_handle_put (&schedwrk_instance_database, *handle);
+
 error_destroy:
 	hdb_handle_destroy (&schedwrk_instance_database, *handle);
 
@@ -145,7 +314,7 @@ int schedwrk_create (
 	int (schedwrk_fn) (const void *),
 	const void *context)
 {
-	return schedwrk_internal_create (handle, schedwrk_fn, context, 1);
+	return schedwrk_internal_create (handle, NULL, schedwrk_fn, context, 1);
 }
 
 int schedwrk_create_nolock (
@@ -153,10 +322,70 @@ int schedwrk_create_nolock (
 	int (schedwrk_fn) (const void *),
 	const void *context)
 {
-	return schedwrk_internal_create (handle, schedwrk_fn, context, 0);
+	return schedwrk_internal_create (handle, NULL, schedwrk_fn, context, 0);
+}
+
+int schedwrk_create_named (
+	hdb_handle_t *handle,
+	const char *name,
+	int (schedwrk_fn) (const void *),
+	const void *context)
+{
+	return schedwrk_internal_create (handle, name, schedwrk_fn, context, 1);
 }
 
 void schedwrk_destroy (hdb_handle_t handle)
 {
-	hdb_handle_destroy (&schedwrk_instance_database, handle);
+	struct schedwrk_instance *instance;
+
+	if (hdb_handle_get (&schedwrk_instance_database,
+	    hdb_nocheck_convert (handle), (void *)&instance) != 0) {
+		return;
+	}
+
+	if (!list_empty (&instance->list)) {
+		list_del (&instance->list);
+		list_init (&instance->list);
+		schedwrk_run_queue_entries--;
+	}
+	instance->destroyed = 1;
+
+	hdb_handle_put (&schedwrk_instance_database, hdb_nocheck_convert (handle));
+	hdb_handle_destroy (&schedwrk_instance_database, hdb_nocheck_convert (handle));
+
+	/*
+	 * Inside of schedwrk_do the callback is removed by its return value
+	 */
+	if (!schedwrk_running && list_empty (&schedwrk_run_queue) &&
+	    schedwrk_callback_handle != NULL) {
+		totempg_callback_token_destroy (&schedwrk_callback_handle);
+		schedwrk_callback_handle = NULL;
+	}
+}
+
+void schedwrk_stats_update (void)
+{
+	char key_name[ICMAP_KEYNAME_MAXLEN];
+	int i;
+
+	icmap_set_uint64 ("runtime.schedwrk.budget_exceeded", schedwrk_budget_exceeded);
+	icmap_set_uint32 ("runtime.schedwrk.queued", schedwrk_run_queue_entries);
+
+	for (i = 0; i < schedwrk_stats_entries; i++) {
+		snprintf (key_name, ICMAP_KEYNAME_MAXLEN, "runtime.schedwrk.%s.runs",
+			schedwrk_stats_list[i].name);
+		icmap_set_uint64 (key_name, schedwrk_stats_list[i].runs);
+
+		snprintf (key_name, ICMAP_KEYNAME_MAXLEN, "runtime.schedwrk.%s.run_time",
+			schedwrk_stats_list[i].name);
+		icmap_set_uint64 (key_name, schedwrk_stats_list[i].run_time / QB_TIME_NS_IN_USEC);
+
+		snprintf (key_name, ICMAP_KEYNAME_MAXLEN, "runtime.schedwrk.%s.run_time_max",
+			schedwrk_stats_list[i].name);
+		icmap_set_uint64 (key_name, schedwrk_stats_list[i].run_time_max / QB_TIME_NS_IN_USEC);
+
+		snprintf (key_name, ICMAP_KEYNAME_MAXLEN, "runtime.schedwrk.%s.deferred",
+			schedwrk_stats_list[i].name);
+		icmap_set_uint64 (key_name, schedwrk_stats_list[i].deferred);
+	}
 }
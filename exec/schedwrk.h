@@ -34,6 +34,11 @@
 #ifndef SCHEDWRK_H_DEFINED
 #define SCHEDWRK_H_DEFINED
 
+/*
+ * Default time budget of one token callback in microseconds
+ */
+#define SCHEDWRK_BUDGET_DEFAULT		10000
+
 extern void schedwrk_init (
         void (*serialize_lock_fn) (void),
         void (*serialize_unlock_fn) (void));
@@ -48,6 +53,18 @@ extern int schedwrk_create_nolock (
         int (schedwrk_fn) (const void *),
         const void *context);
 
+extern int schedwrk_create_named (
+        hdb_handle_t *handle,
+        const char *name,
+        int (schedwrk_fn) (const void *),
+        const void *context);
+
 extern void schedwrk_destroy (hdb_handle_t handle);
 
+extern void schedwrk_budget_set (uint32_t budget_usec);
+
+extern int schedwrk_budget_exhausted (void);
+
+extern void schedwrk_stats_update (void);
+
 #endif /* SCHEDWRK_H_DEFINED */
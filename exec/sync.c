@@ -44,6 +44,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <errno.h>
+#include <stddef.h>
 #include <time.h>
 #include <unistd.h>
 #include <netinet/in.h>
@@ -69,6 +70,7 @@ LOGSYS_DECLARE_SUBSYS ("SYNC");
 enum sync_process_state {
 	INIT,
 	PROCESS,
+	PROCESSED,
 	ACTIVATE
 };
 
@@ -90,12 +92,15 @@ struct service_entry {
 	int (*sync_process) (void);
 	void (*sync_activate) (void);
 	enum sync_process_state state;
+	uint64_t depends;
+	int stage;
 	char name[128];
 };
 
 struct processor_entry {
 	int nodeid;
 	int received;
+	int staged;
 };
 
 struct req_exec_memb_determine_message {
@@ -108,8 +113,16 @@ struct req_exec_service_build_message {
 	struct memb_ring_id ring_id __attribute__((aligned(8)));
 	int service_list_entries __attribute__((aligned(8)));
 	int service_list[128] __attribute__((aligned(8)));
+	/*
+	 * Appended after the original message so older nodes still parse it.
+	 * Only if every member sends it are services synchronized in stages.
+	 */
+	uint64_t service_depends[128] __attribute__((aligned(8)));
 };
 
+#define SERVICE_BUILD_MESSAGE_V1_SIZE \
+	offsetof (struct req_exec_service_build_message, service_depends)
+
 struct req_exec_barrier_message {
 	struct qb_ipc_request_header header __attribute__((aligned(8)));
 	struct memb_ring_id ring_id __attribute__((aligned(8)));
@@ -127,7 +140,9 @@ static unsigned int my_memb_determine_list[PROCESSOR_COUNT_MAX];
 
 static unsigned int my_memb_determine_list_entries = 0;
 
-static int my_processing_idx = 0;
+static int my_processing_stage = 0;
+
+static int my_stage_entries = 0;
 
 static hdb_handle_t my_schedwrk_handle;
 
@@ -228,16 +243,25 @@ static void sync_barrier_handler (unsigned int nodeid, const void *msg)
 		}
 	}
 	if (barrier_reached) {
-		log_printf (LOGSYS_LEVEL_DEBUG, "Committing synchronization for %s",
-			my_service_list[my_processing_idx].name);
-		my_service_list[my_processing_idx].state = ACTIVATE;
+		/*
+		 * One barrier commits every service of the stage, activation
+		 * is still done in service id order
+		 */
+		for (i = 0; i < my_service_list_entries; i++) {
+			if (my_service_list[i].stage != my_processing_stage) {
+				continue;
+			}
+			log_printf (LOGSYS_LEVEL_DEBUG, "Committing synchronization for %s",
+				my_service_list[i].name);
+			my_service_list[i].state = ACTIVATE;
 
-		if (my_sync_callbacks_retrieve(my_service_list[my_processing_idx].service_id, NULL) != -1) {
-			my_service_list[my_processing_idx].sync_activate ();
+			if (my_sync_callbacks_retrieve(my_service_list[i].service_id, NULL) != -1) {
+				my_service_list[i].sync_activate ();
+			}
 		}
 
-		my_processing_idx += 1;
-		if (my_service_list_entries == my_processing_idx) {
+		my_processing_stage += 1;
+		if (my_stage_entries == my_processing_stage) {
 			my_memb_determine_list_entries = 0;
 			sync_synchronization_completed ();
 		} else {
@@ -301,19 +325,116 @@ static void sync_memb_determine (unsigned int nodeid, const void *msg)
 	}
 }
 
-static void sync_service_build_handler (unsigned int nodeid, const void *msg)
+static int sync_service_index_get (int service_id)
+{
+	int i;
+
+	for (i = 0; i < my_service_list_entries; i++) {
+		if (my_service_list[i].service_id == service_id) {
+			return (i);
+		}
+	}
+	return (-1);
+}
+
+/*
+ * Assign each service to a stage so that everything it depends on is
+ * activated in an earlier stage. Inputs are the merged service list and
+ * dependencies, which are identical on all members, so every node
+ * computes the same stages.
+ */
+static void sync_stages_build (void)
+{
+	int staged = 1;
+	int assigned;
+	int progress;
+	int stage;
+	int i, j;
+
+	for (i = 0; i < my_processor_list_entries; i++) {
+		if (my_processor_list[i].staged == 0) {
+			staged = 0;
+		}
+	}
+
+	for (i = 0; i < my_service_list_entries; i++) {
+		my_service_list[i].stage = -1;
+	}
+
+	assigned = 0;
+	progress = 1;
+	while (staged && progress && assigned < my_service_list_entries) {
+		progress = 0;
+		for (i = 0; i < my_service_list_entries; i++) {
+			if (my_service_list[i].stage != -1) {
+				continue;
+			}
+			stage = 0;
+			for (j = 0; j < my_service_list_entries; j++) {
+				if ((my_service_list[i].depends &
+				    (1ULL << my_service_list[j].service_id)) == 0 || j == i) {
+					continue;
+				}
+				if (my_service_list[j].stage == -1) {
+					stage = -1;
+					break;
+				}
+				if (my_service_list[j].stage + 1 > stage) {
+					stage = my_service_list[j].stage + 1;
+				}
+			}
+			if (stage != -1) {
+				my_service_list[i].stage = stage;
+				assigned += 1;
+				progress = 1;
+			}
+		}
+	}
+
+	if (staged && assigned != my_service_list_entries) {
+		log_printf (LOGSYS_LEVEL_WARNING,
+			"Dependency loop between sync services, synchronizing them one by one");
+		staged = 0;
+	}
+
+	/*
+	 * Older members wait for one barrier per service
+	 */
+	if (staged == 0) {
+		for (i = 0; i < my_service_list_entries; i++) {
+			my_service_list[i].stage = i;
+		}
+	}
+
+	my_stage_entries = 0;
+	for (i = 0; i < my_service_list_entries; i++) {
+		if (my_service_list[i].stage + 1 > my_stage_entries) {
+			my_stage_entries = my_service_list[i].stage + 1;
+		}
+	}
+	my_processing_stage = 0;
+
+	log_printf (LOGSYS_LEVEL_DEBUG, "Synchronizing %d services in %d stages",
+		my_service_list_entries, my_stage_entries);
+}
+
+static void sync_service_build_handler (unsigned int nodeid, const void *msg,
+	unsigned int msg_len)
 {
 	const struct req_exec_service_build_message *req_exec_service_build_message = msg;
 	int i, j;
 	int barrier_reached = 1;
 	int found;
 	int qsort_trigger = 0;
+	int staged;
 
 	if (memcmp (&my_ring_id, &req_exec_service_build_message->ring_id,
 		sizeof (struct memb_ring_id)) != 0) {
 		log_printf (LOGSYS_LEVEL_DEBUG, "service build for old ring - discarding");
 		return;
 	}
+	staged = (msg_len >= sizeof (struct req_exec_service_build_message));
+
 	for (i = 0; i < req_exec_service_build_message->service_list_entries; i++) {
 
 		found = 0;
@@ -349,9 +470,18 @@ static void sync_service_build_handler (unsigned int nodeid, const void *msg)
 		qsort (my_service_list, my_service_list_entries,
 			sizeof (struct service_entry), service_entry_compare);
 	}
+	if (staged) {
+		for (i = 0; i < req_exec_service_build_message->service_list_entries; i++) {
+			j = sync_service_index_get (
+				req_exec_service_build_message->service_list[i]);
+			my_service_list[j].depends |=
+				req_exec_service_build_message->service_depends[i];
+		}
+	}
 	for (i = 0; i < my_processor_list_entries; i++) {
 		if (my_processor_list[i].nodeid == nodeid) {
 			my_processor_list[i].received = 1;
+			my_processor_list[i].staged = staged;
 		}
 	}
 	for (i = 0; i < my_processor_list_entries; i++) {
@@ -360,6 +490,7 @@ static void sync_service_build_handler (unsigned int nodeid, const void *msg)
 		}
 	}
 	if (barrier_reached) {
+		sync_stages_build ();
 		sync_process_enter ();
 	}
 }
@@ -377,7 +508,7 @@ static void sync_deliver_fn (
 			sync_barrier_handler (nodeid, msg);
 			break;
 		case MESSAGE_REQ_SYNC_SERVICE_BUILD:
-			sync_service_build_handler (nodeid, msg);
+			sync_service_build_handler (nodeid, msg, msg_len);
 			break;
 		case MESSAGE_REQ_SYNC_MEMB_DETERMINE:
 			sync_memb_determine (nodeid, msg);
@@ -463,7 +594,8 @@ static void sync_process_enter (void)
 	for (i = 0; i < my_processor_list_entries; i++) {
 		my_processor_list[i].received = 0;
 	}
-	schedwrk_create (&my_schedwrk_handle,
+	schedwrk_create_named (&my_schedwrk_handle,
+		"sync",
 		schedwrk_processor,
 		NULL);
 }
@@ -482,6 +614,7 @@ static void sync_servicelist_build_enter (
 	for (i = 0; i < member_list_entries; i++) {
 		my_processor_list[i].nodeid = member_list[i];
 		my_processor_list[i].received = 0;
+		my_processor_list[i].staged = 0;
 	}
 	my_processor_list_entries = member_list_entries;
 
@@ -489,7 +622,8 @@ static void sync_servicelist_build_enter (
 		member_list_entries * sizeof (unsigned int));
 	my_member_list_entries = member_list_entries;
 
-	my_processing_idx = 0;
+	my_processing_stage = 0;
+	my_stage_entries = 0;
 
 	memset(my_service_list, 0, sizeof (struct service_entry) * SERVICES_COUNT_MAX);
 	my_service_list_entries = 0;
@@ -510,63 +644,98 @@ static void sync_servicelist_build_enter (
 		my_service_list[my_service_list_entries].sync_process = sync_callbacks.sync_process;
 		my_service_list[my_service_list_entries].sync_abort = sync_callbacks.sync_abort;
 		my_service_list[my_service_list_entries].sync_activate = sync_callbacks.sync_activate;
+		my_service_list[my_service_list_entries].depends = sync_callbacks.sync_depends;
 		my_service_list_entries += 1;
 	}
 
+	memset (service_build.service_depends, 0, sizeof (service_build.service_depends));
 	for (i = 0; i < my_service_list_entries; i++) {
 		service_build.service_list[i] =
 			my_service_list[i].service_id;
+		service_build.service_depends[i] =
+			my_service_list[i].depends;
 	}
 	service_build.service_list_entries = my_service_list_entries;
 
 	service_build_message_transmit (&service_build);
 }
 
-static int schedwrk_processor (const void *context)
+static void sync_trans_list_update (void)
 {
-	int res = 0;
-
-	if (my_service_list[my_processing_idx].state == INIT) {
-		unsigned int old_trans_list[PROCESSOR_COUNT_MAX];
-		size_t old_trans_list_entries = 0;
-		int o, m;
-		my_service_list[my_processing_idx].state = PROCESS;
-
-		memcpy (old_trans_list, my_trans_list, my_trans_list_entries *
-			sizeof (unsigned int));
-		old_trans_list_entries = my_trans_list_entries;
-
-		my_trans_list_entries = 0;
-		for (o = 0; o < old_trans_list_entries; o++) {
-			for (m = 0; m < my_member_list_entries; m++) {
-				if (old_trans_list[o] == my_member_list[m]) {
-					my_trans_list[my_trans_list_entries] = my_member_list[m];
-					my_trans_list_entries++;
-					break;
-				}
+	unsigned int old_trans_list[PROCESSOR_COUNT_MAX];
+	size_t old_trans_list_entries = 0;
+	int o, m;
+
+	memcpy (old_trans_list, my_trans_list, my_trans_list_entries *
+		sizeof (unsigned int));
+	old_trans_list_entries = my_trans_list_entries;
+
+	my_trans_list_entries = 0;
+	for (o = 0; o < old_trans_list_entries; o++) {
+		for (m = 0; m < my_member_list_entries; m++) {
+			if (old_trans_list[o] == my_member_list[m]) {
+				my_trans_list[my_trans_list_entries] = my_member_list[m];
+				my_trans_list_entries++;
+				break;
 			}
 		}
+	}
+}
 
-		if (my_sync_callbacks_retrieve(my_service_list[my_processing_idx].service_id, NULL) != -1) {
-			my_service_list[my_processing_idx].sync_init (my_trans_list,
+/*
+ * All services of the current stage are initialized together and then
+ * processed round robin, so their sync messages share token rotations.
+ * A single barrier is entered once every one of them has finished.
+ */
+static int schedwrk_processor (const void *context)
+{
+	int trans_list_updated = 0;
+	int pending = 0;
+	int res;
+	int i;
+
+	for (i = 0; i < my_service_list_entries; i++) {
+		if (my_service_list[i].stage != my_processing_stage ||
+		    my_service_list[i].state != INIT) {
+			continue;
+		}
+		my_service_list[i].state = PROCESS;
+
+		if (trans_list_updated == 0) {
+			sync_trans_list_update ();
+			trans_list_updated = 1;
+		}
+
+		if (my_sync_callbacks_retrieve(my_service_list[i].service_id, NULL) != -1) {
+			my_service_list[i].sync_init (my_trans_list,
 				my_trans_list_entries, my_member_list,
 				my_member_list_entries,
 				&my_ring_id);
 		}
 	}
-	if (my_service_list[my_processing_idx].state == PROCESS) {
-		my_service_list[my_processing_idx].state = PROCESS;
-		if (my_sync_callbacks_retrieve(my_service_list[my_processing_idx].service_id, NULL) != -1) {
-			res = my_service_list[my_processing_idx].sync_process ();
+
+	for (i = 0; i < my_service_list_entries; i++) {
+		if (my_service_list[i].stage != my_processing_stage ||
+		    my_service_list[i].state != PROCESS) {
+			continue;
+		}
+		if (my_sync_callbacks_retrieve(my_service_list[i].service_id, NULL) != -1) {
+			res = my_service_list[i].sync_process ();
 		} else {
 			res = 0;
 		}
 		if (res == 0) {
-			sync_barrier_enter();
+			my_service_list[i].state = PROCESSED;
 		} else {
-			return (-1);
+			pending = 1;
 		}
 	}
+
+	if (pending) {
+		return (-1);
+	}
+
+	sync_barrier_enter();
 	return (0);
 }
 
@@ -601,11 +770,27 @@ void sync_save_transitional (
 
 void sync_abort (void)
 {
+	int i;
+
 	ENTER();
 	if (my_state == SYNC_PROCESS) {
 		schedwrk_destroy (my_schedwrk_handle);
-		if (my_sync_callbacks_retrieve(my_service_list[my_processing_idx].service_id, NULL) != -1) {
-			my_service_list[my_processing_idx].sync_abort ();
+	}
+
+	/*
+	 * Every service of the current stage which was initialized but not
+	 * activated yet is aborted, including ones which already finished
+	 * processing and wait for the others or for the barrier
+	 */
+	for (i = 0; i < my_service_list_entries; i++) {
+		if (my_service_list[i].stage != my_processing_stage ||
+		    (my_service_list[i].state != PROCESS &&
+		     my_service_list[i].state != PROCESSED)) {
+			continue;
+		}
+		my_service_list[i].state = INIT;
+		if (my_sync_callbacks_retrieve(my_service_list[i].service_id, NULL) != -1) {
+			my_service_list[i].sync_abort ();
 		}
 	}
 
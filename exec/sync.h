@@ -45,6 +45,7 @@ struct sync_callbacks {
 	int (*sync_process) (void);
 	void (*sync_activate) (void);
 	void (*sync_abort) (void);
+	uint64_t sync_depends;
 	const char *name;
 };
 
@@ -79,6 +79,7 @@
 #define RRP_AUTORECOVERY_CHECK_TIMEOUT		1000
 
 #define DEFAULT_PORT				5405
+#define SHM_PATH				"/dev/shm/corosync"
 
 static char error_string_response[512];
 
@@ -130,6 +131,12 @@ static uint32_t *totem_get_param_by_name(struct totem_config *totem_config, cons
 		return &totem_config->max_messages;
 	if (strcmp(param_name, "totem.miss_count_const") == 0)
 		return &totem_config->miss_count_const;
+	if (strcmp(param_name, "totem.shm_delay") == 0)
+		return &totem_config->shm_delay;
+	if (strcmp(param_name, "totem.shm_loss") == 0)
+		return &totem_config->shm_loss;
+	if (strcmp(param_name, "totem.shm_reorder") == 0)
+		return &totem_config->shm_reorder;
 
 	return NULL;
 }
@@ -231,6 +238,12 @@ static void totem_volatile_config_read (struct totem_config *totem_config, const
 	    RRP_AUTORECOVERY_CHECK_TIMEOUT, 0);
 
 	totem_volatile_config_set_value(totem_config, "totem.heartbeat_failures_allowed", deleted_key, 0, 1);
+
+	totem_volatile_config_set_value(totem_config, "totem.shm_delay", deleted_key, 0, 1);
+
+	totem_volatile_config_set_value(totem_config, "totem.shm_loss", deleted_key, 0, 1);
+
+	totem_volatile_config_set_value(totem_config, "totem.shm_reorder", deleted_key, 0, 1);
 }
 
 static int totem_volatile_config_validate (
@@ -323,6 +336,20 @@ static int totem_volatile_config_validate (
 		goto parse_error;
 	}
 
+	if (totem_config->shm_loss > 100) {
+		snprintf (local_error_reason, sizeof(local_error_reason),
+			"The shm loss parameter (%d %%) may not be greater than 100 %%.",
+			totem_config->shm_loss);
+		goto parse_error;
+	}
+
+	if (totem_config->shm_reorder > 100) {
+		snprintf (local_error_reason, sizeof(local_error_reason),
+			"The shm reorder parameter (%d %%) may not be greater than 100 %%.",
+			totem_config->shm_reorder);
+		goto parse_error;
+	}
+
 	if (totem_config->rrp_token_expired_timeout < MINIMUM_TIMEOUT) {
 		snprintf (local_error_reason, sizeof(local_error_reason),
 			"The RRP token expired timeout parameter (%d ms) may not be less than (%d ms).",
@@ -608,11 +635,19 @@ static int find_local_node_in_nodelist(struct totem_config *totem_config)
 	char *node_addr_str;
 	struct totem_ip_address node_addr;
 
-	res = totemip_iface_check(&totem_config->interfaces[0].bindnet,
-		&bind_addr, &interface_up, &interface_num,
-		totem_config->clear_node_high_bit);
-	if (res == -1) {
-		return (-1);
+	if (totem_config->transport_number == TOTEM_TRANSPORT_SHM) {
+		/*
+		 * Shm addresses are only names, bindnetaddr is the exact address
+		 * of the local node
+		 */
+		memcpy(&bind_addr, &totem_config->interfaces[0].bindnet, sizeof(bind_addr));
+	} else {
+		res = totemip_iface_check(&totem_config->interfaces[0].bindnet,
+			&bind_addr, &interface_up, &interface_num,
+			totem_config->clear_node_high_bit);
+		if (res == -1) {
+			return (-1);
+		}
 	}
 
 	iter = icmap_iter_init("nodelist.node.");
@@ -1204,6 +1239,24 @@ extern int totem_config_read (
 		if (strcmp (str, "iba") == 0) {
 			totem_config->transport_number = TOTEM_TRANSPORT_RDMA;
 		}
+
+		if (strcmp (str, "shm") == 0) {
+			totem_config->transport_number = TOTEM_TRANSPORT_SHM;
+		}
+		free(str);
+	}
+
+	if (icmap_get_string("totem.shm_path", &str) == CS_OK) {
+		totem_config->shm_path = str;
+	} else {
+		totem_config->shm_path = strdup(SHM_PATH);
+	}
+
+	totem_config->io_uring = 0;
+	if (icmap_get_string("totem.io_uring", &str) == CS_OK) {
+		if (strcmp (str, "yes") == 0) {
+			totem_config->io_uring = 1;
+		}
 		free(str);
 	}
 
@@ -1359,10 +1412,23 @@ int totem_config_validate (
 	 */
 	if (strcmp (totem_config->rrp_mode, "none") &&
 		strcmp (totem_config->rrp_mode, "active") &&
-		strcmp (totem_config->rrp_mode, "passive")) {
+		strcmp (totem_config->rrp_mode, "passive") &&
+		strcmp (totem_config->rrp_mode, "stripe")) {
 		snprintf (local_error_reason, sizeof(local_error_reason),
-			"The RRP mode \"%s\" specified is invalid.  It must be none, active, or passive.\n", totem_config->rrp_mode);
+			"The RRP mode \"%s\" specified is invalid.  It must be none, active, passive or stripe.\n", totem_config->rrp_mode);
+		goto parse_error;
+	}
+
+	if (totem_config->io_uring) {
+#ifdef HAVE_LIBURING
+		if (totem_config->transport_number != TOTEM_TRANSPORT_UDPU) {
+			error_reason = "io_uring can only be used with the udpu transport";
+			goto parse_error;
+		}
+#else
+		error_reason = "io_uring support was not compiled in";
 		goto parse_error;
+#endif
 	}
 
 	if (strcmp (totem_config->rrp_mode, "none") == 0) {
@@ -199,6 +199,11 @@ struct totemiba_instance {
 		const char *format,
 		...)__attribute__((format(printf, 6, 7)));
 
+	int (*totemiba_log_callsite_register) (
+		struct logsys_callsite *cs,
+		int level,
+		int subsys);
+
 
 	int totemiba_subsys_id;
 
@@ -221,13 +226,17 @@ union u {
 	void *v;
 };
 
-#define log_printf(level, format, args...)			\
-do {								\
-        instance->totemiba_log_printf (				\
-			level,					\
-			instance->totemiba_subsys_id,		\
-			__FUNCTION__, __FILE__, __LINE__,	\
-			(const char *)format, ##args);		\
+#define log_printf(level, format, args...)				\
+do {									\
+	static struct logsys_callsite _cs = LOGSYS_CALLSITE_INIT;	\
+	if (LOGSYS_CALLSITE_ENABLED(&_cs, level,			\
+	    instance->totemiba_subsys_id,				\
+	    instance->totemiba_log_callsite_register)) {		\
+		instance->totemiba_log_printf (level,			\
+			instance->totemiba_subsys_id,			\
+			__FUNCTION__, __FILE__, __LINE__,		\
+			(const char *)format, ##args);			\
+	}								\
 } while (0);
 
 struct recv_buf {
@@ -772,13 +781,13 @@ static int recv_token_accept_setup (struct totemiba_instance *instance)
 
 	qb_loop_poll_add (
 		instance->totemiba_poll_handle,
-		QB_LOOP_MED,
+		QB_LOOP_HIGH,
 		instance->recv_token_recv_completion_channel->fd,
 		POLLIN, instance, recv_token_cq_recv_event_fn);
 
 	qb_loop_poll_add (
 		instance->totemiba_poll_handle,
-		QB_LOOP_MED,
+		QB_LOOP_HIGH,
 		instance->recv_token_send_completion_channel->fd,
 		POLLIN, instance, recv_token_cq_send_event_fn);
 
@@ -1038,19 +1047,19 @@ static int send_token_bind (struct totemiba_instance *instance)
 	
 	qb_loop_poll_add (
 		instance->totemiba_poll_handle,
-		QB_LOOP_MED,
+		QB_LOOP_HIGH,
 		instance->send_token_recv_completion_channel->fd,
 		POLLIN, instance, send_token_cq_recv_event_fn);
 
 	qb_loop_poll_add (
 		instance->totemiba_poll_handle,
-		QB_LOOP_MED,
+		QB_LOOP_HIGH,
 		instance->send_token_send_completion_channel->fd,
 		POLLIN, instance, send_token_cq_send_event_fn);
 
 	qb_loop_poll_add (
 		instance->totemiba_poll_handle,
-		QB_LOOP_MED,
+		QB_LOOP_HIGH,
 		instance->send_token_channel->fd,
 		POLLIN, instance, send_token_rdma_event_fn);
 
@@ -1142,7 +1151,7 @@ static int recv_token_bind (struct totemiba_instance *instance)
 
 	qb_loop_poll_add (
 		instance->totemiba_poll_handle,
-		QB_LOOP_MED,
+		QB_LOOP_HIGH,
 		instance->listen_recv_token_channel->fd,
 		POLLIN, instance, recv_token_rdma_event_fn);
 
@@ -1257,19 +1266,19 @@ static int mcast_bind (struct totemiba_instance *instance)
 
 	qb_loop_poll_add (
 		instance->totemiba_poll_handle,
-		QB_LOOP_MED,
+		QB_LOOP_HIGH,
 		instance->mcast_recv_completion_channel->fd,
 		POLLIN, instance, mcast_cq_recv_event_fn);
 
 	qb_loop_poll_add (
 		instance->totemiba_poll_handle,
-		QB_LOOP_MED,
+		QB_LOOP_HIGH,
 		instance->mcast_send_completion_channel->fd,
 		POLLIN, instance, mcast_cq_send_event_fn);
 
 	qb_loop_poll_add (
 		instance->totemiba_poll_handle,
-		QB_LOOP_MED,
+		QB_LOOP_HIGH,
 		instance->mcast_channel->fd,
 		POLLIN, instance, mcast_rdma_event_fn);
 
@@ -1403,6 +1412,8 @@ int totemiba_initialize (
 
 	instance->totemiba_subsys_id = totem_config->totem_logging_configuration.log_subsys_id;
 	instance->totemiba_log_printf = totem_config->totem_logging_configuration.log_printf;
+	instance->totemiba_log_callsite_register =
+		totem_config->totem_logging_configuration.log_callsite_register;
 
 	*iba_context = instance;
 	return (res);
@@ -42,6 +42,7 @@
 #endif
 #include <totemudp.h>
 #include <totemudpu.h>
+#include <totemshm.h>
 #include <totemnet.h>
 #include <qb/qbloop.h>
 
@@ -138,7 +139,7 @@ struct transport {
 };
 
 struct transport transport_entries[] = {
-	{
+	[TOTEM_TRANSPORT_UDP] = {
 		.name = "UDP/IP Multicast",
 		.initialize = totemudp_initialize,
 		.buffer_alloc = totemudp_buffer_alloc,
@@ -158,7 +159,7 @@ struct transport transport_entries[] = {
 		.crypto_set = totemudp_crypto_set,
 		.recv_mcast_empty = totemudp_recv_mcast_empty
 	},
-	{
+	[TOTEM_TRANSPORT_UDPU] = {
 		.name = "UDP/IP Unicast",
 		.initialize = totemudpu_initialize,
 		.buffer_alloc = totemudpu_buffer_alloc,
@@ -182,7 +183,7 @@ struct transport transport_entries[] = {
 		.member_set_active = totemudpu_member_set_active
 	},
 #ifdef HAVE_RDMA
-	{
+	[TOTEM_TRANSPORT_RDMA] = {
 		.name = "Infiniband/IP",
 		.initialize = totemiba_initialize,
 		.buffer_alloc = totemiba_buffer_alloc,
@@ -202,8 +203,31 @@ struct transport transport_entries[] = {
 		.crypto_set = totemiba_crypto_set,
 		.recv_mcast_empty = totemiba_recv_mcast_empty
 
-	}
+	},
 #endif
+	[TOTEM_TRANSPORT_SHM] = {
+		.name = "Shared memory",
+		.initialize = totemshm_initialize,
+		.buffer_alloc = totemshm_buffer_alloc,
+		.buffer_release = totemshm_buffer_release,
+		.processor_count_set = totemshm_processor_count_set,
+		.token_send = totemshm_token_send,
+		.mcast_flush_send = totemshm_mcast_flush_send,
+		.mcast_noflush_send = totemshm_mcast_noflush_send,
+		.recv_flush = totemshm_recv_flush,
+		.send_flush = totemshm_send_flush,
+		.iface_check = totemshm_iface_check,
+		.finalize = totemshm_finalize,
+		.net_mtu_adjust = totemshm_net_mtu_adjust,
+		.iface_print = totemshm_iface_print,
+		.iface_get = totemshm_iface_get,
+		.token_target_set = totemshm_token_target_set,
+		.crypto_set = totemshm_crypto_set,
+		.recv_mcast_empty = totemshm_recv_mcast_empty,
+		.member_add = totemshm_member_add,
+		.member_remove = totemshm_member_remove,
+		.member_set_active = totemshm_member_set_active
+	}
 };
 	
 struct totemnet_instance {
@@ -220,16 +244,25 @@ struct totemnet_instance {
                 const char *format,
                 ...)__attribute__((format(printf, 6, 7)));
 
+	int (*totemnet_log_callsite_register) (
+		struct logsys_callsite *cs,
+		int level,
+		int subsys);
+
         int totemnet_subsys_id;
 };
 
 #define log_printf(level, format, args...)				\
 do {									\
-	instance->totemnet_log_printf (					\
-		level,							\
-		instance->totemnet_subsys_id,				\
-		__FUNCTION__, __FILE__, __LINE__,			\
-		(const char *)format, ##args);				\
+	static struct logsys_callsite _cs = LOGSYS_CALLSITE_INIT;	\
+	if (LOGSYS_CALLSITE_ENABLED(&_cs, level,			\
+	    instance->totemnet_subsys_id,				\
+	    instance->totemnet_log_callsite_register)) {		\
+		instance->totemnet_log_printf (level,			\
+			instance->totemnet_subsys_id,			\
+			__FUNCTION__, __FILE__, __LINE__,		\
+			(const char *)format, ##args);			\
+	}								\
 } while (0);
 
 static void totemnet_instance_initialize (
@@ -239,6 +272,8 @@ static void totemnet_instance_initialize (
 	int transport;
 
 	instance->totemnet_log_printf = config->totem_logging_configuration.log_printf;
+	instance->totemnet_log_callsite_register =
+		config->totem_logging_configuration.log_callsite_register;
 	instance->totemnet_subsys_id = config->totem_logging_configuration.log_subsys_id;
 
 
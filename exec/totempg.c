@@ -187,6 +187,11 @@ static void (*totempg_log_printf) (
 	int line,
 	const char *format, ...) __attribute__((format(printf, 6, 7)));
 
+static int (*totempg_log_callsite_register) (
+	struct logsys_callsite *cs,
+	int level,
+	int subsys);
+
 struct totem_config *totempg_totem_config;
 
 static totempg_stats_t totempg_stats;
@@ -268,12 +273,17 @@ static pthread_mutex_t callback_token_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 static pthread_mutex_t mcast_msg_mutex = PTHREAD_MUTEX_INITIALIZER;
 
-#define log_printf(level, format, args...)			\
-do {								\
-        totempg_log_printf(level,				\
-			   totempg_subsys_id,			\
-			   __FUNCTION__, __FILE__, __LINE__,	\
-			   format, ##args);			\
+#define log_printf(level, format, args...)				\
+do {									\
+	static struct logsys_callsite _cs = LOGSYS_CALLSITE_INIT;	\
+	if (LOGSYS_CALLSITE_ENABLED(&_cs, level,			\
+	    totempg_subsys_id,						\
+	    totempg_log_callsite_register)) {				\
+		totempg_log_printf (level,				\
+			totempg_subsys_id,				\
+			__FUNCTION__, __FILE__, __LINE__,		\
+			format, ##args);				\
+	}								\
 } while (0);
 
 static int msg_count_send_ok (int msg_count);
@@ -809,6 +819,8 @@ int totempg_initialize (
 	totempg_log_level_notice = totem_config->totem_logging_configuration.log_level_notice;
 	totempg_log_level_debug = totem_config->totem_logging_configuration.log_level_debug;
 	totempg_log_printf = totem_config->totem_logging_configuration.log_printf;
+	totempg_log_callsite_register =
+		totem_config->totem_logging_configuration.log_callsite_register;
 	totempg_subsys_id = totem_config->totem_logging_configuration.log_subsys_id;
 
 	fragmentation_data = malloc (TOTEMPG_PACKET_SIZE);
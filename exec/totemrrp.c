@@ -63,6 +63,7 @@
 #include <corosync/swab.h>
 #include <qb/qbdefs.h>
 #include <qb/qbloop.h>
+#include <qb/qbutil.h>
 #define LOGSYS_UTILS_ONLY 1
 #include <corosync/logsys.h>
 
@@ -93,6 +94,19 @@ struct passive_instance {
 	unsigned int msg_xmit_iface;
 };
 
+/*
+ * Number of recently delivered multicast messages remembered by active rrp
+ * to suppress the copies received on the other rings. Must be power of 2.
+ */
+#define ACTIVE_MCAST_SEEN_MAX			256
+
+struct active_mcast_seen {
+	unsigned int gen;
+	unsigned int seq;
+	unsigned int rep_nodeid;
+	unsigned long long ring_seq;
+};
+
 struct active_instance {
 	struct totemrrp_instance *rrp_instance;
 	unsigned int *faulty;
@@ -104,6 +118,15 @@ struct active_instance {
         qb_loop_timer_handle timer_expired_token;
         qb_loop_timer_handle timer_problem_decrementer;
 	void *totemrrp_context;
+	unsigned int mcast_seen_gen;
+	struct active_mcast_seen mcast_seen[ACTIVE_MCAST_SEEN_MAX];
+	/*
+	 * Used only by stripe mode
+	 */
+	unsigned int *stripe_weight;
+	int *stripe_current;
+	unsigned long long *stripe_token_lag;
+	unsigned long long stripe_token_time;
 };
 
 struct rrp_algo {
@@ -214,6 +237,13 @@ struct totemrrp_instance {
 		unsigned int *seqid,
 		unsigned int *token_is);
 
+	void (*totemrrp_mcast_seqid_get) (
+		const void *msg,
+		unsigned int msg_len,
+		struct memb_ring_id *ring_id,
+		unsigned int *seqid,
+		unsigned int *mcast_is);
+
 	void (*totemrrp_target_set_completed) (
 		void *context);
 
@@ -242,6 +272,11 @@ struct totemrrp_instance {
 		int line,
 		const char *format, ...)__attribute__((format(printf, 6, 7)));
 
+	int (*totemrrp_log_callsite_register) (
+		struct logsys_callsite *cs,
+		int level,
+		int subsys);
+
 	void **net_handles;
 
 	void *rrp_algo_instance;
@@ -517,6 +552,38 @@ static void active_timer_problem_decrementer_start (
 static void active_timer_problem_decrementer_cancel (
 	struct active_instance *active_instance);
 
+/*
+ * Stripe replication
+ */
+static void *stripe_instance_initialize (
+	struct totemrrp_instance *rrp_instance,
+	int interface_count);
+
+static void stripe_mcast_recv (
+	struct totemrrp_instance *instance,
+	unsigned int iface_no,
+	void *context,
+	const void *msg,
+	unsigned int msg_len);
+
+static void stripe_mcast_noflush_send (
+	struct totemrrp_instance *instance,
+	const void *msg,
+	unsigned int msg_len);
+
+static void stripe_mcast_flush_send (
+	struct totemrrp_instance *instance,
+	const void *msg,
+	unsigned int msg_len);
+
+static void stripe_token_recv (
+	struct totemrrp_instance *instance,
+	unsigned int iface_no,
+	void *context,
+	const void *msg,
+	unsigned int msg_len,
+	unsigned int token_seqid);
+
 /*
  * 0-5 reserved for totemsrp.c
  */
@@ -623,20 +690,60 @@ struct rrp_algo active_algo = {
 	.membership_changed	= active_membership_changed
 };
 
+/*
+ * Token is handled exactly as in active mode (sent on all rings and
+ * delivered once received on all non-faulty rings, which also guarantees
+ * that the multicasts sent before it on any ring were received), but each
+ * multicast is sent on one ring only.
+ */
+struct rrp_algo stripe_algo = {
+	.name			= "stripe",
+	.initialize		= stripe_instance_initialize,
+	.mcast_recv		= stripe_mcast_recv,
+	.mcast_noflush_send	= stripe_mcast_noflush_send,
+	.mcast_flush_send	= stripe_mcast_flush_send,
+	.token_recv		= stripe_token_recv,
+	.token_send		= active_token_send,
+	.recv_flush		= active_recv_flush,
+	.send_flush		= active_send_flush,
+	.iface_check		= active_iface_check,
+	.processor_count_set	= active_processor_count_set,
+	.token_target_set	= active_token_target_set,
+	.ring_reenable		= active_ring_reenable,
+	.mcast_recv_empty	= active_mcast_recv_empty,
+	.member_add		= active_member_add,
+	.member_remove		= active_member_remove,
+	.membership_changed	= active_membership_changed
+};
+
 struct rrp_algo *rrp_algos[] = {
 	&none_algo,
 	&passive_algo,
-	&active_algo
+	&active_algo,
+	&stripe_algo
 };
 
-#define RRP_ALGOS_COUNT 3
+#define RRP_ALGOS_COUNT 4
 
-#define log_printf(level, format, args...)			\
-do {								\
-	rrp_instance->totemrrp_log_printf (			\
-		level, rrp_instance->totemrrp_subsys_id,	\
-		__FUNCTION__, __FILE__, __LINE__,		\
-		format, ##args);				\
+/*
+ * Stripe weights are recomputed from the delay of the token copy received
+ * on each ring behind the first copy. A ring saturated by multicasts
+ * delivers its copy later and gets a smaller share of the multicasts.
+ */
+#define STRIPE_WEIGHT_MAX			16
+#define STRIPE_LAG_BASE_USEC			100
+
+#define log_printf(level, format, args...)				\
+do {									\
+	static struct logsys_callsite _cs = LOGSYS_CALLSITE_INIT;	\
+	if (LOGSYS_CALLSITE_ENABLED(&_cs, level,			\
+	    rrp_instance->totemrrp_subsys_id,				\
+	    rrp_instance->totemrrp_log_callsite_register)) {		\
+		rrp_instance->totemrrp_log_printf (level,		\
+			rrp_instance->totemrrp_subsys_id,		\
+			__FUNCTION__, __FILE__, __LINE__,		\
+			format, ##args);				\
+	}								\
 } while (0);
 
 static void stats_set_interface_faulty(struct totemrrp_instance *rrp_instance,
@@ -665,7 +772,8 @@ static void timer_function_test_ring_timeout (void *context)
 		.endian_detector = ENDIAN_LOCAL,
 	};
 
-	if (strcmp(rrp_instance->totem_config->rrp_mode, "active") == 0)
+	if (strcmp(rrp_instance->totem_config->rrp_mode, "active") == 0 ||
+	    strcmp(rrp_instance->totem_config->rrp_mode, "stripe") == 0)
 		faulty = ((struct active_instance *)(rrp_instance->rrp_algo_instance))->faulty;
 	if (strcmp(rrp_instance->totem_config->rrp_mode, "passive") == 0)
 		faulty = ((struct passive_instance *)(rrp_instance->rrp_algo_instance))->faulty;
@@ -1409,6 +1517,8 @@ void *active_instance_initialize (
 
 	instance->last_token_seq = ARR_SEQNO_START_TOKEN - 1;
 
+	instance->mcast_seen_gen = 1;
+
 error_exit:
 	return ((void *)instance);
 }
@@ -1549,6 +1659,60 @@ static void active_timer_problem_decrementer_cancel (
 /*
  * active replication
  */
+
+/*
+ * Forget all remembered multicast messages. Done for every new token and
+ * membership, so a copy dropped by totemsrp can always be retransmitted.
+ */
+static void active_mcast_seen_reset (struct active_instance *active_instance)
+{
+	active_instance->mcast_seen_gen++;
+	if (active_instance->mcast_seen_gen == 0) {
+		memset (active_instance->mcast_seen, 0, sizeof (active_instance->mcast_seen));
+		active_instance->mcast_seen_gen = 1;
+	}
+}
+
+/*
+ * Returns 1 if the message was already delivered from another ring since
+ * the last token, otherwise remembers it and returns 0
+ */
+static int active_mcast_seen_check (
+	struct totemrrp_instance *instance,
+	const void *msg,
+	unsigned int msg_len)
+{
+	struct active_instance *active_instance = (struct active_instance *)instance->rrp_algo_instance;
+	struct active_mcast_seen *seen;
+	struct memb_ring_id ring_id;
+	unsigned int seqid;
+	unsigned int mcast_is;
+
+	if (instance->interface_count < 2) {
+		return (0);
+	}
+
+	instance->totemrrp_mcast_seqid_get (msg, msg_len, &ring_id, &seqid, &mcast_is);
+	if (!mcast_is) {
+		return (0);
+	}
+
+	seen = &active_instance->mcast_seen[seqid & (ACTIVE_MCAST_SEEN_MAX - 1)];
+	if (seen->gen == active_instance->mcast_seen_gen &&
+	    seen->seq == seqid &&
+	    seen->ring_seq == ring_id.seq &&
+	    seen->rep_nodeid == ring_id.rep.nodeid) {
+		return (1);
+	}
+
+	seen->gen = active_instance->mcast_seen_gen;
+	seen->seq = seqid;
+	seen->ring_seq = ring_id.seq;
+	seen->rep_nodeid = ring_id.rep.nodeid;
+
+	return (0);
+}
+
 static void active_mcast_recv (
 	struct totemrrp_instance *instance,
 	unsigned int iface_no,
@@ -1556,6 +1720,11 @@ static void active_mcast_recv (
 	const void *msg,
 	unsigned int msg_len)
 {
+	if (active_mcast_seen_check (instance, msg, msg_len)) {
+		instance->stats.mcast_dup_suppressed[iface_no]++;
+		return;
+	}
+
 	instance->totemrrp_deliver_fn (
 		context,
 		msg,
@@ -1605,6 +1774,7 @@ static void active_token_recv (
 
 	active_instance->totemrrp_context = context;
 	if (sq_lt_compare (active_instance->last_token_seq, token_seq)) {
+		active_mcast_seen_reset (active_instance);
 		memcpy (active_instance->token, msg, msg_len);
 		active_instance->token_len = msg_len;
 		for (i = 0; i < rrp_instance->interface_count; i++) {
@@ -1710,9 +1880,12 @@ static void active_membership_changed (
 	const struct srp_addr *joined_list, size_t joined_list_entries,
 	const struct memb_ring_id *ring_id)
 {
+	struct active_instance *active_instance = (struct active_instance *)rrp_instance->rrp_algo_instance;
 	int i;
 	int interface;
 
+	active_mcast_seen_reset (active_instance);
+
 	for (interface = 0; interface < rrp_instance->interface_count; interface++) {
 		for (i = 0; i < left_list_entries; i++) {
 			if (left_list->no_addrs < interface + 1 ||
@@ -1826,6 +1999,165 @@ static void active_ring_reenable (
 	}
 }
 
+/*
+ * Stripe replication
+ */
+void *stripe_instance_initialize (
+	struct totemrrp_instance *rrp_instance,
+	int interface_count)
+{
+	struct active_instance *instance;
+	int i;
+
+	instance = active_instance_initialize (rrp_instance, interface_count);
+	if (instance == 0) {
+		goto error_exit;
+	}
+
+	instance->stripe_weight = malloc (sizeof (unsigned int) * interface_count);
+	instance->stripe_current = malloc (sizeof (int) * interface_count);
+	instance->stripe_token_lag = malloc (sizeof (unsigned long long) * interface_count);
+	if (instance->stripe_weight == 0 || instance->stripe_current == 0 ||
+	    instance->stripe_token_lag == 0) {
+		free (instance->stripe_weight);
+		free (instance->stripe_current);
+		free (instance->stripe_token_lag);
+		free (instance->counter_problems);
+		free (instance->last_token_recv);
+		free (instance->faulty);
+		free (instance);
+		instance = 0;
+		goto error_exit;
+	}
+
+	for (i = 0; i < interface_count; i++) {
+		instance->stripe_weight[i] = STRIPE_WEIGHT_MAX;
+		instance->stripe_current[i] = 0;
+		instance->stripe_token_lag[i] = 0;
+	}
+
+error_exit:
+	return ((void *)instance);
+}
+
+static void stripe_weights_update (
+	struct totemrrp_instance *instance,
+	struct active_instance *active_instance)
+{
+	unsigned long long lag_min = ULLONG_MAX;
+	unsigned int weight;
+	int i;
+
+	for (i = 0; i < instance->interface_count; i++) {
+		if (active_instance->faulty[i] == 0 &&
+		    active_instance->stripe_token_lag[i] < lag_min) {
+			lag_min = active_instance->stripe_token_lag[i];
+		}
+	}
+	if (lag_min == ULLONG_MAX) {
+		return;
+	}
+
+	for (i = 0; i < instance->interface_count; i++) {
+		weight = (STRIPE_WEIGHT_MAX * (STRIPE_LAG_BASE_USEC + lag_min)) /
+			(STRIPE_LAG_BASE_USEC + active_instance->stripe_token_lag[i]);
+		active_instance->stripe_weight[i] = weight ? weight : 1;
+	}
+}
+
+/*
+ * Smooth weighted round robin over the non-faulty rings
+ */
+static unsigned int stripe_iface_select (struct totemrrp_instance *instance)
+{
+	struct active_instance *active_instance = (struct active_instance *)instance->rrp_algo_instance;
+	int total = 0;
+	int best = -1;
+	int i;
+
+	for (i = 0; i < instance->interface_count; i++) {
+		if (active_instance->faulty[i] == 1) {
+			continue;
+		}
+		active_instance->stripe_current[i] += active_instance->stripe_weight[i];
+		total += active_instance->stripe_weight[i];
+		if (best == -1 ||
+		    active_instance->stripe_current[i] > active_instance->stripe_current[best]) {
+			best = i;
+		}
+	}
+
+	if (best == -1) {
+		return (0);
+	}
+	active_instance->stripe_current[best] -= total;
+
+	return (best);
+}
+
+static void stripe_mcast_recv (
+	struct totemrrp_instance *instance,
+	unsigned int iface_no,
+	void *context,
+	const void *msg,
+	unsigned int msg_len)
+{
+	instance->totemrrp_deliver_fn (
+		context,
+		msg,
+		msg_len);
+}
+
+static void stripe_mcast_flush_send (
+	struct totemrrp_instance *instance,
+	const void *msg,
+	unsigned int msg_len)
+{
+	totemnet_mcast_flush_send (instance->net_handles[stripe_iface_select (instance)],
+		msg, msg_len);
+}
+
+static void stripe_mcast_noflush_send (
+	struct totemrrp_instance *instance,
+	const void *msg,
+	unsigned int msg_len)
+{
+	totemnet_mcast_noflush_send (instance->net_handles[stripe_iface_select (instance)],
+		msg, msg_len);
+}
+
+static void stripe_token_recv (
+	struct totemrrp_instance *rrp_instance,
+	unsigned int iface_no,
+	void *context,
+	const void *msg,
+	unsigned int msg_len,
+	unsigned int token_seq)
+{
+	struct active_instance *active_instance = (struct active_instance *)rrp_instance->rrp_algo_instance;
+	unsigned long long now;
+
+	now = qb_util_nano_current_get ();
+
+	if (sq_lt_compare (active_instance->last_token_seq, token_seq)) {
+		/*
+		 * First copy of a new token
+		 */
+		stripe_weights_update (rrp_instance, active_instance);
+		active_instance->stripe_token_time = now;
+		active_instance->stripe_token_lag[iface_no] =
+			(active_instance->stripe_token_lag[iface_no] * 7) / 8;
+	} else
+	if (token_seq == active_instance->last_token_seq &&
+	    active_instance->last_token_recv[iface_no] == 0) {
+		active_instance->stripe_token_lag[iface_no] =
+			(active_instance->stripe_token_lag[iface_no] * 7 +
+			(now - active_instance->stripe_token_time) / QB_TIME_NS_IN_USEC) / 8;
+	}
+
+	active_token_recv (rrp_instance, iface_no, context, msg, msg_len, token_seq);
+}
+
 static void totemrrp_instance_initialize (struct totemrrp_instance *instance)
 {
 	memset (instance, 0, sizeof (struct totemrrp_instance));
@@ -2022,6 +2354,13 @@ int totemrrp_initialize (
 		unsigned int *seqid,
 		unsigned int *token_is),
 
+	void (*mcast_seqid_get) (
+		const void *msg,
+		unsigned int msg_len,
+		struct memb_ring_id *ring_id,
+		unsigned int *seqid,
+		unsigned int *mcast_is),
+
 	unsigned int (*msgs_missing) (void),
 
 	void (*target_set_completed) (void *context))
@@ -2041,6 +2380,7 @@ int totemrrp_initialize (
 	stats->rrp = &instance->stats;
 	instance->stats.interface_count = totem_config->interface_count;
 	instance->stats.faulty = calloc(instance->stats.interface_count, sizeof(uint8_t));
+	instance->stats.mcast_dup_suppressed = calloc(instance->stats.interface_count, sizeof(uint64_t));
 
 	res = totemrrp_algorithm_set (
 		instance->totem_config,
@@ -2059,6 +2399,8 @@ int totemrrp_initialize (
 	instance->totemrrp_log_level_debug = totem_config->totem_logging_configuration.log_level_debug;
 	instance->totemrrp_subsys_id = totem_config->totem_logging_configuration.log_subsys_id;
 	instance->totemrrp_log_printf = totem_config->totem_logging_configuration.log_printf;
+	instance->totemrrp_log_callsite_register =
+		totem_config->totem_logging_configuration.log_callsite_register;
 
 	instance->interfaces = totem_config->interfaces;
 
@@ -2070,6 +2412,8 @@ int totemrrp_initialize (
 
 	instance->totemrrp_token_seqid_get = token_seqid_get;
 
+	instance->totemrrp_mcast_seqid_get = mcast_seqid_get;
+
 	instance->totemrrp_target_set_completed = target_set_completed;
 
 	instance->totemrrp_msgs_missing = msgs_missing;
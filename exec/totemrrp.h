@@ -85,6 +85,13 @@ extern int totemrrp_initialize (
 		unsigned int *seqid,
 		unsigned int *token_is),
 
+	void (*mcast_seqid_get) (
+		const void *msg,
+		unsigned int msg_len,
+		struct memb_ring_id *ring_id,
+		unsigned int *seqid,
+		unsigned int *mcast_is),
+
 	unsigned int (*msgs_missing) (void),
 
 	void (*target_set_completed) (
@@ -0,0 +1,1314 @@
+/*
+ * Copyright (c) 2026 Red Hat, Inc.
+ *
+ * All rights reserved.
+ *
+ * This software licensed under BSD license, the text of which follows:
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * - Neither the name of the Red Hat, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived from this
+ *   software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Shared memory transport for running many instances on one host.
+ *
+ * Every instance owns an inbox ring, a file under totem.shm_path (normally on
+ * tmpfs) named after its ring address and port. Senders map the inbox of
+ * each member and copy frames into it under a process-shared mutex. The owner
+ * consumes the ring without locking. A fifo next to the ring wakes the owner
+ * when it is sleeping in poll, so busy rings cost no system calls.
+ *
+ * Delay, loss and reordering can be injected on receive to emulate a network.
+ */
+
+#include <config.h>
+
+#include <assert.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/poll.h>
+
+#include <qb/qbdefs.h>
+#include <qb/qbloop.h>
+#include <qb/qbutil.h>
+#include <qb/qbatomic.h>
+
+#include <corosync/list.h>
+#define LOGSYS_UTILS_ONLY 1
+#include <corosync/logsys.h>
+#include "totemshm.h"
+
+#include "util.h"
+#include "totemcrypto.h"
+
+#define SHM_RING_MAGIC			0x54534852
+#define SHM_RING_VERSION		1
+#define SHM_RING_SLOTS			256
+/*
+ * Frames delivered per poll callback before yielding to the main loop
+ */
+#define SHM_DELIVER_BUDGET		SHM_RING_SLOTS
+/*
+ * How often an unreachable member ring is looked up again
+ */
+#define SHM_OPEN_RETRY_MSEC		100
+
+struct totemshm_slot {
+	uint64_t stamp;
+	uint32_t len;
+	uint32_t pad;
+	unsigned char buf[FRAME_SIZE_MAX];
+};
+
+/*
+ * Shared between processes. head is advanced by senders holding lock, tail
+ * only by the owner. Both are free running counters.
+ */
+struct totemshm_ring {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t slots;
+	uint32_t slot_size;
+	pthread_mutex_t lock;
+	int32_t head;
+	int32_t tail;
+	int32_t reader_sleeping;
+	int32_t reader_pid;
+	int32_t dropped;
+	struct totemshm_slot slot[SHM_RING_SLOTS];
+};
+
+struct totemshm_member {
+	struct list_head list;
+	struct totem_ip_address member;
+	int active;
+	struct totemshm_ring *ring;
+	int doorbell_fd;
+	uint64_t open_retry_time;
+};
+
+struct totemshm_instance {
+	struct crypto_instance *crypto_inst;
+
+	qb_loop_t *totemshm_poll_handle;
+
+	struct totem_interface *totem_interface;
+
+	void *context;
+
+	void (*totemshm_deliver_fn) (
+		void *context,
+		const void *msg,
+		unsigned int msg_len);
+
+	void (*totemshm_iface_change_fn) (
+		void *context,
+		const struct totem_ip_address *iface_address);
+
+	void (*totemshm_target_set_completed) (void *context);
+
+	/*
+	 * Function and data used to log messages
+	 */
+	int totemshm_log_level_security;
+
+	int totemshm_log_level_error;
+
+	int totemshm_log_level_warning;
+
+	int totemshm_log_level_notice;
+
+	int totemshm_log_level_debug;
+
+	int totemshm_subsys_id;
+
+	void (*totemshm_log_printf) (
+		int level,
+		int subsys,
+		const char *function,
+		const char *file,
+		int line,
+		const char *format,
+		...)__attribute__((format(printf, 6, 7)));
+
+	int (*totemshm_log_callsite_register) (
+		struct logsys_callsite *cs,
+		int level,
+		int subsys);
+
+	char iov_buffer[FRAME_SIZE_MAX];
+
+	char held_buffer[FRAME_SIZE_MAX];
+
+	unsigned int held_len;
+
+	struct list_head member_list;
+
+	struct totem_ip_address my_id;
+
+	qb_loop_timer_handle timer_bind;
+
+	qb_loop_timer_handle timer_delay;
+
+	int timer_delay_armed;
+
+	unsigned int my_memb_entries;
+
+	struct totem_config *totem_config;
+
+	totemsrp_stats_t *stats;
+
+	struct totem_ip_address token_target;
+
+	struct totemshm_member *token_member;
+
+	struct totemshm_ring *ring;
+
+	int doorbell_fd;
+
+	char ring_path[PATH_MAX];
+
+	char doorbell_path[PATH_MAX];
+
+	uint32_t dropped_reported;
+
+	qb_loop_timer_handle timer_merge_detect_timeout;
+
+	int send_merge_detect_message;
+
+	unsigned int merge_detect_messages_sent_before_timeout;
+};
+
+static void totemshm_start_merge_detect_timeout(
+	void *shm_context);
+
+static void totemshm_stop_merge_detect_timeout(
+	void *shm_context);
+
+static void totemshm_instance_initialize (struct totemshm_instance *instance)
+{
+	memset (instance, 0, sizeof (struct totemshm_instance));
+
+	instance->doorbell_fd = -1;
+
+	/*
+	 * There is always atleast 1 processor
+	 */
+	instance->my_memb_entries = 1;
+
+	list_init (&instance->member_list);
+}
+
+#define log_printf(level, format, args...)				\
+do {									\
+	static struct logsys_callsite _cs = LOGSYS_CALLSITE_INIT;	\
+	if (LOGSYS_CALLSITE_ENABLED(&_cs, level,			\
+	    instance->totemshm_subsys_id,				\
+	    instance->totemshm_log_callsite_register)) {		\
+		instance->totemshm_log_printf (level,			\
+			instance->totemshm_subsys_id,			\
+			__FUNCTION__, __FILE__, __LINE__,		\
+			(const char *)format, ##args);			\
+	}								\
+} while (0);
+#define LOGSYS_PERROR(err_num, level, fmt, args...)						\
+do {												\
+	char _error_str[LOGSYS_MAX_PERROR_MSG_LEN];						\
+	const char *_error_ptr = qb_strerror_r(err_num, _error_str, sizeof(_error_str));	\
+        instance->totemshm_log_printf (								\
+		level, instance->totemshm_subsys_id,						\
+                __FUNCTION__, __FILE__, __LINE__,						\
+		fmt ": %s (%d)", ##args, _error_ptr, err_num);					\
+	} while(0)
+
+static void shm_paths_get (
+	struct totemshm_instance *instance,
+	const struct totem_ip_address *addr,
+	char *ring_path,
+	char *doorbell_path)
+{
+	snprintf (ring_path, PATH_MAX, "%s/%s-%u",
+		instance->totem_config->shm_path, totemip_print (addr),
+		instance->totem_interface->ip_port);
+	snprintf (doorbell_path, PATH_MAX, "%s.fifo", ring_path);
+}
+
+static int shm_ring_lock (struct totemshm_ring *ring)
+{
+	int res;
+
+	res = pthread_mutex_lock (&ring->lock);
+#ifdef HAVE_PTHREAD_MUTEXATTR_SETROBUST
+	if (res == EOWNERDEAD) {
+		/*
+		 * Previous holder died. It never advanced head, so its
+		 * half written slot is simply reused.
+		 */
+		pthread_mutex_consistent (&ring->lock);
+		res = 0;
+	}
+#endif
+
+	return (res);
+}
+
+static void shm_ring_unlock (struct totemshm_ring *ring)
+{
+	pthread_mutex_unlock (&ring->lock);
+}
+
+static int shm_ring_mutex_init (struct totemshm_ring *ring)
+{
+	pthread_mutexattr_t attr;
+	int res;
+
+	pthread_mutexattr_init (&attr);
+	res = pthread_mutexattr_setpshared (&attr, PTHREAD_PROCESS_SHARED);
+#ifdef HAVE_PTHREAD_MUTEXATTR_SETROBUST
+	if (res == 0) {
+		res = pthread_mutexattr_setrobust (&attr, PTHREAD_MUTEX_ROBUST);
+	}
+#endif
+	if (res == 0) {
+		res = pthread_mutex_init (&ring->lock, &attr);
+	}
+	pthread_mutexattr_destroy (&attr);
+
+	return (res);
+}
+
+static struct totemshm_ring *shm_ring_map (const char *path, int create)
+{
+	struct totemshm_ring *ring;
+	struct stat st;
+	int fd;
+
+	fd = open (path, O_RDWR | (create ? O_CREAT : 0), 0600);
+	if (fd == -1) {
+		return (NULL);
+	}
+
+	if (fstat (fd, &st) == -1) {
+		goto error_close;
+	}
+	if (st.st_size < sizeof (struct totemshm_ring)) {
+		if (!create || ftruncate (fd, sizeof (struct totemshm_ring)) == -1) {
+			goto error_close;
+		}
+	}
+
+	ring = mmap (NULL, sizeof (struct totemshm_ring), PROT_READ | PROT_WRITE,
+		MAP_SHARED, fd, 0);
+	if (ring == MAP_FAILED) {
+		goto error_close;
+	}
+	close (fd);
+
+	return (ring);
+
+error_close:
+	close (fd);
+	return (NULL);
+}
+
+static int shm_ring_valid (const struct totemshm_ring *ring)
+{
+	return (ring->magic == SHM_RING_MAGIC &&
+		ring->version == SHM_RING_VERSION &&
+		ring->slots == SHM_RING_SLOTS &&
+		ring->slot_size == FRAME_SIZE_MAX);
+}
+
+/*
+ * Create (or take over after a crash) the inbox of this instance
+ */
+static int shm_ring_create (struct totemshm_instance *instance)
+{
+	struct totemshm_ring *ring;
+	pid_t pid;
+	int res;
+
+	if (mkdir (instance->totem_config->shm_path, 0700) == -1 && errno != EEXIST) {
+		LOGSYS_PERROR (errno, instance->totemshm_log_level_error,
+			"Can't create shm directory %s", instance->totem_config->shm_path);
+		return (-1);
+	}
+
+	shm_paths_get (instance, &instance->totem_interface->bindnet,
+		instance->ring_path, instance->doorbell_path);
+
+	ring = shm_ring_map (instance->ring_path, 1);
+	if (ring == NULL) {
+		LOGSYS_PERROR (errno, instance->totemshm_log_level_error,
+			"Can't map shm ring %s", instance->ring_path);
+		return (-1);
+	}
+
+	if (shm_ring_valid (ring)) {
+		pid = qb_atomic_int_get (&ring->reader_pid);
+		if (pid != 0 && pid != getpid () && kill (pid, 0) == 0) {
+			log_printf (instance->totemshm_log_level_error,
+				"Shm ring %s is used by process %d, is the address configured twice?",
+				instance->ring_path, pid);
+			munmap (ring, sizeof (struct totemshm_ring));
+			return (-1);
+		}
+
+		/*
+		 * Senders may still have the ring mapped, keep the mutex and
+		 * only drop frames queued for the previous owner
+		 */
+		if (shm_ring_lock (ring) != 0) {
+			munmap (ring, sizeof (struct totemshm_ring));
+			return (-1);
+		}
+		qb_atomic_int_set (&ring->tail, qb_atomic_int_get (&ring->head));
+		shm_ring_unlock (ring);
+	} else {
+		memset (ring, 0, offsetof (struct totemshm_ring, slot));
+		res = shm_ring_mutex_init (ring);
+		if (res != 0) {
+			LOGSYS_PERROR (res, instance->totemshm_log_level_error,
+				"Can't initialize shm ring lock");
+			munmap (ring, sizeof (struct totemshm_ring));
+			return (-1);
+		}
+		ring->version = SHM_RING_VERSION;
+		ring->slots = SHM_RING_SLOTS;
+		ring->slot_size = FRAME_SIZE_MAX;
+		/*
+		 * Magic last, senders don't touch a ring without it
+		 */
+		qb_atomic_int_set ((int32_t *)&ring->magic, SHM_RING_MAGIC);
+	}
+
+	instance->dropped_reported = qb_atomic_int_get (&ring->dropped);
+	qb_atomic_int_set (&ring->reader_sleeping, 0);
+	qb_atomic_int_set (&ring->reader_pid, getpid ());
+
+	if (mkfifo (instance->doorbell_path, 0600) == -1 && errno != EEXIST) {
+		LOGSYS_PERROR (errno, instance->totemshm_log_level_error,
+			"Can't create shm doorbell %s", instance->doorbell_path);
+		goto error_unmap;
+	}
+
+	/*
+	 * Opened read-write so the fifo never reports EOF and senders
+	 * can always open it
+	 */
+	instance->doorbell_fd = open (instance->doorbell_path, O_RDWR | O_NONBLOCK);
+	if (instance->doorbell_fd == -1) {
+		LOGSYS_PERROR (errno, instance->totemshm_log_level_error,
+			"Can't open shm doorbell %s", instance->doorbell_path);
+		goto error_unmap;
+	}
+
+	instance->ring = ring;
+
+	return (0);
+
+error_unmap:
+	qb_atomic_int_set (&ring->reader_pid, 0);
+	munmap (ring, sizeof (struct totemshm_ring));
+	return (-1);
+}
+
+static void shm_ring_destroy (struct totemshm_instance *instance)
+{
+	if (instance->doorbell_fd != -1) {
+		qb_loop_poll_del (instance->totemshm_poll_handle,
+			instance->doorbell_fd);
+		close (instance->doorbell_fd);
+		instance->doorbell_fd = -1;
+	}
+
+	if (instance->ring != NULL) {
+		/*
+		 * Senders notice the zero pid, drop their mapping and look
+		 * the ring up again by name
+		 */
+		qb_atomic_int_set (&instance->ring->reader_pid, 0);
+		unlink (instance->ring_path);
+		unlink (instance->doorbell_path);
+		munmap (instance->ring, sizeof (struct totemshm_ring));
+		instance->ring = NULL;
+	}
+}
+
+static void shm_member_close (struct totemshm_member *member)
+{
+	if (member->ring != NULL) {
+		munmap (member->ring, sizeof (struct totemshm_ring));
+		member->ring = NULL;
+	}
+	if (member->doorbell_fd != -1) {
+		close (member->doorbell_fd);
+		member->doorbell_fd = -1;
+	}
+}
+
+static void shm_member_open (
+	struct totemshm_instance *instance,
+	struct totemshm_member *member)
+{
+	char ring_path[PATH_MAX];
+	char doorbell_path[PATH_MAX];
+	struct totemshm_ring *ring;
+	uint64_t now;
+
+	now = qb_util_nano_current_get ();
+	if (now < member->open_retry_time) {
+		return;
+	}
+	member->open_retry_time = now + SHM_OPEN_RETRY_MSEC * QB_TIME_NS_IN_MSEC;
+
+	shm_paths_get (instance, &member->member, ring_path, doorbell_path);
+
+	ring = shm_ring_map (ring_path, 0);
+	if (ring == NULL) {
+		return;
+	}
+	if (!shm_ring_valid (ring) || qb_atomic_int_get (&ring->reader_pid) == 0) {
+		munmap (ring, sizeof (struct totemshm_ring));
+		return;
+	}
+
+	member->doorbell_fd = open (doorbell_path, O_WRONLY | O_NONBLOCK);
+	if (member->doorbell_fd == -1) {
+		munmap (ring, sizeof (struct totemshm_ring));
+		return;
+	}
+	member->ring = ring;
+
+	log_printf (instance->totemshm_log_level_debug,
+		"Mapped shm ring of member %s", totemip_print (&member->member));
+}
+
+static struct totemshm_ring *shm_member_ring_get (
+	struct totemshm_instance *instance,
+	struct totemshm_member *member)
+{
+	if (member->ring != NULL &&
+	    qb_atomic_int_get (&member->ring->reader_pid) == 0) {
+		log_printf (instance->totemshm_log_level_debug,
+			"Shm ring of member %s was closed", totemip_print (&member->member));
+		shm_member_close (member);
+	}
+
+	if (member->ring == NULL) {
+		shm_member_open (instance, member);
+	}
+
+	return (member->ring);
+}
+
+static void shm_ring_write (
+	struct totemshm_instance *instance,
+	struct totemshm_member *member,
+	const void *buf,
+	size_t len)
+{
+	struct totemshm_ring *ring;
+	struct totemshm_slot *slot;
+	uint32_t head;
+	char doorbell = 0;
+
+	ring = shm_member_ring_get (instance, member);
+	if (ring == NULL) {
+		return;
+	}
+
+	if (shm_ring_lock (ring) != 0) {
+		return;
+	}
+
+	head = (uint32_t)ring->head;
+	if (head - (uint32_t)qb_atomic_int_get (&ring->tail) >= SHM_RING_SLOTS) {
+		/*
+		 * Full, lost like a datagram and recovered by totemsrp
+		 */
+		qb_atomic_int_inc (&ring->dropped);
+		shm_ring_unlock (ring);
+		return;
+	}
+
+	slot = &ring->slot[head % SHM_RING_SLOTS];
+	slot->stamp = qb_util_nano_current_get ();
+	slot->len = len;
+	memcpy (slot->buf, buf, len);
+	qb_atomic_int_set (&ring->head, (int32_t)(head + 1));
+
+	shm_ring_unlock (ring);
+
+	if (qb_atomic_int_compare_and_exchange (&ring->reader_sleeping, 1, 0)) {
+		if (write (member->doorbell_fd, &doorbell, 1) == -1 &&
+		    errno != EAGAIN) {
+			LOGSYS_PERROR (errno, instance->totemshm_log_level_debug,
+				"Can't wake up shm member %s (non-critical)",
+				totemip_print (&member->member));
+		}
+	}
+}
+
+static void shm_frame_process (
+	struct totemshm_instance *instance,
+	void *buf,
+	unsigned int len)
+{
+	int bytes_received = len;
+
+	/*
+	 * Authenticate and if authenticated, decrypt frame
+	 */
+	if (crypto_authenticate_and_decrypt (instance->crypto_inst, buf, &bytes_received) == -1) {
+		log_printf (instance->totemshm_log_level_security, "Received message has invalid digest... ignoring.");
+		log_printf (instance->totemshm_log_level_security,
+			"Invalid packet data");
+		return;
+	}
+
+	instance->totemshm_deliver_fn (
+		instance->context,
+		buf,
+		bytes_received);
+}
+
+/*
+ * Applies injected loss and reordering. A reordered frame is held back and
+ * delivered after the next one, or at the end of the batch.
+ */
+static void shm_frame_deliver (
+	struct totemshm_instance *instance,
+	unsigned int len)
+{
+	unsigned int held_len;
+
+	if (instance->totem_config->shm_loss &&
+	    (unsigned int)(random () % 100) < instance->totem_config->shm_loss) {
+		return;
+	}
+
+	if (instance->totem_config->shm_reorder && instance->held_len == 0 &&
+	    (unsigned int)(random () % 100) < instance->totem_config->shm_reorder) {
+		memcpy (instance->held_buffer, instance->iov_buffer, len);
+		instance->held_len = len;
+		return;
+	}
+
+	shm_frame_process (instance, instance->iov_buffer, len);
+
+	if (instance->held_len) {
+		held_len = instance->held_len;
+		instance->held_len = 0;
+		shm_frame_process (instance, instance->held_buffer, held_len);
+	}
+}
+
+static void timer_function_shm_delay (void *data);
+
+/*
+ * Returns 1 when the ring is drained, 0 when frames are still queued
+ */
+static int shm_ring_drain (struct totemshm_instance *instance)
+{
+	struct totemshm_ring *ring = instance->ring;
+	struct totemshm_slot *slot;
+	uint64_t delay = (uint64_t)instance->totem_config->shm_delay * QB_TIME_NS_IN_USEC;
+	uint64_t now;
+	uint32_t tail;
+	uint32_t dropped;
+	unsigned int len;
+	unsigned int budget = SHM_DELIVER_BUDGET;
+	int res = 1;
+
+	while ((tail = (uint32_t)qb_atomic_int_get (&ring->tail)) !=
+	    (uint32_t)qb_atomic_int_get (&ring->head)) {
+		if (budget-- == 0) {
+			res = 0;
+			break;
+		}
+
+		slot = &ring->slot[tail % SHM_RING_SLOTS];
+
+		if (delay) {
+			now = qb_util_nano_current_get ();
+			if (slot->stamp + delay > now) {
+				if (!instance->timer_delay_armed) {
+					instance->timer_delay_armed = 1;
+					qb_loop_timer_add (instance->totemshm_poll_handle,
+						QB_LOOP_HIGH,
+						slot->stamp + delay - now,
+						(void *)instance,
+						timer_function_shm_delay,
+						&instance->timer_delay);
+				}
+				res = 0;
+				break;
+			}
+		}
+
+		/*
+		 * Copy out before releasing the slot, delivery may flush the
+		 * ring (recv_mcast_empty) and senders reuse the slot
+		 */
+		len = slot->len;
+		if (len > FRAME_SIZE_MAX) {
+			len = 0;
+		}
+		memcpy (instance->iov_buffer, slot->buf, len);
+		qb_atomic_int_compare_and_exchange (&ring->tail, (int32_t)tail,
+			(int32_t)(tail + 1));
+
+		if (len != 0) {
+			shm_frame_deliver (instance, len);
+		}
+	}
+
+	if (instance->held_len) {
+		len = instance->held_len;
+		instance->held_len = 0;
+		shm_frame_process (instance, instance->held_buffer, len);
+	}
+
+	dropped = qb_atomic_int_get (&ring->dropped);
+	if (dropped != instance->dropped_reported) {
+		log_printf (instance->totemshm_log_level_debug,
+			"%u frames were dropped because the shm ring was full",
+			dropped - instance->dropped_reported);
+		instance->dropped_reported = dropped;
+	}
+
+	return (res);
+}
+
+static void shm_ring_deliver (struct totemshm_instance *instance)
+{
+	struct totemshm_ring *ring = instance->ring;
+	char doorbell = 0;
+
+	while (shm_ring_drain (instance)) {
+		/*
+		 * Announce sleep, then recheck to not miss a frame queued by a
+		 * sender that saw the flag still clear
+		 */
+		qb_atomic_int_set (&ring->reader_sleeping, 1);
+		if (qb_atomic_int_get (&ring->tail) == qb_atomic_int_get (&ring->head)) {
+			return;
+		}
+		qb_atomic_int_set (&ring->reader_sleeping, 0);
+	}
+
+	if (!instance->timer_delay_armed) {
+		/*
+		 * Budget exhausted, come back after the rest of the main loop
+		 */
+		if (write (instance->doorbell_fd, &doorbell, 1) == -1 && errno != EAGAIN) {
+			LOGSYS_PERROR (errno, instance->totemshm_log_level_debug,
+				"Can't requeue shm delivery (non-critical)");
+		}
+	}
+}
+
+static void timer_function_shm_delay (void *data)
+{
+	struct totemshm_instance *instance = (struct totemshm_instance *)data;
+
+	instance->timer_delay_armed = 0;
+	if (instance->ring != NULL) {
+		shm_ring_deliver (instance);
+	}
+}
+
+static int shm_doorbell_deliver_fn (
+	int fd,
+	int revents,
+	void *data)
+{
+	struct totemshm_instance *instance = (struct totemshm_instance *)data;
+	char buf[64];
+
+	while (read (fd, buf, sizeof (buf)) > 0)
+		;
+
+	shm_ring_deliver (instance);
+
+	return (0);
+}
+
+static struct totemshm_member *shm_member_find (
+	struct totemshm_instance *instance,
+	const struct totem_ip_address *addr)
+{
+	struct list_head *list;
+	struct totemshm_member *member;
+
+	for (list = instance->member_list.next;
+		list != &instance->member_list;
+		list = list->next) {
+
+		member = list_entry (list, struct totemshm_member, list);
+		if (totemip_equal (addr, &member->member)) {
+			return (member);
+		}
+	}
+
+	return (NULL);
+}
+
+static int shm_send_blocked (struct totemshm_instance *instance)
+{
+	/*
+	 * Total loss cuts the node off in both directions like a failed link
+	 */
+	return (instance->ring == NULL || instance->totem_config->shm_loss == 100);
+}
+
+static inline void ucast_sendmsg (
+	struct totemshm_instance *instance,
+	const void *msg,
+	unsigned int msg_len)
+{
+	size_t buf_out_len;
+	unsigned char buf_out[FRAME_SIZE_MAX];
+
+	if (shm_send_blocked (instance) || instance->token_member == NULL) {
+		return;
+	}
+
+	/*
+	 * Encrypt and digest the message
+	 */
+	if (crypto_encrypt_and_sign (
+		instance->crypto_inst,
+		(const unsigned char *)msg,
+		msg_len,
+		buf_out,
+		&buf_out_len) != 0) {
+		log_printf(LOGSYS_LEVEL_CRIT, "Error encrypting/signing packet (non-critical)");
+		return;
+	}
+
+	shm_ring_write (instance, instance->token_member, buf_out, buf_out_len);
+}
+
+static inline void mcast_sendmsg (
+	struct totemshm_instance *instance,
+	const void *msg,
+	unsigned int msg_len,
+	int only_active)
+{
+	size_t buf_out_len;
+	unsigned char buf_out[FRAME_SIZE_MAX];
+	struct list_head *list;
+	struct totemshm_member *member;
+
+	if (shm_send_blocked (instance)) {
+		return;
+	}
+
+	/*
+	 * Encrypt and digest the message
+	 */
+	if (crypto_encrypt_and_sign (
+		instance->crypto_inst,
+		(const unsigned char *)msg,
+		msg_len,
+		buf_out,
+		&buf_out_len) != 0) {
+		log_printf(LOGSYS_LEVEL_CRIT, "Error encrypting/signing packet (non-critical)");
+		return;
+	}
+
+	for (list = instance->member_list.next;
+		list != &instance->member_list;
+		list = list->next) {
+
+		member = list_entry (list, struct totemshm_member, list);
+
+		/*
+		 * Do not send multicast message if message is not "flush", member
+		 * is inactive and timeout for sending merge message didn't expired.
+		 */
+		if (only_active && !member->active && !instance->send_merge_detect_message)
+			continue ;
+
+		shm_ring_write (instance, member, buf_out, buf_out_len);
+	}
+
+	if (!only_active || instance->send_merge_detect_message) {
+		/*
+		 * Current message was sent to all nodes
+		 */
+		instance->merge_detect_messages_sent_before_timeout++;
+		instance->send_merge_detect_message = 0;
+	}
+}
+
+/*
+ * Deferred like the socket transports because the RRP layer isn't ready to
+ * receive messages during initialization
+ */
+static void timer_function_shm_bind (void *data)
+{
+	struct totemshm_instance *instance = (struct totemshm_instance *)data;
+
+	if (shm_ring_create (instance) == -1) {
+		qb_loop_timer_add (instance->totemshm_poll_handle,
+			QB_LOOP_MED,
+			instance->totem_config->downcheck_timeout*QB_TIME_NS_IN_MSEC,
+			(void *)instance,
+			timer_function_shm_bind,
+			&instance->timer_bind);
+		return;
+	}
+
+	qb_loop_poll_add (instance->totemshm_poll_handle,
+		QB_LOOP_HIGH,
+		instance->doorbell_fd,
+		POLLIN, instance, shm_doorbell_deliver_fn);
+
+	totemip_copy (&instance->totem_interface->boundto,
+		&instance->totem_interface->bindnet);
+	totemip_copy (&instance->my_id, &instance->totem_interface->boundto);
+
+	log_printf (instance->totemshm_log_level_notice,
+		"The shm interface [%s] is now up.",
+		totemip_print (&instance->my_id));
+	instance->totemshm_iface_change_fn (instance->context, &instance->my_id);
+
+	/*
+	 * Pick up frames queued before the doorbell was polled
+	 */
+	shm_ring_deliver (instance);
+}
+
+int totemshm_crypto_set (
+	void *shm_context,
+	const char *cipher_type,
+	const char *hash_type)
+{
+
+	return (0);
+}
+
+int totemshm_finalize (
+	void *shm_context)
+{
+	struct totemshm_instance *instance = (struct totemshm_instance *)shm_context;
+	struct list_head *list;
+	struct totemshm_member *member;
+	int res = 0;
+
+	qb_loop_timer_del (instance->totemshm_poll_handle, instance->timer_bind);
+	if (instance->timer_delay_armed) {
+		qb_loop_timer_del (instance->totemshm_poll_handle, instance->timer_delay);
+		instance->timer_delay_armed = 0;
+	}
+
+	shm_ring_destroy (instance);
+
+	for (list = instance->member_list.next;
+		list != &instance->member_list;
+		list = list->next) {
+
+		member = list_entry (list, struct totemshm_member, list);
+		shm_member_close (member);
+	}
+
+	totemshm_stop_merge_detect_timeout(instance);
+
+	return (res);
+}
+
+/*
+ * Create an instance
+ */
+int totemshm_initialize (
+	qb_loop_t *poll_handle,
+	void **shm_context,
+	struct totem_config *totem_config,
+	totemsrp_stats_t *stats,
+	int interface_no,
+	void *context,
+
+	void (*deliver_fn) (
+		void *context,
+		const void *msg,
+		unsigned int msg_len),
+
+	void (*iface_change_fn) (
+		void *context,
+		const struct totem_ip_address *iface_address),
+
+	void (*target_set_completed) (
+		void *context))
+{
+	struct totemshm_instance *instance;
+
+	instance = malloc (sizeof (struct totemshm_instance));
+	if (instance == NULL) {
+		return (-1);
+	}
+
+	totemshm_instance_initialize (instance);
+
+	instance->totem_config = totem_config;
+	instance->stats = stats;
+
+	/*
+	* Configure logging
+	*/
+	instance->totemshm_log_level_security = 1; //totem_config->totem_logging_configuration.log_level_security;
+	instance->totemshm_log_level_error = totem_config->totem_logging_configuration.log_level_error;
+	instance->totemshm_log_level_warning = totem_config->totem_logging_configuration.log_level_warning;
+	instance->totemshm_log_level_notice = totem_config->totem_logging_configuration.log_level_notice;
+	instance->totemshm_log_level_debug = totem_config->totem_logging_configuration.log_level_debug;
+	instance->totemshm_subsys_id = totem_config->totem_logging_configuration.log_subsys_id;
+	instance->totemshm_log_printf = totem_config->totem_logging_configuration.log_printf;
+	instance->totemshm_log_callsite_register =
+		totem_config->totem_logging_configuration.log_callsite_register;
+
+	instance->crypto_inst = crypto_init (totem_config->private_key,
+		totem_config->private_key_len,
+		totem_config->crypto_cipher_type,
+		totem_config->crypto_hash_type,
+		instance->totemshm_log_printf,
+		instance->totemshm_log_level_security,
+		instance->totemshm_log_level_notice,
+		instance->totemshm_log_level_error,
+		instance->totemshm_subsys_id);
+	if (instance->crypto_inst == NULL) {
+		free(instance);
+		return (-1);
+	}
+
+	instance->totem_interface = &totem_config->interfaces[interface_no];
+
+	instance->totemshm_poll_handle = poll_handle;
+
+	instance->totem_interface->bindnet.nodeid = instance->totem_config->node_id;
+
+	instance->context = context;
+	instance->totemshm_deliver_fn = deliver_fn;
+
+	instance->totemshm_iface_change_fn = iface_change_fn;
+
+	instance->totemshm_target_set_completed = target_set_completed;
+
+	qb_loop_timer_add (instance->totemshm_poll_handle,
+		QB_LOOP_MED,
+		100*QB_TIME_NS_IN_MSEC,
+		(void *)instance,
+		timer_function_shm_bind,
+		&instance->timer_bind);
+
+	totemshm_start_merge_detect_timeout(instance);
+
+	*shm_context = instance;
+	return (0);
+}
+
+void *totemshm_buffer_alloc (void)
+{
+	return malloc (FRAME_SIZE_MAX);
+}
+
+void totemshm_buffer_release (void *ptr)
+{
+	return free (ptr);
+}
+
+int totemshm_processor_count_set (
+	void *shm_context,
+	int processor_count)
+{
+	struct totemshm_instance *instance = (struct totemshm_instance *)shm_context;
+	int res = 0;
+
+	instance->my_memb_entries = processor_count;
+
+	return (res);
+}
+
+int totemshm_recv_flush (void *shm_context)
+{
+	int res = 0;
+
+	return (res);
+}
+
+int totemshm_send_flush (void *shm_context)
+{
+	int res = 0;
+
+	return (res);
+}
+
+int totemshm_token_send (
+	void *shm_context,
+	const void *msg,
+	unsigned int msg_len)
+{
+	struct totemshm_instance *instance = (struct totemshm_instance *)shm_context;
+	int res = 0;
+
+	ucast_sendmsg (instance, msg, msg_len);
+
+	return (res);
+}
+
+int totemshm_mcast_flush_send (
+	void *shm_context,
+	const void *msg,
+	unsigned int msg_len)
+{
+	struct totemshm_instance *instance = (struct totemshm_instance *)shm_context;
+	int res = 0;
+
+	mcast_sendmsg (instance, msg, msg_len, 0);
+
+	return (res);
+}
+
+int totemshm_mcast_noflush_send (
+	void *shm_context,
+	const void *msg,
+	unsigned int msg_len)
+{
+	struct totemshm_instance *instance = (struct totemshm_instance *)shm_context;
+	int res = 0;
+
+	mcast_sendmsg (instance, msg, msg_len, 1);
+
+	return (res);
+}
+
+extern int totemshm_iface_check (void *shm_context)
+{
+	int res = 0;
+
+	/*
+	 * No network interface to lose
+	 */
+	return (res);
+}
+
+extern void totemshm_net_mtu_adjust (void *shm_context, struct totem_config *totem_config)
+{
+
+	totem_config->net_mtu -= crypto_sec_header_size(totem_config->crypto_cipher_type,
+							totem_config->crypto_hash_type);
+}
+
+const char *totemshm_iface_print (void *shm_context)  {
+	struct totemshm_instance *instance = (struct totemshm_instance *)shm_context;
+	const char *ret_char;
+
+	ret_char = totemip_print (&instance->my_id);
+
+	return (ret_char);
+}
+
+int totemshm_iface_get (
+	void *shm_context,
+	struct totem_ip_address *addr)
+{
+	struct totemshm_instance *instance = (struct totemshm_instance *)shm_context;
+	int res = 0;
+
+	memcpy (addr, &instance->my_id, sizeof (struct totem_ip_address));
+
+	return (res);
+}
+
+int totemshm_token_target_set (
+	void *shm_context,
+	const struct totem_ip_address *token_target)
+{
+	struct totemshm_instance *instance = (struct totemshm_instance *)shm_context;
+	int res = 0;
+
+	memcpy (&instance->token_target, token_target,
+		sizeof (struct totem_ip_address));
+	instance->token_member = shm_member_find (instance, token_target);
+
+	instance->totemshm_target_set_completed (instance->context);
+
+	return (res);
+}
+
+extern int totemshm_recv_mcast_empty (
+	void *shm_context)
+{
+	struct totemshm_instance *instance = (struct totemshm_instance *)shm_context;
+	struct totemshm_ring *ring = instance->ring;
+	uint32_t tail;
+	uint32_t head;
+	int msg_processed = 0;
+
+	if (ring == NULL) {
+		return (0);
+	}
+
+	tail = (uint32_t)qb_atomic_int_get (&ring->tail);
+	head = (uint32_t)qb_atomic_int_get (&ring->head);
+	if (tail != head) {
+		qb_atomic_int_set (&ring->tail, (int32_t)head);
+		msg_processed = 1;
+	}
+	instance->held_len = 0;
+
+	return (msg_processed);
+}
+
+int totemshm_member_add (
+	void *shm_context,
+	const struct totem_ip_address *member)
+{
+	struct totemshm_instance *instance = (struct totemshm_instance *)shm_context;
+
+	struct totemshm_member *new_member;
+
+	new_member = malloc (sizeof (struct totemshm_member));
+	if (new_member == NULL) {
+		return (-1);
+	}
+
+	memset(new_member, 0, sizeof(*new_member));
+
+	log_printf (LOGSYS_LEVEL_NOTICE, "adding new SHM member {%s}",
+		totemip_print(member));
+	list_init (&new_member->list);
+	list_add_tail (&new_member->list, &instance->member_list);
+	memcpy (&new_member->member, member, sizeof (struct totem_ip_address));
+	new_member->doorbell_fd = -1;
+	new_member->active = 0;
+
+	if (totemip_equal (member, &instance->token_target)) {
+		instance->token_member = new_member;
+	}
+
+	return (0);
+}
+
+int totemshm_member_remove (
+	void *shm_context,
+	const struct totem_ip_address *token_target)
+{
+	struct totemshm_instance *instance = (struct totemshm_instance *)shm_context;
+	struct totemshm_member *member;
+
+	member = shm_member_find (instance, token_target);
+	if (member == NULL) {
+		return (0);
+	}
+
+	log_printf(LOGSYS_LEVEL_NOTICE,
+		"removing SHM member {%s}",
+		totemip_print(&member->member));
+
+	if (instance->token_member == member) {
+		instance->token_member = NULL;
+	}
+	shm_member_close (member);
+	list_del (&member->list);
+	free (member);
+
+	return (0);
+}
+
+int totemshm_member_set_active (
+	void *shm_context,
+	const struct totem_ip_address *member_ip,
+	int active)
+{
+	struct totemshm_instance *instance = (struct totemshm_instance *)shm_context;
+	struct totemshm_member *member;
+
+	member = shm_member_find (instance, member_ip);
+	if (member == NULL) {
+		log_printf(LOGSYS_LEVEL_DEBUG,
+		    "Can't find SHM member %s (should be marked as %s)",
+			    totemip_print(member_ip),
+			    (active ? "active" : "inactive"));
+		return (0);
+	}
+
+	log_printf(LOGSYS_LEVEL_DEBUG,
+	    "Marking SHM member %s %s",
+	    totemip_print(&member->member),
+	    (active ? "active" : "inactive"));
+
+	member->active = active;
+
+	return (0);
+}
+
+static void timer_function_merge_detect_timeout (
+	void *data)
+{
+	struct totemshm_instance *instance = (struct totemshm_instance *)data;
+
+	if (instance->merge_detect_messages_sent_before_timeout == 0) {
+		instance->send_merge_detect_message = 1;
+	}
+
+	instance->merge_detect_messages_sent_before_timeout = 0;
+
+	totemshm_start_merge_detect_timeout(instance);
+}
+
+static void totemshm_start_merge_detect_timeout(
+	void *shm_context)
+{
+	struct totemshm_instance *instance = (struct totemshm_instance *)shm_context;
+
+	qb_loop_timer_add(instance->totemshm_poll_handle,
+	    QB_LOOP_MED,
+	    instance->totem_config->merge_timeout * 2 * QB_TIME_NS_IN_MSEC,
+	    (void *)instance,
+	    timer_function_merge_detect_timeout,
+	    &instance->timer_merge_detect_timeout);
+
+}
+
+static void totemshm_stop_merge_detect_timeout(
+	void *shm_context)
+{
+	struct totemshm_instance *instance = (struct totemshm_instance *)shm_context;
+
+	qb_loop_timer_del(instance->totemshm_poll_handle,
+	    instance->timer_merge_detect_timeout);
+}
@@ -438,6 +438,11 @@ struct totemsrp_instance {
 		int line,
 		const char *format, ...)__attribute__((format(printf, 6, 7)));;
 
+	int (*totemsrp_log_callsite_register) (
+		struct logsys_callsite *cs,
+		int level,
+		int subsys);
+
 	enum memb_state memb_state;
 
 //TODO	struct srp_addr next_memb;
@@ -522,6 +527,13 @@ struct totemsrp_instance {
 	
 	void * token_recv_event_handle;
 	void * token_sent_event_handle;
+
+	/*
+	 * Time (ns) spent in each phase of processing the current token
+	 */
+	uint64_t token_phase_time[TOTEM_TOKEN_PHASE_MAX];
+
+	uint64_t token_phase_send_mark;
 	char commit_token_storage[40000];
 };
 
@@ -621,6 +633,13 @@ static void main_token_seqid_get (
 	unsigned int *seqid,
 	unsigned int *token_is);
 
+static void main_mcast_seqid_get (
+	const void *msg,
+	unsigned int msg_len,
+	struct memb_ring_id *ring_id,
+	unsigned int *seqid,
+	unsigned int *mcast_is);
+
 static void srp_addr_copy (struct srp_addr *dest, const struct srp_addr *src);
 
 static void srp_addr_to_nodeid (
@@ -688,12 +707,17 @@ struct message_handlers totemsrp_message_handlers = {
 	}
 };
 
-#define log_printf(level, format, args...)		\
-do {							\
-	instance->totemsrp_log_printf (			\
-		level, instance->totemsrp_subsys_id,	\
-		__FUNCTION__, __FILE__, __LINE__,	\
-		format, ##args);			\
+#define log_printf(level, format, args...)				\
+do {									\
+	static struct logsys_callsite _cs = LOGSYS_CALLSITE_INIT;	\
+	if (LOGSYS_CALLSITE_ENABLED(&_cs, level,			\
+	    instance->totemsrp_subsys_id,				\
+	    instance->totemsrp_log_callsite_register)) {		\
+		instance->totemsrp_log_printf (level,			\
+			instance->totemsrp_subsys_id,			\
+			__FUNCTION__, __FILE__, __LINE__,		\
+			format, ##args);				\
+	}								\
 } while (0);
 #define LOGSYS_PERROR(err_num, level, fmt, args...)						\
 do {												\
@@ -763,6 +787,34 @@ static void main_token_seqid_get (
 	}
 }
 
+static void main_mcast_seqid_get (
+	const void *msg,
+	unsigned int msg_len,
+	struct memb_ring_id *ring_id,
+	unsigned int *seqid,
+	unsigned int *mcast_is)
+{
+	const struct mcast *mcast = msg;
+
+	*seqid = 0;
+	*mcast_is = 0;
+	if (msg_len < sizeof (struct mcast) ||
+	    mcast->header.type != MESSAGE_TYPE_MCAST) {
+		return;
+	}
+
+	if (mcast->header.endian_detector != ENDIAN_LOCAL) {
+		*seqid = swab32 (mcast->seq);
+		ring_id->seq = swab64 (mcast->ring_id.seq);
+		ring_id->rep.nodeid = swab32 (mcast->ring_id.rep.nodeid);
+	} else {
+		*seqid = mcast->seq;
+		ring_id->seq = mcast->ring_id.seq;
+		ring_id->rep.nodeid = mcast->ring_id.rep.nodeid;
+	}
+	*mcast_is = 1;
+}
+
 static unsigned int main_msgs_missing (void)
 {
 // TODO
@@ -791,6 +843,110 @@ static int pause_flush (struct totemsrp_instance *instance)
 	return (res);
 }
 
+static void token_phase_mcast_send (
+	struct totemsrp_instance *instance,
+	const void *msg,
+	unsigned int msg_len)
+{
+	uint64_t start = qb_util_nano_current_get ();
+
+	totemrrp_mcast_noflush_send (instance->totemrrp_context, msg, msg_len);
+
+	instance->token_phase_time[TOTEM_TOKEN_PHASE_SEND] +=
+		qb_util_nano_current_get () - start;
+}
+
+static void token_phase_start (struct totemsrp_instance *instance, uint64_t *start)
+{
+	memset (instance->token_phase_time, 0, sizeof (instance->token_phase_time));
+	instance->token_phase_send_mark = 0;
+	*start = qb_util_nano_current_get ();
+}
+
+/*
+ * Account time since *start to phase, except messages sent meanwhile
+ */
+static void token_phase_end (
+	struct totemsrp_instance *instance,
+	enum totem_token_phase phase,
+	uint64_t *start)
+{
+	uint64_t now = qb_util_nano_current_get ();
+	uint64_t send = instance->token_phase_time[TOTEM_TOKEN_PHASE_SEND];
+
+	instance->token_phase_time[phase] += (now - *start) -
+		(send - instance->token_phase_send_mark);
+	instance->token_phase_send_mark = send;
+	*start = now;
+}
+
+static const char *token_phase_names[TOTEM_TOKEN_PHASE_MAX] = {
+	[TOTEM_TOKEN_PHASE_RECV_FLUSH]		= "recv_flush",
+	[TOTEM_TOKEN_PHASE_RX_CALLBACKS]	= "rx_callbacks",
+	[TOTEM_TOKEN_PHASE_RTR]			= "rtr",
+	[TOTEM_TOKEN_PHASE_MCAST]		= "mcast",
+	[TOTEM_TOKEN_PHASE_SEND]		= "send",
+	[TOTEM_TOKEN_PHASE_TOKEN_SEND]		= "token_send",
+	[TOTEM_TOKEN_PHASE_DELIVER]		= "deliver",
+	[TOTEM_TOKEN_PHASE_TX_CALLBACKS]	= "tx_callbacks",
+	[TOTEM_TOKEN_PHASE_TOTAL]		= "total"
+};
+
+const char *totemsrp_token_phase_name (enum totem_token_phase phase)
+{
+	if (phase >= TOTEM_TOKEN_PHASE_MAX) {
+		return ("unknown");
+	}
+
+	return (token_phase_names[phase]);
+}
+
+static void token_phase_account (struct totemsrp_instance *instance, uint64_t token_start)
+{
+	totemsrp_token_phase_stats_t *phase_stats;
+	uint64_t us[TOTEM_TOKEN_PHASE_MAX];
+	int phase, i;
+
+	instance->token_phase_time[TOTEM_TOKEN_PHASE_TOTAL] =
+		qb_util_nano_current_get () - token_start;
+
+	for (phase = 0; phase < TOTEM_TOKEN_PHASE_MAX; phase++) {
+		us[phase] = instance->token_phase_time[phase] / QB_TIME_NS_IN_USEC;
+		phase_stats = &instance->stats.token_phase[phase];
+
+		phase_stats->count++;
+		phase_stats->time_total += us[phase];
+		if (us[phase] > phase_stats->time_max) {
+			phase_stats->time_max = us[phase];
+		}
+		for (i = 0; i < TOTEM_TOKEN_PHASE_BUCKETS - 1; i++) {
+			if (us[phase] <= (1ULL << i)) {
+				break;
+			}
+		}
+		phase_stats->hist[i]++;
+	}
+
+	/*
+	 * Slow tokens are worth a record in the blackbox
+	 */
+	if (us[TOTEM_TOKEN_PHASE_TOTAL] * 10 >
+	    (uint64_t)instance->totem_config->token_timeout * 1000) {
+		log_printf (instance->totemsrp_log_level_debug,
+			"Token held for %llu us: %s %llu %s %llu %s %llu %s %llu %s %llu "
+			"%s %llu %s %llu %s %llu",
+			(unsigned long long)us[TOTEM_TOKEN_PHASE_TOTAL],
+			token_phase_names[0], (unsigned long long)us[0],
+			token_phase_names[1], (unsigned long long)us[1],
+			token_phase_names[2], (unsigned long long)us[2],
+			token_phase_names[3], (unsigned long long)us[3],
+			token_phase_names[4], (unsigned long long)us[4],
+			token_phase_names[5], (unsigned long long)us[5],
+			token_phase_names[6], (unsigned long long)us[6],
+			token_phase_names[7], (unsigned long long)us[7]);
+	}
+}
+
 static int token_event_stats_collector (enum totem_callback_token_type type, const void *void_instance)
 {
 	struct totemsrp_instance *instance = (struct totemsrp_instance *)void_instance;
@@ -879,6 +1035,8 @@ int totemsrp_initialize (
 	instance->totemsrp_log_level_trace = totem_config->totem_logging_configuration.log_level_trace;
 	instance->totemsrp_subsys_id = totem_config->totem_logging_configuration.log_subsys_id;
 	instance->totemsrp_log_printf = totem_config->totem_logging_configuration.log_printf;
+	instance->totemsrp_log_callsite_register =
+		totem_config->totem_logging_configuration.log_callsite_register;
 
 	/*
 	 * Configure totem store and load functions
@@ -1002,6 +1160,7 @@ int totemsrp_initialize (
 		main_deliver_fn,
 		main_iface_change_fn,
 		main_token_seqid_get,
+		main_mcast_seqid_get,
 		main_msgs_missing,
 		target_set_completed);
 
@@ -1546,7 +1705,7 @@ static void reset_token_retransmit_timeout (struct totemsrp_instance *instance)
 	qb_loop_timer_del (instance->totemsrp_poll_handle,
 		instance->timer_orf_token_retransmit_timeout);
 	qb_loop_timer_add (instance->totemsrp_poll_handle,
-		QB_LOOP_MED,
+		QB_LOOP_HIGH,
 		instance->totem_config->token_retransmit_timeout*QB_TIME_NS_IN_MSEC,
 		(void *)instance,
 		timer_function_token_retransmit_timeout,
@@ -1558,7 +1717,7 @@ static void start_merge_detect_timeout (struct totemsrp_instance *instance)
 {
 	if (instance->my_merge_detect_timeout_outstanding == 0) {
 		qb_loop_timer_add (instance->totemsrp_poll_handle,
-			QB_LOOP_MED,
+			QB_LOOP_HIGH,
 			instance->totem_config->merge_timeout*QB_TIME_NS_IN_MSEC,
 			(void *)instance,
 			timer_function_merge_detect_timeout,
@@ -1612,7 +1771,7 @@ static void reset_pause_timeout (struct totemsrp_instance *instance)
 {
 	qb_loop_timer_del (instance->totemsrp_poll_handle, instance->timer_pause_timeout);
 	qb_loop_timer_add (instance->totemsrp_poll_handle,
-		QB_LOOP_MED,
+		QB_LOOP_HIGH,
 		instance->totem_config->token_timeout * QB_TIME_NS_IN_MSEC / 5,
 		(void *)instance,
 		timer_function_pause_timeout,
@@ -1622,7 +1781,7 @@ static void reset_pause_timeout (struct totemsrp_instance *instance)
 static void reset_token_timeout (struct totemsrp_instance *instance) {
 	qb_loop_timer_del (instance->totemsrp_poll_handle, instance->timer_orf_token_timeout);
 	qb_loop_timer_add (instance->totemsrp_poll_handle,
-		QB_LOOP_MED,
+		QB_LOOP_HIGH,
 		instance->totem_config->token_timeout*QB_TIME_NS_IN_MSEC,
 		(void *)instance,
 		timer_function_orf_token_timeout,
@@ -1632,7 +1791,7 @@ static void reset_token_timeout (struct totemsrp_instance *instance) {
 static void reset_heartbeat_timeout (struct totemsrp_instance *instance) {
         qb_loop_timer_del (instance->totemsrp_poll_handle, instance->timer_heartbeat_timeout);
         qb_loop_timer_add (instance->totemsrp_poll_handle,
-		QB_LOOP_MED,
+		QB_LOOP_HIGH,
                 instance->heartbeat_timeout*QB_TIME_NS_IN_MSEC,
                 (void *)instance,
                 timer_function_heartbeat_timeout,
@@ -1656,7 +1815,7 @@ static void cancel_token_retransmit_timeout (struct totemsrp_instance *instance)
 static void start_token_hold_retransmit_timeout (struct totemsrp_instance *instance)
 {
 	qb_loop_timer_add (instance->totemsrp_poll_handle,
-		QB_LOOP_MED,
+		QB_LOOP_HIGH,
 		instance->totem_config->token_hold_timeout*QB_TIME_NS_IN_MSEC,
 		(void *)instance,
 		timer_function_token_hold_retransmit_timeout,
@@ -1729,6 +1888,7 @@ static void timer_function_orf_token_timeout (void *data)
 			log_printf (instance->totemsrp_log_level_notice,
 				"A processor failed, forming new configuration.");
 			totemrrp_iface_check (instance->totemrrp_context);
+			instance->stats.memb_token_lost_time = qb_util_nano_current_get ();
 			memb_state_gather_enter (instance, TOTEMSRP_GSFROM_THE_TOKEN_WAS_LOST_IN_THE_OPERATIONAL_STATE);
 			instance->stats.operational_token_lost++;
 			break;
@@ -1784,7 +1944,7 @@ static void memb_timer_function_state_gather (void *data)
 		qb_loop_timer_del (instance->totemsrp_poll_handle, instance->memb_timer_state_gather_join_timeout);
 
 		qb_loop_timer_add (instance->totemsrp_poll_handle,
-			QB_LOOP_MED,
+			QB_LOOP_HIGH,
 			instance->totem_config->join_timeout*QB_TIME_NS_IN_MSEC,
 			(void *)instance,
 			memb_timer_function_state_gather,
@@ -1891,6 +2051,8 @@ static void memb_state_operational_enter (struct totemsrp_instance *instance)
 	char joined_node_msg[1024];
 	char failed_node_msg[1024];
 
+	instance->stats.memb_operational_time = qb_util_nano_current_get ();
+
 	instance->originated_orf_token = 0;
 
 	memb_consensus_reset (instance);
@@ -2124,6 +2286,16 @@ static void memb_state_gather_enter (
 	struct totemsrp_instance *instance,
 	enum gather_state_from gather_from)
 {
+	if (instance->memb_state == MEMB_STATE_OPERATIONAL) {
+		/*
+		 * First gather of a new membership change
+		 */
+		instance->stats.memb_gather_time = qb_util_nano_current_get ();
+		if (gather_from != TOTEMSRP_GSFROM_THE_TOKEN_WAS_LOST_IN_THE_OPERATIONAL_STATE) {
+			instance->stats.memb_token_lost_time = 0;
+		}
+	}
+
 	instance->orf_token_discard = 1;
 
 	instance->originated_orf_token = 0;
@@ -2140,7 +2312,7 @@ static void memb_state_gather_enter (
 	qb_loop_timer_del (instance->totemsrp_poll_handle, instance->memb_timer_state_gather_join_timeout);
 
 	qb_loop_timer_add (instance->totemsrp_poll_handle,
-		QB_LOOP_MED,
+		QB_LOOP_HIGH,
 		instance->totem_config->join_timeout*QB_TIME_NS_IN_MSEC,
 		(void *)instance,
 		memb_timer_function_state_gather,
@@ -2153,7 +2325,7 @@ static void memb_state_gather_enter (
 		instance->memb_timer_state_gather_consensus_timeout);
 
 	qb_loop_timer_add (instance->totemsrp_poll_handle,
-		QB_LOOP_MED,
+		QB_LOOP_HIGH,
 		instance->totem_config->consensus_timeout*QB_TIME_NS_IN_MSEC,
 		(void *)instance,
 		memb_timer_function_gather_consensus_timeout,
@@ -2228,6 +2400,7 @@ static void memb_state_commit_enter (
 	reset_token_timeout (instance); // REVIEWED
 
 	instance->stats.commit_entered++;
+	instance->stats.memb_commit_time = qb_util_nano_current_get ();
 	instance->stats.continuous_gather = 0;
 
 	/*
@@ -2427,6 +2600,7 @@ originated:
 
 	instance->memb_state = MEMB_STATE_RECOVERY;
 	instance->stats.recovery_entered++;
+	instance->stats.memb_recovery_time = qb_util_nano_current_get ();
 	instance->stats.continuous_gather = 0;
 
 	return;
@@ -2564,9 +2738,7 @@ static int orf_token_remcast (
 
 	sort_queue_item = ptr;
 
-	totemrrp_mcast_noflush_send (
-		instance->totemrrp_context,
-		sort_queue_item->mcast,
+	token_phase_mcast_send (instance, sort_queue_item->mcast,
 		sort_queue_item->msg_len);
 
 	return (0);
@@ -2717,9 +2889,7 @@ static int orf_token_mcast (
 		 */
 		sq_item_add (sort_queue, &sort_queue_item, message_item->mcast->seq);
 
-		totemrrp_mcast_noflush_send (
-			instance->totemrrp_context,
-			message_item->mcast,
+		token_phase_mcast_send (instance, message_item->mcast,
 			message_item->msg_len);
 
 		/*
@@ -3615,6 +3785,8 @@ static int message_handler_orf_token (
 	unsigned int mcasted_retransmit;
 	unsigned int mcasted_regular;
 	unsigned int last_aru;
+	uint64_t token_start;
+	uint64_t phase_start;
 
 #ifdef GIVEINFO
 	unsigned long long tv_current;
@@ -3643,6 +3815,9 @@ static int message_handler_orf_token (
 		msg = (struct orf_token *)token_convert;
 	}
 
+	token_phase_start (instance, &token_start);
+	phase_start = token_start;
+
 	/*
 	 * Make copy of token and retransmit list in case we have
 	 * to flush incoming messages from the kernel queue
@@ -3675,6 +3850,7 @@ static int message_handler_orf_token (
 	instance->flushing = 1;
 	totemrrp_recv_flush (instance->totemrrp_context);
 	instance->flushing = 0;
+	token_phase_end (instance, TOTEM_TOKEN_PHASE_RECV_FLUSH, &phase_start);
 
 	/*
 	 * Determine if we should hold (in reality drop) the token
@@ -3701,6 +3877,7 @@ static int message_handler_orf_token (
 	}
 
 	token_callbacks_execute (instance, TOTEM_CALLBACK_TOKEN_RECEIVED);
+	token_phase_end (instance, TOTEM_TOKEN_PHASE_RX_CALLBACKS, &phase_start);
 
 	switch (instance->memb_state) {
 	case MEMB_STATE_COMMIT:
@@ -3747,6 +3924,7 @@ static int message_handler_orf_token (
 
 		transmits_allowed = fcc_calculate (instance, token);
 		mcasted_retransmit = orf_token_rtr (instance, token, &transmits_allowed);
+		token_phase_end (instance, TOTEM_TOKEN_PHASE_RTR, &phase_start);
 
 		if (instance->my_token_held == 1 &&
 			(token->rtr_list_entries > 0 || mcasted_retransmit > 0)) {
@@ -3863,8 +4041,11 @@ printf ("token seq %d\n", token->seq);
 				}
 			}
 
+			token_phase_end (instance, TOTEM_TOKEN_PHASE_MCAST, &phase_start);
+
 			totemrrp_send_flush (instance->totemrrp_context);
 			token_send (instance, token, forward_token);
+			token_phase_end (instance, TOTEM_TOKEN_PHASE_TOKEN_SEND, &phase_start);
 
 #ifdef GIVEINFO
 			tv_current = qb_util_nano_current_get ();
@@ -3878,6 +4059,7 @@ printf ("token seq %d\n", token->seq);
 				messages_deliver_to_app (instance, 0,
 					instance->my_high_seq_received);
 			}
+			token_phase_end (instance, TOTEM_TOKEN_PHASE_DELIVER, &phase_start);
 
 			/*
 			 * Deliver messages after token has been transmitted
@@ -3892,6 +4074,8 @@ printf ("token seq %d\n", token->seq);
 			}
 
 			token_callbacks_execute (instance, TOTEM_CALLBACK_TOKEN_SENT);
+			token_phase_end (instance, TOTEM_TOKEN_PHASE_TX_CALLBACKS, &phase_start);
+			token_phase_account (instance, token_start);
 		}
 		break;
 	}
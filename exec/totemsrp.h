@@ -143,4 +143,9 @@ void totemsrp_threaded_mode_enable (
 void totemsrp_trans_ack (
 	void *srp_context);
 
+/*
+ * Name of token processing phase as used in runtime keys and logs
+ */
+extern const char *totemsrp_token_phase_name (enum totem_token_phase phase);
+
 #endif /* TOTEMSRP_H_DEFINED */
@@ -151,6 +151,11 @@ struct totemudp_instance {
 		const char *format,
 		...)__attribute__((format(printf, 6, 7)));
 
+	int (*totemudp_log_callsite_register) (
+		struct logsys_callsite *cs,
+		int level,
+		int subsys);
+
 	void *udp_context;
 
 	char iov_buffer[FRAME_SIZE_MAX];
@@ -230,10 +235,15 @@ static void totemudp_instance_initialize (struct totemudp_instance *instance)
 
 #define log_printf(level, format, args...)				\
 do {									\
-        instance->totemudp_log_printf (					\
-		level, instance->totemudp_subsys_id,			\
-                __FUNCTION__, __FILE__, __LINE__,			\
-		(const char *)format, ##args);				\
+	static struct logsys_callsite _cs = LOGSYS_CALLSITE_INIT;	\
+	if (LOGSYS_CALLSITE_ENABLED(&_cs, level,			\
+	    instance->totemudp_subsys_id,				\
+	    instance->totemudp_log_callsite_register)) {		\
+		instance->totemudp_log_printf (level,			\
+			instance->totemudp_subsys_id,			\
+			__FUNCTION__, __FILE__, __LINE__,		\
+			(const char *)format, ##args);			\
+	}								\
 } while (0);
 
 #define LOGSYS_PERROR(err_num, level, fmt, args...)						\
@@ -643,19 +653,19 @@ static void timer_function_netif_check_timeout (
 
 	qb_loop_poll_add (
 		instance->totemudp_poll_handle,
-		QB_LOOP_MED,
+		QB_LOOP_HIGH,
 		instance->totemudp_sockets.mcast_recv,
 		POLLIN, instance, net_deliver_fn);
 
 	qb_loop_poll_add (
 		instance->totemudp_poll_handle,
-		QB_LOOP_MED,
+		QB_LOOP_HIGH,
 		instance->totemudp_sockets.local_mcast_loop[0],
 		POLLIN, instance, net_deliver_fn);
 
 	qb_loop_poll_add (
 		instance->totemudp_poll_handle,
-		QB_LOOP_MED,
+		QB_LOOP_HIGH,
 		instance->totemudp_sockets.token,
 		POLLIN, instance, net_deliver_fn);
 
@@ -1141,6 +1151,8 @@ int totemudp_initialize (
 	instance->totemudp_log_level_debug = totem_config->totem_logging_configuration.log_level_debug;
 	instance->totemudp_subsys_id = totem_config->totem_logging_configuration.log_subsys_id;
 	instance->totemudp_log_printf = totem_config->totem_logging_configuration.log_printf;
+	instance->totemudp_log_callsite_register =
+		totem_config->totem_logging_configuration.log_callsite_register;
 
 	/*
 	* Initialize random number generator for later use to generate salt
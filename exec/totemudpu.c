@@ -60,6 +60,10 @@
 
 #include <qb/qbdefs.h>
 #include <qb/qbloop.h>
+#ifdef HAVE_LIBURING
+#include <sys/eventfd.h>
+#include <liburing.h>
+#endif
 
 #include <corosync/sq.h>
 #include <corosync/list.h>
@@ -84,6 +88,54 @@
 #define NETIF_STATE_REPORT_UP		1
 #define NETIF_STATE_REPORT_DOWN		2
 
+#ifdef HAVE_LIBURING
+/*
+ * io_uring backend: one ring per interface, multishot recvmsg on the token
+ * socket into a ring of provided buffers and sendmsg requests from a pool
+ * of frames, submitted in one batch per token hold
+ */
+#define URING_ENTRIES			256
+#define URING_RECV_FRAMES		64
+#define URING_RECV_FRAME_SIZE		(sizeof (struct io_uring_recvmsg_out) + \
+					 sizeof (struct sockaddr_storage) + FRAME_SIZE_MAX)
+#define URING_RECV_BGID			0
+#define URING_SEND_FRAMES		128
+#define URING_SENDS			1024
+#define URING_DEFERRED_CQES		(URING_RECV_FRAMES + 8)
+
+/*
+ * user_data of recvmsg requests, generation in the upper bits.
+ * Send requests use the (aligned) address of their totemudpu_uring_send.
+ */
+#define URING_TAG_RECV			1
+#define URING_TAG_CANCEL		2
+#define URING_TAG_MASK			3
+
+struct totemudpu_uring_frame {
+	struct list_head list;
+	unsigned int refcount;
+	size_t len;
+	unsigned char buf[FRAME_SIZE_MAX];
+};
+
+struct totemudpu_uring_send {
+	struct list_head list;
+	struct totemudpu_uring_frame *frame;
+	struct msghdr msg;
+	struct iovec iov;
+	struct sockaddr_storage addr;
+};
+
+/*
+ * Receive completion taken off the completion queue by the send path
+ */
+struct totemudpu_uring_cqe {
+	uint64_t user_data;
+	int32_t res;
+	uint32_t flags;
+};
+#endif
+
 #define BIND_STATE_UNBOUND	0
 #define BIND_STATE_REGULAR	1
 #define BIND_STATE_LOOPBACK	2
@@ -143,6 +195,11 @@ struct totemudpu_instance {
 		const char *format,
 		...)__attribute__((format(printf, 6, 7)));
 
+	int (*totemudpu_log_callsite_register) (
+		struct logsys_callsite *cs,
+		int level,
+		int subsys);
+
 	void *udpu_context;
 
 	char iov_buffer[FRAME_SIZE_MAX];
@@ -184,6 +241,39 @@ struct totemudpu_instance {
 	int send_merge_detect_message;
 
 	unsigned int merge_detect_messages_sent_before_timeout;
+#ifdef HAVE_LIBURING
+	int uring_enabled;
+
+	struct io_uring uring;
+
+	int uring_eventfd;
+
+	struct io_uring_buf_ring *uring_recv_br;
+
+	unsigned char *uring_recv_frames;
+
+	struct msghdr uring_recv_msghdr;
+
+	uint64_t uring_recv_gen;
+
+	struct totemudpu_uring_frame *uring_send_frames;
+
+	struct list_head uring_send_frames_free;
+
+	struct totemudpu_uring_send *uring_sends;
+
+	struct list_head uring_sends_free;
+
+	unsigned int uring_sqes_pending;
+
+	struct io_uring_sqe *uring_link_tail;
+
+	struct totemudpu_uring_cqe uring_deferred_cqes[URING_DEFERRED_CQES];
+
+	unsigned int uring_deferred_head;
+
+	unsigned int uring_deferred_count;
+#endif
 };
 
 struct work_item {
@@ -192,6 +282,11 @@ struct work_item {
 	struct totemudpu_instance *instance;
 };
 
+static int net_deliver_fn (
+	int fd,
+	int revents,
+	void *data);
+
 static int totemudpu_build_sockets (
 	struct totemudpu_instance *instance,
 	struct totem_ip_address *bindnet_address,
@@ -230,12 +325,17 @@ static void totemudpu_instance_initialize (struct totemudpu_instance *instance)
 	list_init (&instance->member_list);
 }
 
-#define log_printf(level, format, args...)		\
-do {							\
-        instance->totemudpu_log_printf (		\
-		level, instance->totemudpu_subsys_id,	\
-                __FUNCTION__, __FILE__, __LINE__,	\
-		(const char *)format, ##args);		\
+#define log_printf(level, format, args...)				\
+do {									\
+	static struct logsys_callsite _cs = LOGSYS_CALLSITE_INIT;	\
+	if (LOGSYS_CALLSITE_ENABLED(&_cs, level,			\
+	    instance->totemudpu_subsys_id,				\
+	    instance->totemudpu_log_callsite_register)) {		\
+		instance->totemudpu_log_printf (level,			\
+			instance->totemudpu_subsys_id,			\
+			__FUNCTION__, __FILE__, __LINE__,		\
+			(const char *)format, ##args);			\
+	}								\
 } while (0);
 #define LOGSYS_PERROR(err_num, level, fmt, args...)						\
 do {												\
@@ -247,6 +347,560 @@ do {												\
 		fmt ": %s (%d)", ##args, _error_ptr, err_num);				\
 	} while(0)
 
+#ifdef HAVE_LIBURING
+/*
+ * Sends queued between two submits form one chain of hard links, so the
+ * kernel issues them in queue order even if one of them fails. The chain
+ * is closed before anything else is queued and before every submit.
+ */
+static void uring_link_end (struct totemudpu_instance *instance)
+{
+	if (instance->uring_link_tail != NULL) {
+		instance->uring_link_tail->flags &= ~IOSQE_IO_HARDLINK;
+		instance->uring_link_tail = NULL;
+	}
+}
+
+static void uring_submit (struct totemudpu_instance *instance)
+{
+	int res;
+
+	if (instance->uring_sqes_pending == 0) {
+		return;
+	}
+
+	uring_link_end (instance);
+	res = io_uring_submit (&instance->uring);
+	if (res < 0) {
+		LOGSYS_PERROR (-res, instance->totemudpu_log_level_debug,
+			"io_uring_submit failed (non-critical)");
+	}
+	instance->uring_sqes_pending = 0;
+}
+
+static struct io_uring_sqe *uring_sqe_get (struct totemudpu_instance *instance,
+	int link)
+{
+	struct io_uring_sqe *sqe;
+
+	if (!link) {
+		uring_link_end (instance);
+	}
+
+	sqe = io_uring_get_sqe (&instance->uring);
+	if (sqe == NULL) {
+		/*
+		 * Submission queue is full, flush it
+		 */
+		uring_submit (instance);
+		sqe = io_uring_get_sqe (&instance->uring);
+	}
+	if (sqe != NULL) {
+		instance->uring_sqes_pending++;
+	}
+
+	return (sqe);
+}
+
+static void uring_recv_arm (struct totemudpu_instance *instance)
+{
+	struct io_uring_sqe *sqe;
+
+	sqe = uring_sqe_get (instance, 0);
+	if (sqe == NULL) {
+		return;
+	}
+
+	io_uring_prep_recvmsg_multishot (sqe, instance->token_socket,
+		&instance->uring_recv_msghdr, 0);
+	sqe->flags |= IOSQE_BUFFER_SELECT;
+	sqe->buf_group = URING_RECV_BGID;
+	io_uring_sqe_set_data64 (sqe, (instance->uring_recv_gen << 2) | URING_TAG_RECV);
+	uring_submit (instance);
+}
+
+/*
+ * Called when the token socket is about to be closed, the multishot
+ * receive of the old socket must not be rearmed
+ */
+static void uring_recv_cancel (struct totemudpu_instance *instance)
+{
+	struct io_uring_sqe *sqe;
+
+	sqe = uring_sqe_get (instance, 0);
+	if (sqe != NULL) {
+		io_uring_prep_cancel64 (sqe,
+			(instance->uring_recv_gen << 2) | URING_TAG_RECV, 0);
+		io_uring_sqe_set_data64 (sqe, URING_TAG_CANCEL);
+	}
+	uring_submit (instance);
+	instance->uring_recv_gen++;
+}
+
+static void uring_recv_frame_release (struct totemudpu_instance *instance,
+	unsigned int bid)
+{
+	io_uring_buf_ring_add (instance->uring_recv_br,
+		instance->uring_recv_frames + bid * URING_RECV_FRAME_SIZE,
+		URING_RECV_FRAME_SIZE, bid,
+		io_uring_buf_ring_mask (URING_RECV_FRAMES), 0);
+	io_uring_buf_ring_advance (instance->uring_recv_br, 1);
+}
+
+static void uring_send_release (struct totemudpu_instance *instance,
+	struct totemudpu_uring_send *send)
+{
+	if (--send->frame->refcount == 0) {
+		list_add (&send->frame->list, &instance->uring_send_frames_free);
+	}
+	list_add (&send->list, &instance->uring_sends_free);
+}
+
+static void uring_send_complete (struct totemudpu_instance *instance,
+	int32_t res,
+	struct totemudpu_uring_send *send)
+{
+	if (res < 0) {
+		LOGSYS_PERROR (-res, instance->totemudpu_log_level_debug,
+			"sendmsg(uring) failed (non-critical)");
+	} else {
+		instance->stats_sent += res;
+	}
+	uring_send_release (instance, send);
+}
+
+/*
+ * Returns completed sends to the pools. The caller may be in the middle
+ * of sending, so receive completions are not delivered here but kept in
+ * order for uring_complete.
+ */
+static void uring_reap_sends (struct totemudpu_instance *instance)
+{
+	struct io_uring_cqe *cqe;
+	struct totemudpu_uring_cqe *deferred;
+
+	while (io_uring_peek_cqe (&instance->uring, &cqe) == 0) {
+		if ((io_uring_cqe_get_data64 (cqe) & URING_TAG_MASK) == 0) {
+			uring_send_complete (instance, cqe->res,
+				io_uring_cqe_get_data (cqe));
+		} else {
+			if (instance->uring_deferred_count == URING_DEFERRED_CQES) {
+				break;
+			}
+			deferred = &instance->uring_deferred_cqes[
+				(instance->uring_deferred_head + instance->uring_deferred_count) %
+				URING_DEFERRED_CQES];
+			deferred->user_data = io_uring_cqe_get_data64 (cqe);
+			deferred->res = cqe->res;
+			deferred->flags = cqe->flags;
+			instance->uring_deferred_count++;
+		}
+		io_uring_cqe_seen (&instance->uring, cqe);
+	}
+}
+
+static struct totemudpu_uring_frame *uring_frame_get (
+	struct totemudpu_instance *instance,
+	unsigned int sends_needed,
+	const void *msg,
+	unsigned int msg_len)
+{
+	struct totemudpu_uring_frame *frame;
+	struct list_head *list;
+	unsigned int sends_free = 0;
+
+	uring_reap_sends (instance);
+
+	if (list_empty (&instance->uring_send_frames_free)) {
+		return (NULL);
+	}
+	for (list = instance->uring_sends_free.next;
+	    list != &instance->uring_sends_free && sends_free < sends_needed;
+	    list = list->next) {
+		sends_free++;
+	}
+	if (sends_free < sends_needed) {
+		return (NULL);
+	}
+
+	frame = list_entry (instance->uring_send_frames_free.next,
+		struct totemudpu_uring_frame, list);
+
+	/*
+	 * Encrypt and digest the message
+	 */
+	if (crypto_encrypt_and_sign (
+		instance->crypto_inst,
+		(const unsigned char *)msg,
+		msg_len,
+		frame->buf,
+		&frame->len) != 0) {
+		log_printf(LOGSYS_LEVEL_CRIT, "Error encrypting/signing packet (non-critical)");
+		return (NULL);
+	}
+
+	list_del (&frame->list);
+	frame->refcount = 0;
+
+	return (frame);
+}
+
+static void uring_sendto (
+	struct totemudpu_instance *instance,
+	struct totemudpu_uring_frame *frame,
+	int fd,
+	const struct totem_ip_address *system_to)
+{
+	struct totemudpu_uring_send *send;
+	struct io_uring_sqe *sqe;
+	int addrlen;
+
+	sqe = uring_sqe_get (instance, 1);
+	if (sqe == NULL) {
+		return;
+	}
+
+	send = list_entry (instance->uring_sends_free.next,
+		struct totemudpu_uring_send, list);
+	list_del (&send->list);
+	send->frame = frame;
+	frame->refcount++;
+
+	totemip_totemip_to_sockaddr_convert((struct totem_ip_address *)system_to,
+		instance->totem_interface->ip_port, &send->addr, &addrlen);
+	send->iov.iov_base = frame->buf;
+	send->iov.iov_len = frame->len;
+	memset (&send->msg, 0, sizeof (send->msg));
+	send->msg.msg_name = &send->addr;
+	send->msg.msg_namelen = addrlen;
+	send->msg.msg_iov = &send->iov;
+	send->msg.msg_iovlen = 1;
+
+	/*
+	 * MSG_DONTWAIT: a full socket buffer fails the send right away, as
+	 * for the non blocking socket path, instead of the kernel parking the
+	 * request and letting later sends overtake it
+	 */
+	io_uring_prep_sendmsg (sqe, fd, &send->msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+	io_uring_sqe_set_data (sqe, send);
+	sqe->flags |= IOSQE_IO_HARDLINK;
+	instance->uring_link_tail = sqe;
+}
+
+static void uring_recv_complete (
+	struct totemudpu_instance *instance,
+	int32_t cqe_res,
+	uint32_t cqe_flags,
+	int deliver)
+{
+	struct io_uring_recvmsg_out *out;
+	unsigned char *frame;
+	unsigned int bid;
+	int bytes_received;
+	int res;
+
+	if (!(cqe_flags & IORING_CQE_F_BUFFER)) {
+		return;
+	}
+
+	bid = cqe_flags >> IORING_CQE_BUFFER_SHIFT;
+	frame = instance->uring_recv_frames + bid * URING_RECV_FRAME_SIZE;
+
+	out = io_uring_recvmsg_validate (frame, cqe_res, &instance->uring_recv_msghdr);
+	if (out == NULL || (out->flags & MSG_TRUNC) || !deliver) {
+		uring_recv_frame_release (instance, bid);
+		return;
+	}
+
+	bytes_received = io_uring_recvmsg_payload_length (out, cqe_res,
+		&instance->uring_recv_msghdr);
+	instance->stats_recv += bytes_received;
+
+	/*
+	 * Authenticate and if authenticated, decrypt datagram
+	 */
+	res = crypto_authenticate_and_decrypt (instance->crypto_inst,
+		io_uring_recvmsg_payload (out, &instance->uring_recv_msghdr),
+		&bytes_received);
+	if (res == -1) {
+		log_printf (instance->totemudpu_log_level_security, "Received message has invalid digest... ignoring.");
+		log_printf (instance->totemudpu_log_level_security,
+			"Invalid packet data");
+		uring_recv_frame_release (instance, bid);
+		return;
+	}
+
+	/*
+	 * Handle incoming message
+	 */
+	instance->totemudpu_deliver_fn (
+		instance->context,
+		io_uring_recvmsg_payload (out, &instance->uring_recv_msghdr),
+		bytes_received);
+
+	uring_recv_frame_release (instance, bid);
+}
+
+/*
+ * Process completions one at a time, the deliver function may send
+ * (queue new requests) or empty the receive queue recursively.
+ * Completions deferred by uring_reap_sends are older than anything still
+ * in the completion queue, so they go first.
+ */
+static int uring_complete (struct totemudpu_instance *instance, int deliver)
+{
+	struct io_uring_cqe *cqe_ptr;
+	struct totemudpu_uring_cqe cqe;
+	int msg_processed = 0;
+
+	for (;;) {
+		if (instance->uring_deferred_count > 0) {
+			cqe = instance->uring_deferred_cqes[instance->uring_deferred_head];
+			instance->uring_deferred_head =
+				(instance->uring_deferred_head + 1) % URING_DEFERRED_CQES;
+			instance->uring_deferred_count--;
+		} else if (io_uring_peek_cqe (&instance->uring, &cqe_ptr) == 0) {
+			cqe.user_data = io_uring_cqe_get_data64 (cqe_ptr);
+			cqe.res = cqe_ptr->res;
+			cqe.flags = cqe_ptr->flags;
+			io_uring_cqe_seen (&instance->uring, cqe_ptr);
+		} else {
+			break;
+		}
+
+		switch (cqe.user_data & URING_TAG_MASK) {
+		case URING_TAG_RECV:
+			if (cqe.res >= 0) {
+				uring_recv_complete (instance, cqe.res, cqe.flags, deliver);
+				msg_processed = 1;
+			}
+			if (!(cqe.flags & IORING_CQE_F_MORE) &&
+			    (cqe.user_data >> 2) == instance->uring_recv_gen &&
+			    instance->token_socket > 0) {
+				/*
+				 * Multishot receive terminated (usually out of buffers)
+				 */
+				uring_recv_arm (instance);
+			}
+			break;
+		case URING_TAG_CANCEL:
+			break;
+		default:
+			uring_send_complete (instance, cqe.res,
+				(struct totemudpu_uring_send *)(uintptr_t)cqe.user_data);
+			break;
+		}
+	}
+
+	uring_submit (instance);
+
+	return (msg_processed);
+}
+
+static int uring_deliver_fn (
+	int fd,
+	int revents,
+	void *data)
+{
+	struct totemudpu_instance *instance = (struct totemudpu_instance *)data;
+	eventfd_t events;
+
+	eventfd_read (instance->uring_eventfd, &events);
+
+	uring_complete (instance, 1);
+
+	return (0);
+}
+
+static void uring_finalize (struct totemudpu_instance *instance)
+{
+	if (instance->uring_eventfd > 0) {
+		qb_loop_poll_del (instance->totemudpu_poll_handle,
+			instance->uring_eventfd);
+		close (instance->uring_eventfd);
+	}
+	if (instance->uring_recv_br != NULL) {
+		io_uring_free_buf_ring (&instance->uring, instance->uring_recv_br,
+			URING_RECV_FRAMES, URING_RECV_BGID);
+	}
+	io_uring_queue_exit (&instance->uring);
+	free (instance->uring_recv_frames);
+	free (instance->uring_send_frames);
+	free (instance->uring_sends);
+	instance->uring_enabled = 0;
+}
+
+/*
+ * Returns 0 on success, otherwise the socket path is used
+ */
+static int uring_init (struct totemudpu_instance *instance)
+{
+	unsigned int i;
+	int res;
+
+	res = io_uring_queue_init (URING_ENTRIES, &instance->uring, 0);
+	if (res < 0) {
+		LOGSYS_PERROR (-res, instance->totemudpu_log_level_warning,
+			"Can't initialize io_uring, using socket I/O");
+		return (-1);
+	}
+	instance->uring_enabled = 1;
+
+	instance->uring_recv_frames = malloc (URING_RECV_FRAMES * URING_RECV_FRAME_SIZE);
+	instance->uring_send_frames = malloc (URING_SEND_FRAMES * sizeof (struct totemudpu_uring_frame));
+	instance->uring_sends = malloc (URING_SENDS * sizeof (struct totemudpu_uring_send));
+	if (instance->uring_recv_frames == NULL || instance->uring_send_frames == NULL ||
+	    instance->uring_sends == NULL) {
+		log_printf (instance->totemudpu_log_level_warning,
+			"Can't allocate io_uring buffers, using socket I/O");
+		goto error_exit;
+	}
+
+	instance->uring_recv_br = io_uring_setup_buf_ring (&instance->uring,
+		URING_RECV_FRAMES, URING_RECV_BGID, 0, &res);
+	if (instance->uring_recv_br == NULL) {
+		LOGSYS_PERROR (-res, instance->totemudpu_log_level_warning,
+			"Can't register io_uring receive buffers, using socket I/O");
+		goto error_exit;
+	}
+	for (i = 0; i < URING_RECV_FRAMES; i++) {
+		uring_recv_frame_release (instance, i);
+	}
+
+	list_init (&instance->uring_send_frames_free);
+	for (i = 0; i < URING_SEND_FRAMES; i++) {
+		list_add (&instance->uring_send_frames[i].list, &instance->uring_send_frames_free);
+	}
+	list_init (&instance->uring_sends_free);
+	for (i = 0; i < URING_SENDS; i++) {
+		list_add (&instance->uring_sends[i].list, &instance->uring_sends_free);
+	}
+
+	memset (&instance->uring_recv_msghdr, 0, sizeof (instance->uring_recv_msghdr));
+	instance->uring_recv_msghdr.msg_namelen = sizeof (struct sockaddr_storage);
+
+	instance->uring_eventfd = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (instance->uring_eventfd < 0 ||
+	    io_uring_register_eventfd (&instance->uring, instance->uring_eventfd) < 0) {
+		LOGSYS_PERROR (errno, instance->totemudpu_log_level_warning,
+			"Can't register io_uring eventfd, using socket I/O");
+		goto error_exit;
+	}
+
+	qb_loop_poll_add (instance->totemudpu_poll_handle,
+		QB_LOOP_HIGH,
+		instance->uring_eventfd,
+		POLLIN, instance, uring_deliver_fn);
+
+	log_printf (instance->totemudpu_log_level_notice,
+		"Using io_uring for network I/O");
+
+	return (0);
+
+error_exit:
+	uring_finalize (instance);
+	return (-1);
+}
+
+static int uring_ucast_send (
+	struct totemudpu_instance *instance,
+	struct totem_ip_address *system_to,
+	const void *msg,
+	unsigned int msg_len)
+{
+	struct totemudpu_uring_frame *frame;
+
+	frame = uring_frame_get (instance, 1, msg, msg_len);
+	if (frame == NULL) {
+		return (-1);
+	}
+
+	uring_sendto (instance, frame, instance->token_socket, system_to);
+	if (frame->refcount == 0) {
+		list_add (&frame->list, &instance->uring_send_frames_free);
+	}
+	uring_submit (instance);
+
+	return (0);
+}
+
+/*
+ * Messages sent without flush are only queued and submitted together
+ * by totemudpu_send_flush at the end of the token hold
+ */
+static int uring_mcast_send (
+	struct totemudpu_instance *instance,
+	const void *msg,
+	unsigned int msg_len,
+	int only_active)
+{
+	struct totemudpu_uring_frame *frame;
+	struct totemudpu_member *member;
+	struct list_head *list;
+	unsigned int sends_needed = 0;
+
+	for (list = instance->member_list.next;
+		list != &instance->member_list;
+		list = list->next) {
+
+		member = list_entry (list, struct totemudpu_member, list);
+		if (only_active && !member->active && !instance->send_merge_detect_message)
+			continue ;
+		sends_needed++;
+	}
+
+	frame = uring_frame_get (instance, sends_needed, msg, msg_len);
+	if (frame == NULL) {
+		return (-1);
+	}
+
+	for (list = instance->member_list.next;
+		list != &instance->member_list;
+		list = list->next) {
+
+		member = list_entry (list, struct totemudpu_member, list);
+		if (only_active && !member->active && !instance->send_merge_detect_message)
+			continue ;
+		uring_sendto (instance, frame, member->fd, &member->member);
+	}
+	if (frame->refcount == 0) {
+		list_add (&frame->list, &instance->uring_send_frames_free);
+	}
+
+	if (!only_active) {
+		uring_submit (instance);
+	}
+
+	return (0);
+}
+#endif
+
+static void token_socket_poll_add (struct totemudpu_instance *instance)
+{
+#ifdef HAVE_LIBURING
+	if (instance->uring_enabled) {
+		uring_recv_arm (instance);
+		return;
+	}
+#endif
+	qb_loop_poll_add (instance->totemudpu_poll_handle,
+		QB_LOOP_HIGH,
+		instance->token_socket,
+		POLLIN, instance, net_deliver_fn);
+}
+
+static void token_socket_poll_del (struct totemudpu_instance *instance)
+{
+#ifdef HAVE_LIBURING
+	if (instance->uring_enabled) {
+		uring_recv_cancel (instance);
+		return;
+	}
+#endif
+	qb_loop_poll_del (instance->totemudpu_poll_handle,
+		instance->token_socket);
+}
+
 int totemudpu_crypto_set (
 	void *udpu_context,
 	const char *cipher_type,
@@ -271,6 +925,21 @@ static inline void ucast_sendmsg (
 	struct iovec iovec;
 	int addrlen;
 
+#ifdef HAVE_LIBURING
+	/*
+	 * Falls back to sendmsg when the frame pool is exhausted
+	 */
+	if (instance->uring_enabled) {
+		if (uring_ucast_send (instance, system_to, msg, msg_len) == 0) {
+			return;
+		}
+		/*
+		 * Queued frames must leave before this one
+		 */
+		uring_submit (instance);
+	}
+#endif
+
 	/*
 	 * Encrypt and digest the message
 	 */
@@ -325,6 +994,19 @@ static inline void ucast_sendmsg (
 	}
 }
 
+static void mcast_merge_detect_update (
+	struct totemudpu_instance *instance,
+	int only_active)
+{
+	if (!only_active || instance->send_merge_detect_message) {
+		/*
+		 * Current message was sent to all nodes
+		 */
+		instance->merge_detect_messages_sent_before_timeout++;
+		instance->send_merge_detect_message = 0;
+	}
+}
+
 static inline void mcast_sendmsg (
 	struct totemudpu_instance *instance,
 	const void *msg,
@@ -341,6 +1023,19 @@ static inline void mcast_sendmsg (
         struct list_head *list;
 	struct totemudpu_member *member;
 
+#ifdef HAVE_LIBURING
+	if (instance->uring_enabled) {
+		if (uring_mcast_send (instance, msg, msg_len, only_active) == 0) {
+			mcast_merge_detect_update (instance, only_active);
+			return;
+		}
+		/*
+		 * Frame pool exhausted, queued frames must leave before this one
+		 */
+		uring_submit (instance);
+	}
+#endif
+
 	/*
 	 * Encrypt and digest the message
 	 */
@@ -409,13 +1104,7 @@ static inline void mcast_sendmsg (
 		}
 	}
 
-	if (!only_active || instance->send_merge_detect_message) {
-		/*
-		 * Current message was sent to all nodes
-		 */
-		instance->merge_detect_messages_sent_before_timeout++;
-		instance->send_merge_detect_message = 0;
-	}
+	mcast_merge_detect_update (instance, only_active);
 }
 
 int totemudpu_finalize (
@@ -425,13 +1114,18 @@ int totemudpu_finalize (
 	int res = 0;
 
 	if (instance->token_socket > 0) {
-		qb_loop_poll_del (instance->totemudpu_poll_handle,
-			instance->token_socket);
+		token_socket_poll_del (instance);
 		close (instance->token_socket);
 	}
 
 	totemudpu_stop_merge_detect_timeout(instance);
 
+#ifdef HAVE_LIBURING
+	if (instance->uring_enabled) {
+		uring_finalize (instance);
+	}
+#endif
+
 	return (res);
 }
 
@@ -567,8 +1261,7 @@ static void timer_function_netif_check_timeout (
 	}
 
 	if (instance->token_socket > 0) {
-		qb_loop_poll_del (instance->totemudpu_poll_handle,
-			instance->token_socket);
+		token_socket_poll_del (instance);
 		close (instance->token_socket);
 	}
 
@@ -602,10 +1295,7 @@ static void timer_function_netif_check_timeout (
 		bind_address,
 		&instance->totem_interface->boundto);
 
-	qb_loop_poll_add (instance->totemudpu_poll_handle,
-		QB_LOOP_MED,
-		instance->token_socket,
-		POLLIN, instance, net_deliver_fn);
+	token_socket_poll_add (instance);
 
 	totemip_copy (&instance->my_id, &instance->totem_interface->boundto);
 
@@ -802,6 +1492,8 @@ int totemudpu_initialize (
 	instance->totemudpu_log_level_debug = totem_config->totem_logging_configuration.log_level_debug;
 	instance->totemudpu_subsys_id = totem_config->totem_logging_configuration.log_subsys_id;
 	instance->totemudpu_log_printf = totem_config->totem_logging_configuration.log_printf;
+	instance->totemudpu_log_callsite_register =
+		totem_config->totem_logging_configuration.log_callsite_register;
 
 	/*
 	* Initialize random number generator for later use to generate salt
@@ -839,6 +1531,12 @@ int totemudpu_initialize (
         totemip_localhost (AF_INET, &localhost);
 	localhost.nodeid = instance->totem_config->node_id;
 
+#ifdef HAVE_LIBURING
+	if (totem_config->io_uring) {
+		uring_init (instance);
+	}
+#endif
+
 	/*
 	 * RRP layer isn't ready to receive message because it hasn't
 	 * initialized yet.  Add short timer to check the interfaces.
@@ -899,6 +1597,14 @@ int totemudpu_send_flush (void *udpu_context)
 {
 	int res = 0;
 
+#ifdef HAVE_LIBURING
+	struct totemudpu_instance *instance = (struct totemudpu_instance *)udpu_context;
+
+	if (instance->uring_enabled) {
+		uring_submit (instance);
+	}
+#endif
+
 	return (res);
 }
 
@@ -1007,6 +1713,12 @@ extern int totemudpu_recv_mcast_empty (
 	int nfds;
 	int msg_processed = 0;
 
+#ifdef HAVE_LIBURING
+	if (instance->uring_enabled) {
+		msg_processed = uring_complete (instance, 0);
+	}
+#endif
+
 	/*
 	 * Receive datagram
 	 */
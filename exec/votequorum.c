@@ -186,6 +186,7 @@ struct cluster_node {
 	uint32_t    expected_votes;
 	uint32_t    flags;
 	struct      list_head list;
+	struct      cluster_node *hash_next;
 };
 
 /*
@@ -215,6 +216,22 @@ static struct memb_ring_id quorum_ringid;
 static struct cluster_node cluster_nodes[PROCESSOR_COUNT_MAX+2];
 static int cluster_nodes_entries = 0;
 
+/*
+ * nodeid index of cluster_nodes
+ */
+#define NODE_HASH_SIZE 256
+
+static struct cluster_node *node_hash[NODE_HASH_SIZE];
+
+/*
+ * totals of NODESTATE_MEMBER nodes in cluster_members_list, kept up to
+ * date by node_*_set so quorum calculation doesn't walk the list
+ */
+static unsigned int member_votes_total = 0;
+static unsigned int member_nodes_total = 0;
+static unsigned int member_expected_max = 0;
+static int member_expected_max_valid = 0;
+
 /*
  * votequorum tracking
  */
@@ -408,7 +425,13 @@ static struct corosync_service_engine votequorum_service_engine = {
 	.sync_init			= votequorum_sync_init,
 	.sync_process			= votequorum_sync_process,
 	.sync_activate			= votequorum_sync_activate,
-	.sync_abort			= votequorum_sync_abort
+	.sync_abort			= votequorum_sync_abort,
+	/*
+	 * cmap may refuse a node with a different config version before we
+	 * count its votes, and cpg clients expect the configuration change
+	 * before the quorum change.
+	 */
+	.sync_depends			= (1ULL << CMAP_SERVICE) | (1ULL << CPG_SERVICE)
 };
 
 struct corosync_service_engine *votequorum_get_service_engine_ver0 (void)
@@ -433,6 +456,101 @@ static struct default_service votequorum_service[] = {
 #define list_iterate(v, head) \
 	for (v = (head)->next; v != head; v = v->next)
 
+static unsigned int node_hash_bucket(unsigned int nodeid)
+{
+	return ((nodeid * 2654435761U) >> 24) & (NODE_HASH_SIZE - 1);
+}
+
+static void node_hash_add(struct cluster_node *node)
+{
+	unsigned int bucket = node_hash_bucket(node->node_id);
+
+	node->hash_next = node_hash[bucket];
+	node_hash[bucket] = node;
+}
+
+static void node_hash_del(struct cluster_node *node)
+{
+	struct cluster_node **iter;
+
+	for (iter = &node_hash[node_hash_bucket(node->node_id)]; *iter != NULL;
+	     iter = &(*iter)->hash_next) {
+		if (*iter == node) {
+			*iter = node->hash_next;
+			break;
+		}
+	}
+	node->hash_next = NULL;
+}
+
+static void node_totals_account(struct cluster_node *node, int add)
+{
+	if (node->node_id == VOTEQUORUM_QDEVICE_NODEID ||
+	    node->state != NODESTATE_MEMBER) {
+		return;
+	}
+
+	if (add) {
+		member_votes_total += node->votes;
+		member_nodes_total++;
+		if (node->expected_votes > member_expected_max) {
+			member_expected_max = node->expected_votes;
+		}
+	} else {
+		member_votes_total -= node->votes;
+		member_nodes_total--;
+		if (node->expected_votes >= member_expected_max) {
+			member_expected_max_valid = 0;
+		}
+	}
+}
+
+static void node_state_set(struct cluster_node *node, nodestate_t state)
+{
+	node_totals_account(node, 0);
+	node->state = state;
+	node_totals_account(node, 1);
+}
+
+static void node_votes_set(struct cluster_node *node, uint32_t votes)
+{
+	node_totals_account(node, 0);
+	node->votes = votes;
+	node_totals_account(node, 1);
+}
+
+static void node_expected_votes_set(struct cluster_node *node, uint32_t expected_votes)
+{
+	node_totals_account(node, 0);
+	node->expected_votes = expected_votes;
+	node_totals_account(node, 1);
+}
+
+/*
+ * Highest expected_votes can't be decreased incrementally, list is walked
+ * only after the node holding it changed
+ */
+static unsigned int member_expected_max_get(void)
+{
+	struct cluster_node *node;
+	struct list_head *tmp;
+
+	if (member_expected_max_valid) {
+		return member_expected_max;
+	}
+
+	member_expected_max = 0;
+	list_iterate(tmp, &cluster_members_list) {
+		node = list_entry(tmp, struct cluster_node, list);
+		if (node->state == NODESTATE_MEMBER) {
+			member_expected_max = max(member_expected_max, node->expected_votes);
+		}
+	}
+	member_expected_max_valid = 1;
+
+	return member_expected_max;
+}
+
 static void node_add_ordered(struct cluster_node *newnode)
 {
 	struct cluster_node *node = NULL;
@@ -484,6 +602,8 @@ static struct cluster_node *allocate_node(unsigned int nodeid)
 			log_printf(LOGSYS_LEVEL_CRIT, "Unable to find memory for node %u data!!", nodeid);
 			goto out;
 		}
+		node_totals_account(cl, 0);
+		node_hash_del(cl);
 		list_del(tmp);
 	}
 
@@ -491,6 +611,7 @@ static struct cluster_node *allocate_node(unsigned int nodeid)
 	cl->node_id = nodeid;
 	if (nodeid != VOTEQUORUM_QDEVICE_NODEID) {
 		node_add_ordered(cl);
+		node_hash_add(cl);
 	}
 
 out:
@@ -502,7 +623,6 @@ out:
 static struct cluster_node *find_node_by_nodeid(unsigned int nodeid)
 {
 	struct cluster_node *node;
-	struct list_head *tmp;
 
 	ENTER();
 
@@ -516,8 +636,7 @@ static struct cluster_node *find_node_by_nodeid(unsigned int nodeid)
 		return qdevice;
 	}
 
-	list_iterate(tmp, &cluster_members_list) {
-		node = list_entry(tmp, struct cluster_node, list);
+	for (node = node_hash[node_hash_bucket(nodeid)]; node != NULL; node = node->hash_next) {
 		if (node->node_id == nodeid) {
 			LEAVE();
 			return node;
@@ -537,11 +656,16 @@ static void get_lowest_node_id(void)
 
 	lowest_node_id = us->node_id;
 
+	/*
+	 * cluster_members_list is sorted by node_id
+	 */
 	list_iterate(tmp, &cluster_members_list) {
 		node = list_entry(tmp, struct cluster_node, list);
-		if ((node->state == NODESTATE_MEMBER) &&
-		    (node->node_id < lowest_node_id)) {
-			lowest_node_id = node->node_id;
+		if (node->state == NODESTATE_MEMBER) {
+			if (node->node_id < lowest_node_id) {
+				lowest_node_id = node->node_id;
+			}
+			break;
 		}
 	}
 	log_printf(LOGSYS_LEVEL_DEBUG, "lowest node id: %d us: %d", lowest_node_id, us->node_id);
@@ -559,11 +683,13 @@ static void get_highest_node_id(void)
 
 	highest_node_id = us->node_id;
 
-	list_iterate(tmp, &cluster_members_list) {
+	for (tmp = cluster_members_list.prev; tmp != &cluster_members_list; tmp = tmp->prev) {
 		node = list_entry(tmp, struct cluster_node, list);
-		if ((node->state == NODESTATE_MEMBER) &&
-		    (node->node_id > highest_node_id)) {
-			highest_node_id = node->node_id;
+		if (node->state == NODESTATE_MEMBER) {
+			if (node->node_id > highest_node_id) {
+				highest_node_id = node->node_id;
+			}
+			break;
 		}
 	}
 	log_printf(LOGSYS_LEVEL_DEBUG, "highest node id: %d us: %d", highest_node_id, us->node_id);
@@ -575,17 +701,13 @@ static void get_highest_node_id(void)
 static int check_low_node_id_partition(void)
 {
 	struct cluster_node *node = NULL;
-	struct list_head *tmp;
 	int found = 0;
 
 	ENTER();
 
-	list_iterate(tmp, &cluster_members_list) {
-		node = list_entry(tmp, struct cluster_node, list);
-		if ((node->state == NODESTATE_MEMBER) &&
-		    (node->node_id == lowest_node_id)) {
-				found = 1;
-		}
+	node = find_node_by_nodeid(lowest_node_id);
+	if ((node) && (node->state == NODESTATE_MEMBER)) {
+		found = 1;
 	}
 
 	LEAVE();
@@ -595,17 +717,13 @@ static int check_low_node_id_partition(void)
 static int check_high_node_id_partition(void)
 {
 	struct cluster_node *node = NULL;
-	struct list_head *tmp;
 	int found = 0;
 
 	ENTER();
 
-	list_iterate(tmp, &cluster_members_list) {
-		node = list_entry(tmp, struct cluster_node, list);
-		if ((node->state == NODESTATE_MEMBER) &&
-		    (node->node_id == highest_node_id)) {
-				found = 1;
-		}
+	node = find_node_by_nodeid(highest_node_id);
+	if ((node) && (node->state == NODESTATE_MEMBER)) {
+		found = 1;
 	}
 
 	LEAVE();
@@ -717,7 +835,7 @@ static void parse_atb_string(char *atb_string)
 		do {
 			num = strtol(ptr, &ptr, 10);
 			if (num) {
-				log_printf(LOGSYS_LEVEL_DEBUG, "ATB nodelist[%d] = %d", atb_nodelist_entries, num);
+				log_printf(LOGSYS_LEVEL_DEBUG, "ATB nodelist[%d] = %ld", atb_nodelist_entries, num);
 				atb_nodelist[atb_nodelist_entries++] = num;
 			}
 		} while (num);
@@ -917,22 +1035,21 @@ static int calculate_quorum(int allow_decrease, unsigned int max_expected, unsig
 		max_expected = max(ev_barrier, max_expected);
 	}
 
-	list_iterate(nodelist, &cluster_members_list) {
-		node = list_entry(nodelist, struct cluster_node, list);
-
-		log_printf(LOGSYS_LEVEL_DEBUG, "node %u state=%d, votes=%u, expected=%u",
-			   node->node_id, node->state, node->votes, node->expected_votes);
-
-		if (node->state == NODESTATE_MEMBER) {
-			if (max_expected) {
-				node->expected_votes = max_expected;
-			} else {
-				highest_expected = max(highest_expected, node->expected_votes);
+	if (max_expected) {
+		list_iterate(nodelist, &cluster_members_list) {
+			node = list_entry(nodelist, struct cluster_node, list);
+			if (node->state == NODESTATE_MEMBER) {
+				node_expected_votes_set(node, max_expected);
 			}
-			total_votes += node->votes;
-			total_nodes++;
 		}
+	} else {
+		highest_expected = member_expected_max_get();
 	}
+	total_votes = member_votes_total;
+	total_nodes = member_nodes_total;
+
+	log_printf(LOGSYS_LEVEL_DEBUG, "members=%u, votes=%u, highest expected=%u",
+		   total_nodes, total_votes, highest_expected);
 
 	if (us->flags & NODE_FLAGS_QDEVICE_CAST_VOTE) {
 		log_printf(LOGSYS_LEVEL_DEBUG, "node 0 state=1, votes=%u", qdevice->votes);
@@ -1062,21 +1179,11 @@ static void are_we_quorate(unsigned int total_votes)
 
 static void get_total_votes(unsigned int *totalvotes, unsigned int *current_members)
 {
-	unsigned int total_votes = 0;
-	unsigned int cluster_members = 0;
-	struct list_head *nodelist;
-	struct cluster_node *node;
+	unsigned int total_votes = member_votes_total;
+	unsigned int cluster_members = member_nodes_total;
 
 	ENTER();
 
-	list_iterate(nodelist, &cluster_members_list) {
-		node = list_entry(nodelist, struct cluster_node, list);
-		if (node->state == NODESTATE_MEMBER) {
-			cluster_members++;
-			total_votes += node->votes;
-		}
-	}
-
 	if (qdevice->votes) {
 		total_votes += qdevice->votes;
 		cluster_members++;
@@ -1109,7 +1216,7 @@ static void recalculate_quorum(int allow_decrease, int by_current_nodes)
 	 */
 	log_printf(LOGSYS_LEVEL_DEBUG, "total_votes=%d, expected_votes=%d", total_votes, us->expected_votes);
 	if (total_votes > us->expected_votes) {
-		us->expected_votes = total_votes;
+		node_expected_votes_set(us, total_votes);
 		votequorum_exec_send_expectedvotes_notification();
 	}
 
@@ -1488,15 +1595,16 @@ static char *votequorum_readconfig(int runtime)
 	}
 
 	if (have_nodelist) {
-		us->votes = node_votes;
-		us->expected_votes = node_expected_votes;
+		node_votes_set(us, node_votes);
+		node_expected_votes_set(us, node_expected_votes);
 	} else {
-		us->votes = 1;
-		icmap_get_uint32("quorum.votes", &us->votes);
+		node_votes = 1;
+		icmap_get_uint32("quorum.votes", &node_votes);
+		node_votes_set(us, node_votes);
 	}
 
 	if (expected_votes) {
-		us->expected_votes = expected_votes;
+		node_expected_votes_set(us, expected_votes);
 	}
 
 	/*
@@ -2021,11 +2129,11 @@ static void message_handler_req_exec_votequorum_nodeinfo (
 
 	/* Update node state */
 	node->flags = req_exec_quorum_nodeinfo->flags;
-	node->votes = req_exec_quorum_nodeinfo->votes;
-	node->state = NODESTATE_MEMBER;
+	node_votes_set(node, req_exec_quorum_nodeinfo->votes);
+	node_state_set(node, NODESTATE_MEMBER);
 
 	if (node->flags & NODE_FLAGS_LEAVING) {
-		node->state = NODESTATE_LEAVING;
+		node_state_set(node, NODESTATE_LEAVING);
 		allow_downgrade = 1;
 		by_node = 1;
 	}
@@ -2033,13 +2141,13 @@ static void message_handler_req_exec_votequorum_nodeinfo (
 	if ((!cluster_is_quorate) &&
 	    (node->flags & NODE_FLAGS_QUORATE)) {
 		allow_downgrade = 1;
-		us->expected_votes = req_exec_quorum_nodeinfo->expected_votes;
+		node_expected_votes_set(us, req_exec_quorum_nodeinfo->expected_votes);
 	}
 
 	if (node->flags & NODE_FLAGS_QUORATE || (ev_tracking)) {
-		node->expected_votes = req_exec_quorum_nodeinfo->expected_votes;
+		node_expected_votes_set(node, req_exec_quorum_nodeinfo->expected_votes);
 	} else {
-		node->expected_votes = us->expected_votes;
+		node_expected_votes_set(node, us->expected_votes);
 	}
 
 	if ((last_man_standing) && (node->votes > 1)) {
@@ -2103,13 +2211,13 @@ static void message_handler_req_exec_votequorum_reconfigure (
 		list_iterate(nodelist, &cluster_members_list) {
 			node = list_entry(nodelist, struct cluster_node, list);
 			if (node->state == NODESTATE_MEMBER) {
-				node->expected_votes = req_exec_quorum_reconfigure->value;
+				node_expected_votes_set(node, req_exec_quorum_reconfigure->value);
 			}
 		}
 		votequorum_exec_send_expectedvotes_notification();
 		update_ev_barrier(req_exec_quorum_reconfigure->value);
 		if (ev_tracking) {
-		    us->expected_votes = max(us->expected_votes, ev_tracking_barrier);
+		    node_expected_votes_set(us, max(us->expected_votes, ev_tracking_barrier));
 		}
 		recalculate_quorum(1, 0);  /* Allow decrease */
 		break;
@@ -2120,7 +2228,7 @@ static void message_handler_req_exec_votequorum_reconfigure (
 			LEAVE();
 			return;
 		}
-		node->votes = req_exec_quorum_reconfigure->value;
+		node_votes_set(node, req_exec_quorum_reconfigure->value);
 		recalculate_quorum(1, 0);  /* Allow decrease */
 		break;
 
@@ -2175,6 +2283,11 @@ static char *votequorum_exec_init_fn (struct corosync_api_v1 *api)
 	qdevice = NULL;
 	us = NULL;
 	memset(cluster_nodes, 0, sizeof(cluster_nodes));
+	memset(node_hash, 0, sizeof(node_hash));
+	member_votes_total = 0;
+	member_nodes_total = 0;
+	member_expected_max = 0;
+	member_expected_max_valid = 0;
 
 	/*
 	 * Allocate a cluster_node for qdevice
@@ -2198,8 +2311,8 @@ static char *votequorum_exec_init_fn (struct corosync_api_v1 *api)
 
 	icmap_set_uint32("runtime.votequorum.this_node_id", us->node_id);
 
-	us->state = NODESTATE_MEMBER;
-	us->votes = 1;
+	node_state_set(us, NODESTATE_MEMBER);
+	node_votes_set(us, 1);
 	us->flags |= NODE_FLAGS_FIRST;
 
 	error = votequorum_readconfig(VOTEQUORUM_READCONFIG_STARTUP);
@@ -2277,7 +2390,7 @@ static void votequorum_sync_init (
 			left_nodes = 1;
 			node = find_node_by_nodeid(quorum_members[i]);
 			if (node) {
-				node->state = NODESTATE_DEAD;
+				node_state_set(node, NODESTATE_DEAD);
 			}
 		}
 	}
@@ -2618,13 +2731,13 @@ static void message_handler_req_lib_votequorum_setvotes (void *conn, const void
 	 * Check votes is valid
 	 */
 	saved_votes = node->votes;
-	node->votes = req_lib_votequorum_setvotes->votes;
+	node_votes_set(node, req_lib_votequorum_setvotes->votes);
 
 	newquorum = calculate_quorum(1, 0, &total_votes);
 
 	if (newquorum < total_votes / 2 ||
 	    newquorum > total_votes) {
-		node->votes = saved_votes;
+		node_votes_set(node, saved_votes);
 		error = CS_ERR_INVALID_PARAM;
 		goto error_exit;
 	}
@@ -2858,8 +2971,8 @@ static void message_handler_req_lib_votequorum_qdevice_poll (void *conn,
 		      req_lib_votequorum_qdevice_poll->ring_id.seq == quorum_ringid.seq)) {
 			log_printf(LOGSYS_LEVEL_DEBUG, "Received poll ring id (%u.%"PRIu64") != last sync "
 			    "ring id (%u.%"PRIu64"). Ignoring poll call.",
-			    req_lib_votequorum_qdevice_poll->ring_id.nodeid, req_lib_votequorum_qdevice_poll->ring_id.seq,
-			    quorum_ringid.rep.nodeid, quorum_ringid.seq);
+			    req_lib_votequorum_qdevice_poll->ring_id.nodeid, (uint64_t)req_lib_votequorum_qdevice_poll->ring_id.seq,
+			    quorum_ringid.rep.nodeid, (uint64_t)quorum_ringid.seq);
 			error = CS_ERR_MESSAGE_ERROR;
 			goto out;
 		}
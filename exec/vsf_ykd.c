@@ -182,8 +182,9 @@ static int ykd_state_send_msg (const void *context)
 
 static void ykd_state_send (void)
 {
-	api->schedwrk_create (
+	api->schedwrk_create_named (
 		&schedwrk_state_send_callback_handle,
+		"ykd_state_send",
                 ykd_state_send_msg,
                 NULL);
 }
@@ -207,8 +208,9 @@ static int ykd_attempt_send_msg (const void *context)
 
 static void ykd_attempt_send (void)
 {
-	api->schedwrk_create (
+	api->schedwrk_create_named (
 		&schedwrk_attempt_send_callback_handle,
+		"ykd_attempt_send",
                 ykd_attempt_send_msg,
                 NULL);
 }
@@ -406,6 +406,17 @@ struct corosync_api_v1 {
 		qb_loop_t * handle,
 		int fd);
 
+	int (*schedwrk_create_named) (
+		hdb_handle_t *handle,
+		const char *name,
+		int (schedwrk_fn) (const void *),
+		const void *context);
+
+	/*
+	 * Work item should return -1 (run again) once this is true
+	 */
+	int (*schedwrk_budget_exhausted) (void);
+
 };
 
 #define SERVICE_ID_MAKE(a,b) ( ((a)<<16) | (b) )
@@ -462,6 +473,12 @@ struct corosync_service_engine {
 	int (*sync_process) (void);
 	void (*sync_activate) (void);
 	void (*sync_abort) (void);
+	/*
+	 * Bitmask of service ids (1 << id) which must be activated before
+	 * sync_init of this service is called. Services without dependencies
+	 * are synchronized in parallel.
+	 */
+	uint64_t sync_depends;
 };
 
 #endif /* COROAPI_H_DEFINED */
@@ -80,6 +80,7 @@ typedef enum {
 
 typedef enum {
 	CPG_MODEL_V1 = 1,
+	CPG_MODEL_V2 = 2,
 } cpg_model_t;
 
 struct cpg_address {
@@ -96,6 +97,10 @@ struct cpg_name {
 
 #define CPG_MEMBERS_MAX 128
 
+#define CPG_MCAST_BATCH_MAX 64
+
+#define CPG_DELIVER_BATCH_MAX 64
+
 struct cpg_iteration_description_t {
 	struct cpg_name group;
 	uint32_t nodeid;
@@ -119,6 +124,24 @@ typedef void (*cpg_deliver_fn_t) (
 	void *msg,
 	size_t msg_len);
 
+/**
+ * One message of a batch passed to cpg_deliver_batch_fn_t.
+ * msg stays valid only until the callback returns, except for messages
+ * delivered with CPG_MODEL_V1_ZC_DELIVER.
+ */
+struct cpg_deliver_entry {
+	struct cpg_name group_name;
+	uint32_t nodeid;
+	uint32_t pid;
+	void *msg;
+	size_t msg_len;
+};
+
+typedef void (*cpg_deliver_batch_fn_t) (
+	cpg_handle_t handle,
+	struct cpg_deliver_entry *entries,
+	size_t entries_count);
+
 typedef void (*cpg_confchg_fn_t) (
 	cpg_handle_t handle,
 	const struct cpg_name *group_name,
@@ -142,6 +165,21 @@ typedef struct {
 } cpg_model_data_t;
 
 #define CPG_MODEL_V1_DELIVER_INITIAL_TOTEM_CONF 0x01
+/**
+ * Send fragments of messages larger than cpg_max_atomic_msgsize_get
+ * without waiting for the executive to acknowledge each of them. Only
+ * the last fragment is acknowledged and cpg_mcast_joined returns its result.
+ */
+#define CPG_MODEL_V1_PIPELINED_MCAST 0x02
+/**
+ * Deliver fragmented messages which fit into CPG_ZC_DELIVER_AREA_SIZE
+ * from memory shared with the executive, without reassembling them in the
+ * library. Such message stays valid after the deliver callback returns
+ * and must be released by cpg_zcb_deliver_release.
+ */
+#define CPG_MODEL_V1_ZC_DELIVER 0x04
+
+#define CPG_ZC_DELIVER_AREA_SIZE (16 * 1024 * 1024)
 
 typedef struct {
 	cpg_model_t model;
@@ -151,6 +189,22 @@ typedef struct {
 	unsigned int flags;
 } cpg_model_v1_data_t;
 
+/**
+ * Same as cpg_model_v1_data_t (flags take the CPG_MODEL_V1_ values) plus
+ * cpg_deliver_batch_fn. When it is set, cpg_dispatch drains all messages
+ * already queued for the handle (up to CPG_DELIVER_BATCH_MAX) and passes
+ * them to one cpg_deliver_batch_fn call instead of calling cpg_deliver_fn
+ * for each of them.
+ */
+typedef struct {
+	cpg_model_t model;
+	cpg_deliver_fn_t cpg_deliver_fn;
+	cpg_confchg_fn_t cpg_confchg_fn;
+	cpg_totem_confchg_fn_t cpg_totem_confchg_fn;
+	unsigned int flags;
+	cpg_deliver_batch_fn_t cpg_deliver_batch_fn;
+} cpg_model_v2_data_t;
+
 
 /** @} */
 
@@ -247,6 +301,22 @@ cs_error_t cpg_mcast_joined (
 	const struct iovec *iovec,
 	unsigned int iov_len);
 
+/**
+ * Multicast several messages to groups joined with cpg_join in one request.
+ *
+ * Every message is delivered separately and in the order of the array.
+ *
+ * @param handle
+ * @param guarantee
+ * @param iovec Array of msg_count messages, one iovec per message.
+ * @param msg_count Number of messages, at most CPG_MCAST_BATCH_MAX.
+ */
+cs_error_t cpg_mcast_joined_batch (
+	cpg_handle_t handle,
+	cpg_guarantee_t guarantee,
+	const struct iovec *iovec,
+	unsigned int msg_count);
+
 /**
  * Get membership information from cpg
  */
@@ -279,6 +349,14 @@ cs_error_t cpg_zcb_mcast_joined (
 	void *msg,
 	size_t msg_len);
 
+/**
+ * Release message delivered from zero-copy delivery area
+ * (CPG_MODEL_V1_ZC_DELIVER). Other messages are ignored.
+ */
+cs_error_t cpg_zcb_deliver_release (
+	cpg_handle_t handle,
+	void *msg);
+
 /**
  * Iteration
  */
@@ -386,6 +386,21 @@ extern void icmap_convert_name_to_valid_name(char *key_name);
  */
 extern cs_error_t icmap_copy_map(icmap_map_t dst_map, const icmap_map_t src_map);
 
+/*
+ * Create read-only point-in-time view of map. Snapshot shares items with map,
+ * so no values or key names are copied. Items are copy-on-write, so later
+ * changes of map are not visible in snapshot. All get and iter functions
+ * with _r suffix can be used on snapshot, set/delete/adjust functions return
+ * CS_ERR_ACCESS. Snapshot may be handed over to other thread, but it must not be
+ * used by more threads at once. It's freed by icmap_fini_r.
+ */
+extern cs_error_t icmap_snapshot_create_r(const icmap_map_t map, icmap_map_t *snapshot);
+
+/*
+ * Create snapshot of global icmap
+ */
+extern cs_error_t icmap_snapshot_create(icmap_map_t *snapshot);
+
 #ifdef __cplusplus
 }
 #endif
@@ -56,6 +56,9 @@ enum req_cpg_types {
 	MESSAGE_REQ_CPG_ZC_FREE = 10,
 	MESSAGE_REQ_CPG_ZC_EXECUTE = 11,
 	MESSAGE_REQ_CPG_PARTIAL_MCAST = 12,
+	MESSAGE_REQ_CPG_PARTIAL_MCAST_ASYNC = 13,
+	MESSAGE_REQ_CPG_MCAST_BATCH = 14,
+	MESSAGE_REQ_CPG_ZC_DELIVER_AREA_SET = 15,
 };
 
 enum res_cpg_types {
@@ -78,6 +81,8 @@ enum res_cpg_types {
 	MESSAGE_RES_CPG_ZC_EXECUTE = 16,
 	MESSAGE_RES_CPG_PARTIAL_DELIVER_CALLBACK = 17,
 	MESSAGE_RES_CPG_PARTIAL_SEND = 18,
+	MESSAGE_RES_CPG_ZC_DELIVER_CALLBACK = 19,
+	MESSAGE_RES_CPG_ZC_DELIVER_AREA_SET = 20,
 };
 
 enum lib_cpg_confchg_reason {
@@ -229,6 +234,38 @@ struct req_lib_cpg_partial_mcast {
 	mar_uint8_t message[] __attribute__((aligned(8)));
 };
 
+/*
+ * Fragment sent without waiting for a reply. offset of the fragment in the
+ * message lets the executive notice fragments dropped before it.
+ */
+struct req_lib_cpg_partial_mcast_async {
+	struct qb_ipc_response_header header __attribute__((aligned(8)));
+	mar_uint32_t guarantee __attribute__((aligned(8)));
+	mar_uint32_t msglen __attribute__((aligned(8)));
+	mar_uint32_t fraglen __attribute__((aligned(8)));
+	mar_uint32_t type __attribute__((aligned(8)));
+	mar_uint32_t offset __attribute__((aligned(8)));
+	mar_uint8_t message[] __attribute__((aligned(8)));
+};
+
+/*
+ * Every message of a batch is stored as this header followed by the
+ * message data, padded to CPG_MCAST_BATCH_ALIGN.
+ */
+struct cpg_mcast_batch_entry {
+	mar_uint32_t msglen __attribute__((aligned(8)));
+	mar_uint8_t message[] __attribute__((aligned(8)));
+};
+
+#define CPG_MCAST_BATCH_ALIGN(len)	(((len) + 7) & ~7)
+
+struct req_lib_cpg_mcast_batch {
+	struct qb_ipc_request_header header __attribute__((aligned(8)));
+	mar_uint32_t guarantee __attribute__((aligned(8)));
+	mar_uint32_t msg_count __attribute__((aligned(8)));
+	mar_uint8_t message[] __attribute__((aligned(8)));
+};
+
 struct res_lib_cpg_mcast {
 	struct qb_ipc_response_header header __attribute__((aligned(8)));
 };
@@ -351,4 +388,35 @@ struct coroipcs_zc_header {
 	int map_size;
 	uint64_t server_address;
 };
+
+/*
+ * Zero-copy delivery area is a ring of slots shared by the library and the
+ * executive. Executive allocates slot for each reassembled message and the
+ * library marks it released when the application is done with the message.
+ */
+enum cpg_zc_deliver_slot_state {
+	CPG_ZC_DELIVER_SLOT_BUSY = 0,
+	CPG_ZC_DELIVER_SLOT_RELEASED = 1,
+};
+
+struct cpg_zc_deliver_slot {
+	uint32_t size;
+	int32_t state;
+	uint8_t message[] __attribute__((aligned(8)));
+};
+
+typedef struct {
+	struct qb_ipc_request_header header __attribute__((aligned(8)));
+	size_t map_size __attribute__((aligned(8)));
+	char path_to_file[CPG_ZC_PATH_LEN] __attribute__((aligned(8)));
+} mar_req_coroipcc_zc_deliver_area_set_t __attribute__((aligned(8)));
+
+struct res_lib_cpg_zc_deliver_callback {
+	struct qb_ipc_response_header header __attribute__((aligned(8)));
+	mar_cpg_name_t group_name __attribute__((aligned(8)));
+	mar_uint32_t msglen __attribute__((aligned(8)));
+	mar_uint32_t nodeid __attribute__((aligned(8)));
+	mar_uint32_t pid __attribute__((aligned(8)));
+	mar_uint64_t offset __attribute__((aligned(8)));
+};
 #endif /* IPC_CPG_H_DEFINED */
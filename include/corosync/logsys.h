@@ -91,6 +91,27 @@ extern "C" {
 #define LOGSYS_DEBUG_ON			1
 #define LOGSYS_DEBUG_TRACE		2
 
+/*
+ * Static descriptor of a log callsite which logs through a function
+ * pointer (totem). The first call registers the callsite, after that
+ * logsys keeps enabled up to date on every configuration change, so a
+ * disabled callsite costs a single test.
+ */
+struct logsys_callsite {
+	int32_t enabled;
+	int32_t registered;
+	int32_t level;
+	int32_t subsys;
+	struct logsys_callsite *next;
+};
+
+#define LOGSYS_CALLSITE_INIT { 1, 0, 0, 0, NULL }
+
+#define LOGSYS_CALLSITE_ENABLED(cs, level, subsys, register_fn)		\
+	((cs)->enabled &&						\
+	 ((cs)->registered || (register_fn) == NULL ||			\
+	  (register_fn) ((cs), (level), (subsys))))
+
 #ifndef LOGSYS_UTILS_ONLY
 
 /*
@@ -140,6 +161,10 @@ extern int logsys_config_logfile_priority_set (
 	const char *subsys,
 	unsigned int priority);
 
+extern int logsys_config_blackbox_priority_set (
+	const char *subsys,
+	unsigned int priority);
+
 /*
  * enabling debug, disable message priority filtering.
  * everything is sent everywhere. priority values
@@ -149,6 +174,27 @@ extern int logsys_config_debug_set (
 	const char *subsys,
 	unsigned int value);
 
+/*
+ * Flight recorder modes
+ *
+ * QB stores every message up to trace level in the libqb blackbox.
+ *
+ * BINARY stores messages up to debug level in the libqb blackbox and
+ * trace messages in per-thread rings as the format string pointer plus
+ * the raw arguments. Those are only formatted by
+ * logsys_flightrec_write_to_file.
+ */
+#define LOGSYS_FLIGHTREC_QB		0
+#define LOGSYS_FLIGHTREC_BINARY		1
+
+extern int logsys_flightrec_mode_set (
+	unsigned int mode);
+
+extern unsigned int logsys_flightrec_mode_get (void);
+
+extern int logsys_flightrec_write_to_file (
+	const char *filename);
+
 /*
  * External API - helpers
  *
@@ -175,6 +221,37 @@ extern int _logsys_subsys_create (const char *subsys, const char *filename);
 
 extern int logsys_thread_start (void);
 
+extern int _logsys_callsite_register (
+	struct logsys_callsite *cs,
+	int level,
+	int subsys);
+
+extern int _logsys_flightrec_active;
+
+/*
+ * Stores a trace message in the flight recorder and passes it to libqb
+ * only if some other target also wants trace messages.
+ */
+extern void _logsys_flightrec_log (
+	int subsys,
+	const char *function_name,
+	const char *file_name,
+	int file_line,
+	const char *format,
+	...) __attribute__((format(printf, 5, 6)));
+
+/*
+ * Returns non zero if the message is also wanted by some other target
+ * and should be passed to libqb.
+ */
+extern int _logsys_flightrec_record_va (
+	int subsys,
+	const char *function_name,
+	const char *file_name,
+	int file_line,
+	const char *format,
+	va_list ap);
+
 static int logsys_subsys_id __attribute__((unused)) = LOGSYS_MAX_SUBSYS_COUNT;
 
 #define LOGSYS_DECLARE_SYSTEM(name,mode,syslog_facility,syslog_priority)\
@@ -214,7 +291,19 @@ static void logsys_subsys_init (void)					\
 		qb_log(level, fmt ": %s (%d)", ##args, _error_ptr, err_num);				\
 	} while(0)
 
-#define log_printf(level, format, args...) qb_log(level, format, ##args)
+/*
+ * Arguments are evaluated in exactly one of the branches. level must be
+ * a constant, as for qb_log.
+ */
+#define log_printf(level, format, args...) do {					\
+		if ((level) == LOGSYS_LEVEL_TRACE && _logsys_flightrec_active) {		\
+			_logsys_flightrec_log (logsys_subsys_id, __func__, __FILE__, __LINE__,	\
+				format, ##args);						\
+		} else {									\
+			qb_log(level, format, ##args);						\
+		}										\
+	} while(0)
+
 #define ENTER qb_enter
 #define LEAVE qb_leave
 #define TRACE1(format, args...) qb_log(LOG_TRACE, "TRACE1:" #format, ##args)
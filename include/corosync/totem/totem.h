@@ -71,6 +71,8 @@ struct totem_interface {
 	struct totem_ip_address member_list[PROCESSOR_COUNT_MAX];
 };
 
+struct logsys_callsite;
+
 struct totem_logging_configuration {
 	void (*log_printf) (
 		int level,
@@ -81,6 +83,14 @@ struct totem_logging_configuration {
 		const char *format,
 		...) __attribute__((format(printf, 6, 7)));
 
+	/*
+	 * Returns non zero if the callsite logs at all
+	 */
+	int (*log_callsite_register) (
+		struct logsys_callsite *cs,
+		int level,
+		int subsys);
+
 	int log_level_security;
 	int log_level_error;
 	int log_level_warning;
@@ -96,7 +106,8 @@ enum { TOTEM_RRP_MODE_BYTES = 64 };
 typedef enum {
 	TOTEM_TRANSPORT_UDP = 0,
 	TOTEM_TRANSPORT_UDPU = 1,
-	TOTEM_TRANSPORT_RDMA = 2
+	TOTEM_TRANSPORT_RDMA = 2,
+	TOTEM_TRANSPORT_SHM = 3
 } totem_transport_t;
 
 #define MEMB_RING_ID
@@ -184,6 +195,16 @@ struct totem_config {
 
 	totem_transport_t transport_number;
 
+	unsigned int io_uring;
+
+	char *shm_path;
+
+	unsigned int shm_delay;
+
+	unsigned int shm_loss;
+
+	unsigned int shm_reorder;
+
 	unsigned int miss_count_const;
 
 	int ip_version;
@@ -229,6 +250,7 @@ typedef struct {
 	totemnet_stats_t *net;
 	char *algo_name;
 	uint8_t *faulty;
+	uint64_t *mcast_dup_suppressed;
 	uint32_t interface_count;
 } totemrrp_stats_t;
 
@@ -239,6 +261,37 @@ typedef struct {
 	int backlog_calc;
 } totemsrp_token_stats_t;
 
+/*
+ * Phases of processing of the regular token. Time spent sending messages
+ * (including encryption) is accounted to TOTEM_TOKEN_PHASE_SEND and not to
+ * the phase sending them.
+ */
+enum totem_token_phase {
+	TOTEM_TOKEN_PHASE_RECV_FLUSH,
+	TOTEM_TOKEN_PHASE_RX_CALLBACKS,
+	TOTEM_TOKEN_PHASE_RTR,
+	TOTEM_TOKEN_PHASE_MCAST,
+	TOTEM_TOKEN_PHASE_SEND,
+	TOTEM_TOKEN_PHASE_TOKEN_SEND,
+	TOTEM_TOKEN_PHASE_DELIVER,
+	TOTEM_TOKEN_PHASE_TX_CALLBACKS,
+	TOTEM_TOKEN_PHASE_TOTAL,
+	TOTEM_TOKEN_PHASE_MAX
+};
+
+/*
+ * Bucket i of hist counts phases taking at most 2^i us, the last bucket
+ * counts the rest
+ */
+#define TOTEM_TOKEN_PHASE_BUCKETS 17
+
+typedef struct {
+	uint64_t count;
+	uint64_t time_total;
+	uint64_t time_max;
+	uint64_t hist[TOTEM_TOKEN_PHASE_BUCKETS];
+} totemsrp_token_phase_stats_t;
+
 typedef struct {
 	totem_stats_header_t hdr;
 	totemrrp_stats_t *rrp;
@@ -265,6 +318,16 @@ typedef struct {
 	uint64_t recovery_token_lost;
 	uint64_t consensus_timeouts;
 	uint64_t rx_msg_dropped;
+	/*
+	 * Monotonic timestamps (ns) of the phase boundaries of the last
+	 * membership change. token_lost is 0 if the change was not caused by
+	 * a token loss in the OPERATIONAL state.
+	 */
+	uint64_t memb_token_lost_time;
+	uint64_t memb_gather_time;
+	uint64_t memb_commit_time;
+	uint64_t memb_recovery_time;
+	uint64_t memb_operational_time;
 	uint32_t continuous_gather;
 	uint32_t continuous_sendmsg_failures;
 
@@ -272,6 +335,7 @@ typedef struct {
 	int latest_token;
 #define TOTEM_TOKEN_STATS_MAX 100
 	totemsrp_token_stats_t token[TOTEM_TOKEN_STATS_MAX];
+	totemsrp_token_phase_stats_t token_phase[TOTEM_TOKEN_PHASE_MAX];
 
 } totemsrp_stats_t;
 
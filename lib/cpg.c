@@ -55,6 +55,7 @@
 #include <qb/qbdefs.h>
 #include <qb/qbipcc.h>
 #include <qb/qblog.h>
+#include <qb/qbatomic.h>
 
 #include <corosync/hdb.h>
 #include <corosync/list.h>
@@ -87,21 +88,44 @@ struct cpg_inst {
 	union {
 		cpg_model_data_t model_data;
 		cpg_model_v1_data_t model_v1_data;
+		cpg_model_v2_data_t model_v2_data;
 	};
 	struct list_head iteration_list_head;
     uint32_t max_msg_size;
-    char *assembly_buf;
-    uint32_t assembly_buf_ptr;
-    int assembling; /* Flag that says we have started assembling a message.
-					 * It's here to catch the situation where a node joins
-					 * the cluster/group in the middle of a CPG message send
-					 * so we don't pass on a partial message to the client.
-					 */
+    /*
+     * Fragmented messages being assembled, one per sender. A sender without
+     * one here had its first fragment sent before we joined, so the rest of
+     * its message is not passed on to the client.
+     */
+    struct list_head assembly_list_head;
+	/*
+	 * Messages collected for cpg_deliver_batch_fn (CPG_MODEL_V2 only)
+	 */
+	struct cpg_deliver_entry *batch_entries;
+	unsigned int batch_entries_count;
+	char *batch_buf;
+	size_t batch_buf_ptr;
+	/*
+	 * Area shared with executive for CPG_MODEL_V1_ZC_DELIVER
+	 */
+	char *zc_deliver_area;
+	size_t zc_deliver_size;
 };
 static void cpg_inst_free (void *inst);
 
+static cs_error_t cpg_zc_deliver_area_set (struct cpg_inst *cpg_inst);
+
 DECLARE_HDB_DATABASE(cpg_handle_t_db, cpg_inst_free);
 
+struct cpg_assembly_data {
+	struct list_head list;
+	uint32_t nodeid;
+	uint32_t pid;
+	uint32_t msglen;
+	uint32_t assembly_buf_ptr;
+	char *assembly_buf;
+};
+
 struct cpg_iteration_instance_t {
 	cpg_iteration_handle_t cpg_iteration_handle;
 	qb_ipcc_connection_t *conn;
@@ -134,10 +158,45 @@ static void cpg_iteration_instance_finalize (struct cpg_iteration_instance_t *cp
 	hdb_handle_destroy (&cpg_iteration_handle_t_db, cpg_iteration_instance->cpg_iteration_handle);
 }
 
+static struct cpg_assembly_data *cpg_assembly_data_find (
+	struct cpg_inst *cpg_inst,
+	uint32_t nodeid,
+	uint32_t pid)
+{
+	struct list_head *iter;
+	struct cpg_assembly_data *assembly_data;
+
+	for (iter = cpg_inst->assembly_list_head.next; iter != &cpg_inst->assembly_list_head;
+	    iter = iter->next) {
+		assembly_data = list_entry (iter, struct cpg_assembly_data, list);
+		if (assembly_data->nodeid == nodeid && assembly_data->pid == pid) {
+			return (assembly_data);
+		}
+	}
+
+	return (NULL);
+}
+
+static void cpg_assembly_data_free (struct cpg_assembly_data *assembly_data)
+{
+	list_del (&assembly_data->list);
+	free (assembly_data->assembly_buf);
+	free (assembly_data);
+}
+
 static void cpg_inst_free (void *inst)
 {
 	struct cpg_inst *cpg_inst = (struct cpg_inst *)inst;
 	qb_ipcc_disconnect(cpg_inst->c);
+	while (!list_empty (&cpg_inst->assembly_list_head)) {
+		cpg_assembly_data_free (list_entry (cpg_inst->assembly_list_head.next,
+			struct cpg_assembly_data, list));
+	}
+	free(cpg_inst->batch_entries);
+	free(cpg_inst->batch_buf);
+	if (cpg_inst->zc_deliver_area != NULL) {
+		munmap (cpg_inst->zc_deliver_area, cpg_inst->zc_deliver_size);
+	}
 }
 
 static void cpg_inst_finalize (struct cpg_inst *cpg_inst, hdb_handle_t handle)
@@ -158,6 +217,96 @@ static void cpg_inst_finalize (struct cpg_inst *cpg_inst, hdb_handle_t handle)
 	hdb_handle_destroy (&cpg_handle_t_db, handle);
 }
 
+static void cpg_deliver_batch_flush (
+	cpg_handle_t handle,
+	struct cpg_inst *cpg_inst,
+	cpg_deliver_batch_fn_t deliver_batch_fn)
+{
+	unsigned int entries_count;
+
+	entries_count = cpg_inst->batch_entries_count;
+	cpg_inst->batch_entries_count = 0;
+	cpg_inst->batch_buf_ptr = 0;
+
+	if (entries_count > 0) {
+		deliver_batch_fn (handle, cpg_inst->batch_entries, entries_count);
+	}
+}
+
+static void cpg_deliver_batch_add (
+	cpg_handle_t handle,
+	struct cpg_inst *cpg_inst,
+	cpg_deliver_batch_fn_t deliver_batch_fn,
+	const struct res_lib_cpg_deliver_callback *res_cpg_deliver_callback)
+{
+	struct cpg_deliver_entry *entry;
+	size_t msg_len = res_cpg_deliver_callback->msglen;
+
+	/*
+	 * Keep messages 8 byte aligned in the batch buffer. Single message
+	 * always fits into the empty buffer, because it was received into
+	 * dispatch buffer of the same size.
+	 */
+	if (cpg_inst->batch_entries_count == CPG_DELIVER_BATCH_MAX ||
+	    cpg_inst->batch_buf_ptr + msg_len > IPC_DISPATCH_SIZE) {
+		cpg_deliver_batch_flush (handle, cpg_inst, deliver_batch_fn);
+	}
+
+	entry = &cpg_inst->batch_entries[cpg_inst->batch_entries_count++];
+	marshall_from_mar_cpg_name_t (&entry->group_name,
+		&res_cpg_deliver_callback->group_name);
+	entry->nodeid = res_cpg_deliver_callback->nodeid;
+	entry->pid = res_cpg_deliver_callback->pid;
+	entry->msg = cpg_inst->batch_buf + cpg_inst->batch_buf_ptr;
+	entry->msg_len = msg_len;
+	memcpy (entry->msg, res_cpg_deliver_callback->message, msg_len);
+
+	cpg_inst->batch_buf_ptr += (msg_len + 7) & ~7;
+}
+
+/*
+ * Add deliver callback in dispatch_buf to the batch and drain all other deliver
+ * callbacks already waiting in the ring without blocking. First event which is not
+ * deliver callback is left in dispatch_buf and *pending_event is set so cpg_dispatch
+ * handles it after the batch was delivered.
+ */
+static void cpg_dispatch_deliver_batch (
+	cpg_handle_t handle,
+	struct cpg_inst *cpg_inst,
+	cpg_deliver_batch_fn_t deliver_batch_fn,
+	char *dispatch_buf,
+	int *pending_event)
+{
+	struct qb_ipc_response_header *dispatch_data = (struct qb_ipc_response_header *)dispatch_buf;
+	int32_t errno_res;
+
+	*pending_event = 0;
+
+	cpg_deliver_batch_add (handle, cpg_inst, deliver_batch_fn,
+		(struct res_lib_cpg_deliver_callback *)dispatch_buf);
+
+	while (cpg_inst->batch_entries_count < CPG_DELIVER_BATCH_MAX) {
+		errno_res = qb_ipcc_event_recv (cpg_inst->c, dispatch_buf, IPC_DISPATCH_SIZE, 0);
+		if (errno_res < 0) {
+			/*
+			 * Ring is empty or connection failed. Failure is reported by next
+			 * receive in cpg_dispatch.
+			 */
+			break;
+		}
+
+		if (dispatch_data->id != MESSAGE_RES_CPG_DELIVER_CALLBACK) {
+			*pending_event = 1;
+			break;
+		}
+
+		cpg_deliver_batch_add (handle, cpg_inst, deliver_batch_fn,
+			(struct res_lib_cpg_deliver_callback *)dispatch_buf);
+	}
+
+	cpg_deliver_batch_flush (handle, cpg_inst, deliver_batch_fn);
+}
+
 /**
  * @defgroup cpg_coroipcc The closed process group API
  * @ingroup coroipcc
@@ -190,7 +339,7 @@ cs_error_t cpg_model_initialize (
 	cs_error_t error;
 	struct cpg_inst *cpg_inst;
 
-	if (model != CPG_MODEL_V1) {
+	if (model != CPG_MODEL_V1 && model != CPG_MODEL_V2) {
 		error = CS_ERR_INVALID_PARAM;
 		goto error_no_destroy;
 	}
@@ -215,13 +364,41 @@ cs_error_t cpg_model_initialize (
 		switch (model) {
 		case CPG_MODEL_V1:
 			memcpy (&cpg_inst->model_v1_data, model_data, sizeof (cpg_model_v1_data_t));
-			if ((cpg_inst->model_v1_data.flags & ~(CPG_MODEL_V1_DELIVER_INITIAL_TOTEM_CONF)) != 0) {
+			if ((cpg_inst->model_v1_data.flags & ~(CPG_MODEL_V1_DELIVER_INITIAL_TOTEM_CONF |
+			    CPG_MODEL_V1_PIPELINED_MCAST | CPG_MODEL_V1_ZC_DELIVER)) != 0) {
+				error = CS_ERR_INVALID_PARAM;
+
+				goto error_destroy;
+			}
+			break;
+		case CPG_MODEL_V2:
+			memcpy (&cpg_inst->model_v2_data, model_data, sizeof (cpg_model_v2_data_t));
+			if ((cpg_inst->model_v2_data.flags & ~(CPG_MODEL_V1_DELIVER_INITIAL_TOTEM_CONF |
+			    CPG_MODEL_V1_PIPELINED_MCAST | CPG_MODEL_V1_ZC_DELIVER)) != 0) {
 				error = CS_ERR_INVALID_PARAM;
 
 				goto error_destroy;
 			}
+
+			if (cpg_inst->model_v2_data.cpg_deliver_batch_fn != NULL) {
+				cpg_inst->batch_entries = malloc (CPG_DELIVER_BATCH_MAX *
+					sizeof (struct cpg_deliver_entry));
+				cpg_inst->batch_buf = malloc (IPC_DISPATCH_SIZE);
+				if (cpg_inst->batch_entries == NULL || cpg_inst->batch_buf == NULL) {
+					error = CS_ERR_NO_MEMORY;
+
+					goto error_put_destroy;
+				}
+			}
 			break;
 		}
+
+		if (cpg_inst->model_v1_data.flags & CPG_MODEL_V1_ZC_DELIVER) {
+			error = cpg_zc_deliver_area_set (cpg_inst);
+			if (error != CS_OK) {
+				goto error_put_destroy;
+			}
+		}
 	}
 
 	/* Allow space for corosync internal headers */
@@ -230,6 +407,7 @@ cs_error_t cpg_model_initialize (
 	cpg_inst->context = context;
 
 	list_init(&cpg_inst->iteration_list_head);
+	list_init(&cpg_inst->assembly_list_head);
 
 	hdb_handle_put (&cpg_handle_t_db, *handle);
 
@@ -376,6 +554,7 @@ cs_error_t cpg_dispatch (
 	struct res_lib_cpg_deliver_callback *res_cpg_deliver_callback;
 	struct res_lib_cpg_partial_deliver_callback *res_cpg_partial_deliver_callback;
 	struct res_lib_cpg_totem_confchg_callback *res_cpg_totem_confchg_callback;
+	struct res_lib_cpg_zc_deliver_callback *res_cpg_zc_deliver_callback;
 	struct cpg_inst cpg_inst_copy;
 	struct qb_ipc_response_header *dispatch_data;
 	struct cpg_address member_list[CPG_MEMBERS_MAX];
@@ -389,6 +568,10 @@ cs_error_t cpg_dispatch (
 	uint32_t totem_member_list[CPG_MEMBERS_MAX];
 	int32_t errno_res;
 	char dispatch_buf[IPC_DISPATCH_SIZE];
+	int pending_event = 0;
+	cpg_deliver_batch_fn_t deliver_batch_fn;
+	struct cpg_deliver_entry deliver_entry;
+	struct cpg_assembly_data *assembly_data;
 
 	error = hdb_error_to_cs (hdb_handle_get (&cpg_handle_t_db, handle, (void *)&cpg_inst));
 	if (error != CS_OK) {
@@ -405,11 +588,19 @@ cs_error_t cpg_dispatch (
 
 	dispatch_data = (struct qb_ipc_response_header *)dispatch_buf;
 	do {
-		errno_res = qb_ipcc_event_recv (
-			cpg_inst->c,
-			dispatch_buf,
-			IPC_DISPATCH_SIZE,
-			timeout);
+		if (pending_event) {
+			/*
+			 * Event was already read by cpg_dispatch_deliver_batch
+			 */
+			pending_event = 0;
+			errno_res = 0;
+		} else {
+			errno_res = qb_ipcc_event_recv (
+				cpg_inst->c,
+				dispatch_buf,
+				IPC_DISPATCH_SIZE,
+				timeout);
+		}
 		error = qb_to_cs_error (errno_res);
 		if (error == CS_ERR_BAD_HANDLE) {
 			error = CS_OK;
@@ -439,13 +630,25 @@ cs_error_t cpg_dispatch (
 		 * operate at the same time that cpgFinalize has been called.
 		 */
 		memcpy (&cpg_inst_copy, cpg_inst, sizeof (struct cpg_inst));
+		deliver_batch_fn = NULL;
+		if (cpg_inst_copy.model_data.model == CPG_MODEL_V2) {
+			deliver_batch_fn = cpg_inst_copy.model_v2_data.cpg_deliver_batch_fn;
+		}
+
 		switch (cpg_inst_copy.model_data.model) {
 		case CPG_MODEL_V1:
+		case CPG_MODEL_V2:
 			/*
 			 * Dispatch incoming message
 			 */
 			switch (dispatch_data->id) {
 			case MESSAGE_RES_CPG_DELIVER_CALLBACK:
+				if (deliver_batch_fn != NULL) {
+					cpg_dispatch_deliver_batch (handle, cpg_inst,
+						deliver_batch_fn, dispatch_buf, &pending_event);
+					break;
+				}
+
 				if (cpg_inst_copy.model_v1_data.cpg_deliver_fn == NULL) {
 					break;
 				}
@@ -471,43 +674,136 @@ cs_error_t cpg_dispatch (
 					&group_name,
 					&res_cpg_partial_deliver_callback->group_name);
 
+				assembly_data = cpg_assembly_data_find (cpg_inst,
+					res_cpg_partial_deliver_callback->nodeid,
+					res_cpg_partial_deliver_callback->pid);
+
 				if (res_cpg_partial_deliver_callback->type == LIBCPG_PARTIAL_FIRST) {
+					/*
+					 * Previous message was abandoned by the sender
+					 */
+					if (assembly_data != NULL) {
+						cpg_assembly_data_free (assembly_data);
+					}
 					/*
 					 * Allocate a buffer to contain a full message.
 					 */
-					cpg_inst->assembly_buf = malloc(res_cpg_partial_deliver_callback->msglen);
-					if (!cpg_inst->assembly_buf) {
+					assembly_data = malloc (sizeof (struct cpg_assembly_data));
+					if (!assembly_data) {
 						error = CS_ERR_NO_MEMORY;
 						goto error_put;
 					}
-					cpg_inst->assembling = 1;
-					cpg_inst->assembly_buf_ptr = 0;
-				}
-				if (cpg_inst->assembling) {
-					memcpy(cpg_inst->assembly_buf + cpg_inst->assembly_buf_ptr,
-					       res_cpg_partial_deliver_callback->message, res_cpg_partial_deliver_callback->fraglen);
-					cpg_inst->assembly_buf_ptr += res_cpg_partial_deliver_callback->fraglen;
-
-					if (res_cpg_partial_deliver_callback->type == LIBCPG_PARTIAL_LAST) {
-						cpg_inst_copy.model_v1_data.cpg_deliver_fn (handle,
-							&group_name,
-							res_cpg_partial_deliver_callback->nodeid,
-							res_cpg_partial_deliver_callback->pid,
-							cpg_inst->assembly_buf,
-							res_cpg_partial_deliver_callback->msglen);
-						free(cpg_inst->assembly_buf);
-						cpg_inst->assembling = 0;
+					assembly_data->assembly_buf = malloc(res_cpg_partial_deliver_callback->msglen);
+					if (!assembly_data->assembly_buf) {
+						free (assembly_data);
+						error = CS_ERR_NO_MEMORY;
+						goto error_put;
 					}
+					assembly_data->nodeid = res_cpg_partial_deliver_callback->nodeid;
+					assembly_data->pid = res_cpg_partial_deliver_callback->pid;
+					assembly_data->msglen = res_cpg_partial_deliver_callback->msglen;
+					assembly_data->assembly_buf_ptr = 0;
+					list_add_tail (&assembly_data->list, &cpg_inst->assembly_list_head);
+				}
+				if (assembly_data == NULL) {
+					break;
+				}
+				if (res_cpg_partial_deliver_callback->fraglen >
+				    assembly_data->msglen - assembly_data->assembly_buf_ptr) {
+					cpg_assembly_data_free (assembly_data);
+					break;
+				}
+
+				memcpy(assembly_data->assembly_buf + assembly_data->assembly_buf_ptr,
+				       res_cpg_partial_deliver_callback->message, res_cpg_partial_deliver_callback->fraglen);
+				assembly_data->assembly_buf_ptr += res_cpg_partial_deliver_callback->fraglen;
+
+				if (res_cpg_partial_deliver_callback->type != LIBCPG_PARTIAL_LAST) {
+					break;
+				}
+				if (assembly_data->assembly_buf_ptr != assembly_data->msglen) {
+					cpg_assembly_data_free (assembly_data);
+					break;
+				}
+
+				/*
+				 * Unlink before calling back, the callback may dispatch again
+				 */
+				list_del (&assembly_data->list);
+				if (deliver_batch_fn != NULL) {
+					memcpy (&deliver_entry.group_name, &group_name, sizeof (group_name));
+					deliver_entry.nodeid = res_cpg_partial_deliver_callback->nodeid;
+					deliver_entry.pid = res_cpg_partial_deliver_callback->pid;
+					deliver_entry.msg = assembly_data->assembly_buf;
+					deliver_entry.msg_len = assembly_data->msglen;
+
+					deliver_batch_fn (handle, &deliver_entry, 1);
+				} else if (cpg_inst_copy.model_v1_data.cpg_deliver_fn != NULL) {
+					cpg_inst_copy.model_v1_data.cpg_deliver_fn (handle,
+						&group_name,
+						res_cpg_partial_deliver_callback->nodeid,
+						res_cpg_partial_deliver_callback->pid,
+						assembly_data->assembly_buf,
+						assembly_data->msglen);
+				}
+				free (assembly_data->assembly_buf);
+				free (assembly_data);
+				break;
+
+			case MESSAGE_RES_CPG_ZC_DELIVER_CALLBACK:
+				res_cpg_zc_deliver_callback = (struct res_lib_cpg_zc_deliver_callback *)dispatch_data;
+
+				if (cpg_inst->zc_deliver_area == NULL ||
+				    res_cpg_zc_deliver_callback->offset > cpg_inst->zc_deliver_size ||
+				    res_cpg_zc_deliver_callback->msglen >
+				    cpg_inst->zc_deliver_size - res_cpg_zc_deliver_callback->offset) {
+					error = CS_ERR_LIBRARY;
+					goto error_put;
+				}
+
+				marshall_from_mar_cpg_name_t (
+					&group_name,
+					&res_cpg_zc_deliver_callback->group_name);
+
+				if (deliver_batch_fn != NULL) {
+					memcpy (&deliver_entry.group_name, &group_name, sizeof (group_name));
+					deliver_entry.nodeid = res_cpg_zc_deliver_callback->nodeid;
+					deliver_entry.pid = res_cpg_zc_deliver_callback->pid;
+					deliver_entry.msg = cpg_inst->zc_deliver_area +
+						res_cpg_zc_deliver_callback->offset;
+					deliver_entry.msg_len = res_cpg_zc_deliver_callback->msglen;
+
+					deliver_batch_fn (handle, &deliver_entry, 1);
+				} else if (cpg_inst_copy.model_v1_data.cpg_deliver_fn != NULL) {
+					cpg_inst_copy.model_v1_data.cpg_deliver_fn (handle,
+						&group_name,
+						res_cpg_zc_deliver_callback->nodeid,
+						res_cpg_zc_deliver_callback->pid,
+						cpg_inst->zc_deliver_area + res_cpg_zc_deliver_callback->offset,
+						res_cpg_zc_deliver_callback->msglen);
 				}
 				break;
 
 			case MESSAGE_RES_CPG_CONFCHG_CALLBACK:
+				res_cpg_confchg_callback = (struct res_lib_cpg_confchg_callback *)dispatch_data;
+
+				/*
+				 * Processes which left will never finish their messages
+				 */
+				left_list_start = res_cpg_confchg_callback->member_list +
+					res_cpg_confchg_callback->member_list_entries;
+				for (i = 0; i < res_cpg_confchg_callback->left_list_entries; i++) {
+					assembly_data = cpg_assembly_data_find (cpg_inst,
+						left_list_start[i].nodeid, left_list_start[i].pid);
+					if (assembly_data != NULL) {
+						cpg_assembly_data_free (assembly_data);
+					}
+				}
+
 				if (cpg_inst_copy.model_v1_data.cpg_confchg_fn == NULL) {
 					break;
 				}
 
-				res_cpg_confchg_callback = (struct res_lib_cpg_confchg_callback *)dispatch_data;
-
 				for (i = 0; i < res_cpg_confchg_callback->member_list_entries; i++) {
 					marshall_from_mar_cpg_address_t (&member_list[i],
 						&res_cpg_confchg_callback->member_list[i]);
@@ -561,7 +857,7 @@ cs_error_t cpg_dispatch (
 				goto error_put;
 				break;
 			} /* - switch (dispatch_data->id) */
-			break; /* case CPG_MODEL_V1 */
+			break; /* case CPG_MODEL_V1, CPG_MODEL_V2 */
 		} /* - switch (cpg_inst_copy.model_data.model) */
 
 		if (cpg_inst_copy.finalize || cpg_inst->finalize) {
@@ -574,9 +870,11 @@ cs_error_t cpg_dispatch (
 		}
 
 		/*
-		 * Determine if more messages should be processed
+		 * Determine if more messages should be processed. Event read ahead
+		 * while draining deliver batch must be processed in any case.
 		 */
-		if (dispatch_types == CS_DISPATCH_ONE || dispatch_types == CS_DISPATCH_ONE_NONBLOCKING) {
+		if ((dispatch_types == CS_DISPATCH_ONE || dispatch_types == CS_DISPATCH_ONE_NONBLOCKING) &&
+		    !pending_event) {
 			cont = 0;
 		}
 	} while (cont);
@@ -613,6 +911,7 @@ cs_error_t cpg_join (
 
 	switch (cpg_inst->model_data.model) {
 	case CPG_MODEL_V1:
+	case CPG_MODEL_V2:
 		req_lib_cpg_join.flags = cpg_inst->model_v1_data.flags;
 		break;
 	}
@@ -884,6 +1183,84 @@ error_close_unlink:
 	return -1;
 }
 
+static cs_error_t cpg_zc_deliver_area_set (struct cpg_inst *cpg_inst)
+{
+	void *buf = NULL;
+	char path[PATH_MAX];
+	mar_req_coroipcc_zc_deliver_area_set_t req_coroipcc_zc_deliver_area_set;
+	struct qb_ipc_response_header res_coroipcs_zc_deliver_area_set;
+	struct iovec iovec;
+	cs_error_t error;
+
+	if (memory_map (path, "corosync_zerocopy-XXXXXX", &buf, CPG_ZC_DELIVER_AREA_SIZE) == -1) {
+		return (CS_ERR_NO_MEMORY);
+	}
+
+	if (strlen(path) >= CPG_ZC_PATH_LEN) {
+		unlink(path);
+		munmap (buf, CPG_ZC_DELIVER_AREA_SIZE);
+		return (CS_ERR_NAME_TOO_LONG);
+	}
+
+	req_coroipcc_zc_deliver_area_set.header.size = sizeof (mar_req_coroipcc_zc_deliver_area_set_t);
+	req_coroipcc_zc_deliver_area_set.header.id = MESSAGE_REQ_CPG_ZC_DELIVER_AREA_SET;
+	req_coroipcc_zc_deliver_area_set.map_size = CPG_ZC_DELIVER_AREA_SIZE;
+	strcpy (req_coroipcc_zc_deliver_area_set.path_to_file, path);
+
+	iovec.iov_base = (void *)&req_coroipcc_zc_deliver_area_set;
+	iovec.iov_len = sizeof (mar_req_coroipcc_zc_deliver_area_set_t);
+
+	error = coroipcc_msg_send_reply_receive (
+		cpg_inst->c,
+		&iovec,
+		1,
+		&res_coroipcs_zc_deliver_area_set,
+		sizeof (struct qb_ipc_response_header));
+
+	if (error == CS_OK) {
+		error = res_coroipcs_zc_deliver_area_set.error;
+	}
+
+	if (error != CS_OK) {
+		/*
+		 * Executive unlinks the file when it maps it
+		 */
+		unlink(path);
+		munmap (buf, CPG_ZC_DELIVER_AREA_SIZE);
+		return (error);
+	}
+
+	cpg_inst->zc_deliver_area = buf;
+	cpg_inst->zc_deliver_size = CPG_ZC_DELIVER_AREA_SIZE;
+
+	return (CS_OK);
+}
+
+cs_error_t cpg_zcb_deliver_release (
+	cpg_handle_t handle,
+	void *msg)
+{
+	cs_error_t error;
+	struct cpg_inst *cpg_inst;
+	struct cpg_zc_deliver_slot *slot;
+
+	error = hdb_error_to_cs (hdb_handle_get (&cpg_handle_t_db, handle, (void *)&cpg_inst));
+	if (error != CS_OK) {
+		return (error);
+	}
+
+	if (cpg_inst->zc_deliver_area != NULL &&
+	    (char *)msg >= cpg_inst->zc_deliver_area + sizeof (struct cpg_zc_deliver_slot) &&
+	    (char *)msg < cpg_inst->zc_deliver_area + cpg_inst->zc_deliver_size) {
+		slot = (struct cpg_zc_deliver_slot *)((char *)msg - sizeof (struct cpg_zc_deliver_slot));
+		qb_atomic_int_set (&slot->state, CPG_ZC_DELIVER_SLOT_RELEASED);
+	}
+
+	hdb_handle_put (&cpg_handle_t_db, handle);
+
+	return (error);
+}
+
 cs_error_t cpg_zcb_alloc (
 	cpg_handle_t handle,
 	size_t size,
@@ -1047,22 +1424,32 @@ static cs_error_t send_fragments (
 	cs_error_t error = CS_OK;
 	struct iovec iov[2];
 	struct req_lib_cpg_partial_mcast req_lib_cpg_mcast;
+	struct req_lib_cpg_partial_mcast_async req_lib_cpg_mcast_async;
 	struct res_lib_cpg_partial_send res_lib_cpg_partial_send;
+	struct iovec async_iov[2];
 	size_t sent = 0;
 	size_t iov_sent = 0;
 	int retry_count;
+	int restart_count = 0;
+	int pipelined;
+
+	pipelined = ((cpg_inst->model_data.model == CPG_MODEL_V1 ||
+		cpg_inst->model_data.model == CPG_MODEL_V2) &&
+		(cpg_inst->model_v1_data.flags & CPG_MODEL_V1_PIPELINED_MCAST));
 
-	req_lib_cpg_mcast.header.id = MESSAGE_REQ_CPG_PARTIAL_MCAST;
 	req_lib_cpg_mcast.guarantee = guarantee;
 	req_lib_cpg_mcast.msglen = msg_len;
 
 	iov[0].iov_base = (void *)&req_lib_cpg_mcast;
 	iov[0].iov_len = sizeof (struct req_lib_cpg_partial_mcast);
 
-	i=0;
-	iov_sent = 0 ;
 	qb_ipcc_fc_enable_max_set(cpg_inst->c,  2);
 
+restart:
+	i=0;
+	iov_sent = 0;
+	sent = 0;
+
 	while (error == CS_OK && sent < msg_len) {
 
 		retry_count = 0;
@@ -1087,10 +1474,39 @@ static cs_error_t send_fragments (
 		req_lib_cpg_mcast.header.size = sizeof (struct req_lib_cpg_partial_mcast) + iov[1].iov_len;
 		iov[1].iov_base = (char *)iovec[i].iov_base + iov_sent;
 
+		/*
+		 * In pipelined mode only the last fragment waits for a reply,
+		 * which carries the result of the whole message.
+		 */
+		if (pipelined && req_lib_cpg_mcast.type != LIBCPG_PARTIAL_LAST) {
+			req_lib_cpg_mcast.header.id = MESSAGE_REQ_CPG_PARTIAL_MCAST_ASYNC;
+		} else {
+			req_lib_cpg_mcast.header.id = MESSAGE_REQ_CPG_PARTIAL_MCAST;
+		}
+
+		if (req_lib_cpg_mcast.header.id == MESSAGE_REQ_CPG_PARTIAL_MCAST_ASYNC) {
+			req_lib_cpg_mcast_async.header.id = MESSAGE_REQ_CPG_PARTIAL_MCAST_ASYNC;
+			req_lib_cpg_mcast_async.header.size = sizeof (req_lib_cpg_mcast_async) +
+				iov[1].iov_len;
+			req_lib_cpg_mcast_async.guarantee = req_lib_cpg_mcast.guarantee;
+			req_lib_cpg_mcast_async.msglen = req_lib_cpg_mcast.msglen;
+			req_lib_cpg_mcast_async.fraglen = req_lib_cpg_mcast.fraglen;
+			req_lib_cpg_mcast_async.type = req_lib_cpg_mcast.type;
+			req_lib_cpg_mcast_async.offset = sent;
+
+			async_iov[0].iov_base = (void *)&req_lib_cpg_mcast_async;
+			async_iov[0].iov_len = sizeof (req_lib_cpg_mcast_async);
+			async_iov[1] = iov[1];
+		}
+
 	resend:
-		error = coroipcc_msg_send_reply_receive (cpg_inst->c, iov, 2,
-							 &res_lib_cpg_partial_send,
-							 sizeof (res_lib_cpg_partial_send));
+		if (req_lib_cpg_mcast.header.id == MESSAGE_REQ_CPG_PARTIAL_MCAST_ASYNC) {
+			error = qb_to_cs_error(qb_ipcc_sendv(cpg_inst->c, async_iov, 2));
+		} else {
+			error = coroipcc_msg_send_reply_receive (cpg_inst->c, iov, 2,
+								 &res_lib_cpg_partial_send,
+								 sizeof (res_lib_cpg_partial_send));
+		}
 
 		if (error == CS_ERR_TRY_AGAIN) {
 			fprintf(stderr, "sleep. counter=%d\n", retry_count);
@@ -1109,7 +1525,23 @@ static cs_error_t send_fragments (
 			i++;
 			iov_sent = 0;
 		}
-		error = res_lib_cpg_partial_send.header.error;
+		if (req_lib_cpg_mcast.header.id == MESSAGE_REQ_CPG_PARTIAL_MCAST) {
+			error = res_lib_cpg_partial_send.header.error;
+		}
+	}
+
+	/*
+	 * Some unacknowledged fragment was dropped by the executive, send
+	 * the whole message again
+	 */
+	if (pipelined && error == CS_ERR_MESSAGE_ERROR) {
+		if (++restart_count > MAX_RETRIES) {
+			error = CS_ERR_TRY_AGAIN;
+			goto error_exit;
+		}
+		usleep(10000);
+		error = CS_OK;
+		goto restart;
 	}
 error_exit:
 	qb_ipcc_fc_enable_max_set(cpg_inst->c,  1);
@@ -1166,6 +1598,76 @@ error_exit:
 	return (error);
 }
 
+cs_error_t cpg_mcast_joined_batch (
+	cpg_handle_t handle,
+	cpg_guarantee_t guarantee,
+	const struct iovec *iovec,
+	unsigned int msg_count)
+{
+	static const char pad[CPG_MCAST_BATCH_ALIGN(1)];
+	unsigned int i;
+	unsigned int iov_len;
+	cs_error_t error;
+	struct cpg_inst *cpg_inst;
+	struct iovec iov[1 + 3 * CPG_MCAST_BATCH_MAX];
+	struct cpg_mcast_batch_entry entries[CPG_MCAST_BATCH_MAX];
+	struct req_lib_cpg_mcast_batch req_lib_cpg_mcast_batch;
+	size_t batch_len = 0;
+
+	if (msg_count == 0 || msg_count > CPG_MCAST_BATCH_MAX) {
+		return (CS_ERR_INVALID_PARAM);
+	}
+
+	error = hdb_error_to_cs (hdb_handle_get (&cpg_handle_t_db, handle, (void *)&cpg_inst));
+	if (error != CS_OK) {
+		return (error);
+	}
+
+	iov[0].iov_base = (void *)&req_lib_cpg_mcast_batch;
+	iov[0].iov_len = sizeof (struct req_lib_cpg_mcast_batch);
+	iov_len = 1;
+
+	for (i = 0; i < msg_count; i++) {
+		entries[i].msglen = iovec[i].iov_len;
+		iov[iov_len].iov_base = (void *)&entries[i];
+		iov[iov_len].iov_len = sizeof (struct cpg_mcast_batch_entry);
+		iov_len++;
+		iov[iov_len].iov_base = iovec[i].iov_base;
+		iov[iov_len].iov_len = iovec[i].iov_len;
+		iov_len++;
+		if (CPG_MCAST_BATCH_ALIGN(iovec[i].iov_len) != iovec[i].iov_len) {
+			iov[iov_len].iov_base = (void *)pad;
+			iov[iov_len].iov_len = CPG_MCAST_BATCH_ALIGN(iovec[i].iov_len) - iovec[i].iov_len;
+			iov_len++;
+		}
+		batch_len += sizeof (struct cpg_mcast_batch_entry) + CPG_MCAST_BATCH_ALIGN(iovec[i].iov_len);
+	}
+
+	/*
+	 * Whole request, including its header and the header of every
+	 * message, has to fit
+	 */
+	if (sizeof (struct req_lib_cpg_mcast_batch) + batch_len > cpg_inst->max_msg_size) {
+		error = CS_ERR_TOO_BIG;
+		goto error_exit;
+	}
+
+	req_lib_cpg_mcast_batch.header.size = sizeof (struct req_lib_cpg_mcast_batch) +
+		batch_len;
+	req_lib_cpg_mcast_batch.header.id = MESSAGE_REQ_CPG_MCAST_BATCH;
+	req_lib_cpg_mcast_batch.guarantee = guarantee;
+	req_lib_cpg_mcast_batch.msg_count = msg_count;
+
+	qb_ipcc_fc_enable_max_set(cpg_inst->c,  2);
+	error = qb_to_cs_error(qb_ipcc_sendv(cpg_inst->c, iov, iov_len));
+	qb_ipcc_fc_enable_max_set(cpg_inst->c,  1);
+
+error_exit:
+	hdb_handle_put (&cpg_handle_t_db, handle);
+
+	return (error);
+}
+
 cs_error_t cpg_iteration_initialize(
 	cpg_handle_t handle,
 	cpg_iteration_type_t iteration_type,
@@ -98,13 +98,15 @@ static void cpg_bm_deliver_fn (
 	write_count++;
 }
 
-static cpg_callbacks_t callbacks = {
+static cpg_model_v1_data_t model_data = {
+	.model			= CPG_MODEL_V1,
 	.cpg_deliver_fn 	= cpg_bm_deliver_fn,
 	.cpg_confchg_fn		= cpg_bm_confchg_fn
 };
 
 #define ONE_MEG 1048576
-static char data[ONE_MEG];
+#define LARGE_ROUNDS 4
+static char *data;
 
 static void cpg_benchmark (
 	cpg_handle_t handle_in,
@@ -154,10 +156,35 @@ static void* dispatch_thread (void *arg)
 	return NULL;
 }
 
-int main (void) {
+static void usage (char *cmd)
+{
+	printf ("%s [-p] [-l]\n", cmd);
+	printf ("\n");
+	printf ("	-p    Send fragments of large messages pipelined (CPG_MODEL_V1_PIPELINED_MCAST)\n");
+	printf ("	-l    Benchmark large (fragmented) messages from 2 MB up\n");
+}
+
+int main (int argc, char *argv[]) {
 	unsigned int size;
+	unsigned int max_size;
 	int i;
 	unsigned int res;
+	int opt;
+	int large = 0;
+
+	while ((opt = getopt (argc, argv, "plh")) != -1) {
+		switch (opt) {
+		case 'p':
+			model_data.flags |= CPG_MODEL_V1_PIPELINED_MCAST;
+			break;
+		case 'l':
+			large = 1;
+			break;
+		default:
+			usage (argv[0]);
+			exit (0);
+		}
+	}
 
 	qb_log_init("cpgbench", LOG_USER, LOG_EMERG);
 	qb_log_ctl(QB_LOG_SYSLOG, QB_LOG_CONF_ENABLED, QB_FALSE);
@@ -165,9 +192,21 @@ int main (void) {
 			  QB_LOG_FILTER_FILE, "*", LOG_DEBUG);
 	qb_log_ctl(QB_LOG_STDERR, QB_LOG_CONF_ENABLED, QB_TRUE);
 
-	size = 64;
+	if (large) {
+		size = 2 * ONE_MEG;
+		max_size = size << (LARGE_ROUNDS - 1);
+	} else {
+		size = 64;
+		max_size = ONE_MEG;
+	}
+	data = calloc (1, max_size);
+	if (data == NULL) {
+		printf ("Can't allocate %u bytes of message data\n", max_size);
+		exit (1);
+	}
+
 	signal (SIGALRM, sigalrm_handler);
-	res = cpg_initialize (&handle, &callbacks);
+	res = cpg_model_initialize (&handle, CPG_MODEL_V1, (cpg_model_data_t *)&model_data, NULL);
 	if (res != CS_OK) {
 		printf ("cpg_initialize failed with result %d\n", res);
 		exit (1);
@@ -180,12 +219,20 @@ int main (void) {
 		exit (1);
 	}
 
-	for (i = 0; i < 10; i++) { /* number of repetitions - up to 50k */
-		cpg_benchmark (handle, size);
-		signal (SIGALRM, sigalrm_handler);
-		size *= 5;
-		if (size >= (ONE_MEG - 100)) {
-			break;
+	if (large) {
+		for (i = 0; i < LARGE_ROUNDS; i++) {
+			cpg_benchmark (handle, size);
+			signal (SIGALRM, sigalrm_handler);
+			size *= 2;
+		}
+	} else {
+		for (i = 0; i < 10; i++) { /* number of repetitions - up to 50k */
+			cpg_benchmark (handle, size);
+			signal (SIGALRM, sigalrm_handler);
+			size *= 5;
+			if (size >= (ONE_MEG - 100)) {
+				break;
+			}
 		}
 	}
 
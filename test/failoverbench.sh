@@ -0,0 +1,294 @@
+#!@BASHPATH@
+
+#
+# Measure failover latency of a local cluster. Several corosync instances
+# are started on one host, each in its own network namespace connected by a
+# bridge (udpu) or through the shm transport. One node is then repeatedly failed and the time until the
+# survivors form a new quorate membership is measured, both from outside
+# (wall clock of the harness) and as reported by the survivors in the
+# runtime.membership.last_change.* keys.
+#
+# Must be run as root. Uses ip(8), unshare(1), corosync and corosync-cmapctl
+# from PATH.
+#
+
+set -e
+
+nodes=3
+iterations=5
+fault="kill"
+token=1000
+transport="udpu"
+timeout=60
+workdir=""
+net="10.254.0"
+prefix="cf$$"
+
+usage() {
+	echo "failoverbench [options]"
+	echo ""
+	echo "Options:"
+	echo " -n nodes        Number of nodes (default 3)"
+	echo " -i iterations   Number of failovers to measure (default 5)"
+	echo " -f fault        Fault to inject: kill (SIGKILL), stop (SIGSTOP) or"
+	echo "                 link (take the network link of the node down) (default kill)"
+	echo " -t token        Totem token timeout in ms (default 1000)"
+	echo " -T transport    udpu or shm (default udpu)"
+	echo " -w workdir      Directory for configs and logs (default temporary)"
+	echo " -h              display this help"
+}
+
+while getopts "hn:i:f:t:T:w:" optflag; do
+		case "$optflag" in
+		h)
+			usage
+			exit 0
+		;;
+		n)
+			nodes="$OPTARG"
+		;;
+		i)
+			iterations="$OPTARG"
+		;;
+		f)
+			fault="$OPTARG"
+		;;
+		t)
+			token="$OPTARG"
+		;;
+		T)
+			transport="$OPTARG"
+		;;
+		w)
+			workdir="$OPTARG"
+		;;
+		\?|:)
+			usage
+			exit 1
+		;;
+		esac
+done
+
+case "$fault" in
+	kill|stop|link) ;;
+	*) usage; exit 1 ;;
+esac
+
+case "$transport" in
+	udpu|shm) ;;
+	*) usage; exit 1 ;;
+esac
+
+if [ "$nodes" -lt 3 ]; then
+	echo "At least 3 nodes are needed to keep quorum after a failure"
+	exit 1
+fi
+
+if [ "$(id -u)" != "0" ]; then
+	echo "failoverbench must be run as root"
+	exit 1
+fi
+
+[ -z "$workdir" ] && workdir="$(mktemp -d /tmp/failoverbench.XXXXXX)"
+mkdir -p "$workdir"
+
+now_ms() {
+	echo $(( $(date +%s%N) / 1000000 ))
+}
+
+node_exec() {
+	local node="$1"
+	shift
+	ip netns exec "$prefix-$node" "$@"
+}
+
+cmap_get() {
+	node_exec "$1" corosync-cmapctl -g "$2" 2>/dev/null | sed -e 's/.* = //'
+}
+
+members_joined() {
+	node_exec "$1" corosync-cmapctl runtime.totem.pg.mrp.srp.members. 2>/dev/null | \
+		grep -c "status (str) = joined" || true
+}
+
+cleanup() {
+	local i
+
+	for i in $(seq 1 "$nodes"); do
+		[ -f "$workdir/node$i/pid" ] && kill -CONT "$(cat "$workdir/node$i/pid")" 2>/dev/null || true
+		[ -f "$workdir/node$i/pid" ] && kill -TERM "$(cat "$workdir/node$i/pid")" 2>/dev/null || true
+	done
+	sleep 1
+	for i in $(seq 1 "$nodes"); do
+		ip netns del "$prefix-$i" 2>/dev/null || true
+	done
+	ip link del "$prefix-br" 2>/dev/null || true
+	rm -rf "$workdir/shm"
+}
+trap cleanup EXIT
+
+config_write() {
+	local node="$1"
+	local i
+
+	cat > "$workdir/node$node/corosync.conf" << EOF
+totem {
+	version: 2
+	cluster_name: failoverbench
+	transport: $transport
+	token: $token
+	shm_path: $workdir/shm
+	interface {
+		ringnumber: 0
+		bindnetaddr: $net.$([ "$transport" = "shm" ] && echo "$node" || echo 0)
+		mcastport: 5405
+	}
+}
+
+nodelist {
+$(for i in $(seq 1 "$nodes"); do
+	printf "\tnode {\n\t\tring0_addr: %s.%s\n\t\tnodeid: %s\n\t}\n" "$net" "$i" "$i"
+done)
+}
+
+quorum {
+	provider: corosync_votequorum
+}
+
+logging {
+	to_logfile: yes
+	logfile: $workdir/node$node/corosync.log
+	to_syslog: no
+	to_stderr: no
+	timestamp: hires
+}
+EOF
+}
+
+node_start() {
+	local node="$1"
+	local dir="$workdir/node$node"
+
+	mkdir -p "$dir/run" "$dir/lib"
+	rm -f "$dir/pid"
+
+	#
+	# Each instance has its own net namespace (and so its own abstract IPC
+	# sockets) and a private mount namespace hiding the shared pid file
+	#
+	COROSYNC_MAIN_CONFIG_FILE="$dir/corosync.conf" COROSYNC_RUN_DIR="$dir/lib" \
+	    ip netns exec "$prefix-$node" unshare -m sh -c \
+	    "mount --bind '$dir/run' /var/run && echo \$\$ > '$dir/pid' && exec corosync -f" \
+	    > "$dir/stdout" 2>&1 &
+}
+
+node_fail() {
+	local node="$1"
+	local pid
+
+	pid="$(cat "$workdir/node$node/pid")"
+
+	case "$fault" in
+	kill) kill -KILL "$pid" ;;
+	stop) kill -STOP "$pid" ;;
+	link)
+		if [ "$transport" = "shm" ]; then
+			node_exec "$node" corosync-cmapctl -s totem.shm_loss u32 100 > /dev/null
+		else
+			ip link set "$prefix-v$node" down
+		fi
+		;;
+	esac
+}
+
+node_heal() {
+	local node="$1"
+
+	case "$fault" in
+	kill) sleep 1; node_start "$node" ;;
+	stop) kill -CONT "$(cat "$workdir/node$node/pid")" ;;
+	link)
+		if [ "$transport" = "shm" ]; then
+			node_exec "$node" corosync-cmapctl -s totem.shm_loss u32 0 > /dev/null
+		else
+			ip link set "$prefix-v$node" up
+		fi
+		;;
+	esac
+}
+
+wait_members() {
+	local expected="$1"
+	local node="$2"
+	local start
+
+	start=$(now_ms)
+	while [ "$(members_joined "$node")" != "$expected" ] || \
+	    ! node_exec "$node" corosync-quorumtool -s 2>/dev/null | grep -q "Quorate: *Yes"; do
+		if [ $(( $(now_ms) - start )) -gt $(( timeout * 1000 )) ]; then
+			echo "Timeout waiting for $expected members on node $node"
+			exit 1
+		fi
+		sleep 0.01
+	done
+}
+
+#
+# With shm the namespaces only separate the IPC sockets of the instances
+#
+[ "$transport" = "udpu" ] && ip link add "$prefix-br" type bridge
+[ "$transport" = "udpu" ] && ip link set "$prefix-br" up
+
+for i in $(seq 1 "$nodes"); do
+	ip netns add "$prefix-$i"
+	if [ "$transport" = "udpu" ]; then
+		ip link add "$prefix-v$i" type veth peer name eth0 netns "$prefix-$i"
+		ip link set "$prefix-v$i" master "$prefix-br" up
+		node_exec "$i" ip addr add "$net.$i/24" dev eth0
+		node_exec "$i" ip link set eth0 up
+	fi
+	node_exec "$i" ip link set lo up
+	mkdir -p "$workdir/node$i"
+	config_write "$i"
+	node_start "$i"
+done
+
+wait_members "$nodes" 1
+echo "Cluster of $nodes nodes formed, logs in $workdir"
+
+victim="$nodes"
+measured=""
+
+for it in $(seq 1 "$iterations"); do
+	count=$(cmap_get 1 runtime.membership.change_count)
+
+	t_fail=$(now_ms)
+	node_fail "$victim"
+
+	while [ "$(cmap_get 1 runtime.membership.change_count)" = "$count" ] || \
+	    [ "$(members_joined 1)" != "$((nodes - 1))" ]; do
+		if [ $(( $(now_ms) - t_fail )) -gt $(( timeout * 1000 )) ]; then
+			echo "Timeout waiting for failover"
+			exit 1
+		fi
+		sleep 0.01
+	done
+	wait_members "$((nodes - 1))" 1
+	t_done=$(now_ms)
+
+	printf "failover %d: %d ms (observed)" "$it" $((t_done - t_fail))
+	for k in gather commit recovery operational sync_start sync_end quorate total; do
+		printf " %s=%s" "$k" "$(cmap_get 1 runtime.membership.last_change.$k)"
+	done
+	printf " (us)\n"
+	measured="$measured $((t_done - t_fail))"
+
+	node_heal "$victim"
+	wait_members "$nodes" 1
+done
+
+echo "$measured" | tr ' ' '\n' | grep -v '^$' | sort -n | \
+	awk '{ v[NR] = $1; s += $1 } END { printf "observed failover ms: min %d avg %.1f max %d\n", v[1], s / NR, v[NR] }'
+
+echo "membership change latency histogram of node 1:"
+node_exec 1 corosync-cmapctl runtime.membership.change_latency.
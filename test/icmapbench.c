@@ -0,0 +1,255 @@
+/*
+ * Copyright (c) 2026 Red Hat, Inc.
+ *
+ * All rights reserved.
+ *
+ * This software licensed under BSD license, the text of which follows:
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * - Neither the name of the Red Hat, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived from this
+ *   software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Benchmark of icmap (in-process, no corosync needed). Measures get, set,
+ * iteration and prefix tracking throughput and memory used by keys.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include <corosync/corotypes.h>
+#include <corosync/icmap.h>
+
+#ifndef timersub
+#define timersub(a, b, result)						\
+	do {								\
+		(result)->tv_sec = (a)->tv_sec - (b)->tv_sec;		\
+		(result)->tv_usec = (a)->tv_usec - (b)->tv_usec;	\
+		if ((result)->tv_usec < 0) {				\
+			--(result)->tv_sec;				\
+			(result)->tv_usec += 1000000;			\
+		}							\
+	} while (0)
+#endif /* timersub */
+
+#define DEFAULT_KEYS	10000
+#define DEFAULT_ROUNDS	10
+
+static unsigned int keys = DEFAULT_KEYS;
+
+static unsigned int rounds = DEFAULT_ROUNDS;
+
+static unsigned long long notifications;
+
+static struct timeval tv_start;
+
+static void bm_start (void)
+{
+	gettimeofday (&tv_start, NULL);
+}
+
+static void bm_stop (const char *name, unsigned long long ops)
+{
+	struct timeval tv_end;
+	struct timeval tv_elapsed;
+	double elapsed;
+
+	gettimeofday (&tv_end, NULL);
+	timersub (&tv_end, &tv_start, &tv_elapsed);
+
+	elapsed = tv_elapsed.tv_sec + (tv_elapsed.tv_usec / 1000000.0);
+
+	printf ("%-28s %10llu ops in %8.3f s = %12.2f ops/s\n", name, ops, elapsed,
+		elapsed > 0 ? ops / elapsed : 0.0);
+}
+
+static long rss_kb_get (void)
+{
+	FILE *f;
+	long pages = 0;
+	long rss = 0;
+
+	f = fopen ("/proc/self/statm", "r");
+	if (f == NULL) {
+		return (0);
+	}
+	if (fscanf (f, "%ld %ld", &pages, &rss) != 2) {
+		rss = 0;
+	}
+	fclose (f);
+
+	return (rss * (sysconf (_SC_PAGESIZE) / 1024));
+}
+
+static void key_name_get (char *key_name, size_t len, unsigned int i)
+{
+	/*
+	 * Similar to runtime.connections keys, few prefixes and many leaves
+	 */
+	snprintf (key_name, len, "runtime.bench.conn%u.stat%u", i / 16, i % 16);
+}
+
+static void bm_notify_fn (
+	int32_t event,
+	const char *key_name,
+	struct icmap_notify_value new_val,
+	struct icmap_notify_value old_val,
+	void *user_data)
+{
+	notifications++;
+}
+
+static void usage (char *cmd)
+{
+	printf ("%s [-n keys] [-r rounds]\n", cmd);
+	printf ("\n");
+	printf ("  -n  number of keys (default %u)\n", DEFAULT_KEYS);
+	printf ("  -r  number of rounds of each test (default %u)\n", DEFAULT_ROUNDS);
+}
+
+int main (int argc, char *argv[])
+{
+	char key_name[ICMAP_KEYNAME_MAXLEN];
+	icmap_iter_t iter;
+	icmap_track_t track;
+	unsigned long long ops;
+	uint64_t u64;
+	long rss_before, rss_after;
+	unsigned int i, r;
+	int opt;
+
+	while ((opt = getopt (argc, argv, "n:r:h")) != -1) {
+		switch (opt) {
+		case 'n':
+			keys = strtoul (optarg, NULL, 10);
+			break;
+		case 'r':
+			rounds = strtoul (optarg, NULL, 10);
+			break;
+		case 'h':
+		default:
+			usage (argv[0]);
+			exit (0);
+		}
+	}
+
+	if (keys == 0 || rounds == 0) {
+		usage (argv[0]);
+		exit (1);
+	}
+
+	if (icmap_init () != CS_OK) {
+		fprintf (stderr, "Can't initialize icmap\n");
+		exit (1);
+	}
+
+	rss_before = rss_kb_get ();
+	bm_start ();
+	for (i = 0; i < keys; i++) {
+		key_name_get (key_name, sizeof (key_name), i);
+		icmap_set_uint64 (key_name, 0);
+	}
+	bm_stop ("insert uint64", keys);
+	rss_after = rss_kb_get ();
+
+	printf ("%-28s %10ld KB per 10000 keys\n", "rss",
+		(long)(((rss_after - rss_before) * 10000.0) / keys));
+
+	bm_start ();
+	for (r = 0; r < rounds; r++) {
+		for (i = 0; i < keys; i++) {
+			key_name_get (key_name, sizeof (key_name), i);
+			icmap_set_uint64 (key_name, r + 1);
+		}
+	}
+	bm_stop ("set uint64", (unsigned long long)rounds * keys);
+
+	bm_start ();
+	for (r = 0; r < rounds; r++) {
+		for (i = 0; i < keys; i++) {
+			key_name_get (key_name, sizeof (key_name), i);
+			icmap_get_uint64 (key_name, &u64);
+		}
+	}
+	bm_stop ("get uint64", (unsigned long long)rounds * keys);
+
+	bm_start ();
+	for (r = 0; r < rounds; r++) {
+		for (i = 0; i < keys; i++) {
+			key_name_get (key_name, sizeof (key_name), i);
+			icmap_set_string (key_name, (r % 2) ? "odd" : "even");
+		}
+	}
+	bm_stop ("set string", (unsigned long long)rounds * keys);
+
+	ops = 0;
+	bm_start ();
+	for (r = 0; r < rounds; r++) {
+		iter = icmap_iter_init ("runtime.bench.");
+		while (icmap_iter_next (iter, NULL, NULL) != NULL) {
+			ops++;
+		}
+		icmap_iter_finalize (iter);
+	}
+	bm_stop ("iter", ops);
+
+	for (i = 0; i < keys; i++) {
+		key_name_get (key_name, sizeof (key_name), i);
+		icmap_set_uint64 (key_name, 0);
+	}
+
+	if (icmap_track_add ("runtime.bench.", ICMAP_TRACK_ADD | ICMAP_TRACK_DELETE |
+	    ICMAP_TRACK_MODIFY | ICMAP_TRACK_PREFIX, bm_notify_fn, NULL, &track) != CS_OK) {
+		fprintf (stderr, "Can't add track\n");
+		exit (1);
+	}
+
+	bm_start ();
+	for (r = 0; r < rounds; r++) {
+		for (i = 0; i < keys; i++) {
+			key_name_get (key_name, sizeof (key_name), i);
+			icmap_set_uint64 (key_name, r + 1);
+		}
+	}
+	bm_stop ("set uint64 prefix tracked", (unsigned long long)rounds * keys);
+	printf ("%-28s %10llu\n", "notifications", notifications);
+
+	icmap_track_delete (track);
+
+	bm_start ();
+	for (i = 0; i < keys; i++) {
+		key_name_get (key_name, sizeof (key_name), i);
+		icmap_delete (key_name);
+	}
+	bm_stop ("delete", keys);
+
+	icmap_fini ();
+
+	return (0);
+}
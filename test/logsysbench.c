@@ -0,0 +1,235 @@
+/*
+ * Copyright (c) 2026 Red Hat, Inc.
+ *
+ * All rights reserved.
+ *
+ * This software licensed under BSD license, the text of which follows:
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * - Neither the name of the Red Hat, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived from this
+ *   software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/*
+ * Benchmark of the cost of a trace level log call (in-process, no corosync
+ * needed) with the libqb blackbox, with the binary flight recorder and
+ * with trace disabled for the subsystem.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include <corosync/logsys.h>
+
+LOGSYS_DECLARE_SYSTEM ("logsysbench",
+	0,
+	LOG_DAEMON,
+	LOG_INFO);
+
+LOGSYS_DECLARE_SUBSYS ("BENCH");
+
+#define DEFAULT_CALLS	1000000
+
+static unsigned int calls = DEFAULT_CALLS;
+
+static struct timespec ts_start;
+
+static void bm_start (void)
+{
+	clock_gettime (CLOCK_MONOTONIC, &ts_start);
+}
+
+static void bm_stop (const char *name, unsigned long long ops)
+{
+	struct timespec ts_end;
+	double elapsed;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts_end);
+
+	elapsed = (ts_end.tv_sec - ts_start.tv_sec) * 1000000000.0 +
+		(ts_end.tv_nsec - ts_start.tv_nsec);
+
+	printf ("%-36s %10llu calls %10.1f ns/call\n", name, ops,
+		ops > 0 ? elapsed / ops : 0.0);
+}
+
+/*
+ * Same as the log function main.c passes to totem
+ */
+static void
+totem_log_printf (int level, int subsys,
+		const char *function_name,
+		const char *file_name,
+		int file_line,
+		const char *format, ...) __attribute__((format(printf, 6, 7)));
+
+static void
+totem_log_printf (int level, int subsys,
+		const char *function_name,
+		const char *file_name,
+		int file_line,
+		const char *format, ...)
+{
+	va_list ap;
+
+	if (level == LOGSYS_LEVEL_TRACE && _logsys_flightrec_active) {
+		va_start (ap, format);
+		if (!_logsys_flightrec_record_va (subsys, function_name,
+		    file_name, file_line, format, ap)) {
+			va_end (ap);
+			return;
+		}
+		va_end (ap);
+	}
+
+	va_start (ap, format);
+	qb_log_from_external_source_va (function_name, file_name,
+				    format, level, file_line,
+				    subsys, ap);
+	va_end (ap);
+}
+
+/*
+ * Same as the log_printf macros of the totem files
+ */
+#define totem_callsite_log_printf(level, format, args...)		\
+do {									\
+	static struct logsys_callsite _cs = LOGSYS_CALLSITE_INIT;	\
+	if (LOGSYS_CALLSITE_ENABLED(&_cs, level,			\
+	    logsys_subsys_id,						\
+	    _logsys_callsite_register)) {				\
+		totem_log_printf (level,				\
+			logsys_subsys_id,				\
+			__FUNCTION__, __FILE__, __LINE__,		\
+			format, ##args);				\
+	}								\
+} while (0)
+
+static void bm_run (const char *mode_name)
+{
+	char name[64];
+	unsigned int i;
+
+	snprintf (name, sizeof (name), "%s log_printf", mode_name);
+	bm_start ();
+	for (i = 0; i < calls; i++) {
+		log_printf (LOGSYS_LEVEL_TRACE, "Delivering %x to %x", i, i + 1);
+	}
+	bm_stop (name, calls);
+
+	snprintf (name, sizeof (name), "%s log_printf string", mode_name);
+	bm_start ();
+	for (i = 0; i < calls; i++) {
+		log_printf (LOGSYS_LEVEL_TRACE, "releasing messages up to and including %x for %s",
+			i, "ring 0");
+	}
+	bm_stop (name, calls);
+
+	snprintf (name, sizeof (name), "%s totem log_printf", mode_name);
+	bm_start ();
+	for (i = 0; i < calls; i++) {
+		totem_callsite_log_printf (LOGSYS_LEVEL_TRACE,
+			"mcasted message added to pending queue %u", i);
+	}
+	bm_stop (name, calls);
+}
+
+static void usage (char *cmd)
+{
+	printf ("%s [-n calls] [-f file]\n", cmd);
+	printf ("\n");
+	printf ("  -n  number of log calls of each test (default %u)\n", DEFAULT_CALLS);
+	printf ("  -f  write formatted binary flight recorder records to file\n");
+}
+
+int main (int argc, char *argv[])
+{
+	const char *fname = NULL;
+	int opt;
+	int res;
+
+	while ((opt = getopt (argc, argv, "n:f:h")) != -1) {
+		switch (opt) {
+		case 'n':
+			calls = strtoul (optarg, NULL, 10);
+			break;
+		case 'f':
+			fname = optarg;
+			break;
+		case 'h':
+		default:
+			usage (argv[0]);
+			exit (0);
+		}
+	}
+
+	if (calls == 0) {
+		usage (argv[0]);
+		exit (1);
+	}
+
+	logsys_config_apply ();
+
+	if (logsys_flightrec_mode_set (LOGSYS_FLIGHTREC_QB) < 0) {
+		fprintf (stderr, "Can't set qb flight recorder mode\n");
+		exit (1);
+	}
+	bm_run ("qb");
+
+	if (logsys_flightrec_mode_set (LOGSYS_FLIGHTREC_BINARY) < 0) {
+		fprintf (stderr, "Can't set binary flight recorder mode\n");
+		exit (1);
+	}
+	bm_run ("binary");
+
+	/*
+	 * Trace is wanted by no target, totem callsites are disabled
+	 */
+	if (logsys_config_blackbox_priority_set ("BENCH", LOGSYS_LEVEL_DEBUG) < 0) {
+		fprintf (stderr, "Can't set blackbox priority\n");
+		exit (1);
+	}
+	logsys_config_apply ();
+	bm_run ("no trace");
+
+	if (fname != NULL) {
+		bm_start ();
+		res = logsys_flightrec_write_to_file (fname);
+		bm_stop ("binary write to file", 1);
+		if (res < 0) {
+			fprintf (stderr, "Can't write %s: %s\n", fname, strerror (-res));
+			exit (1);
+		}
+	}
+
+	logsys_system_fini ();
+
+	return (0);
+}
@@ -0,0 +1,435 @@
+/*
+ * Copyright (c) 2026 Red Hat, Inc.
+ *
+ * All rights reserved.
+ *
+ * This software licensed under BSD license, the text of which follows:
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * - Neither the name of the Red Hat, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived from this
+ *   software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Scenario test of exec/sync.c (in-process, no corosync needed).
+ *
+ * This file implements the totempg group and schedwrk calls used by sync.c
+ * and plays a two node membership: messages sent by the local node are
+ * delivered as sent by both nodes, unless the scenario holds back the ones
+ * of the peer. Registered services count the calls of their sync callbacks,
+ * which are checked after every scenario.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+
+#include <corosync/corotypes.h>
+#include <corosync/totem/totempg.h>
+#include <corosync/totem/totem.h>
+
+#include "schedwrk.h"
+#include "sync.h"
+
+#define LOCAL_NODEID	1
+#define PEER_NODEID	2
+#define SERVICES	3
+#define QUEUE_MAX	64
+
+struct sim_msg {
+	char buf[4096];
+	size_t len;
+};
+
+struct sim_service {
+	const char *name;
+	uint64_t depends;
+	int process_res;
+	int init_calls;
+	int process_calls;
+	int activate_calls;
+	int abort_calls;
+};
+
+static void (*sim_deliver_fn) (
+	unsigned int nodeid,
+	const void *msg,
+	unsigned int msg_len,
+	int endian_conversion_required);
+
+static struct sim_msg queue[QUEUE_MAX];
+
+static int queue_entries;
+
+static int (*sim_schedwrk_fn) (const void *);
+
+static const void *sim_schedwrk_context;
+
+static int sync_completed;
+
+static int failures;
+
+static struct sim_service services[SERVICES];
+
+/*
+ * totempg and schedwrk used by sync.c
+ */
+int totempg_groups_initialize (
+	void **instance,
+	void (*deliver_fn) (
+		unsigned int nodeid,
+		const void *msg,
+		unsigned int msg_len,
+		int endian_conversion_required),
+	void (*confchg_fn) (
+		enum totem_configuration_type configuration_type,
+		const unsigned int *member_list, size_t member_list_entries,
+		const unsigned int *left_list, size_t left_list_entries,
+		const unsigned int *joined_list, size_t joined_list_entries,
+		const struct memb_ring_id *ring_id))
+{
+	sim_deliver_fn = deliver_fn;
+	*instance = &sim_deliver_fn;
+
+	return (0);
+}
+
+int totempg_groups_join (
+	void *instance,
+	const struct totempg_group *groups,
+	size_t group_cnt)
+{
+	return (0);
+}
+
+int totempg_groups_mcast_joined (
+	void *instance,
+	const struct iovec *iovec,
+	unsigned int iov_len,
+	int guarantee)
+{
+	struct sim_msg *msg;
+	unsigned int i;
+
+	if (queue_entries == QUEUE_MAX) {
+		return (-1);
+	}
+	msg = &queue[queue_entries++];
+	msg->len = 0;
+	for (i = 0; i < iov_len; i++) {
+		memcpy (msg->buf + msg->len, iovec[i].iov_base, iovec[i].iov_len);
+		msg->len += iovec[i].iov_len;
+	}
+
+	return (0);
+}
+
+int schedwrk_create_named (
+	hdb_handle_t *handle,
+	const char *name,
+	int (schedwrk_fn) (const void *),
+	const void *context)
+{
+	sim_schedwrk_fn = schedwrk_fn;
+	sim_schedwrk_context = context;
+	*handle = 1;
+
+	return (0);
+}
+
+void schedwrk_destroy (hdb_handle_t handle)
+{
+	sim_schedwrk_fn = NULL;
+}
+
+/*
+ * Deliver queued messages, as sent by the local node and (if peer is set)
+ * by the peer too
+ */
+static void queue_deliver (int peer)
+{
+	struct sim_msg msgs[QUEUE_MAX];
+	int entries;
+	int i;
+
+	memcpy (msgs, queue, sizeof (queue));
+	entries = queue_entries;
+	queue_entries = 0;
+
+	for (i = 0; i < entries; i++) {
+		sim_deliver_fn (LOCAL_NODEID, msgs[i].buf, msgs[i].len, 0);
+		if (peer) {
+			sim_deliver_fn (PEER_NODEID, msgs[i].buf, msgs[i].len, 0);
+		}
+	}
+}
+
+/*
+ * One run of the sync schedwrk, like one pass of the main loop
+ */
+static void schedwrk_run (void)
+{
+	if (sim_schedwrk_fn != NULL) {
+		if (sim_schedwrk_fn (sim_schedwrk_context) == 0) {
+			sim_schedwrk_fn = NULL;
+		}
+	}
+}
+
+#define SERVICE_CALLBACKS(n)						\
+static void service##n##_init (						\
+	const unsigned int *trans_list, size_t trans_list_entries,	\
+	const unsigned int *member_list, size_t member_list_entries,	\
+	const struct memb_ring_id *ring_id)				\
+{									\
+	services[n].init_calls++;					\
+}									\
+static int service##n##_process (void)					\
+{									\
+	services[n].process_calls++;					\
+	return (services[n].process_res);				\
+}									\
+static void service##n##_activate (void)				\
+{									\
+	services[n].activate_calls++;					\
+}									\
+static void service##n##_abort (void)					\
+{									\
+	services[n].abort_calls++;					\
+}
+
+SERVICE_CALLBACKS(0)
+SERVICE_CALLBACKS(1)
+SERVICE_CALLBACKS(2)
+
+static int sim_sync_callbacks_retrieve (int service_id, struct sync_callbacks *callbacks)
+{
+	if (service_id >= SERVICES) {
+		return (-1);
+	}
+	if (callbacks == NULL) {
+		return (0);
+	}
+
+	switch (service_id) {
+	case 0:
+		callbacks->sync_init = service0_init;
+		callbacks->sync_process = service0_process;
+		callbacks->sync_activate = service0_activate;
+		callbacks->sync_abort = service0_abort;
+		break;
+	case 1:
+		callbacks->sync_init = service1_init;
+		callbacks->sync_process = service1_process;
+		callbacks->sync_activate = service1_activate;
+		callbacks->sync_abort = service1_abort;
+		break;
+	case 2:
+		callbacks->sync_init = service2_init;
+		callbacks->sync_process = service2_process;
+		callbacks->sync_activate = service2_activate;
+		callbacks->sync_abort = service2_abort;
+		break;
+	}
+	callbacks->sync_depends = services[service_id].depends;
+	callbacks->name = services[service_id].name;
+
+	return (0);
+}
+
+static void sim_synchronization_completed (void)
+{
+	sync_completed++;
+}
+
+static void services_reset (void)
+{
+	int i;
+
+	for (i = 0; i < SERVICES; i++) {
+		services[i].process_res = 0;
+		services[i].init_calls = 0;
+		services[i].process_calls = 0;
+		services[i].activate_calls = 0;
+		services[i].abort_calls = 0;
+	}
+	sync_completed = 0;
+}
+
+static void check (const char *scenario, const char *what, int value, int expected)
+{
+	if (value != expected) {
+		printf ("FAIL %s: %s is %d, expected %d\n", scenario, what, value, expected);
+		failures++;
+	}
+}
+
+static void check_service (const char *scenario, int i,
+	int init_calls, int activate_calls, int abort_calls)
+{
+	char what[64];
+
+	snprintf (what, sizeof (what), "%s sync_init calls", services[i].name);
+	check (scenario, what, services[i].init_calls, init_calls);
+	snprintf (what, sizeof (what), "%s sync_activate calls", services[i].name);
+	check (scenario, what, services[i].activate_calls, activate_calls);
+	snprintf (what, sizeof (what), "%s sync_abort calls", services[i].name);
+	check (scenario, what, services[i].abort_calls, abort_calls);
+}
+
+/*
+ * Start sync of a new ring and get to processing of the first stage
+ */
+static void ring_start (unsigned long long seq)
+{
+	unsigned int member_list[2] = { LOCAL_NODEID, PEER_NODEID };
+	struct memb_ring_id ring_id;
+
+	memset (&ring_id, 0, sizeof (ring_id));
+	ring_id.seq = seq;
+
+	services_reset ();
+	queue_entries = 0;
+	sync_save_transitional (member_list, 2, &ring_id);
+	sync_start (member_list, 2, &ring_id);
+	/* service build */
+	queue_deliver (1);
+}
+
+/*
+ * Membership changes after one service of a stage finished processing and
+ * the other one didn't
+ */
+static void scenario_abort_in_process (void)
+{
+	const char *name = "abort in process";
+
+	ring_start (4);
+	services[1].process_res = -1;
+	schedwrk_run ();
+	sync_abort ();
+
+	check_service (name, 0, 1, 0, 1);
+	check_service (name, 1, 1, 0, 1);
+	check_service (name, 2, 0, 0, 0);
+	check (name, "sync completed", sync_completed, 0);
+}
+
+/*
+ * Membership changes after the stage was processed, while the barrier of
+ * the peer is missing
+ */
+static void scenario_abort_in_barrier (void)
+{
+	const char *name = "abort in barrier";
+
+	ring_start (8);
+	schedwrk_run ();
+	/* barrier of local node only */
+	queue_deliver (0);
+	sync_abort ();
+
+	check_service (name, 0, 1, 0, 1);
+	check_service (name, 1, 1, 0, 1);
+	check_service (name, 2, 0, 0, 0);
+	check (name, "sync completed", sync_completed, 0);
+
+	/* Second abort without new ring must not abort services again */
+	sync_abort ();
+	check_service (name, 0, 1, 0, 1);
+	check_service (name, 1, 1, 0, 1);
+}
+
+/*
+ * Membership changes in the second stage, services of the first stage are
+ * already active
+ */
+static void scenario_abort_in_second_stage (void)
+{
+	const char *name = "abort in second stage";
+
+	ring_start (12);
+	schedwrk_run ();
+	queue_deliver (1);
+	services[2].process_res = -1;
+	schedwrk_run ();
+	sync_abort ();
+
+	check_service (name, 0, 1, 1, 0);
+	check_service (name, 1, 1, 1, 0);
+	check_service (name, 2, 1, 0, 1);
+	check (name, "sync completed", sync_completed, 0);
+}
+
+/*
+ * Sync of a new ring after the aborts runs to completion
+ */
+static void scenario_complete (void)
+{
+	const char *name = "complete";
+
+	ring_start (16);
+	schedwrk_run ();
+	queue_deliver (1);
+	schedwrk_run ();
+	queue_deliver (1);
+
+	check_service (name, 0, 1, 1, 0);
+	check_service (name, 1, 1, 1, 0);
+	check_service (name, 2, 1, 1, 0);
+	check (name, "sync completed", sync_completed, 1);
+}
+
+int main (int argc, char *argv[])
+{
+	/*
+	 * Services 0 and 1 are independent and synchronized in one stage,
+	 * service 2 depends on service 0
+	 */
+	services[0].name = "service0";
+	services[1].name = "service1";
+	services[2].name = "service2";
+	services[2].depends = (1ULL << 0);
+
+	if (sync_init (sim_sync_callbacks_retrieve, sim_synchronization_completed) != 0) {
+		fprintf (stderr, "Can't initialize sync\n");
+		exit (1);
+	}
+
+	scenario_abort_in_process ();
+	scenario_abort_in_barrier ();
+	scenario_abort_in_second_stage ();
+	scenario_complete ();
+
+	if (failures) {
+		printf ("%d checks failed\n", failures);
+		return (1);
+	}
+	printf ("all scenarios passed\n");
+
+	return (0);
+}
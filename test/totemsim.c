@@ -0,0 +1,1245 @@
+/*
+ * Copyright (c) 2026 Red Hat, Inc.
+ *
+ * All rights reserved.
+ *
+ * This software licensed under BSD license, the text of which follows:
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ * - Neither the name of the Red Hat, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived from this
+ *   software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+ * THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Deterministic simulator of a totem ring (no corosync, no network needed).
+ *
+ * N totemsrp instances run in one process on top of a simulated network
+ * (this file implements the totemnet API) and a virtual clock (this file
+ * implements the qb_loop timers and qb_util_nano_current_get used by
+ * totemsrp and totemrrp). Events are processed in virtual time order, so a
+ * run is reproducible for a given seed and takes as long as the CPU needs,
+ * independently of the simulated timeouts.
+ *
+ * Every node multicasts messages carrying their origin, sequence number and
+ * send time. Reported are throughput, delivery latency percentiles,
+ * retransmits, FIFO order violations and the time the membership took to
+ * converge after every scripted fault.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdarg.h>
+#include <limits.h>
+#include <sys/param.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#include <qb/qbdefs.h>
+#include <qb/qbloop.h>
+#include <qb/qbutil.h>
+
+#include <corosync/list.h>
+#include <corosync/totem/totem.h>
+#define LOGSYS_UTILS_ONLY 1
+#include <corosync/logsys.h>
+
+#include "totemsrp.h"
+#include "totemnet.h"
+
+#define DEFAULT_NODES		5
+#define DEFAULT_DURATION	10
+#define DEFAULT_RATE		1000
+#define DEFAULT_SIZE		100
+#define DEFAULT_LATENCY		100
+#define DEFAULT_TOKEN		1000
+#define DEFAULT_SEED		1
+
+/*
+ * Same defaults and derivations as totemconfig.c
+ */
+#define TOKEN_RETRANSMITS_BEFORE_LOSS_CONST	4
+#define TOKEN_COEFFICIENT			650
+#define JOIN_TIMEOUT				50
+#define MERGE_TIMEOUT				200
+#define DOWNCHECK_TIMEOUT			1000
+#define FAIL_TO_RECV_CONST			2500
+#define	SEQNO_UNCHANGED_CONST			30
+#define MAX_NETWORK_DELAY			50
+#define WINDOW_SIZE				50
+#define MAX_MESSAGES				17
+#define MISS_COUNT_CONST			5
+#define RRP_PROBLEM_COUNT_TIMEOUT		2000
+#define RRP_PROBLEM_COUNT_THRESHOLD_DEFAULT	10
+#define RRP_AUTORECOVERY_CHECK_TIMEOUT		1000
+
+#define SIM_NET_MTU		1500
+#define SIM_BIND_DELAY_MSEC	100
+#define SIM_LOAD_TICK_USEC	1000
+#define SIM_FAULTS_MAX		64
+
+#define LATENCY_BUCKET_USEC	10
+#define LATENCY_BUCKETS		1000000
+
+/*
+ * Virtual time starts at 1s, totemsrp treats some zero timestamps as unset
+ */
+#define SIM_TIME_START		QB_TIME_NS_IN_SEC
+
+struct sim_node;
+
+struct sim_event {
+	uint64_t time;
+	uint64_t seq;
+	struct sim_node *node;
+	void (*fn) (void *data);
+	void *data;
+	int cancelled;
+	int is_timer;
+	struct list_head timer_list;
+};
+
+struct sim_net {
+	void *context;
+
+	void (*deliver_fn) (
+		void *context,
+		const void *msg,
+		unsigned int msg_len);
+
+	void (*iface_change_fn) (
+		void *context,
+		const struct totem_ip_address *iface_address);
+
+	void (*target_set_completed) (
+		void *context);
+
+	struct totem_ip_address my_id;
+
+	struct totem_ip_address token_target;
+};
+
+struct sim_node {
+	unsigned int index;
+
+	struct totem_config totem_config;
+
+	totemmrp_stats_t stats;
+
+	void *srp_context;
+
+	struct sim_net net;
+
+	struct list_head timers;
+
+	int isolated;
+
+	uint32_t next_seq;
+
+	uint32_t *last_seq;
+
+	double load_credit;
+
+	uint64_t sent;
+
+	uint64_t send_failed;
+
+	uint64_t delivered;
+
+	uint64_t order_violations;
+
+	unsigned int member_count;
+};
+
+struct sim_frame {
+	struct sim_node *dst;
+	unsigned int len;
+	unsigned char buf[];
+};
+
+/*
+ * Payload of the load messages
+ */
+struct sim_msg {
+	uint32_t origin;
+	uint32_t seq;
+	uint64_t send_time;
+} __attribute__((packed));
+
+enum sim_fault_type {
+	SIM_FAULT_FORM,
+	SIM_FAULT_ISOLATE,
+	SIM_FAULT_JOIN,
+	SIM_FAULT_LOSS,
+	SIM_FAULT_LATENCY
+};
+
+struct sim_fault {
+	uint64_t time;
+	enum sim_fault_type type;
+	unsigned int arg;
+	char desc[64];
+	int topology_changed;
+	int converged;
+	uint64_t converged_time;
+};
+
+static struct sim_node *nodes;
+
+static unsigned int node_count = DEFAULT_NODES;
+
+static unsigned int duration = DEFAULT_DURATION;
+
+static unsigned int rate = DEFAULT_RATE;
+
+static unsigned int msg_size = DEFAULT_SIZE;
+
+static double loss_pct;
+
+static unsigned int latency_usec = DEFAULT_LATENCY;
+
+static unsigned int jitter_usec;
+
+static unsigned int token = DEFAULT_TOKEN;
+
+static unsigned int window_size = WINDOW_SIZE;
+
+static unsigned int max_messages = MAX_MESSAGES;
+
+static uint64_t seed = DEFAULT_SEED;
+
+static int log_level = LOGSYS_LEVEL_WARNING;
+
+static struct sim_fault faults[SIM_FAULTS_MAX];
+
+static unsigned int fault_count;
+
+static uint64_t sim_now = SIM_TIME_START;
+
+static uint64_t sim_event_seq;
+
+static struct sim_node *sim_current;
+
+static struct sim_event **heap;
+
+static size_t heap_len;
+
+static size_t heap_size;
+
+static uint64_t rng_state;
+
+static uint64_t latency_hist[LATENCY_BUCKETS];
+
+static uint64_t latency_count;
+
+static uint64_t latency_max;
+
+static uint64_t frames_sent;
+
+static uint64_t frames_lost;
+
+static uint64_t events_processed;
+
+/*
+ * xorshift64*, the simulation must not depend on libc random state
+ */
+static uint64_t sim_random (void)
+{
+	rng_state ^= rng_state >> 12;
+	rng_state ^= rng_state << 25;
+	rng_state ^= rng_state >> 27;
+	return (rng_state * 2685821657736338717ULL);
+}
+
+static double sim_random_unit (void)
+{
+	return ((sim_random () >> 11) * (1.0 / 9007199254740992.0));
+}
+
+static int sim_event_before (const struct sim_event *a, const struct sim_event *b)
+{
+	return (a->time < b->time || (a->time == b->time && a->seq < b->seq));
+}
+
+static void heap_push (struct sim_event *ev)
+{
+	size_t i, parent;
+
+	if (heap_len == heap_size) {
+		heap_size = heap_size ? heap_size * 2 : 1024;
+		heap = realloc (heap, heap_size * sizeof (struct sim_event *));
+		if (heap == NULL) {
+			fprintf (stderr, "Out of memory\n");
+			exit (1);
+		}
+	}
+
+	i = heap_len++;
+	while (i > 0) {
+		parent = (i - 1) / 2;
+		if (!sim_event_before (ev, heap[parent])) {
+			break;
+		}
+		heap[i] = heap[parent];
+		i = parent;
+	}
+	heap[i] = ev;
+}
+
+static struct sim_event *heap_pop (void)
+{
+	struct sim_event *top;
+	struct sim_event *last;
+	size_t i, child;
+
+	if (heap_len == 0) {
+		return (NULL);
+	}
+
+	top = heap[0];
+	last = heap[--heap_len];
+	i = 0;
+	while ((child = 2 * i + 1) < heap_len) {
+		if (child + 1 < heap_len && sim_event_before (heap[child + 1], heap[child])) {
+			child++;
+		}
+		if (!sim_event_before (heap[child], last)) {
+			break;
+		}
+		heap[i] = heap[child];
+		i = child;
+	}
+	heap[i] = last;
+
+	return (top);
+}
+
+static struct sim_event *sim_event_add (
+	struct sim_node *node,
+	uint64_t delay,
+	void (*fn) (void *data),
+	void *data)
+{
+	struct sim_event *ev;
+
+	ev = calloc (1, sizeof (struct sim_event));
+	if (ev == NULL) {
+		fprintf (stderr, "Out of memory\n");
+		exit (1);
+	}
+	ev->time = sim_now + delay;
+	ev->seq = ++sim_event_seq;
+	ev->node = node;
+	ev->fn = fn;
+	ev->data = data;
+	list_init (&ev->timer_list);
+
+	heap_push (ev);
+
+	return (ev);
+}
+
+/*
+ * Virtual clock replacing the qb_loop timers and clock of libqb. The loop
+ * handle passed to totemsrp is the sim_node, so every timer knows its node.
+ */
+int32_t qb_loop_timer_add (
+	qb_loop_t *l,
+	enum qb_loop_priority p,
+	uint64_t nsec_duration,
+	void *data,
+	qb_loop_timer_dispatch_fn dispatch_fn,
+	qb_loop_timer_handle *timer_handle_out)
+{
+	struct sim_node *node = (struct sim_node *)l;
+	struct sim_event *ev;
+
+	ev = sim_event_add (node, nsec_duration, dispatch_fn, data);
+	ev->is_timer = 1;
+	list_add_tail (&ev->timer_list, &node->timers);
+
+	if (timer_handle_out) {
+		*timer_handle_out = ev->seq;
+	}
+
+	return (0);
+}
+
+int32_t qb_loop_timer_del (qb_loop_t *l, qb_loop_timer_handle th)
+{
+	struct sim_node *node = (struct sim_node *)l;
+	struct list_head *list;
+	struct sim_event *ev;
+
+	for (list = node->timers.next; list != &node->timers; list = list->next) {
+		ev = list_entry (list, struct sim_event, timer_list);
+		if (ev->seq == th) {
+			ev->cancelled = 1;
+			list_del (&ev->timer_list);
+			return (0);
+		}
+	}
+
+	return (-1);
+}
+
+uint64_t qb_util_nano_current_get (void)
+{
+	return (sim_now);
+}
+
+static void sim_log_printf (
+	int level,
+	int subsys,
+	const char *function_name,
+	const char *file_name,
+	int file_line,
+	const char *format,
+	...)
+{
+	va_list ap;
+
+	if (level > log_level) {
+		return;
+	}
+
+	printf ("%10.6f node %2u [%s:%d] ",
+		(sim_now - SIM_TIME_START) / (double)QB_TIME_NS_IN_SEC,
+		sim_current ? sim_current->index + 1 : 0, file_name, file_line);
+	va_start (ap, format);
+	vprintf (format, ap);
+	va_end (ap);
+	printf ("\n");
+}
+
+static int sim_log_callsite_register (
+	struct logsys_callsite *cs,
+	int level,
+	int subsys)
+{
+	cs->registered = 1;
+	cs->enabled = (level <= log_level);
+
+	return (cs->enabled);
+}
+
+static void sim_addr_get (unsigned int index, struct totem_ip_address *addr)
+{
+	memset (addr, 0, sizeof (struct totem_ip_address));
+	addr->nodeid = index + 1;
+	addr->family = AF_INET;
+	addr->addr[0] = 10;
+	addr->addr[1] = 0;
+	addr->addr[2] = (index + 1) >> 8;
+	addr->addr[3] = (index + 1) & 0xff;
+}
+
+static void sim_ring_id_create_or_load (
+	struct memb_ring_id *memb_ring_id,
+	const struct totem_ip_address *addr)
+{
+	totemip_copy (&memb_ring_id->rep, addr);
+	memb_ring_id->seq = 0;
+}
+
+static void sim_ring_id_store (
+	const struct memb_ring_id *memb_ring_id,
+	const struct totem_ip_address *addr)
+{
+}
+
+/*
+ * Simulated network
+ */
+static void sim_frame_deliver (void *data)
+{
+	struct sim_frame *frame = (struct sim_frame *)data;
+
+	frame->dst->net.deliver_fn (frame->dst->net.context, frame->buf, frame->len);
+	free (frame);
+}
+
+static void sim_frame_send (
+	struct sim_node *src,
+	struct sim_node *dst,
+	const void *msg,
+	unsigned int msg_len)
+{
+	struct sim_frame *frame;
+	uint64_t delay;
+
+	frames_sent++;
+
+	if (src != dst) {
+		if (src->isolated || dst->isolated ||
+		    (loss_pct > 0 && sim_random_unit () * 100 < loss_pct)) {
+			frames_lost++;
+			return;
+		}
+	}
+
+	frame = malloc (sizeof (struct sim_frame) + msg_len);
+	if (frame == NULL) {
+		fprintf (stderr, "Out of memory\n");
+		exit (1);
+	}
+	frame->dst = dst;
+	frame->len = msg_len;
+	memcpy (frame->buf, msg, msg_len);
+
+	delay = (uint64_t)latency_usec * QB_TIME_NS_IN_USEC;
+	if (jitter_usec) {
+		delay += (uint64_t)(sim_random_unit () * jitter_usec * QB_TIME_NS_IN_USEC);
+	}
+
+	sim_event_add (dst, delay, sim_frame_deliver, frame);
+}
+
+static void sim_bind_fn (void *data)
+{
+	struct sim_node *node = (struct sim_node *)data;
+
+	node->net.iface_change_fn (node->net.context, &node->net.my_id);
+}
+
+int totemnet_initialize (
+	qb_loop_t *poll_handle,
+	void **net_context,
+	struct totem_config *totem_config,
+	totemsrp_stats_t *stats,
+	int interface_no,
+	void *context,
+
+	void (*deliver_fn) (
+		void *context,
+		const void *msg,
+		unsigned int msg_len),
+
+	void (*iface_change_fn) (
+		void *context,
+		const struct totem_ip_address *iface_address),
+
+	void (*target_set_completed) (
+		void *context))
+{
+	struct sim_node *node = (struct sim_node *)poll_handle;
+	qb_loop_timer_handle timer;
+
+	node->net.context = context;
+	node->net.deliver_fn = deliver_fn;
+	node->net.iface_change_fn = iface_change_fn;
+	node->net.target_set_completed = target_set_completed;
+	sim_addr_get (node->index, &node->net.my_id);
+
+	/*
+	 * Like the real transports, report the interface once totemrrp is set up
+	 */
+	qb_loop_timer_add (poll_handle, QB_LOOP_MED,
+		SIM_BIND_DELAY_MSEC * QB_TIME_NS_IN_MSEC, node, sim_bind_fn, &timer);
+
+	*net_context = node;
+	return (0);
+}
+
+void *totemnet_buffer_alloc (void *net_context)
+{
+	return malloc (FRAME_SIZE_MAX);
+}
+
+void totemnet_buffer_release (void *net_context, void *ptr)
+{
+	free (ptr);
+}
+
+int totemnet_processor_count_set (void *net_context, int processor_count)
+{
+	return (0);
+}
+
+int totemnet_token_send (void *net_context, const void *msg, unsigned int msg_len)
+{
+	struct sim_node *node = (struct sim_node *)net_context;
+	unsigned int nodeid = node->net.token_target.nodeid;
+
+	if (nodeid == 0 || nodeid > node_count) {
+		return (0);
+	}
+
+	sim_frame_send (node, &nodes[nodeid - 1], msg, msg_len);
+
+	return (0);
+}
+
+/*
+ * Multicast semantics of the udp transport, every node (including the
+ * sender) gets a copy
+ */
+int totemnet_mcast_flush_send (void *net_context, const void *msg, unsigned int msg_len)
+{
+	struct sim_node *node = (struct sim_node *)net_context;
+	unsigned int i;
+
+	for (i = 0; i < node_count; i++) {
+		sim_frame_send (node, &nodes[i], msg, msg_len);
+	}
+
+	return (0);
+}
+
+int totemnet_mcast_noflush_send (void *net_context, const void *msg, unsigned int msg_len)
+{
+	return (totemnet_mcast_flush_send (net_context, msg, msg_len));
+}
+
+int totemnet_recv_flush (void *net_context)
+{
+	return (0);
+}
+
+int totemnet_send_flush (void *net_context)
+{
+	return (0);
+}
+
+int totemnet_iface_check (void *net_context)
+{
+	return (0);
+}
+
+int totemnet_finalize (void *net_context)
+{
+	return (0);
+}
+
+int totemnet_net_mtu_adjust (void *net_context, struct totem_config *totem_config)
+{
+	return (0);
+}
+
+const char *totemnet_iface_print (void *net_context)
+{
+	struct sim_node *node = (struct sim_node *)net_context;
+
+	return (totemip_print (&node->net.my_id));
+}
+
+int totemnet_iface_get (void *net_context, struct totem_ip_address *addr)
+{
+	struct sim_node *node = (struct sim_node *)net_context;
+
+	memcpy (addr, &node->net.my_id, sizeof (struct totem_ip_address));
+
+	return (0);
+}
+
+int totemnet_token_target_set (void *net_context, const struct totem_ip_address *token_target)
+{
+	struct sim_node *node = (struct sim_node *)net_context;
+
+	memcpy (&node->net.token_target, token_target, sizeof (struct totem_ip_address));
+	node->net.target_set_completed (node->net.context);
+
+	return (0);
+}
+
+int totemnet_crypto_set (void *net_context, const char *cipher_type, const char *hash_type)
+{
+	return (0);
+}
+
+int totemnet_recv_mcast_empty (void *net_context)
+{
+	return (0);
+}
+
+int totemnet_member_add (void *net_context, const struct totem_ip_address *member)
+{
+	return (0);
+}
+
+int totemnet_member_remove (void *net_context, const struct totem_ip_address *member)
+{
+	return (0);
+}
+
+int totemnet_member_set_active (void *net_context, const struct totem_ip_address *member, int active)
+{
+	return (0);
+}
+
+/*
+ * Membership converged after a fault once every node has the membership
+ * expected from the set of isolated nodes
+ */
+static unsigned int sim_expected_members (const struct sim_node *node)
+{
+	unsigned int i;
+	unsigned int res = 0;
+
+	if (node->isolated) {
+		return (1);
+	}
+
+	for (i = 0; i < node_count; i++) {
+		if (!nodes[i].isolated) {
+			res++;
+		}
+	}
+
+	return (res);
+}
+
+static void sim_convergence_check (void)
+{
+	struct sim_fault *fault = NULL;
+	unsigned int i;
+
+	for (i = 0; i < fault_count; i++) {
+		if (faults[i].time <= sim_now && faults[i].topology_changed) {
+			fault = &faults[i];
+		}
+	}
+	if (fault == NULL || fault->converged) {
+		return;
+	}
+
+	for (i = 0; i < node_count; i++) {
+		if (nodes[i].member_count != sim_expected_members (&nodes[i])) {
+			return;
+		}
+	}
+
+	fault->converged = 1;
+	fault->converged_time = sim_now;
+}
+
+static void sim_trans_ack_fn (void *data)
+{
+	struct sim_node *node = (struct sim_node *)data;
+
+	totemsrp_trans_ack (node->srp_context);
+}
+
+static void sim_confchg_fn (
+	enum totem_configuration_type configuration_type,
+	const unsigned int *member_list, size_t member_list_entries,
+	const unsigned int *left_list, size_t left_list_entries,
+	const unsigned int *joined_list, size_t joined_list_entries,
+	const struct memb_ring_id *ring_id)
+{
+	struct sim_node *node = sim_current;
+
+	if (configuration_type != TOTEM_CONFIGURATION_REGULAR) {
+		return;
+	}
+
+	node->member_count = member_list_entries;
+
+	/*
+	 * corosync acks after sync, there is no sync here
+	 */
+	sim_event_add (node, 0, sim_trans_ack_fn, node);
+
+	sim_convergence_check ();
+}
+
+static void sim_deliver_fn (
+	unsigned int nodeid,
+	const void *msg,
+	unsigned int msg_len,
+	int endian_conversion_required)
+{
+	struct sim_node *node = sim_current;
+	struct sim_msg sim_msg;
+	uint64_t latency;
+	uint64_t bucket;
+
+	if (msg_len < sizeof (struct sim_msg)) {
+		return;
+	}
+	memcpy (&sim_msg, msg, sizeof (sim_msg));
+	if (sim_msg.origin >= node_count) {
+		return;
+	}
+
+	node->delivered++;
+
+	if (sim_msg.seq <= node->last_seq[sim_msg.origin]) {
+		node->order_violations++;
+	}
+	node->last_seq[sim_msg.origin] = sim_msg.seq;
+
+	latency = (sim_now - sim_msg.send_time) / QB_TIME_NS_IN_USEC;
+	bucket = latency / LATENCY_BUCKET_USEC;
+	if (bucket >= LATENCY_BUCKETS) {
+		bucket = LATENCY_BUCKETS - 1;
+	}
+	latency_hist[bucket]++;
+	latency_count++;
+	if (latency > latency_max) {
+		latency_max = latency;
+	}
+}
+
+static void sim_waiting_trans_ack_fn (int waiting_trans_ack)
+{
+}
+
+/*
+ * Load
+ */
+static int sim_msg_send (struct sim_node *node)
+{
+	unsigned char buf[FRAME_SIZE_MAX];
+	struct sim_msg sim_msg;
+	struct iovec iov;
+
+	sim_msg.origin = node->index;
+	sim_msg.seq = node->next_seq + 1;
+	sim_msg.send_time = sim_now;
+	memset (buf, 0, msg_size);
+	memcpy (buf, &sim_msg, sizeof (sim_msg));
+
+	iov.iov_base = buf;
+	iov.iov_len = msg_size;
+
+	if (totemsrp_avail (node->srp_context) <= 0 ||
+	    totemsrp_mcast (node->srp_context, &iov, 1, 0) != 0) {
+		node->send_failed++;
+		return (-1);
+	}
+
+	node->next_seq++;
+	node->sent++;
+
+	return (0);
+}
+
+static void sim_load_fn (void *data)
+{
+	struct sim_node *node = (struct sim_node *)data;
+
+	if (node->member_count == 0) {
+		/*
+		 * Like corosync services, wait for the first membership
+		 */
+	} else if (rate == 0) {
+		/*
+		 * Saturate, keep the queue full
+		 */
+		while (sim_msg_send (node) == 0)
+			;
+	} else {
+		node->load_credit += rate * (SIM_LOAD_TICK_USEC / 1000000.0);
+		while (node->load_credit >= 1.0) {
+			node->load_credit -= 1.0;
+			if (sim_msg_send (node) != 0) {
+				break;
+			}
+		}
+	}
+
+	if (sim_now - SIM_TIME_START < (uint64_t)duration * QB_TIME_NS_IN_SEC) {
+		sim_event_add (node, SIM_LOAD_TICK_USEC * QB_TIME_NS_IN_USEC, sim_load_fn, node);
+	}
+}
+
+/*
+ * Faults
+ */
+static void sim_fault_fn (void *data)
+{
+	struct sim_fault *fault = (struct sim_fault *)data;
+	struct sim_node *node = NULL;
+
+	if (fault->type == SIM_FAULT_ISOLATE || fault->type == SIM_FAULT_JOIN) {
+		node = &nodes[fault->arg - 1];
+	}
+
+	switch (fault->type) {
+	case SIM_FAULT_FORM:
+		fault->topology_changed = 1;
+		break;
+	case SIM_FAULT_ISOLATE:
+		fault->topology_changed = !node->isolated;
+		node->isolated = 1;
+		break;
+	case SIM_FAULT_JOIN:
+		fault->topology_changed = node->isolated;
+		node->isolated = 0;
+		break;
+	case SIM_FAULT_LOSS:
+		loss_pct = fault->arg;
+		break;
+	case SIM_FAULT_LATENCY:
+		latency_usec = fault->arg;
+		break;
+	}
+
+	/*
+	 * An outage shorter than the token timeout doesn't change membership
+	 */
+	sim_convergence_check ();
+}
+
+static int sim_fault_parse (const char *str)
+{
+	struct sim_fault *fault;
+	unsigned int time_msec;
+	unsigned int arg;
+	char action[16];
+
+	if (fault_count >= SIM_FAULTS_MAX) {
+		return (-1);
+	}
+	if (sscanf (str, "%u:%15[a-z]:%u", &time_msec, action, &arg) != 3) {
+		return (-1);
+	}
+
+	fault = &faults[fault_count];
+	fault->time = SIM_TIME_START + (uint64_t)time_msec * QB_TIME_NS_IN_MSEC;
+	fault->arg = arg;
+	snprintf (fault->desc, sizeof (fault->desc), "%s %u", action, arg);
+
+	if (strcmp (action, "isolate") == 0) {
+		fault->type = SIM_FAULT_ISOLATE;
+	} else if (strcmp (action, "join") == 0) {
+		fault->type = SIM_FAULT_JOIN;
+	} else if (strcmp (action, "loss") == 0) {
+		fault->type = SIM_FAULT_LOSS;
+	} else if (strcmp (action, "latency") == 0) {
+		fault->type = SIM_FAULT_LATENCY;
+	} else {
+		return (-1);
+	}
+
+	if ((fault->type == SIM_FAULT_ISOLATE || fault->type == SIM_FAULT_JOIN) &&
+	    (arg == 0 || arg > node_count)) {
+		return (-1);
+	}
+	if (fault->type == SIM_FAULT_LOSS && arg > 100) {
+		return (-1);
+	}
+
+	fault_count++;
+
+	return (0);
+}
+
+static void sim_node_init (struct sim_node *node, unsigned int index)
+{
+	struct totem_config *totem_config = &node->totem_config;
+
+	memset (node, 0, sizeof (struct sim_node));
+	node->index = index;
+	list_init (&node->timers);
+	node->last_seq = calloc (node_count, sizeof (uint32_t));
+	totem_config->interfaces = calloc (INTERFACE_MAX, sizeof (struct totem_interface));
+	if (node->last_seq == NULL || totem_config->interfaces == NULL) {
+		fprintf (stderr, "Out of memory\n");
+		exit (1);
+	}
+
+	totem_config->version = 2;
+	totem_config->node_id = index + 1;
+	totem_config->interface_count = 1;
+	sim_addr_get (index, &totem_config->interfaces[0].bindnet);
+	sim_addr_get (index, &totem_config->interfaces[0].boundto);
+	totem_config->interfaces[0].mcast_addr.family = AF_INET;
+	totem_config->interfaces[0].mcast_addr.addr[0] = 239;
+	totem_config->interfaces[0].ip_port = 5405;
+	totem_config->transport_number = TOTEM_TRANSPORT_UDP;
+	strcpy (totem_config->rrp_mode, "none");
+	totem_config->crypto_cipher_type = "none";
+	totem_config->crypto_hash_type = "none";
+	totem_config->net_mtu = SIM_NET_MTU;
+
+	totem_config->token_timeout = token;
+	if (node_count > 2) {
+		totem_config->token_timeout += (node_count - 2) * TOKEN_COEFFICIENT;
+	}
+	totem_config->token_retransmits_before_loss_const = TOKEN_RETRANSMITS_BEFORE_LOSS_CONST;
+	totem_config->token_retransmit_timeout = (int)(totem_config->token_timeout /
+		(totem_config->token_retransmits_before_loss_const + 0.2));
+	totem_config->token_hold_timeout = (int)(totem_config->token_retransmit_timeout * 0.8 -
+		(1000/HZ));
+	totem_config->join_timeout = JOIN_TIMEOUT;
+	totem_config->consensus_timeout = (int)(float)(1.2 * totem_config->token_timeout);
+	totem_config->merge_timeout = MERGE_TIMEOUT;
+	totem_config->downcheck_timeout = DOWNCHECK_TIMEOUT;
+	totem_config->fail_to_recv_const = FAIL_TO_RECV_CONST;
+	totem_config->seqno_unchanged_const = SEQNO_UNCHANGED_CONST;
+	totem_config->rrp_problem_count_timeout = RRP_PROBLEM_COUNT_TIMEOUT;
+	totem_config->rrp_problem_count_threshold = RRP_PROBLEM_COUNT_THRESHOLD_DEFAULT;
+	totem_config->rrp_problem_count_mcast_threshold = RRP_PROBLEM_COUNT_THRESHOLD_DEFAULT * 10;
+	totem_config->rrp_token_expired_timeout = totem_config->token_retransmit_timeout;
+	totem_config->rrp_autorecovery_check_timeout = RRP_AUTORECOVERY_CHECK_TIMEOUT;
+	totem_config->max_network_delay = MAX_NETWORK_DELAY;
+	totem_config->window_size = window_size;
+	totem_config->max_messages = max_messages;
+	totem_config->miss_count_const = MISS_COUNT_CONST;
+
+	totem_config->totem_logging_configuration.log_printf = sim_log_printf;
+	totem_config->totem_logging_configuration.log_callsite_register = sim_log_callsite_register;
+	totem_config->totem_logging_configuration.log_level_security = LOGSYS_LEVEL_WARNING;
+	totem_config->totem_logging_configuration.log_level_error = LOGSYS_LEVEL_ERROR;
+	totem_config->totem_logging_configuration.log_level_warning = LOGSYS_LEVEL_WARNING;
+	totem_config->totem_logging_configuration.log_level_notice = LOGSYS_LEVEL_NOTICE;
+	totem_config->totem_logging_configuration.log_level_debug = LOGSYS_LEVEL_DEBUG;
+	totem_config->totem_logging_configuration.log_level_trace = LOGSYS_LEVEL_TRACE;
+
+	totem_config->totem_memb_ring_id_create_or_load = sim_ring_id_create_or_load;
+	totem_config->totem_memb_ring_id_store = sim_ring_id_store;
+}
+
+static uint64_t latency_percentile (double pct)
+{
+	uint64_t wanted;
+	uint64_t seen = 0;
+	unsigned int i;
+
+	if (latency_count == 0) {
+		return (0);
+	}
+
+	wanted = (uint64_t)(latency_count * pct / 100.0);
+	for (i = 0; i < LATENCY_BUCKETS; i++) {
+		seen += latency_hist[i];
+		if (seen > wanted) {
+			return ((uint64_t)i * LATENCY_BUCKET_USEC);
+		}
+	}
+
+	return (latency_max);
+}
+
+static void usage (char *cmd)
+{
+	printf ("%s [options]\n", cmd);
+	printf ("\n");
+	printf ("  -n  number of nodes (default %u)\n", DEFAULT_NODES);
+	printf ("  -d  duration of the load in simulated seconds (default %u)\n", DEFAULT_DURATION);
+	printf ("  -r  messages per second sent by each node, 0 saturates (default %u)\n", DEFAULT_RATE);
+	printf ("  -s  message size in bytes (default %u)\n", DEFAULT_SIZE);
+	printf ("  -l  frame loss in percent (default 0)\n");
+	printf ("  -L  network latency in us (default %u)\n", DEFAULT_LATENCY);
+	printf ("  -J  additional random latency in us (default 0)\n");
+	printf ("  -t  token timeout in ms before token_coefficient (default %u)\n", DEFAULT_TOKEN);
+	printf ("  -w  window_size (default %u)\n", WINDOW_SIZE);
+	printf ("  -m  max_messages (default %u)\n", MAX_MESSAGES);
+	printf ("  -S  random seed (default %u)\n", DEFAULT_SEED);
+	printf ("  -e  fault event ms:action:arg, may be repeated. Actions:\n");
+	printf ("      isolate:node, join:node, loss:percent, latency:us\n");
+	printf ("  -v  log totem messages (repeat for debug)\n");
+}
+
+int main (int argc, char *argv[])
+{
+	struct sim_event *ev;
+	struct sim_node *node;
+	struct timeval tv_start, tv_end;
+	uint64_t end_time;
+	uint64_t sent = 0, send_failed = 0, delivered = 0, order_violations = 0;
+	uint64_t mcast_tx = 0, mcast_retx = 0, rx_msg_dropped = 0, token_rx = 0;
+	double elapsed;
+	unsigned int i;
+	int opt;
+
+	while ((opt = getopt (argc, argv, "n:d:r:s:l:L:J:t:w:m:S:e:vh")) != -1) {
+		switch (opt) {
+		case 'n':
+			node_count = strtoul (optarg, NULL, 10);
+			break;
+		case 'd':
+			duration = strtoul (optarg, NULL, 10);
+			break;
+		case 'r':
+			rate = strtoul (optarg, NULL, 10);
+			break;
+		case 's':
+			msg_size = strtoul (optarg, NULL, 10);
+			break;
+		case 'l':
+			loss_pct = strtod (optarg, NULL);
+			break;
+		case 'L':
+			latency_usec = strtoul (optarg, NULL, 10);
+			break;
+		case 'J':
+			jitter_usec = strtoul (optarg, NULL, 10);
+			break;
+		case 't':
+			token = strtoul (optarg, NULL, 10);
+			break;
+		case 'w':
+			window_size = strtoul (optarg, NULL, 10);
+			break;
+		case 'm':
+			max_messages = strtoul (optarg, NULL, 10);
+			break;
+		case 'S':
+			seed = strtoull (optarg, NULL, 10);
+			break;
+		case 'e':
+			/*
+			 * Parsed after all options, node count may follow
+			 */
+			break;
+		case 'v':
+			log_level = (log_level == LOGSYS_LEVEL_WARNING) ?
+				LOGSYS_LEVEL_NOTICE : LOGSYS_LEVEL_DEBUG;
+			break;
+		case 'h':
+		default:
+			usage (argv[0]);
+			exit (0);
+		}
+	}
+
+	if (node_count == 0 || node_count > PROCESSOR_COUNT_MAX || duration == 0 ||
+	    msg_size < sizeof (struct sim_msg) || msg_size > SIM_NET_MTU - 200 ||
+	    loss_pct < 0 || loss_pct > 100 || token == 0 || window_size == 0 ||
+	    max_messages == 0) {
+		usage (argv[0]);
+		exit (1);
+	}
+
+	faults[0].time = SIM_TIME_START;
+	faults[0].type = SIM_FAULT_FORM;
+	strcpy (faults[0].desc, "start");
+	fault_count = 1;
+
+	optind = 1;
+	while ((opt = getopt (argc, argv, "n:d:r:s:l:L:J:t:w:m:S:e:vh")) != -1) {
+		if (opt == 'e' && sim_fault_parse (optarg) != 0) {
+			fprintf (stderr, "Invalid fault event %s\n", optarg);
+			exit (1);
+		}
+	}
+
+	rng_state = seed ? seed : DEFAULT_SEED;
+
+	nodes = calloc (node_count, sizeof (struct sim_node));
+	if (nodes == NULL) {
+		fprintf (stderr, "Out of memory\n");
+		exit (1);
+	}
+
+	for (i = 0; i < fault_count; i++) {
+		sim_event_add (NULL, faults[i].time - sim_now, sim_fault_fn, &faults[i]);
+	}
+
+	for (i = 0; i < node_count; i++) {
+		node = &nodes[i];
+		sim_node_init (node, i);
+
+		sim_current = node;
+		if (totemsrp_initialize ((qb_loop_t *)node, &node->srp_context,
+		    &node->totem_config, &node->stats,
+		    sim_deliver_fn, sim_confchg_fn, sim_waiting_trans_ack_fn) != 0) {
+			fprintf (stderr, "Can't initialize totemsrp of node %u\n", i + 1);
+			exit (1);
+		}
+
+		sim_event_add (node, 0, sim_load_fn, node);
+	}
+
+	/*
+	 * Run one second past the load so the ring can drain
+	 */
+	end_time = SIM_TIME_START + ((uint64_t)duration + 1) * QB_TIME_NS_IN_SEC;
+
+	gettimeofday (&tv_start, NULL);
+	while ((ev = heap_pop ()) != NULL && ev->time <= end_time) {
+		if (ev->is_timer && !ev->cancelled) {
+			list_del (&ev->timer_list);
+		}
+		if (!ev->cancelled) {
+			sim_now = ev->time;
+			sim_current = ev->node;
+			ev->fn (ev->data);
+			events_processed++;
+		}
+		free (ev);
+	}
+	gettimeofday (&tv_end, NULL);
+	elapsed = (tv_end.tv_sec - tv_start.tv_sec) + (tv_end.tv_usec - tv_start.tv_usec) / 1000000.0;
+
+	for (i = 0; i < node_count; i++) {
+		node = &nodes[i];
+		sent += node->sent;
+		send_failed += node->send_failed;
+		delivered += node->delivered;
+		order_violations += node->order_violations;
+		mcast_tx += node->stats.srp->mcast_tx;
+		mcast_retx += node->stats.srp->mcast_retx;
+		rx_msg_dropped += node->stats.srp->rx_msg_dropped;
+		token_rx += node->stats.srp->orf_token_rx;
+	}
+
+	printf ("%-28s %u nodes, %u s, seed %llu\n", "simulated",
+		node_count, duration, (unsigned long long)seed);
+	printf ("%-28s %.3f s, %llu events\n", "wall clock",
+		elapsed, (unsigned long long)events_processed);
+	printf ("%-28s %12.2f msgs/s (%llu queue full)\n", "offered",
+		(double)sent / duration, (unsigned long long)send_failed);
+	printf ("%-28s %12.2f msgs/s per node, %.2f KB/s\n", "delivered",
+		(double)delivered / node_count / duration,
+		(double)delivered / node_count / duration * msg_size / 1024.0);
+	printf ("%-28s %12.2f per node\n", "token rotations/s",
+		(double)token_rx / node_count / (duration + 1));
+	printf ("%-28s %llu us p50, %llu us p90, %llu us p99, %llu us max\n", "latency",
+		(unsigned long long)latency_percentile (50),
+		(unsigned long long)latency_percentile (90),
+		(unsigned long long)latency_percentile (99),
+		(unsigned long long)latency_max);
+	printf ("%-28s %llu of %llu mcasts, %llu dropped\n", "retransmits",
+		(unsigned long long)mcast_retx, (unsigned long long)mcast_tx,
+		(unsigned long long)rx_msg_dropped);
+	printf ("%-28s %llu of %llu\n", "frames lost",
+		(unsigned long long)frames_lost, (unsigned long long)frames_sent);
+	printf ("%-28s %llu\n", "order violations", (unsigned long long)order_violations);
+
+	for (i = 0; i < fault_count; i++) {
+		if (faults[i].type != SIM_FAULT_FORM &&
+		    faults[i].type != SIM_FAULT_ISOLATE &&
+		    faults[i].type != SIM_FAULT_JOIN) {
+			continue;
+		}
+		if (faults[i].converged) {
+			printf ("%-28s %llu ms after %s at %llu ms\n", "membership converged",
+				(unsigned long long)((faults[i].converged_time - faults[i].time) / QB_TIME_NS_IN_MSEC),
+				faults[i].desc,
+				(unsigned long long)((faults[i].time - SIM_TIME_START) / QB_TIME_NS_IN_MSEC));
+		} else {
+			printf ("%-28s after %s at %llu ms\n", "membership NOT converged",
+				faults[i].desc,
+				(unsigned long long)((faults[i].time - SIM_TIME_START) / QB_TIME_NS_IN_MSEC));
+		}
+	}
+
+	return (order_violations ? 1 : 0);
+}
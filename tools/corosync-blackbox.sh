@@ -32,3 +32,6 @@
 corosync-cmapctl -s runtime.blackbox.dump_state str $(date +%s)
 corosync-cmapctl -s runtime.blackbox.dump_flight_data str $(date +%s)
 qb-blackbox "@LOCALSTATEDIR@/lib/corosync/fdata"
+if [ -e "@LOCALSTATEDIR@/lib/corosync/fdata-trace" ]; then
+	cat "@LOCALSTATEDIR@/lib/corosync/fdata-trace"
+fi